@@ -0,0 +1,257 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "jack_common.h"
+#include "asset_cache.h"
+
+static const char     ASSET_MAGIC[4] = { 'C', 'L', 'I', 'P' };
+static const uint32_t ASSET_VERSION = 1;
+static const char*    ASSET_SUFFIX = ".clip";
+
+struct asset_header
+{
+    char     magic[4];
+    uint32_t version;
+    uint64_t source_hash;
+    uint32_t sample_rate;
+    uint32_t reserved;
+    uint64_t frames;
+};
+
+// A clip whose samples point straight into a mapped cache file
+class mapped_audio_clip : public audio_clip
+{
+public:
+    mapped_audio_clip(void* mapping, size_t mapping_len)
+        : audio_clip(reinterpret_cast<const float*>(
+                         static_cast<const char*>(mapping) + sizeof(asset_header)),
+                     static_cast<const asset_header*>(mapping)->frames),
+          m_mapping(mapping),
+          m_mapping_len(mapping_len)
+    {
+    }
+    ~mapped_audio_clip()
+    {
+        munmap(m_mapping, m_mapping_len);
+    }
+
+private:
+    void* const  m_mapping;
+    const size_t m_mapping_len;
+};
+
+uint64_t hash_bytes(const void* data, size_t len, uint64_t seed)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint64_t hash = seed;
+    for (size_t i = 0; i < len; ++i)
+    {
+        hash ^= p[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static bool hash_file(const char* filepath, uint64_t* hash)
+{
+    const int fd = open(filepath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return false;
+    }
+
+    *hash = hash_bytes(data, st.st_size);
+    munmap(data, st.st_size);
+    return true;
+}
+
+static std::string source_name(const char* filepath)
+{
+    std::string path(filepath);
+    return std::string(basename(&path[0]));
+}
+
+static std::string cache_entry_path(const char*    cache_dir,
+                                    const char*    filepath,
+                                    uint64_t       hash,
+                                    jack_nframes_t sample_rate)
+{
+    char suffix[64];
+    snprintf(suffix,
+             sizeof(suffix),
+             ".%016llx.%u%s",
+             (unsigned long long)hash,
+             (unsigned)sample_rate,
+             ASSET_SUFFIX);
+
+    return std::string(cache_dir) + "/" + source_name(filepath) + suffix;
+}
+
+static audio_clip_ptr map_cache_entry(const std::string& entry_path,
+                                      uint64_t           hash,
+                                      jack_nframes_t     sample_rate)
+{
+    const int fd = open(entry_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(asset_header))
+    {
+        close(fd);
+        return nullptr;
+    }
+
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    const asset_header* header = static_cast<const asset_header*>(data);
+    const bool valid =
+        memcmp(header->magic, ASSET_MAGIC, sizeof(ASSET_MAGIC)) == 0 &&
+        header->version == ASSET_VERSION &&
+        header->source_hash == hash &&
+        header->sample_rate == sample_rate &&
+        sizeof(asset_header) + (header->frames * sizeof(float)) == (size_t)st.st_size;
+    if (!valid)
+    {
+        munmap(data, st.st_size);
+        return nullptr;
+    }
+
+    return std::make_shared<mapped_audio_clip>(data, st.st_size);
+}
+
+// Removes entries for older versions of the same source file
+static void prune_cache_entries(const char* cache_dir,
+                                const char* filepath,
+                                const std::string& keep_path)
+{
+    DIR* dir = opendir(cache_dir);
+    if (dir == nullptr)
+    {
+        return;
+    }
+
+    const std::string prefix = source_name(filepath) + ".";
+    const std::string keep_name = source_name(keep_path.c_str());
+    const size_t suffix_len = strlen(ASSET_SUFFIX);
+
+    struct dirent* ent = nullptr;
+    while ((ent = readdir(dir)) != nullptr)
+    {
+        const std::string name(ent->d_name);
+        if (name.compare(0, prefix.size(), prefix) == 0 &&
+            name.size() > suffix_len &&
+            name.compare(name.size() - suffix_len, suffix_len, ASSET_SUFFIX) == 0 &&
+            name != keep_name)
+        {
+            unlinkat(dirfd(dir), ent->d_name, 0);
+        }
+    }
+
+    closedir(dir);
+}
+
+static void write_cache_entry(const std::string& entry_path,
+                              uint64_t           hash,
+                              jack_nframes_t     sample_rate,
+                              const audio_clip&  clip)
+{
+    asset_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, ASSET_MAGIC, sizeof(ASSET_MAGIC));
+    header.version = ASSET_VERSION;
+    header.source_hash = hash;
+    header.sample_rate = sample_rate;
+    header.frames = clip.size();
+
+    // Write to a temporary file and rename it into place so a reader never
+    // sees a partial entry
+    const std::string tmp_path = entry_path + ".tmp";
+    FILE* f = fopen(tmp_path.c_str(), "wb");
+    if (f == nullptr)
+    {
+        return;
+    }
+
+    const bool ok =
+        fwrite(&header, sizeof(header), 1, f) == 1 &&
+        fwrite(clip.data(), sizeof(float), clip.size(), f) == clip.size();
+
+    if (fclose(f) != 0 || !ok || rename(tmp_path.c_str(), entry_path.c_str()) != 0)
+    {
+        unlink(tmp_path.c_str());
+    }
+}
+
+audio_clip_ptr read_cached_audio_clip(const char*    filepath,
+                                      jack_nframes_t jack_sample_rate,
+                                      const char*    cache_dir)
+{
+    uint64_t hash = 0;
+    if (cache_dir == nullptr || *cache_dir == '\0' || !hash_file(filepath, &hash))
+    {
+        return read_audio_clip(filepath, jack_sample_rate);
+    }
+
+    const std::string entry_path =
+        cache_entry_path(cache_dir, filepath, hash, jack_sample_rate);
+
+    audio_clip_ptr clip = map_cache_entry(entry_path, hash, jack_sample_rate);
+    if (clip)
+    {
+        return clip;
+    }
+
+    clip = read_audio_clip(filepath, jack_sample_rate);
+    if (clip)
+    {
+        mkdir(cache_dir, 0755);
+        write_cache_entry(entry_path, hash, jack_sample_rate, *clip);
+        prune_cache_entries(cache_dir, filepath, entry_path);
+    }
+
+    return clip;
+}
@@ -0,0 +1,37 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ASSET_CACHE_H
+#define ASSET_CACHE_H
+
+#include <cstdint>
+
+#include <jack/jack.h>
+
+#include "audio_clip.h"
+
+// 64-bit FNV-1a over a block of memory
+uint64_t hash_bytes(const void* data, size_t len, uint64_t seed = 0xcbf29ce484222325ULL);
+
+// Loads a notification sound already decoded and resampled to the JACK
+// sample rate. Entries live in cache_dir as raw float files keyed by the
+// hash of the source file and the sample rate, and are mapped straight into
+// memory. On a miss the WAV file is decoded, resampled and written to the
+// cache for next time. If cache_dir is empty this is the same as
+// read_audio_clip. Returns nullptr if the sound could not be loaded
+audio_clip_ptr read_cached_audio_clip(const char*    filepath,
+                                      jack_nframes_t jack_sample_rate,
+                                      const char*    cache_dir);
+
+#endif
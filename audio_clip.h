@@ -0,0 +1,56 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef AUDIO_CLIP_H
+#define AUDIO_CLIP_H
+
+#include <cstddef>
+#include <vector>
+#include <memory>
+#include <utility>
+
+// An immutable decoded sound. Clips are shared between the thread that
+// loads them and the playback cursors, and are never copied or modified
+// once created
+class audio_clip
+{
+public:
+    explicit audio_clip(std::vector<float>&& samples)
+        : m_samples(std::move(samples)),
+          m_data(m_samples.data()),
+          m_size(m_samples.size())
+    {
+    }
+    virtual ~audio_clip() {}
+
+    const float* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+protected:
+    // For subclasses that own the sample memory some other way
+    audio_clip(const float* data, size_t size)
+        : m_data(data),
+          m_size(size)
+    {
+    }
+
+private:
+    std::vector<float> m_samples;
+    const float*       m_data;
+    size_t             m_size;
+};
+
+typedef std::shared_ptr<const audio_clip> audio_clip_ptr;
+
+#endif
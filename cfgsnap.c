@@ -0,0 +1,90 @@
+#include <string.h>
+#include <stdio.h>
+
+#include "config_snapshot.h"
+
+// Compiles and reads config snapshots, so scripts can look up settings
+// without parsing the INI files again for every value.
+//
+// usage: cfgsnap compile <Snapshot> <Filename> ...
+//        cfgsnap get <Snapshot> <Section> <Key> [<Section> <Key> ...]
+
+static int compile(int argc, char* argv[])
+{
+    if (argc < 4 || argc - 3 > CONFIG_SNAPSHOT_MAX_SOURCES)
+    {
+        fprintf(stderr, "usage: %s compile <Snapshot> <Filename> ...\n", argv[0]);
+        return 1;
+    }
+
+    const char* snapshot_path = argv[2];
+    const char* const* sources = (const char* const*)&argv[3];
+    const int num_sources = argc - 3;
+
+    // Leave an up to date snapshot of the same files alone
+    struct config_snapshot* snap = config_snapshot_open(snapshot_path);
+    if (snap != NULL)
+    {
+        int same = config_snapshot_num_sources(snap) == num_sources &&
+                   config_snapshot_is_current(snap);
+        for (int i = 0; same && i < num_sources; ++i)
+        {
+            same = strcmp(config_snapshot_source(snap, i), sources[i]) == 0;
+        }
+        config_snapshot_close(snap);
+
+        if (same)
+        {
+            return 0;
+        }
+    }
+
+    if (!config_snapshot_compile(snapshot_path, sources, num_sources))
+    {
+        fprintf(stderr, "Could not write %s\n", snapshot_path);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int get(int argc, char* argv[])
+{
+    if (argc < 5 || (argc - 3) % 2 != 0)
+    {
+        fprintf(stderr, "usage: %s get <Snapshot> <Section> <Key> [<Section> <Key> ...]\n", argv[0]);
+        return 1;
+    }
+
+    // Exit with 2 so callers know to fall back to reading the INI files
+    struct config_snapshot* snap = config_snapshot_open_current(argv[2]);
+    if (snap == NULL)
+    {
+        return 2;
+    }
+
+    for (int i = 3; i + 1 < argc; i += 2)
+    {
+        const char* val = config_snapshot_get(snap, argv[i], argv[i + 1]);
+        printf("%s\n", val != NULL ? val : "");
+    }
+
+    config_snapshot_close(snap);
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc >= 2 && strcmp(argv[1], "compile") == 0)
+    {
+        return compile(argc, argv);
+    }
+    else if (argc >= 2 && strcmp(argv[1], "get") == 0)
+    {
+        return get(argc, argv);
+    }
+
+    fprintf(stderr, "usage: %s compile <Snapshot> <Filename> ...\n", argv[0]);
+    fprintf(stderr, "       %s get <Snapshot> <Section> <Key> [<Section> <Key> ...]\n", argv[0]);
+    return 1;
+}
@@ -0,0 +1,418 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Measures how the modes decode over a simulated HF channel (see
+// channel_sim.h), for sizing hardware for the worst traffic rather than
+// for clean loopback audio. For each mode and SNR it runs test speech
+// through crypto_tx_common, the channel and crypto_rx_common, timing the
+// receive side and noting when it first syncs and how much of the time it
+// stays synced. The pipeline's payload is encrypted, so the bit error rate
+// comes from a second pass of FreeDV's own test frames over the same
+// channel. Prints one row per point:
+//
+//   mode  snr_db  ber  synced_%  sync_s  rx_cpu_%
+//
+// Modes default to the configured one. SNRs are first:last:step in dB
+//
+// usage: channel_bench [-m <Modes>] [-s <SNRs>] [-f <Fading>] [-o <Hz>]
+//                      [-d <Hz/s>] [-c <ppm>] [-t <Seconds>] [-r <Seed>]
+//                      <ConfigFile>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdexcept>
+
+#include "freedv_api.h"
+
+#include "crypto_cfg.h"
+#include "crypto_tx_common.h"
+#include "crypto_rx_common.h"
+#include "channel_sim.h"
+#include "simd.h"
+#include "test_speech.h"
+#include "minIni.h"
+
+static const int MODES[] = {
+    FREEDV_MODE_1600,
+    FREEDV_MODE_700C,
+    FREEDV_MODE_700D,
+    FREEDV_MODE_700E,
+    FREEDV_MODE_2400A,
+    FREEDV_MODE_2400B,
+    FREEDV_MODE_800XA,
+};
+
+// What one point of the sweep measured
+struct bench_result
+{
+    double ber;
+    double synced;
+    double sync_seconds;
+    double rx_cpu;
+};
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [-m <Modes>] [-s <SNRs>] [-f <Fading>] [-o <Hz>]\n"
+            "       [-d <Hz/s>] [-c <ppm>] [-t <Seconds>] [-r <Seed>] <ConfigFile>\n",
+            name);
+}
+
+static double thread_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
+
+static bool parse_mode_list(const char* list, std::vector<int>* modes)
+{
+    std::string names(list);
+    char* save = nullptr;
+    for (const char* name = strtok_r(&names[0], ",", &save);
+         name != nullptr;
+         name = strtok_r(nullptr, ",", &save))
+    {
+        bool found = false;
+        for (int mode : MODES)
+        {
+            if (strcasecmp(name, mode_name(mode)) == 0)
+            {
+                modes->push_back(mode);
+                found = true;
+            }
+        }
+        if (!found)
+        {
+            return false;
+        }
+    }
+    return !modes->empty();
+}
+
+// A copy of the config with only the mode changed, so the pipeline is
+// built as it would be for that mode. Returns an empty path on failure
+static std::string config_for_mode(const char* config_file, int mode)
+{
+    char path[] = "/tmp/channel_bench_XXXXXX";
+    const int fd = mkstemp(path);
+    if (fd < 0)
+    {
+        return std::string();
+    }
+
+    FILE* out = fdopen(fd, "w");
+    FILE* in = fopen(config_file, "r");
+    bool ok = out != nullptr && in != nullptr;
+    if (ok)
+    {
+        char buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), in)) > 0)
+        {
+            ok = ok && fwrite(buf, 1, n, out) == n;
+        }
+    }
+    if (in != nullptr)
+    {
+        fclose(in);
+    }
+    if (out != nullptr)
+    {
+        ok = fclose(out) == 0 && ok;
+    }
+    else
+    {
+        close(fd);
+    }
+
+    if (!ok || !ini_puts("Codec", "Mode", mode_name(mode), path))
+    {
+        unlink(path);
+        return std::string();
+    }
+    return path;
+}
+
+// Runs the crypto pipeline over the channel for the given number of
+// seconds of speech, filling in everything but the bit error rate
+static void run_pipeline(const char*           config_file,
+                         const channel_params& params,
+                         uint32_t              seed,
+                         double                seconds,
+                         bench_result*         result)
+{
+    crypto_tx_common tx("channel_bench", config_file);
+    crypto_rx_common rx("channel_bench", config_file);
+
+    channel_simulator channel;
+    if (!channel.configure(tx.modem_sample_rate(), params, seed))
+    {
+        throw std::runtime_error("Invalid channel settings");
+    }
+
+    const size_t n_speech = tx.speech_samples_per_frame();
+    const size_t num_frames = (seconds * tx.speech_sample_rate()) / n_speech;
+    const std::vector<float> speech = make_test_speech(num_frames * n_speech,
+                                                       tx.speech_sample_rate());
+
+    std::vector<short> speech_in(n_speech);
+    std::vector<float> mod_out(tx.modem_samples_per_frame());
+    std::vector<float> heard;
+    std::vector<short> speech_out(rx.max_speech_samples_per_frame());
+
+    size_t used = 0;
+    size_t consumed = 0;
+    size_t rx_frames = 0;
+    size_t synced_frames = 0;
+    double rx_cost = 0.0;
+    result->sync_seconds = -1.0;
+
+    for (size_t frame = 0; frame < num_frames; ++frame)
+    {
+        simd_float_to_short(speech_in.data(), speech.data() + (frame * n_speech), n_speech,
+                            SHORT_SAMPLE_SCALE);
+        const size_t nout = tx.transmit(mod_out.data(), speech_in.data());
+        channel.process(mod_out.data(), nout, heard);
+
+        for (size_t nin = rx.needed_modem_samples();
+             heard.size() - used >= nin;
+             nin = rx.needed_modem_samples())
+        {
+            const double start = thread_seconds();
+            rx.receive(speech_out.data(), heard.data() + used);
+            rx_cost += thread_seconds() - start;
+            used += nin;
+            consumed += nin;
+            ++rx_frames;
+
+            if (rx.is_synced())
+            {
+                ++synced_frames;
+                if (result->sync_seconds < 0.0)
+                {
+                    result->sync_seconds = (double)consumed / rx.modem_sample_rate();
+                }
+            }
+        }
+
+        heard.erase(heard.begin(), heard.begin() + used);
+        used = 0;
+    }
+
+    const double signal_seconds = (double)consumed / rx.modem_sample_rate();
+    result->synced = rx_frames > 0 ? (double)synced_frames / rx_frames : 0.0;
+    result->rx_cpu = signal_seconds > 0.0 ? rx_cost / signal_seconds : 0.0;
+}
+
+// Bit error rate of FreeDV's test frames over the same channel
+static double run_test_frames(int mode, const channel_params& params, uint32_t seed, double seconds)
+{
+    struct freedv* ftx = freedv_open(mode);
+    struct freedv* frx = freedv_open(mode);
+    if (ftx == nullptr || frx == nullptr)
+    {
+        if (ftx != nullptr)
+        {
+            freedv_close(ftx);
+        }
+        if (frx != nullptr)
+        {
+            freedv_close(frx);
+        }
+        throw std::runtime_error("Could not open FreeDV");
+    }
+    freedv_set_test_frames(ftx, 1);
+    freedv_set_test_frames(frx, 1);
+
+    const unsigned sample_rate = freedv_get_modem_sample_rate(ftx);
+    channel_simulator channel;
+    channel.configure(sample_rate, params, seed);
+
+    std::vector<short> speech_in(freedv_get_n_speech_samples(ftx), 0);
+    std::vector<short> mod_out(freedv_get_n_nom_modem_samples(ftx));
+    std::vector<float> mod_float(mod_out.size());
+    std::vector<float> heard;
+    std::vector<short> demod_in(freedv_get_n_max_modem_samples(frx));
+    std::vector<short> speech_out(freedv_get_n_speech_samples(frx));
+    size_t used = 0;
+
+    const size_t total = seconds * sample_rate;
+    for (size_t done = 0; done < total; done += mod_out.size())
+    {
+        freedv_tx(ftx, mod_out.data(), speech_in.data());
+        simd_short_to_float(mod_float.data(), mod_out.data(), mod_out.size(), 1.0f / SHORT_SAMPLE_SCALE);
+        channel.process(mod_float.data(), mod_float.size(), heard);
+
+        for (size_t nin = freedv_nin(frx); heard.size() - used >= nin; nin = freedv_nin(frx))
+        {
+            simd_float_to_short(demod_in.data(), heard.data() + used, nin, SHORT_SAMPLE_SCALE);
+            freedv_rx(frx, speech_out.data(), demod_in.data());
+            used += nin;
+        }
+
+        heard.erase(heard.begin(), heard.begin() + used);
+        used = 0;
+    }
+
+    const int bits = freedv_get_total_bits(frx);
+    const int errors = freedv_get_total_bit_errors(frx);
+    freedv_close(ftx);
+    freedv_close(frx);
+
+    // Nothing decoded is as bad as it gets
+    return bits > 0 ? (double)errors / bits : 0.5;
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<int> modes;
+    double first_snr = -4.0;
+    double last_snr = 12.0;
+    double snr_step = 2.0;
+    channel_params params;
+    double seconds = 30.0;
+    uint32_t seed = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:s:f:o:d:c:t:r:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'm':
+                if (!parse_mode_list(optarg, &modes))
+                {
+                    fprintf(stderr, "Unknown mode in %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 's':
+                if (sscanf(optarg, "%lf:%lf:%lf", &first_snr, &last_snr, &snr_step) != 3 ||
+                    snr_step <= 0.0)
+                {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'f':
+                if (!parse_fading(optarg, &params))
+                {
+                    fprintf(stderr, "Unknown fading %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'o':
+                params.offset_hz = atof(optarg);
+                break;
+            case 'd':
+                params.drift_hz_per_s = atof(optarg);
+                break;
+            case 'c':
+                params.clock_ppm = atof(optarg);
+                break;
+            case 't':
+                seconds = atof(optarg);
+                break;
+            case 'r':
+                seed = strtoul(optarg, nullptr, 10);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind + 1 != argc || seconds <= 0.0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    const char* config_file = argv[optind];
+
+    try
+    {
+        if (modes.empty())
+        {
+            crypto_tx_common tx("channel_bench", config_file);
+            if (!tx.get_config()->freedv_enabled)
+            {
+                fprintf(stderr, "FreeDV is not enabled in %s\n", config_file);
+                return 1;
+            }
+            modes.push_back(tx.get_config()->freedv_mode);
+        }
+
+        printf("%-6s %7s %10s %9s %7s %9s\n", "mode", "snr_db", "ber", "synced_%", "sync_s", "rx_cpu_%");
+        for (int mode : modes)
+        {
+            const std::string mode_config = config_for_mode(config_file, mode);
+            if (mode_config.empty())
+            {
+                fprintf(stderr, "Could not write a config for %s\n", mode_name(mode));
+                return 1;
+            }
+
+            try
+            {
+                // The last point is included even where the step doesn't
+                // land on it exactly
+                for (double snr = first_snr; snr <= last_snr + (snr_step / 2.0); snr += snr_step)
+                {
+                    params.snr_db = snr;
+
+                    bench_result result;
+                    run_pipeline(mode_config.c_str(), params, seed, seconds, &result);
+                    result.ber = run_test_frames(mode, params, seed, seconds);
+
+                    char sync[16] = "-";
+                    if (result.sync_seconds >= 0.0)
+                    {
+                        snprintf(sync, sizeof(sync), "%.2f", result.sync_seconds);
+                    }
+                    printf("%-6s %7.1f %10.2e %9.1f %7s %9.2f\n",
+                           mode_name(mode),
+                           snr,
+                           result.ber,
+                           result.synced * 100.0,
+                           sync,
+                           result.rx_cpu * 100.0);
+                    fflush(stdout);
+                }
+            }
+            catch (...)
+            {
+                unlink(mode_config.c_str());
+                throw;
+            }
+            unlink(mode_config.c_str());
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        fprintf(stderr, "%s\n", ex.what());
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,325 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstring>
+#include <strings.h>
+#include <algorithm>
+
+#include "channel_sim.h"
+#include "simd.h"
+
+// Samples taken through the channel at a time
+static const size_t CHANNEL_BLOCK = 1024;
+// Length of the Hilbert transformer, enough to keep the image of a signal
+// down from 300 Hz up at any of the modem rates
+static const double HILBERT_SECONDS = 0.008;
+// Noise bandwidth the SNR is given in
+static const double SNR_BANDWIDTH_HZ = 3000.0;
+// The fading gains are made at this many times the Doppler spread, and at
+// least this rate, then interpolated up to the sample rate
+static const double FADING_OVERSAMPLING = 20.0;
+static const double FADING_MIN_RATE_HZ = 10.0;
+// The Gaussian Doppler filter is cut off this many standard deviations out
+static const double FADING_FILTER_SIGMAS = 3.0;
+// Clock offsets are applied as a ratio of two rates this large
+static const unsigned CLOCK_SCALE = 1000000000;
+static const double CLOCK_MAX_PPM = 10000.0;
+
+struct fading_preset
+{
+    const char* name;
+    double      delay_ms;
+    double      spread_hz;
+};
+
+static const fading_preset FADING_PRESETS[] =
+{
+    { "none",     0.0, 0.0 },
+    { "good",     0.5, 0.1 },
+    { "moderate", 1.0, 0.5 },
+    { "poor",     2.0, 1.0 },
+};
+
+bool parse_fading(const char* name, channel_params* params)
+{
+    for (const fading_preset& preset : FADING_PRESETS)
+    {
+        if (strcasecmp(name, preset.name) == 0)
+        {
+            params->fading_delay_ms = preset.delay_ms;
+            params->fading_spread_hz = preset.spread_hz;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Blackman windowed ideal Hilbert transformer, reversed so it can be run
+// forwards over the history. num_taps is odd
+static std::vector<float> design_hilbert(size_t num_taps)
+{
+    const int mid = (num_taps - 1) / 2;
+    std::vector<float> taps(num_taps);
+    for (size_t i = 0; i < num_taps; ++i)
+    {
+        const int n = (int)i - mid;
+        const double w = 0.42 - (0.5 * cos((2.0 * M_PI * i) / (num_taps - 1))) +
+            (0.08 * cos((4.0 * M_PI * i) / (num_taps - 1)));
+        const double h = (n % 2) == 0 ? 0.0 : 2.0 / (M_PI * n);
+        taps[num_taps - 1 - i] = h * w;
+    }
+    return taps;
+}
+
+// Gaussian filter whose output power spectrum, from white noise, has the
+// given standard deviation in Hz, scaled to keep the noise power the same.
+// A Gaussian of width sigma_t has a response of width 1/(2 pi sigma_t),
+// and squaring that for the power spectrum narrows it by sqrt(2)
+static std::vector<float> design_doppler(double sigma_hz, double rate)
+{
+    const double sigma_t = 1.0 / (2.0 * M_SQRT2 * M_PI * sigma_hz);
+    const int half = ceil(FADING_FILTER_SIGMAS * sigma_t * rate);
+    std::vector<float> taps((2 * half) + 1);
+    double energy = 0.0;
+    for (int i = -half; i <= half; ++i)
+    {
+        const double t = i / rate;
+        taps[i + half] = exp(-(t * t) / (2.0 * sigma_t * sigma_t));
+        energy += taps[i + half] * taps[i + half];
+    }
+
+    const float scale = 1.0 / sqrt(energy);
+    for (float& tap : taps)
+    {
+        tap *= scale;
+    }
+    return taps;
+}
+
+channel_simulator::channel_simulator()
+    : m_sample_rate(0),
+      m_delay(0),
+      m_phase(0.0),
+      m_elapsed(0.0),
+      m_fading(false),
+      m_fading_step(0.0),
+      m_fading_frac(0.0),
+      m_power_sum(0.0),
+      m_power_count(0)
+{
+}
+
+bool channel_simulator::configure(unsigned sample_rate, const channel_params& params, uint32_t seed)
+{
+    if (sample_rate == 0 ||
+        params.fading_spread_hz < 0.0 ||
+        params.fading_delay_ms < 0.0 ||
+        fabs(params.clock_ppm) > CLOCK_MAX_PPM)
+    {
+        return false;
+    }
+
+    m_sample_rate = sample_rate;
+    m_params = params;
+
+    const size_t num_taps = ((size_t)(sample_rate * HILBERT_SECONDS) / 2 * 2) + 1;
+    m_hilbert = design_hilbert(num_taps);
+    m_input.assign(num_taps - 1 + CHANNEL_BLOCK, 0.0f);
+
+    m_fading = params.fading_spread_hz > 0.0;
+    m_delay = m_fading ? lrint(params.fading_delay_ms * sample_rate / 1000.0) : 0;
+    m_re.assign(m_delay + CHANNEL_BLOCK, 0.0f);
+    m_im.assign(m_delay + CHANNEL_BLOCK, 0.0f);
+    m_phase = 0.0;
+    m_elapsed = 0.0;
+
+    m_fading_rng.seed(seed ^ 0x9e3779b9);
+    m_fading_normal.reset();
+    if (m_fading)
+    {
+        const double rate = std::max(FADING_MIN_RATE_HZ,
+                                     params.fading_spread_hz * FADING_OVERSAMPLING);
+        m_fading_taps = design_doppler(params.fading_spread_hz / 2.0, rate);
+        m_fading_step = rate / sample_rate;
+        m_fading_frac = 0.0;
+        for (fader& path : m_paths)
+        {
+            init_fader(path);
+        }
+    }
+
+    m_out.resize(CHANNEL_BLOCK);
+    m_gain_re.resize(CHANNEL_BLOCK * 2);
+    m_gain_im.resize(CHANNEL_BLOCK * 2);
+
+    m_power_sum = 0.0;
+    m_power_count = 0;
+    m_noise_rng.seed(seed);
+    m_noise_normal.reset();
+
+    m_clock.reset();
+    if (params.clock_ppm != 0.0)
+    {
+        m_clock.reset(new resampler(SRC_SINC_MEDIUM_QUALITY, 1, CHANNEL_BLOCK * 2));
+        m_clock->set_sample_rates(CLOCK_SCALE,
+                                  CLOCK_SCALE + lrint(params.clock_ppm * (CLOCK_SCALE / 1e6)));
+    }
+    return true;
+}
+
+// Fills the Doppler filter with noise and works out the first two gains, so
+// fading is already under way when the signal starts
+void channel_simulator::init_fader(fader& f)
+{
+    const size_t len = m_fading_taps.size();
+    f.noise_re.assign(len * 2, 0.0f);
+    f.noise_im.assign(len * 2, 0.0f);
+    f.pos = 0;
+    for (size_t i = 0; i < len + 1; ++i)
+    {
+        next_gain(f);
+    }
+    next_gain(f);
+}
+
+// Each path carries half the power, so the gains' real and imaginary
+// parts each have a variance of a quarter
+void channel_simulator::next_gain(fader& f)
+{
+    const size_t len = m_fading_taps.size();
+    const float re = m_fading_normal(m_fading_rng) * 0.5f;
+    const float im = m_fading_normal(m_fading_rng) * 0.5f;
+    f.noise_re[f.pos] = f.noise_re[f.pos + len] = re;
+    f.noise_im[f.pos] = f.noise_im[f.pos + len] = im;
+    f.pos = (f.pos + 1) % len;
+
+    f.prev_re = f.next_re;
+    f.prev_im = f.next_im;
+    f.next_re = simd_dot(m_fading_taps.data(), f.noise_re.data() + f.pos, len);
+    f.next_im = simd_dot(m_fading_taps.data(), f.noise_im.data() + f.pos, len);
+}
+
+// Interpolates both paths' gains across count samples. The imaginary parts
+// are negated, since only the real part of signal times gain is wanted
+void channel_simulator::fill_gains(size_t count)
+{
+    float* const re0 = m_gain_re.data();
+    float* const re1 = m_gain_re.data() + CHANNEL_BLOCK;
+    float* const im0 = m_gain_im.data();
+    float* const im1 = m_gain_im.data() + CHANNEL_BLOCK;
+    fader& p0 = m_paths[0];
+    fader& p1 = m_paths[1];
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        const float frac = m_fading_frac;
+        re0[i] = p0.prev_re + ((p0.next_re - p0.prev_re) * frac);
+        im0[i] = -(p0.prev_im + ((p0.next_im - p0.prev_im) * frac));
+        re1[i] = p1.prev_re + ((p1.next_re - p1.prev_re) * frac);
+        im1[i] = -(p1.prev_im + ((p1.next_im - p1.prev_im) * frac));
+
+        m_fading_frac += m_fading_step;
+        if (m_fading_frac >= 1.0)
+        {
+            m_fading_frac -= 1.0;
+            next_gain(p0);
+            next_gain(p1);
+        }
+    }
+}
+
+void channel_simulator::process(const float* in, size_t count, std::vector<float>& out)
+{
+    while (count > 0)
+    {
+        const size_t n = std::min(count, CHANNEL_BLOCK);
+        process_block(in, n, out);
+        in += n;
+        count -= n;
+    }
+}
+
+void channel_simulator::process_block(const float* in, size_t count, std::vector<float>& out)
+{
+    // The analytic signal, lined up with the middle of the Hilbert filter
+    const size_t num_taps = m_hilbert.size();
+    const size_t mid = (num_taps - 1) / 2;
+    std::copy(in, in + count, m_input.begin() + (num_taps - 1));
+
+    float* const re = m_re.data() + m_delay;
+    float* const im = m_im.data() + m_delay;
+    for (size_t i = 0; i < count; ++i)
+    {
+        re[i] = m_input[i + mid];
+        im[i] = simd_dot(m_hilbert.data(), m_input.data() + i, num_taps);
+    }
+    memmove(m_input.data(), m_input.data() + count, (num_taps - 1) * sizeof(float));
+
+    // Frequency offset, taking the drift at the middle of the block
+    const double hz = m_params.offset_hz +
+        (m_params.drift_hz_per_s * (m_elapsed + (count / (2.0 * m_sample_rate))));
+    const double step = (2.0 * M_PI * hz) / m_sample_rate;
+    simd_mix_nco(re, im, count, m_phase, step);
+    m_phase = fmod(m_phase + (step * count), 2.0 * M_PI);
+    m_elapsed += (double)count / m_sample_rate;
+
+    float* const out_block = m_out.data();
+    if (!m_fading)
+    {
+        std::copy(re, re + count, out_block);
+    }
+    else
+    {
+        fill_gains(count);
+        std::fill(out_block, out_block + count, 0.0f);
+        simd_mul_add(out_block, re, m_gain_re.data(), count);
+        simd_mul_add(out_block, im, m_gain_im.data(), count);
+        simd_mul_add(out_block, m_re.data(), m_gain_re.data() + CHANNEL_BLOCK, count);
+        simd_mul_add(out_block, m_im.data(), m_gain_im.data() + CHANNEL_BLOCK, count);
+
+        memmove(m_re.data(), m_re.data() + count, m_delay * sizeof(float));
+        memmove(m_im.data(), m_im.data() + count, m_delay * sizeof(float));
+    }
+
+    // The SNR is of the power averaged over everything but silence so far,
+    // which for a modem's steady output soon settles
+    const double power = simd_dot(in, in, count);
+    if (power > 0.0)
+    {
+        m_power_sum += power;
+        m_power_count += count;
+    }
+    if (std::isfinite(m_params.snr_db) && m_power_count > 0)
+    {
+        const double signal = m_power_sum / m_power_count;
+        const double noise = (signal * (m_sample_rate / 2.0)) /
+            (SNR_BANDWIDTH_HZ * pow(10.0, m_params.snr_db / 10.0));
+        const float sigma = sqrt(noise);
+        for (size_t i = 0; i < count; ++i)
+        {
+            out_block[i] += sigma * m_noise_normal(m_noise_rng);
+        }
+    }
+
+    if (!m_clock)
+    {
+        out.insert(out.end(), out_block, out_block + count);
+        return;
+    }
+
+    m_clock->enqueue(out_block, count);
+    const size_t prev_size = out.size();
+    out.resize(prev_size + m_clock->available_elems());
+    m_clock->dequeue(out.data() + prev_size, out.size() - prev_size);
+}
@@ -0,0 +1,121 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CHANNEL_SIM_H
+#define CHANNEL_SIM_H
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "resampler.h"
+
+// What happens to the modem signal on its way through an HF channel
+struct channel_params
+{
+    // Of the signal's average power to the noise in 3 kHz, as FreeDV
+    // reports it. Infinite for no noise
+    double snr_db = HUGE_VAL;
+    // Watterson model: two paths of equal average power this far apart,
+    // each faded by a complex Gaussian process whose Doppler spectrum is
+    // this wide (twice its standard deviation). A spread of 0 is no fading
+    double fading_delay_ms = 0.0;
+    double fading_spread_hz = 0.0;
+    // Frequency error, and how fast it moves, as from a drifting oscillator
+    double offset_hz = 0.0;
+    double drift_hz_per_s = 0.0;
+    // How much faster the receiving sound card's clock runs
+    double clock_ppm = 0.0;
+};
+
+// Sets the fading for "none", or the "good", "moderate" and "poor" channels
+// of ITU-R F.520
+bool parse_fading(const char* name, channel_params* params);
+
+// Runs a real modem signal through a simulated channel. The signal is made
+// analytic with a Hilbert transform, shifted in frequency, split into the
+// fading paths and added back up. Noise is added to the real part, which is
+// then resampled to the receiver's clock. The random processes are seeded,
+// and the fading and the noise come from separate generators, so a sweep
+// over SNR sees the same fading at every point
+class channel_simulator
+{
+public:
+    channel_simulator();
+
+    bool configure(unsigned sample_rate, const channel_params& params, uint32_t seed);
+
+    // Appends what the receiver hears to out. With a clock offset that is
+    // not quite count samples
+    void process(const float* in, size_t count, std::vector<float>& out);
+
+private:
+    // One path's fading, a stream of complex gains made at a low rate and
+    // interpolated up to the sample rate
+    struct fader
+    {
+        std::vector<float> noise_re;
+        std::vector<float> noise_im;
+        size_t             pos;
+        float              prev_re;
+        float              prev_im;
+        float              next_re;
+        float              next_im;
+    };
+
+    void init_fader(fader& f);
+    void next_gain(fader& f);
+    void fill_gains(size_t count);
+    void process_block(const float* in, size_t count, std::vector<float>& out);
+
+private:
+    unsigned       m_sample_rate;
+    channel_params m_params;
+
+    std::vector<float> m_hilbert;
+    // Real input, the Hilbert filter's history first
+    std::vector<float> m_input;
+
+    // Analytic signal after the frequency shift, the second path's delay
+    // of history first
+    std::vector<float> m_re;
+    std::vector<float> m_im;
+    size_t             m_delay;
+    double             m_phase;
+    double             m_elapsed;
+
+    bool                            m_fading;
+    std::vector<float>              m_fading_taps;
+    double                          m_fading_step;
+    double                          m_fading_frac;
+    fader                           m_paths[2];
+    std::mt19937                    m_fading_rng;
+    std::normal_distribution<float> m_fading_normal;
+
+    std::vector<float> m_out;
+    // Both paths' gains for a block, the first path's first
+    std::vector<float> m_gain_re;
+    std::vector<float> m_gain_im;
+
+    double                          m_power_sum;
+    uint64_t                        m_power_count;
+    std::mt19937                    m_noise_rng;
+    std::normal_distribution<float> m_noise_normal;
+
+    std::unique_ptr<resampler> m_clock;
+};
+
+#endif
@@ -0,0 +1,265 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "channelizer.h"
+#include "iq_ddc.h"
+#include "simd.h"
+
+mixed_radix_fft::mixed_radix_fft(size_t n)
+    : m_n(n),
+      m_max_factor(1)
+{
+    for (size_t left = n, factor = 2; left > 1;)
+    {
+        if (factor * factor > left)
+        {
+            factor = left;
+        }
+        if (left % factor == 0)
+        {
+            m_factors.push_back(factor);
+            m_max_factor = std::max(m_max_factor, factor);
+            left /= factor;
+        }
+        else
+        {
+            ++factor;
+        }
+    }
+
+    m_twiddles.resize(n);
+    for (size_t i = 0; i < n; ++i)
+    {
+        const double angle = (2.0 * M_PI * i) / n;
+        m_twiddles[i].i = cos(angle);
+        m_twiddles[i].q = sin(angle);
+    }
+}
+
+void mixed_radix_fft::inverse(const iq_sample* in, iq_sample* out) const
+{
+    transform(out, in, 1, 0, m_n);
+}
+
+// Decimation in time. The stage's n inputs are every stride'th of in, which
+// split into one sub-transform per residue of the stage's factor, whose
+// outputs are then combined in place
+void mixed_radix_fft::transform(iq_sample* out,
+                                const iq_sample* in,
+                                size_t stride,
+                                size_t stage,
+                                size_t n) const
+{
+    if (n == 1)
+    {
+        out[0] = in[0];
+        return;
+    }
+
+    const size_t p = m_factors[stage];
+    const size_t m = n / p;
+    for (size_t q = 0; q < p; ++q)
+    {
+        transform(out + (q * m), in + (q * stride), stride * p, stage + 1, m);
+    }
+
+    // This stage's twiddles are every stride'th of the full size's
+    if (p == 2)
+    {
+        for (size_t k = 0; k < m; ++k)
+        {
+            const iq_sample t = m_twiddles[k * stride];
+            const iq_sample a = out[k];
+            const iq_sample b = out[k + m];
+            const float br = (b.i * t.i) - (b.q * t.q);
+            const float bi = (b.i * t.q) + (b.q * t.i);
+            out[k].i = a.i + br;
+            out[k].q = a.q + bi;
+            out[k + m].i = a.i - br;
+            out[k + m].q = a.q - bi;
+        }
+        return;
+    }
+
+    iq_sample scratch[m_max_factor];
+    for (size_t k = 0; k < m; ++k)
+    {
+        for (size_t q = 0; q < p; ++q)
+        {
+            scratch[q] = out[k + (q * m)];
+        }
+
+        for (size_t q1 = 0; q1 < p; ++q1)
+        {
+            const size_t index = k + (q1 * m);
+            float re = 0.0f;
+            float im = 0.0f;
+            for (size_t q2 = 0; q2 < p; ++q2)
+            {
+                const iq_sample t = m_twiddles[((q2 * index) % n) * stride];
+                re += (scratch[q2].i * t.i) - (scratch[q2].q * t.q);
+                im += (scratch[q2].i * t.q) + (scratch[q2].q * t.i);
+            }
+            out[index].i = re;
+            out[index].q = im;
+        }
+    }
+}
+
+channelizer::channelizer()
+    : m_input_rate(0),
+      m_bins(1),
+      m_decimation(1),
+      m_phases(1),
+      m_fill(0),
+      m_origin(0),
+      m_outputs(0),
+      m_out_stride(0)
+{
+}
+
+bool channelizer::configure(unsigned input_rate,
+                            unsigned output_rate,
+                            unsigned spacing,
+                            size_t   max_input)
+{
+    if (spacing == 0 ||
+        output_rate == 0 ||
+        input_rate % spacing != 0 ||
+        input_rate % output_rate != 0 ||
+        output_rate % spacing != 0)
+    {
+        return false;
+    }
+
+    m_input_rate = input_rate;
+    m_bins = input_rate / spacing;
+    m_decimation = input_rate / output_rate;
+    m_fft = mixed_radix_fft(m_bins);
+
+    design_filter();
+
+    const size_t history = m_taps.size() - 1;
+    m_re.assign(history + max_input, 0.0f);
+    m_im.assign(history + max_input, 0.0f);
+    m_fill = history;
+    m_origin = 0;
+
+    m_outputs = 0;
+    m_out_stride = (max_input / m_decimation) + 1;
+    m_out_re.assign(m_bins * m_out_stride, 0.0f);
+    m_out_im.assign(m_bins * m_out_stride, 0.0f);
+    return true;
+}
+
+// iq_ddc's filter, lengthened to a whole number of taps per bin so it
+// folds evenly into the FFT's input
+void channelizer::design_filter()
+{
+    const size_t wanted = IQ_DDC_TAPS_PER_PHASE * m_decimation;
+    m_phases = std::max<size_t>(1, (wanted + m_bins - 1) / m_bins);
+    m_taps = iq_lowpass(m_phases * m_bins, 0.5 / m_decimation);
+}
+
+size_t channelizer::bin(double offset_hz) const
+{
+    const double spacing = (double)m_input_rate / m_bins;
+    const long nearest = lround(offset_hz / spacing) % (long)m_bins;
+    return nearest < 0 ? nearest + m_bins : nearest;
+}
+
+double channelizer::bin_frequency(size_t bin) const
+{
+    const double spacing = (double)m_input_rate / m_bins;
+    return bin < (m_bins + 1) / 2 ? bin * spacing : ((double)bin - m_bins) * spacing;
+}
+
+size_t channelizer::push(const float* iq, size_t count)
+{
+    float* const re = m_re.data() + m_fill;
+    float* const im = m_im.data() + m_fill;
+    for (size_t i = 0; i < count; ++i)
+    {
+        re[i] = iq[i * 2];
+        im[i] = iq[(i * 2) + 1];
+    }
+    m_fill += count;
+
+    const size_t num_taps = m_taps.size();
+    m_outputs = m_fill >= num_taps ? ((m_fill - num_taps) / m_decimation) + 1 : 0;
+    return m_outputs;
+}
+
+// Each bin's output is the input mixed down by the bin's frequency, then
+// filtered and decimated. Mixing can wait until after filtering, when the
+// filter's taps fold into one sum per bin and mixing every bin at once is
+// an inverse FFT of them. The mixer's phase at the output sample comes
+// out as a rotation of the sums
+void channelizer::run(size_t first, size_t count)
+{
+    const size_t bins = m_bins;
+    float sum_re[bins];
+    float sum_im[bins];
+    iq_sample folded[bins];
+    iq_sample mixed[bins];
+
+    for (size_t n = first; n < first + count; ++n)
+    {
+        const size_t start = n * m_decimation;
+
+        // The taps are symmetric, so they can be run forwards over the
+        // history like iq_ddc's
+        std::fill(sum_re, sum_re + bins, 0.0f);
+        std::fill(sum_im, sum_im + bins, 0.0f);
+        for (size_t phase = 0; phase < m_phases; ++phase)
+        {
+            const size_t offset = phase * bins;
+            simd_mul_add(sum_re, m_taps.data() + offset, m_re.data() + start + offset, bins);
+            simd_mul_add(sum_im, m_taps.data() + offset, m_im.data() + start + offset, bins);
+        }
+
+        // Sum j holds the taps for delay bins - 1 - j, modulo the number
+        // of bins. The output sample is at the newest input sample
+        const size_t now = (m_origin + start + m_taps.size() - 1) % bins;
+        for (size_t i = 0; i < bins; ++i)
+        {
+            const size_t j = bins - 1 - ((i + now) % bins);
+            folded[i].i = sum_re[j];
+            folded[i].q = sum_im[j];
+        }
+
+        m_fft.inverse(folded, mixed);
+        for (size_t bin = 0; bin < bins; ++bin)
+        {
+            m_out_re[(bin * m_out_stride) + n] = mixed[bin].i;
+            m_out_im[(bin * m_out_stride) + n] = mixed[bin].q;
+        }
+    }
+}
+
+void channelizer::finish()
+{
+    const size_t used = m_outputs * m_decimation;
+    const size_t keep = m_fill - used;
+    memmove(m_re.data(), m_re.data() + used, keep * sizeof(float));
+    memmove(m_im.data(), m_im.data() + used, keep * sizeof(float));
+
+    m_origin = (m_origin + used) % m_bins;
+    m_fill = keep;
+    m_outputs = 0;
+}
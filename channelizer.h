@@ -0,0 +1,138 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CHANNELIZER_H
+#define CHANNELIZER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "crypto_rx_common.h"
+
+// Inverse DFT of any length, factored into primes. Small primes are all a
+// channelizer needs, so each stage is a plain DFT of its prime's length
+class mixed_radix_fft
+{
+public:
+    explicit mixed_radix_fft(size_t n = 1);
+
+    size_t size() const
+    {
+        return m_n;
+    }
+
+    // out[k] = sum of in[m] * e^(j * 2 * pi * k * m / n), unscaled. in and
+    // out must not overlap
+    void inverse(const iq_sample* in, iq_sample* out) const;
+
+private:
+    void transform(iq_sample* out, const iq_sample* in, size_t stride, size_t stage, size_t n) const;
+
+private:
+    size_t                 m_n;
+    size_t                 m_max_factor;
+    std::vector<size_t>    m_factors;
+    std::vector<iq_sample> m_twiddles;
+};
+
+// Polyphase FFT filter bank splitting a wideband capture into evenly spaced
+// channels all at once. Every bin gets the same low pass filter as iq_ddc's
+// and comes out at the modem's sample rate, centred on 0 Hz, for the cost of
+// one filter and one FFT per output sample however many bins there are.
+//
+// The bins are input_rate / spacing apart and the output can be
+// oversampled, so the spacing needn't be the output rate, only a whole
+// fraction of it. Bins are numbered as an FFT's are, upwards from 0 Hz with
+// the top half being the negative frequencies.
+//
+// push and finish are called from one thread, run from any number at once
+// on different outputs
+class channelizer
+{
+public:
+    channelizer();
+
+    // Returns false unless spacing splits input_rate into a whole number
+    // of bins and output_rate is a whole number of bins. push takes up to
+    // max_input samples at a time
+    bool configure(unsigned input_rate, unsigned output_rate, unsigned spacing, size_t max_input);
+
+    size_t num_bins() const
+    {
+        return m_bins;
+    }
+
+    // Bins per output sample rate, which is how many neighbouring bins each
+    // bin's filter overlaps
+    size_t oversampling() const
+    {
+        return m_bins / m_decimation;
+    }
+
+    // The bin nearest offset_hz and the frequency at the centre of a bin
+    size_t bin(double offset_hz) const;
+    double bin_frequency(size_t bin) const;
+
+    // Adds count interleaved I/Q samples and returns how many outputs per
+    // bin they complete, which run then computes
+    size_t push(const float* iq, size_t count);
+
+    // Computes outputs first to first + count - 1 of the last push for
+    // every bin
+    void run(size_t first, size_t count);
+
+    // The last push's outputs for one bin, as separate real and imaginary
+    // parts
+    const float* re(size_t bin) const
+    {
+        return m_out_re.data() + (bin * m_out_stride);
+    }
+
+    const float* im(size_t bin) const
+    {
+        return m_out_im.data() + (bin * m_out_stride);
+    }
+
+    // Drops the input the last push's outputs no longer need, once they
+    // have all been run
+    void finish();
+
+private:
+    void design_filter();
+
+private:
+    unsigned m_input_rate;
+    size_t   m_bins;
+    size_t   m_decimation;
+    size_t   m_phases;
+
+    mixed_radix_fft    m_fft;
+    std::vector<float> m_taps;
+
+    // Input, the filter's history first
+    std::vector<float> m_re;
+    std::vector<float> m_im;
+    size_t             m_fill;
+    // Input sample m_re[0] is, counted from the start, modulo the number of
+    // bins. Each bin's mixer is lined up with it
+    size_t             m_origin;
+
+    size_t             m_outputs;
+    size_t             m_out_stride;
+    std::vector<float> m_out_re;
+    std::vector<float> m_out_im;
+};
+
+#endif
@@ -0,0 +1,444 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "crypto_cfg.h"
+#include "config_snapshot.h"
+
+static const char     SNAPSHOT_MAGIC[4] = { 'C', 'C', 'F', 'G' };
+static const uint32_t SNAPSHOT_VERSION = 1;
+
+struct snapshot_source
+{
+    uint32_t path_offset;
+    uint32_t reserved;
+    // -1 if the file didn't exist
+    int64_t  size;
+    int64_t  mtime_ns;
+    uint64_t inode;
+};
+
+struct snapshot_header
+{
+    char     magic[4];
+    uint32_t version;
+    // FNV-1a of everything after the header
+    uint64_t checksum;
+    uint32_t num_sources;
+    uint32_t num_entries;
+    uint32_t num_slots;
+    uint32_t strings_size;
+    struct snapshot_source sources[CONFIG_SNAPSHOT_MAX_SOURCES];
+};
+
+struct snapshot_entry
+{
+    uint32_t hash;
+    uint32_t section_offset;
+    uint32_t key_offset;
+    uint32_t value_offset;
+};
+
+// The file is laid out as the header, the entries, a hash table of entry
+// indices plus one (zero is an empty slot) and then the string pool
+struct config_snapshot
+{
+    void*                         mapping;
+    size_t                        mapping_len;
+    const struct snapshot_header* header;
+    const struct snapshot_entry*  entries;
+    const uint32_t*               slots;
+    const char*                   strings;
+};
+
+static uint64_t checksum_bytes(const void* data, size_t len) {
+    const unsigned char* p = (const unsigned char*)data;
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; ++i) {
+        hash = (hash ^ p[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static void stat_source(const char* path, struct snapshot_source* source) {
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        source->size = st.st_size;
+        source->mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+        source->inode = st.st_ino;
+    }
+    else {
+        source->size = -1;
+        source->mtime_ns = 0;
+        source->inode = 0;
+    }
+}
+
+/* Compiling */
+
+struct setting
+{
+    uint32_t section;
+    uint32_t key;
+    uint32_t value;
+};
+
+struct compile_state
+{
+    struct setting* settings;
+    size_t          num_settings;
+    size_t          max_settings;
+
+    char*           strings;
+    size_t          strings_size;
+    size_t          max_strings_size;
+
+    int             failed;
+};
+
+static uint32_t add_string(struct compile_state* state, const char* str) {
+    const size_t len = strlen(str) + 1;
+    if (state->strings_size + len > state->max_strings_size) {
+        const size_t new_size = (state->max_strings_size + len) * 2;
+        char* strings = realloc(state->strings, new_size);
+        if (strings == NULL) {
+            state->failed = 1;
+            return 0;
+        }
+        state->strings = strings;
+        state->max_strings_size = new_size;
+    }
+
+    const uint32_t offset = state->strings_size;
+    memcpy(state->strings + offset, str, len);
+    state->strings_size += len;
+    return offset;
+}
+
+static int compile_callback(const mTCHAR *Section, const mTCHAR *Key, const mTCHAR *Value, void *UserData) {
+    struct compile_state* state = (struct compile_state*)UserData;
+
+    // Files are read highest priority first, so an existing value is only
+    // replaced if it is empty
+    for (size_t i = 0; i < state->num_settings; ++i) {
+        struct setting* s = &state->settings[i];
+        if (strcasecmp(state->strings + s->section, Section) == 0 &&
+            strcasecmp(state->strings + s->key, Key) == 0) {
+            if (state->strings[s->value] == '\0' && *Value != '\0') {
+                s->value = add_string(state, Value);
+            }
+            return 1;
+        }
+    }
+
+    if (state->num_settings == state->max_settings) {
+        const size_t new_max = state->max_settings ? state->max_settings * 2 : 128;
+        struct setting* settings = realloc(state->settings, new_max * sizeof(struct setting));
+        if (settings == NULL) {
+            state->failed = 1;
+            return 0;
+        }
+        state->settings = settings;
+        state->max_settings = new_max;
+    }
+
+    struct setting* s = &state->settings[state->num_settings++];
+    s->section = add_string(state, Section);
+    s->key = add_string(state, Key);
+    s->value = add_string(state, Value);
+    return 1;
+}
+
+static int write_snapshot(const char* snapshot_path,
+                          const struct snapshot_header* header,
+                          const struct snapshot_entry* entries,
+                          const uint32_t* slots,
+                          const char* strings) {
+    char tmp_path[256];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%d", snapshot_path, (int)getpid());
+
+    FILE* f = fopen(tmp_path, "wb");
+    if (f == NULL) {
+        return 0;
+    }
+
+    const int ok =
+        fwrite(header, sizeof(*header), 1, f) == 1 &&
+        fwrite(entries, sizeof(*entries), header->num_entries, f) == header->num_entries &&
+        fwrite(slots, sizeof(*slots), header->num_slots, f) == header->num_slots &&
+        fwrite(strings, 1, header->strings_size, f) == header->strings_size;
+
+    if (fclose(f) != 0 || !ok || rename(tmp_path, snapshot_path) != 0) {
+        unlink(tmp_path);
+        return 0;
+    }
+
+    return 1;
+}
+
+int config_snapshot_compile(const char* snapshot_path,
+                            const char* const sources[],
+                            int num_sources) {
+    if (num_sources < 1 || num_sources > CONFIG_SNAPSHOT_MAX_SOURCES) {
+        return 0;
+    }
+
+    struct snapshot_header header;
+    memset(&header, 0, sizeof(header));
+
+    struct compile_state state;
+    memset(&state, 0, sizeof(state));
+
+    // Record the state of the files before reading them so a change made
+    // while compiling makes the snapshot look stale rather than current
+    for (int i = 0; i < num_sources; ++i) {
+        header.sources[i].path_offset = add_string(&state, sources[i]);
+        stat_source(sources[i], &header.sources[i]);
+        if (header.sources[i].size >= 0) {
+            ini_browse(compile_callback, &state, sources[i]);
+        }
+    }
+
+    uint32_t num_slots = 16;
+    while (num_slots < state.num_settings * 2) {
+        num_slots *= 2;
+    }
+
+    struct snapshot_entry* entries = calloc(state.num_settings + 1, sizeof(struct snapshot_entry));
+    uint32_t* slots = calloc(num_slots, sizeof(uint32_t));
+
+    int ok = !state.failed && entries != NULL && slots != NULL;
+    if (ok) {
+        for (size_t i = 0; i < state.num_settings; ++i) {
+            const struct setting* s = &state.settings[i];
+            entries[i].hash = config_key_hash(state.strings + s->section, state.strings + s->key);
+            entries[i].section_offset = s->section;
+            entries[i].key_offset = s->key;
+            entries[i].value_offset = s->value;
+
+            uint32_t slot = entries[i].hash;
+            while (slots[slot & (num_slots - 1)] != 0) {
+                ++slot;
+            }
+            slots[slot & (num_slots - 1)] = i + 1;
+        }
+
+        memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        header.version = SNAPSHOT_VERSION;
+        header.num_sources = num_sources;
+        header.num_entries = state.num_settings;
+        header.num_slots = num_slots;
+        header.strings_size = state.strings_size;
+
+        uint64_t checksum = checksum_bytes(entries, state.num_settings * sizeof(struct snapshot_entry));
+        // Mix in each section separately so they can be checksummed in place
+        checksum ^= checksum_bytes(slots, num_slots * sizeof(uint32_t)) * 31;
+        checksum ^= checksum_bytes(state.strings, state.strings_size) * 961;
+        header.checksum = checksum;
+
+        ok = write_snapshot(snapshot_path, &header, entries, slots, state.strings);
+    }
+
+    free(entries);
+    free(slots);
+    free(state.settings);
+    free(state.strings);
+    return ok;
+}
+
+/* Reading */
+
+int is_config_snapshot(const char* path) {
+    char magic[sizeof(SNAPSHOT_MAGIC)];
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        return 0;
+    }
+
+    const int ret = fread(magic, sizeof(magic), 1, f) == 1 &&
+                    memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) == 0;
+    fclose(f);
+    return ret;
+}
+
+static int snapshot_is_valid(const struct config_snapshot* snap) {
+    const struct snapshot_header* header = snap->header;
+    if (snap->mapping_len < sizeof(*header) ||
+        memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 ||
+        header->version != SNAPSHOT_VERSION ||
+        header->num_sources > CONFIG_SNAPSHOT_MAX_SOURCES ||
+        header->num_slots == 0 ||
+        (header->num_slots & (header->num_slots - 1)) != 0 ||
+        header->strings_size == 0) {
+        return 0;
+    }
+
+    const size_t entries_size = (size_t)header->num_entries * sizeof(struct snapshot_entry);
+    const size_t slots_size = (size_t)header->num_slots * sizeof(uint32_t);
+    if (sizeof(*header) + entries_size + slots_size + header->strings_size != snap->mapping_len ||
+        snap->strings[header->strings_size - 1] != '\0') {
+        return 0;
+    }
+
+    uint64_t checksum = checksum_bytes(snap->entries, entries_size);
+    checksum ^= checksum_bytes(snap->slots, slots_size) * 31;
+    checksum ^= checksum_bytes(snap->strings, header->strings_size) * 961;
+    if (checksum != header->checksum) {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < header->num_entries; ++i) {
+        const struct snapshot_entry* e = &snap->entries[i];
+        if (e->section_offset >= header->strings_size ||
+            e->key_offset >= header->strings_size ||
+            e->value_offset >= header->strings_size) {
+            return 0;
+        }
+    }
+    for (uint32_t i = 0; i < header->num_slots; ++i) {
+        if (snap->slots[i] > header->num_entries) {
+            return 0;
+        }
+    }
+    for (uint32_t i = 0; i < header->num_sources; ++i) {
+        if (header->sources[i].path_offset >= header->strings_size) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+struct config_snapshot* config_snapshot_open(const char* snapshot_path) {
+    const int fd = open(snapshot_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct snapshot_header)) {
+        close(fd);
+        return NULL;
+    }
+
+    void* mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+
+    struct config_snapshot* snap = calloc(1, sizeof(struct config_snapshot));
+    if (snap == NULL) {
+        munmap(mapping, st.st_size);
+        return NULL;
+    }
+
+    const char* base = (const char*)mapping;
+    snap->mapping = mapping;
+    snap->mapping_len = st.st_size;
+    snap->header = (const struct snapshot_header*)base;
+    snap->entries = (const struct snapshot_entry*)(base + sizeof(struct snapshot_header));
+    snap->slots = (const uint32_t*)(snap->entries + snap->header->num_entries);
+    snap->strings = (const char*)(snap->slots + snap->header->num_slots);
+
+    // Check the sizes before touching anything past the header
+    const size_t min_len = sizeof(struct snapshot_header) +
+        (size_t)snap->header->num_entries * sizeof(struct snapshot_entry) +
+        (size_t)snap->header->num_slots * sizeof(uint32_t) + 1;
+    if (snap->mapping_len < min_len || !snapshot_is_valid(snap)) {
+        config_snapshot_close(snap);
+        return NULL;
+    }
+
+    return snap;
+}
+
+void config_snapshot_close(struct config_snapshot* snap) {
+    if (snap != NULL) {
+        munmap(snap->mapping, snap->mapping_len);
+        free(snap);
+    }
+}
+
+int config_snapshot_num_sources(const struct config_snapshot* snap) {
+    return snap->header->num_sources;
+}
+
+const char* config_snapshot_source(const struct config_snapshot* snap, int idx) {
+    return snap->strings + snap->header->sources[idx].path_offset;
+}
+
+int config_snapshot_is_current(const struct config_snapshot* snap) {
+    for (uint32_t i = 0; i < snap->header->num_sources; ++i) {
+        const struct snapshot_source* recorded = &snap->header->sources[i];
+        struct snapshot_source cur;
+        stat_source(config_snapshot_source(snap, i), &cur);
+        if (cur.size != recorded->size ||
+            cur.mtime_ns != recorded->mtime_ns ||
+            cur.inode != recorded->inode) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+struct config_snapshot* config_snapshot_open_current(const char* snapshot_path) {
+    struct config_snapshot* snap = config_snapshot_open(snapshot_path);
+    if (snap == NULL || config_snapshot_is_current(snap)) {
+        return snap;
+    }
+
+    char paths[CONFIG_SNAPSHOT_MAX_SOURCES][256];
+    const char* sources[CONFIG_SNAPSHOT_MAX_SOURCES];
+    const int num_sources = config_snapshot_num_sources(snap);
+    for (int i = 0; i < num_sources; ++i) {
+        strncpy(paths[i], config_snapshot_source(snap, i), sizeof(paths[i]) - 1);
+        paths[i][sizeof(paths[i]) - 1] = '\0';
+        sources[i] = paths[i];
+    }
+    config_snapshot_close(snap);
+
+    if (!config_snapshot_compile(snapshot_path, sources, num_sources)) {
+        return NULL;
+    }
+    return config_snapshot_open(snapshot_path);
+}
+
+const char* config_snapshot_get(const struct config_snapshot* snap,
+                                const char* section,
+                                const char* key) {
+    const uint32_t mask = snap->header->num_slots - 1;
+    uint32_t slot = config_key_hash(section, key);
+    for (uint32_t probes = 0; probes <= mask; ++probes, ++slot) {
+        const uint32_t idx = snap->slots[slot & mask];
+        if (idx == 0) {
+            break;
+        }
+
+        const struct snapshot_entry* e = &snap->entries[idx - 1];
+        if (strcasecmp(snap->strings + e->section_offset, section) == 0 &&
+            strcasecmp(snap->strings + e->key_offset, key) == 0) {
+            return snap->strings + e->value_offset;
+        }
+    }
+    return NULL;
+}
+
+void config_snapshot_browse(const struct config_snapshot* snap,
+                            INI_CALLBACK callback,
+                            void* user_data) {
+    for (uint32_t i = 0; i < snap->header->num_entries; ++i) {
+        const struct snapshot_entry* e = &snap->entries[i];
+        if (!callback(snap->strings + e->section_offset,
+                      snap->strings + e->key_offset,
+                      snap->strings + e->value_offset,
+                      user_data)) {
+            break;
+        }
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef CONFIG_SNAPSHOT_H
+#define CONFIG_SNAPSHOT_H
+
+#include "minIni.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A config snapshot is every setting from a stack of INI files merged into
+// one binary file that can be mapped straight into memory. The files are
+// given highest priority first, like iniget: the first file with a non-empty
+// value for a key wins. The snapshot records the size and modification
+// time of each file, so a reader can tell when it is out of date
+#define CONFIG_SNAPSHOT_PATH "/var/run/crypto.ini.bin"
+#define CONFIG_SNAPSHOT_MAX_SOURCES 4
+
+struct config_snapshot;
+
+// Writes a new snapshot of the given files. The snapshot is written to a
+// temporary file and renamed into place. Returns 0 on failure
+int config_snapshot_compile(const char* snapshot_path,
+                            const char* const sources[],
+                            int num_sources);
+
+// Returns non-zero if the file at path starts like a snapshot
+int is_config_snapshot(const char* path);
+
+// Maps a snapshot. Returns NULL if it is missing or corrupt
+struct config_snapshot* config_snapshot_open(const char* snapshot_path);
+void config_snapshot_close(struct config_snapshot* snap);
+
+// Returns non-zero if none of the source files changed since the snapshot
+// was compiled
+int config_snapshot_is_current(const struct config_snapshot* snap);
+
+// Maps the snapshot, recompiling it from its own source files first if it
+// is out of date
+struct config_snapshot* config_snapshot_open_current(const char* snapshot_path);
+
+int config_snapshot_num_sources(const struct config_snapshot* snap);
+const char* config_snapshot_source(const struct config_snapshot* snap, int idx);
+
+// Returns NULL if the key isn't present
+const char* config_snapshot_get(const struct config_snapshot* snap,
+                                const char* section,
+                                const char* key);
+
+// Calls callback for each setting, like ini_browse
+void config_snapshot_browse(const struct config_snapshot* snap,
+                            INI_CALLBACK callback,
+                            void* user_data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
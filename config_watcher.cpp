@@ -0,0 +1,132 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "config_snapshot.h"
+#include "config_watcher.h"
+
+// Writes are only picked up once the file is closed, so a reload never
+// sees a half written file
+static const uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE;
+
+config_watcher::config_watcher()
+    : m_fd(-1)
+{
+}
+
+config_watcher::~config_watcher()
+{
+    close();
+}
+
+bool config_watcher::open(const char* config_file)
+{
+    close();
+
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_fd < 0)
+    {
+        return false;
+    }
+
+    bool ok = true;
+    struct config_snapshot* snap = is_config_snapshot(config_file) ?
+        config_snapshot_open(config_file) : nullptr;
+    if (snap != nullptr)
+    {
+        for (int i = 0; i < config_snapshot_num_sources(snap); ++i)
+        {
+            ok = add_file(config_snapshot_source(snap, i)) && ok;
+        }
+        config_snapshot_close(snap);
+    }
+    else
+    {
+        ok = add_file(config_file);
+    }
+
+    if (!ok)
+    {
+        close();
+    }
+    return ok;
+}
+
+void config_watcher::close()
+{
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    m_files.clear();
+}
+
+bool config_watcher::add_file(const std::string& path)
+{
+    const size_t slash = path.rfind('/');
+    const std::string dir = slash == std::string::npos ? "." :
+                            slash == 0 ? "/" : path.substr(0, slash);
+    const std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+
+    // Watching the same directory twice returns the same descriptor
+    const int wd = inotify_add_watch(m_fd, dir.c_str(), WATCH_MASK);
+    if (wd < 0)
+    {
+        return false;
+    }
+
+    m_files.push_back(watched_file{wd, name});
+    return true;
+}
+
+bool config_watcher::changed()
+{
+    if (m_fd < 0)
+    {
+        return false;
+    }
+
+    bool ret = false;
+    alignas(struct inotify_event) char buffer[4096];
+    ssize_t len;
+    while ((len = read(m_fd, buffer, sizeof(buffer))) > 0)
+    {
+        for (ssize_t pos = 0; pos < len;)
+        {
+            const struct inotify_event* ev = (const struct inotify_event*)(buffer + pos);
+            pos += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->len == 0)
+            {
+                continue;
+            }
+
+            for (const watched_file& file : m_files)
+            {
+                if (file.wd == ev->wd && file.name == ev->name)
+                {
+                    ret = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    return ret;
+}
@@ -0,0 +1,54 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CONFIG_WATCHER_H
+#define CONFIG_WATCHER_H
+
+#include <string>
+#include <vector>
+
+// Watches the config files with inotify so a daemon can reload without
+// being signalled. The directories are watched rather than the files
+// themselves, so a file replaced by a rename (iniset, cfgsnap) is still
+// seen. For a config snapshot the files it was compiled from are watched
+class config_watcher
+{
+public:
+    config_watcher();
+    ~config_watcher();
+
+    bool open(const char* config_file);
+    void close();
+
+    int fd() const { return m_fd; }
+
+    // Returns true if a watched file was written, replaced or deleted since
+    // the last call. Never blocks
+    bool changed();
+
+private:
+    bool add_file(const std::string& path);
+
+private:
+    struct watched_file
+    {
+        int         wd;
+        std::string name;
+    };
+
+    int                       m_fd;
+    std::vector<watched_file> m_files;
+};
+
+#endif
@@ -1030,12 +1030,11 @@ write_device_image()
             TMP_CRYPTO_INI=`mktemp`
             cp "$CRYPTO_INI_USR" "$TMP_CRYPTO_INI"
 
-            iniset Config ConfigPassword '*' "$TMP_CRYPTO_INI"
             if test "$2" -ne 0
             then
-                iniset Config Enabled 1 "$TMP_CRYPTO_INI"
+                iniset -e "Config/ConfigPassword=*" -e Config/Enabled=1 "$TMP_CRYPTO_INI"
             else
-                iniset Config Enabled 0 "$TMP_CRYPTO_INI"
+                iniset -e "Config/ConfigPassword=*" -e Config/Enabled=0 "$TMP_CRYPTO_INI"
             fi
 
             rm -f "$ASOUND_CFG" && alsactl store
@@ -1182,9 +1181,17 @@ start_alsamixer()
     done
 }
 
+# Uses the slot list show_key_slot_dialog read
 key_slot_str()
 {
-    has_key "$1" && echo "*Slot $1" || echo " Slot $1"
+    case " $KEY_SLOTS " in
+        *" $1 "*)
+            echo "*Slot $1"
+            ;;
+        *)
+            echo " Slot $1"
+            ;;
+    esac
 }
 
 # $1: 1 to show all or 0 to show only entries with keys
@@ -1196,15 +1203,18 @@ show_key_slot_dialog()
     rm -f /tmp/key_slots_dialog &>/dev/null
     touch /tmp/key_slots_dialog &>/dev/null
     COUNT=0
-    IDX=1
-    while test "$IDX" -le 256
+    KEY_SLOTS=`keyslot list | xargs`
+    if test "$1" -eq 1
+    then
+        SLOTS=`seq 1 256`
+    else
+        SLOTS="$KEY_SLOTS"
+    fi
+
+    for IDX in $SLOTS
     do
-        if test "$1" -eq 1 || has_key "$IDX"
-        then
-            COUNT=$((COUNT+1))
-            echo "$IDX \"`key_slot_str $IDX`\" `on_off "$IDX" "$3"`" >> /tmp/key_slots_dialog
-        fi
-        IDX=$((IDX+1))
+        COUNT=$((COUNT+1))
+        echo "$IDX \"`key_slot_str $IDX`\" `on_off "$IDX" "$3"`" >> /tmp/key_slots_dialog
     done
 
     if test "$4" = "1"
@@ -1244,16 +1254,13 @@ generate_encryption_keys()
                 has_any_keys
                 HAD_KEYS="$?"
 
+                # All the keys come from one read of the RNG
                 RESULT=0
-                for IDX in `cat $ANSWER`
-                do
-                    if gen_key "$IDX"
-                    then
-                        set_dirty
-                    else
-                        RESULT=1
-                    fi
-                done
+                SLOTS=`cat $ANSWER`
+                if test -n "$SLOTS"
+                then
+                    gen_key $SLOTS && set_dirty || RESULT=1
+                fi
 
                 if test $RESULT -eq 0
                 then
@@ -1285,15 +1292,11 @@ delete_encryption_keys()
             if show_key_slot_dialog 0 "Delete" "" 1 2>$ANSWER
             then
                 RESULT=0
-                for IDX in `cat $ANSWER`
-                do
-                    if rm "`get_key_path $IDX`"
-                    then
-                        set_dirty
-                    else
-                        RESULT=1
-                    fi
-                done
+                SLOTS=`cat $ANSWER`
+                if test -n "$SLOTS"
+                then
+                    keyslot remove $SLOTS && set_dirty || RESULT=1
+                fi
 
                 if test $RESULT -eq 0
                 then
@@ -1637,8 +1640,7 @@ main_menu()
         touch /tmp/shell_opt
         touch /tmp/config_opt
 
-        PTT_ENABLED=`get_config_val PTT Enabled`
-        PTT_GPIONUM=`get_config_val PTT GPIONum`
+        eval "`get_config_vals PTT_ENABLED=PTT/Enabled PTT_GPIONUM=PTT/GPIONum`"
 
         HEIGHT=13
         if test "$PTT_ENABLED" -ne 0 && test "$PTT_GPIONUM" -eq "-1"
@@ -0,0 +1,148 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <poll.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <cstdarg>
+
+#include <algorithm>
+
+#include "control_socket.h"
+
+control_socket::control_socket()
+    : m_fd(-1),
+      m_peer_len(0)
+{
+    memset(m_path, 0, sizeof(m_path));
+    memset(&m_peer, 0, sizeof(m_peer));
+}
+
+control_socket::~control_socket()
+{
+    close();
+}
+
+bool control_socket::open(const char* path)
+{
+    close();
+
+    if (path == nullptr || *path == '\0' || strlen(path) >= sizeof(m_path))
+    {
+        return false;
+    }
+
+    m_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (m_fd < 0)
+    {
+        return false;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    // Remove a stale socket left behind by a previous instance
+    unlink(path);
+    if (bind(m_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+
+    strncpy(m_path, path, sizeof(m_path) - 1);
+    return true;
+}
+
+void control_socket::close()
+{
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+        unlink(m_path);
+        memset(m_path, 0, sizeof(m_path));
+    }
+}
+
+bool control_socket::receive(char* buffer, size_t buffer_size, int timeout_ms)
+{
+    if (m_fd < 0)
+    {
+        if (timeout_ms > 0) usleep(timeout_ms * 1000);
+        return false;
+    }
+
+    struct pollfd pfd;
+    pfd.fd = m_fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, timeout_ms) <= 0 || (pfd.revents & POLLIN) == 0)
+    {
+        return false;
+    }
+
+    m_peer_len = sizeof(m_peer);
+    const ssize_t len = recvfrom(m_fd,
+                                 buffer,
+                                 buffer_size - 1,
+                                 MSG_DONTWAIT,
+                                 (struct sockaddr*)&m_peer,
+                                 &m_peer_len);
+    if (len < 0)
+    {
+        m_peer_len = 0;
+        return false;
+    }
+
+    // Strip the trailing newline added by shell callers
+    size_t end = len;
+    while (end > 0 && (buffer[end - 1] == '\n' || buffer[end - 1] == '\r'))
+    {
+        --end;
+    }
+    buffer[end] = '\0';
+
+    return true;
+}
+
+void control_socket::reply(const char* format, ...)
+{
+    // An unbound sender has a zero length (or family only) address
+    if (m_fd < 0 || m_peer_len <= sizeof(sa_family_t))
+    {
+        return;
+    }
+
+    char buffer[CONTROL_MSG_MAX];
+
+    va_list args;
+    va_start(args, format);
+    const int len = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+
+    if (len > 0)
+    {
+        sendto(m_fd,
+               buffer,
+               std::min((size_t)len, sizeof(buffer) - 1),
+               MSG_DONTWAIT,
+               (struct sockaddr*)&m_peer,
+               m_peer_len);
+    }
+}
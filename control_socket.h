@@ -0,0 +1,51 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CONTROL_SOCKET_H
+#define CONTROL_SOCKET_H
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define CONTROL_MSG_MAX 256
+
+// Local datagram socket used to send commands to a running daemon. Each
+// datagram is one command line, e.g. "volume +10". A reply is sent back
+// if the sender bound its own address (crypto_ctl does)
+class control_socket
+{
+public:
+    control_socket();
+    ~control_socket();
+
+    bool open(const char* path);
+    void close();
+
+    int fd() const { return m_fd; }
+
+    // Waits up to timeout_ms for a command. Returns true and fills in
+    // buffer (NUL terminated) if one was received
+    bool receive(char* buffer, size_t buffer_size, int timeout_ms);
+
+    // Sends a reply to the sender of the last received command
+    void reply(const char* format, ...);
+
+private:
+    int                m_fd;
+    char               m_path[sizeof(sockaddr_un::sun_path)];
+    struct sockaddr_un m_peer;
+    socklen_t          m_peer_len;
+};
+
+#endif
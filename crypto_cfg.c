@@ -1,10 +1,17 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <ctype.h>
+#include <unistd.h>
 
 #include "gpiod.h"
 #include "freedv_api.h"
 #include "crypto_cfg.h"
+#include "crypto_cfg_schema.h"
+#include "config_snapshot.h"
 #include "minIni.h"
 
 int bias_flags(const char *option)
@@ -50,174 +57,231 @@ void get_key_path(char* buffer, size_t buffer_size, uint key_index)
     buffer[buffer_size - 1] = '\0';
 }
 
-static int ini_callback(const mTCHAR *Section, const mTCHAR *Key, const mTCHAR *Value, void *UserData) {
-    struct config *cfg = (struct config*)UserData;
+static const struct config_entry CONFIG_ENTRIES[] = {
+#define CONFIG_ENTRY(section, key, type, field, def, min, max, change) \
+    { #section, #key, CONFIG_TYPE_##type,                              \
+      offsetof(struct config, field),                                  \
+      sizeof(((struct config*)0)->field),                              \
+      def, min, max, CONFIG_CHANGE_##change },
+    CONFIG_SCHEMA(CONFIG_ENTRY)
+#undef CONFIG_ENTRY
+};
 
-    if (strcasecmp(Section, "Crypto") ==0) {
-        if (strcasecmp(Key, "AutoRekey") == 0) {
-            cfg->rekey_period = atoi(Value);
-        }
-        else if (strcasecmp(Key, "Enabled") == 0) {
-            cfg->crypto_enabled = atoi(Value);
-        }
-        else if (strcasecmp(Key, "KeyIndex") == 0) {
-            get_key_path(cfg->key_file, sizeof(cfg->key_file), atoi(Value));
-        }
+#define NUM_CONFIG_ENTRIES (sizeof(CONFIG_ENTRIES) / sizeof(CONFIG_ENTRIES[0]))
+
+// Open addressed hash table of indices into CONFIG_ENTRIES plus one, so
+// zero marks an empty slot. Must be a power of 2 comfortably larger than
+// the number of settings
+#define CONFIG_HASH_SLOTS 256
+static unsigned char config_hash_table[CONFIG_HASH_SLOTS];
+
+uint32_t config_key_hash(const char* section, const char* key) {
+    uint32_t hash = 2166136261u;
+    for (const char* p = section; *p; ++p) {
+        hash = (hash ^ (unsigned char)tolower((unsigned char)*p)) * 16777619u;
     }
-    else if (strcasecmp(Section, "Audio") == 0) {
-        if (strcasecmp(Key, "ModemQuietMaxThresh") == 0) {
-            cfg->modem_quiet_max_thresh = atoi(Value);
-        }
-        else if (strcasecmp(Key, "ModemSignalMinThresh") == 0) {
-            cfg->modem_signal_min_thresh = atoi(Value);
-        }
-        else if (strcasecmp(Key, "ModemNumQuietFlushFrames") == 0) {
-            cfg->modem_num_quiet_flush_frames = atoi(Value);
-        }
+    hash *= 16777619u;
+    for (const char* p = key; *p; ++p) {
+        hash = (hash ^ (unsigned char)tolower((unsigned char)*p)) * 16777619u;
     }
-    else if (strcasecmp(Section, "PTT") == 0) {
-        if (strcasecmp(Key, "Enabled") == 0) {
-            cfg->ptt_enabled = atoi(Value);
-        }
-        else if (strcasecmp(Key, "GPIONum") == 0) {
-            cfg->ptt_gpio_num = atoi(Value);
-        }
-        else if (strcasecmp(Key, "ActiveLow") == 0) {
-            cfg->ptt_active_low = active_flags(Value);
-        }
-        else if (strcasecmp(Key, "Bias") == 0) {
-            cfg->ptt_gpio_bias = bias_flags(Value);
-        }
-        else if (strcasecmp(Key, "OutputGPIONum") == 0) {
-            cfg->ptt_output_gpio_num = atoi(Value);
-        }
-        else if (strcasecmp(Key, "OutputActiveLow") == 0) {
-            cfg->ptt_output_active_low = active_flags(Value);
-        }
-        else if (strcasecmp(Key, "OutputBias") == 0) {
-            cfg->ptt_output_bias = bias_flags(Value);
-        }
-        else if (strcasecmp(Key, "OutputDrive") == 0) {
-            cfg->ptt_output_drive = drive_flags(Value);
-        }
+    return hash;
+}
+
+// Settings are only read from the main thread, so building the table on
+// first use is safe
+static void build_config_hash_table(void) {
+    static int built = 0;
+    if (built) {
+        return;
     }
-    else if (strcasecmp(Section, "Diagnostics") ==0) {
-        if (strcasecmp(Key, "LogFile") == 0) {
-            strncpy(cfg->log_file, Value, sizeof(cfg->log_file) - 1);
-        }
-        else if (strcasecmp(Key, "LogLevel") == 0) {
-            cfg->log_level = atoi(Value);
+
+    for (size_t i = 0; i < NUM_CONFIG_ENTRIES; ++i) {
+        uint32_t slot = config_key_hash(CONFIG_ENTRIES[i].section, CONFIG_ENTRIES[i].key);
+        while (config_hash_table[slot & (CONFIG_HASH_SLOTS - 1)] != 0) {
+            ++slot;
         }
+        config_hash_table[slot & (CONFIG_HASH_SLOTS - 1)] = (unsigned char)(i + 1);
     }
-    else if (strcasecmp(Section, "Codec") == 0) {
-        if (strcasecmp(Key, "Mode") == 0) {
-            if (!strcasecmp(Value,"1600")) cfg->freedv_mode = FREEDV_MODE_1600;
-            if (!strcasecmp(Value,"700C")) cfg->freedv_mode = FREEDV_MODE_700C;
-            if (!strcasecmp(Value,"700D")) cfg->freedv_mode = FREEDV_MODE_700D;
-            if (!strcasecmp(Value,"700E")) cfg->freedv_mode = FREEDV_MODE_700E;
-            if (!strcasecmp(Value,"2400A")) cfg->freedv_mode = FREEDV_MODE_2400A;
-            if (!strcasecmp(Value,"2400B")) cfg->freedv_mode = FREEDV_MODE_2400B;
-            if (!strcasecmp(Value,"800XA")) cfg->freedv_mode = FREEDV_MODE_800XA;
-        }
-        else if (strcasecmp(Key, "SquelchEnabled") == 0 ) {
-            cfg->freedv_squelch_enabled = atoi(Value);
-        }
-        else if (strcasecmp(Key, "SquelchThresh700C") == 0 ) {
-            cfg->freedv_squelch_thresh_700c = atof(Value);
-        }
-        else if (strcasecmp(Key, "SquelchThresh700D") == 0 ) {
-            cfg->freedv_squelch_thresh_700d = atof(Value);
-        }
-        else if (strcasecmp(Key, "SquelchThresh700E") == 0 ) {
-            cfg->freedv_squelch_thresh_700e = atof(Value);
+    built = 1;
+}
+
+const struct config_entry* find_config_entry(const char* section, const char* key) {
+    build_config_hash_table();
+
+    uint32_t slot = config_key_hash(section, key);
+    for (;;) {
+        const unsigned char idx = config_hash_table[slot & (CONFIG_HASH_SLOTS - 1)];
+        if (idx == 0) {
+            return NULL;
         }
-        else if (strcasecmp(Key, "Enabled") == 0 ) {
-            cfg->freedv_enabled = atoi(Value);
+
+        const struct config_entry* entry = &CONFIG_ENTRIES[idx - 1];
+        if (strcasecmp(entry->section, section) == 0 && strcasecmp(entry->key, key) == 0) {
+            return entry;
         }
+        ++slot;
     }
-    else if (strcasecmp(Section, "JACK") == 0) {
-        if (strcasecmp(Key, "TXPeriod700C") == 0) {
-            cfg->jack_tx_period_700c = atoi(Value);
-        }
-        else if (strcasecmp(Key, "TXPeriod700D") == 0){
-            cfg->jack_tx_period_700d = atoi(Value);
-        }
-        else if (strcasecmp(Key, "TXPeriod700E") == 0){
-            cfg->jack_tx_period_700e = atoi(Value);
-        }
-        else if (strcasecmp(Key, "TXPeriod800XA") == 0){
-            cfg->jack_tx_period_800xa = atoi(Value);
-        }
-        else if (strcasecmp(Key, "TXPeriod1600") == 0){
-            cfg->jack_tx_period_1600 = atoi(Value);
-        }
-        else if (strcasecmp(Key, "TXPeriod2400B") == 0){
-            cfg->jack_tx_period_2400b = atoi(Value);
-        }
+}
 
-        else if (strcasecmp(Key, "RXPeriod700C") == 0) {
-            cfg->jack_rx_period_700c = atoi(Value);
-        }
-        else if (strcasecmp(Key, "RXPeriod700D") == 0){
-            cfg->jack_rx_period_700d = atoi(Value);
-        }
-        else if (strcasecmp(Key, "RXPeriod700E") == 0){
-            cfg->jack_rx_period_700e = atoi(Value);
-        }
-        else if (strcasecmp(Key, "RXPeriod800XA") == 0){
-            cfg->jack_rx_period_800xa = atoi(Value);
-        }
-        else if (strcasecmp(Key, "RXPeriod1600") == 0){
-            cfg->jack_rx_period_1600 = atoi(Value);
-        }
-        else if (strcasecmp(Key, "RXPeriod2400B") == 0){
-            cfg->jack_rx_period_2400b = atoi(Value);
+unsigned config_diff(const struct config* a, const struct config* b) {
+    unsigned changes = 0;
+    for (size_t i = 0; i < NUM_CONFIG_ENTRIES; ++i) {
+        const struct config_entry* entry = &CONFIG_ENTRIES[i];
+        if (memcmp((const char*)a + entry->offset, (const char*)b + entry->offset, entry->size) != 0) {
+            changes |= entry->change;
         }
+    }
+    return changes;
+}
 
-        else if (strcasecmp(Key, "SecureNotifyFile") == 0) {
-            strncpy(cfg->jack_secure_notify_file,
-                    Value,
-                    sizeof(cfg->jack_secure_notify_file) - 1);
-        }
-        else if (strcasecmp(Key, "InsecureNotifyFile") == 0) {
-            strncpy(cfg->jack_insecure_notify_file,
-                    Value,
-                    sizeof(cfg->jack_insecure_notify_file) - 1);
-        }
+static int parse_mode(const char* value, int* mode) {
+    if (!strcasecmp(value, "1600"))       *mode = FREEDV_MODE_1600;
+    else if (!strcasecmp(value, "700C"))  *mode = FREEDV_MODE_700C;
+    else if (!strcasecmp(value, "700D"))  *mode = FREEDV_MODE_700D;
+    else if (!strcasecmp(value, "700E"))  *mode = FREEDV_MODE_700E;
+    else if (!strcasecmp(value, "2400A")) *mode = FREEDV_MODE_2400A;
+    else if (!strcasecmp(value, "2400B")) *mode = FREEDV_MODE_2400B;
+    else if (!strcasecmp(value, "800XA")) *mode = FREEDV_MODE_800XA;
+    else return 0;
 
-        else if (strcasecmp(Key, "VoiceInPort") == 0) {
-            strncpy(cfg->jack_voice_in_port,
-                    Value,
-                    sizeof(cfg->jack_voice_in_port) - 1);
-        }
-        else if (strcasecmp(Key, "ModemOutPort") == 0) {
-            strncpy(cfg->jack_modem_out_port,
-                    Value,
-                    sizeof(cfg->jack_modem_out_port) - 1);
-        }
-        else if (strcasecmp(Key, "ModemInPort") == 0) {
-            strncpy(cfg->jack_modem_in_port,
-                    Value,
-                    sizeof(cfg->jack_modem_in_port) - 1);
-        }
-        else if (strcasecmp(Key, "VoiceOutPort") == 0) {
-            strncpy(cfg->jack_voice_out_port,
-                    Value,
-                    sizeof(cfg->jack_voice_out_port) - 1);
-        }
-        else if (strcasecmp(Key, "NotifyOutPort") == 0) {
-            strncpy(cfg->jack_notify_out_port,
-                    Value,
-                    sizeof(cfg->jack_notify_out_port) - 1);
-        }
+    return 1;
+}
+
+const char* mode_name(int mode) {
+    switch (mode) {
+        case FREEDV_MODE_1600:  return "1600";
+        case FREEDV_MODE_700C:  return "700C";
+        case FREEDV_MODE_700D:  return "700D";
+        case FREEDV_MODE_700E:  return "700E";
+        case FREEDV_MODE_2400A: return "2400A";
+        case FREEDV_MODE_2400B: return "2400B";
+        case FREEDV_MODE_800XA: return "800XA";
+        default:                return NULL;
+    }
+}
+
+// Like atoi, numbers may be followed by junk (e.g. a stray ';') but must
+// start with a digit
+static int parse_number(const char* value, double* number) {
+    char* end = NULL;
+    *number = strtod(value, &end);
+    return end != value;
+}
+
+int set_config_value(const struct config_entry* entry, const char* value, struct config* cfg) {
+    void* field = (char*)cfg + entry->offset;
+    double number = 0;
+
+    switch (entry->type) {
+        case CONFIG_TYPE_INT:
+            if (!parse_number(value, &number) ||
+                number < entry->min || number > entry->max) {
+                return 0;
+            }
+            *(int*)field = (int)number;
+            break;
+        case CONFIG_TYPE_FLOAT:
+            if (!parse_number(value, &number) ||
+                number < entry->min || number > entry->max) {
+                return 0;
+            }
+            *(float*)field = (float)number;
+            break;
+        case CONFIG_TYPE_STRING:
+            strncpy((char*)field, value, entry->size - 1);
+            ((char*)field)[entry->size - 1] = '\0';
+            break;
+        case CONFIG_TYPE_KEY:
+            if (!parse_number(value, &number) ||
+                number < entry->min || number > entry->max) {
+                return 0;
+            }
+            get_key_path((char*)field, entry->size, (uint)number);
+            break;
+        case CONFIG_TYPE_ACTIVE:
+            *(int*)field = active_flags(value);
+            break;
+        case CONFIG_TYPE_BIAS:
+            *(int*)field = bias_flags(value);
+            break;
+        case CONFIG_TYPE_DRIVE:
+            *(int*)field = drive_flags(value);
+            break;
+        case CONFIG_TYPE_MODE:
+            return parse_mode(value, (int*)field);
+    }
+
+    return 1;
+}
+
+static int ini_callback(const mTCHAR *Section, const mTCHAR *Key, const mTCHAR *Value, void *UserData) {
+    struct config *cfg = (struct config*)UserData;
+
+    const struct config_entry* entry = find_config_entry(Section, Key);
+    if (entry != NULL && !set_config_value(entry, Value, cfg)) {
+        fprintf(stderr, "Ignoring invalid setting [%s] %s = %s\n", Section, Key, Value);
     }
 
     return 1;
 }
 
-void read_config(const char* config_file, struct config* cfg) {
+// Reads the files a snapshot was compiled from, in the same order so the
+// same layers win. Files missing when it was compiled are skipped the same
+// way, but one that is there has to be readable
+static int read_snapshot_sources(const struct config_snapshot* snap, struct config* cfg) {
+    int num_read = 0;
+    for (int i = 0; i < config_snapshot_num_sources(snap); ++i) {
+        const char* source = config_snapshot_source(snap, i);
+        if (access(source, F_OK) != 0) {
+            continue;
+        }
+        if (!ini_browse(ini_callback, (void*)cfg, source)) {
+            return 0;
+        }
+        ++num_read;
+    }
+    return num_read > 0;
+}
+
+int read_config(const char* config_file, struct config* cfg) {
     memset(cfg, 0, sizeof(struct config));
-    ini_browse(ini_callback, (void*)cfg, config_file);
+    for (size_t i = 0; i < NUM_CONFIG_ENTRIES; ++i) {
+        if (str_has_value(CONFIG_ENTRIES[i].default_value)) {
+            set_config_value(&CONFIG_ENTRIES[i], CONFIG_ENTRIES[i].default_value, cfg);
+        }
+    }
+
+    // A compiled snapshot is used as is, after bringing it up to date with
+    // the files it was compiled from
+    if (is_config_snapshot(config_file)) {
+        struct config_snapshot* snap = config_snapshot_open_current(config_file);
+        if (snap != NULL) {
+            config_snapshot_browse(snap, ini_callback, (void*)cfg);
+            config_snapshot_close(snap);
+            return 1;
+        }
+
+        // Out of date and couldn't be compiled again, e.g. with /var/run
+        // full, so go to the files it came from. A corrupt snapshot
+        // doesn't say what those are
+        snap = config_snapshot_open(config_file);
+        if (snap == NULL) {
+            fprintf(stderr, "Could not load config snapshot %s\n", config_file);
+            return 0;
+        }
+        const int ok = read_snapshot_sources(snap, cfg);
+        config_snapshot_close(snap);
+        if (!ok) {
+            fprintf(stderr, "Could not read the sources of config snapshot %s\n", config_file);
+        }
+        return ok;
+    }
+
+    if (!ini_browse(ini_callback, (void*)cfg, config_file)) {
+        fprintf(stderr, "Could not read config file %s\n", config_file);
+        return 0;
+    }
+    return 1;
 }
 
 size_t read_key_file(const char* key_file, unsigned char key[]) {
@@ -1,6 +1,10 @@
 #ifndef CRYPTO_CFG
 #define CRYPTO_CFG
 
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -12,10 +16,23 @@ struct config
     char log_file[80];
     int  log_level;
 
+    int  tap_enabled;
+    char tap_dir[80];
+    char tap_format[8];
+    int  tap_max_file_size;
+    int  tap_sync_interval;
+
+    char payload_log_dir[80];
+
     int modem_quiet_max_thresh;
     int modem_signal_min_thresh;
     int modem_num_quiet_flush_frames;
 
+    int headset_volume;
+    int notify_volume;
+
+    int drift_compensation;
+
     int  rekey_period;
     int  crypto_enabled;
 
@@ -52,6 +69,12 @@ struct config
 
     char jack_secure_notify_file[80];
     char jack_insecure_notify_file[80];
+    char jack_beep_notify_file[80];
+    char jack_asset_cache_dir[80];
+    char jack_volume_file[80];
+    char jack_rx_control_socket[80];
+    char jack_tx_control_socket[80];
+    char jack_text_notify_command[80];
 
     char jack_voice_in_port[80];
     char jack_modem_out_port[80];
@@ -59,9 +82,93 @@ struct config
     char jack_modem_in_port[80];
     char jack_voice_out_port[80];
     char jack_notify_out_port[80];
+
+    char jack_keyed_state[80];
+    int  jack_keyed_guard;
+
+    int  iq_sample_rate;
+    char iq_format[8];
+    int  iq_offset;
+    int  iq_modem_centre;
+    int  iq_afc;
+
+    char net_tx_link[80];
+    char net_rx_link[80];
+    int  net_link_rate;
+    int  net_frames_per_packet;
+};
+
+enum config_type
+{
+    CONFIG_TYPE_INT,
+    CONFIG_TYPE_FLOAT,
+    CONFIG_TYPE_STRING,
+    // Key index, stored as the path of the key file
+    CONFIG_TYPE_KEY,
+    // GPIO options, stored as libgpiod request flags
+    CONFIG_TYPE_ACTIVE,
+    CONFIG_TYPE_BIAS,
+    CONFIG_TYPE_DRIVE,
+    // FreeDV mode name, stored as FREEDV_MODE_*
+    CONFIG_TYPE_MODE
 };
 
-void read_config(const char* config_file, struct config* cfg);
+// What a running daemon has to redo when a setting changes
+enum config_change
+{
+    // Read by the audio path, which picks up the new value on its next frame
+    CONFIG_CHANGE_LIVE    = 1 << 0,
+    // The key is swapped in place
+    CONFIG_CHANGE_KEY     = 1 << 1,
+    CONFIG_CHANGE_VOLUME  = 1 << 2,
+    // The GPIO lines are requested again
+    CONFIG_CHANGE_PTT     = 1 << 3,
+    // The JACK client is reactivated with a new buffer size and connections
+    CONFIG_CHANGE_JACK    = 1 << 4,
+    // Notification sounds are loaded again
+    CONFIG_CHANGE_NOTIFY  = 1 << 5,
+    CONFIG_CHANGE_TAP     = 1 << 6,
+    // The modem and everything sized from it are rebuilt
+    CONFIG_CHANGE_CODEC   = 1 << 7,
+    // Only read at startup
+    CONFIG_CHANGE_RESTART = 1 << 8
+};
+
+// One setting from the schema in crypto_cfg_schema.h
+struct config_entry
+{
+    const char*      section;
+    const char*      key;
+    enum config_type type;
+    size_t           offset;
+    size_t           size;
+    const char*      default_value;
+    double           min;
+    double           max;
+    // CONFIG_CHANGE_*
+    unsigned         change;
+};
+
+// Fills in cfg from an INI file or a config snapshot, over the schema
+// defaults. Returns 0 if the settings couldn't be read, in which case cfg
+// must not be used: the defaults alone leave encryption off
+int read_config(const char* config_file, struct config* cfg);
+
+// Case insensitive FNV-1a of "section\0key"
+uint32_t config_key_hash(const char* section, const char* key);
+
+// Looks up a setting. Returns NULL if it isn't in the schema
+const struct config_entry* find_config_entry(const char* section, const char* key);
+
+// Parses value into the setting's field in cfg. Returns 0 and leaves cfg
+// alone if the value is malformed or out of range
+int set_config_value(const struct config_entry* entry, const char* value, struct config* cfg);
+
+// The config file spelling of a FREEDV_MODE_*, e.g. "700D", or NULL
+const char* mode_name(int mode);
+
+// Returns the CONFIG_CHANGE_* flags of every setting that differs
+unsigned config_diff(const struct config* a, const struct config* b);
 
 size_t read_key_file(const char* key_file, unsigned char key[]);
 
@@ -0,0 +1,91 @@
+#ifndef CRYPTO_CFG_SCHEMA
+#define CRYPTO_CFG_SCHEMA
+
+// Every setting in struct config, one per line:
+//
+// X(Section, Key, Type, field, "Default", Min, Max, Change)
+//
+// Type selects the parser (see enum config_type). Min and Max are only
+// checked for INT and FLOAT settings. Change says what a running daemon
+// has to redo when the setting changes (see enum config_change). Settings
+// without a default start out as zero. The INI key lookup, defaults, range
+// checks, iniset validation and reload diffs are all generated from this
+// list, so a new setting only needs a line here and a field in struct
+// config
+#define CONFIG_SCHEMA(X) \
+    X(Crypto,      AutoRekey,                 INT,    rekey_period,                   "",       0, INT_MAX, LIVE)     \
+    X(Crypto,      Enabled,                   INT,    crypto_enabled,                 "",       0, 1,       KEY)      \
+    X(Crypto,      KeyIndex,                  KEY,    key_file,                       "",       0, INT_MAX, KEY)      \
+                                                                                                                      \
+    X(Audio,       ModemQuietMaxThresh,       INT,    modem_quiet_max_thresh,         "",       0, 32767,   LIVE)     \
+    X(Audio,       ModemSignalMinThresh,      INT,    modem_signal_min_thresh,        "",       0, 32767,   LIVE)     \
+    X(Audio,       ModemNumQuietFlushFrames,  INT,    modem_num_quiet_flush_frames,   "",       0, INT_MAX, LIVE)     \
+    X(Audio,       HeadsetVolume,             INT,    headset_volume,                 "100",    0, 100,     VOLUME)   \
+    X(Audio,       NotifyVolume,              INT,    notify_volume,                  "100",    0, 100,     VOLUME)   \
+    X(Audio,       DriftCompensation,         INT,    drift_compensation,             "1",      0, 1,       JACK)     \
+                                                                                                                      \
+    X(PTT,         Enabled,                   INT,    ptt_enabled,                    "",       0, 1,       PTT)      \
+    X(PTT,         GPIONum,                   INT,    ptt_gpio_num,                   "",      -1, 1023,    PTT)      \
+    X(PTT,         ActiveLow,                 ACTIVE, ptt_active_low,                 "",       0, 0,       PTT)      \
+    X(PTT,         Bias,                      BIAS,   ptt_gpio_bias,                  "",       0, 0,       PTT)      \
+    X(PTT,         OutputGPIONum,             INT,    ptt_output_gpio_num,            "",       0, 1023,    PTT)      \
+    X(PTT,         OutputActiveLow,           ACTIVE, ptt_output_active_low,          "",       0, 0,       PTT)      \
+    X(PTT,         OutputBias,                BIAS,   ptt_output_bias,                "",       0, 0,       PTT)      \
+    X(PTT,         OutputDrive,               DRIVE,  ptt_output_drive,               "",       0, 0,       PTT)      \
+                                                                                                                      \
+    X(Diagnostics, LogFile,                   STRING, log_file,                       "",       0, 0,       CODEC)    \
+    X(Diagnostics, LogLevel,                  INT,    log_level,                      "",       0, 10,      CODEC)    \
+    X(Diagnostics, TapEnabled,                INT,    tap_enabled,                    "",       0, 1,       TAP)      \
+    X(Diagnostics, TapDir,                    STRING, tap_dir,                        "",       0, 0,       TAP)      \
+    X(Diagnostics, TapFormat,                 STRING, tap_format,                     "",       0, 0,       TAP)      \
+    X(Diagnostics, TapMaxFileSize,            INT,    tap_max_file_size,              "",       0, 4095,    TAP)      \
+    X(Diagnostics, TapSyncInterval,           INT,    tap_sync_interval,              "",       0, 3600,    TAP)      \
+    X(Diagnostics, PayloadLogDir,             STRING, payload_log_dir,                "",       0, 0,       CODEC)    \
+                                                                                                                      \
+    X(Codec,       Enabled,                   INT,    freedv_enabled,                 "",       0, 1,       CODEC)    \
+    X(Codec,       Mode,                      MODE,   freedv_mode,                    "1600",    0, 0,       CODEC)   \
+    X(Codec,       SquelchEnabled,            INT,    freedv_squelch_enabled,         "",       0, 1,       LIVE)     \
+    X(Codec,       SquelchThresh700C,         FLOAT,  freedv_squelch_thresh_700c,     "",    -100, 100,     LIVE)     \
+    X(Codec,       SquelchThresh700D,         FLOAT,  freedv_squelch_thresh_700d,     "",    -100, 100,     LIVE)     \
+    X(Codec,       SquelchThresh700E,         FLOAT,  freedv_squelch_thresh_700e,     "",    -100, 100,     LIVE)     \
+                                                                                                                      \
+    X(JACK,        TXPeriod700C,              INT,    jack_tx_period_700c,            "",       0, 8191,    JACK)     \
+    X(JACK,        TXPeriod700D,              INT,    jack_tx_period_700d,            "",       0, 8191,    JACK)     \
+    X(JACK,        TXPeriod700E,              INT,    jack_tx_period_700e,            "",       0, 8191,    JACK)     \
+    X(JACK,        TXPeriod800XA,             INT,    jack_tx_period_800xa,           "",       0, 8191,    JACK)     \
+    X(JACK,        TXPeriod1600,              INT,    jack_tx_period_1600,            "",       0, 8191,    JACK)     \
+    X(JACK,        TXPeriod2400B,             INT,    jack_tx_period_2400b,           "",       0, 8191,    JACK)     \
+    X(JACK,        RXPeriod700C,              INT,    jack_rx_period_700c,            "",       0, 8191,    JACK)     \
+    X(JACK,        RXPeriod700D,              INT,    jack_rx_period_700d,            "",       0, 8191,    JACK)     \
+    X(JACK,        RXPeriod700E,              INT,    jack_rx_period_700e,            "",       0, 8191,    JACK)     \
+    X(JACK,        RXPeriod800XA,             INT,    jack_rx_period_800xa,           "",       0, 8191,    JACK)     \
+    X(JACK,        RXPeriod1600,              INT,    jack_rx_period_1600,            "",       0, 8191,    JACK)     \
+    X(JACK,        RXPeriod2400B,             INT,    jack_rx_period_2400b,           "",       0, 8191,    JACK)     \
+    X(JACK,        SecureNotifyFile,          STRING, jack_secure_notify_file,        "",       0, 0,       NOTIFY)   \
+    X(JACK,        InsecureNotifyFile,        STRING, jack_insecure_notify_file,      "",       0, 0,       NOTIFY)   \
+    X(JACK,        BeepNotifyFile,            STRING, jack_beep_notify_file,          "",       0, 0,       NOTIFY)   \
+    X(JACK,        AssetCacheDir,             STRING, jack_asset_cache_dir,           "",       0, 0,       NOTIFY)   \
+    X(JACK,        VolumeFile,                STRING, jack_volume_file,               "",       0, 0,       VOLUME)   \
+    X(JACK,        RXControlSocket,           STRING, jack_rx_control_socket,         "",       0, 0,       RESTART)  \
+    X(JACK,        TXControlSocket,           STRING, jack_tx_control_socket,         "",       0, 0,       RESTART)  \
+    X(JACK,        TextNotifyCommand,         STRING, jack_text_notify_command,       "",       0, 0,       LIVE)     \
+    X(JACK,        VoiceInPort,               STRING, jack_voice_in_port,             "",       0, 0,       JACK)     \
+    X(JACK,        ModemOutPort,              STRING, jack_modem_out_port,            "",       0, 0,       JACK)     \
+    X(JACK,        ModemInPort,               STRING, jack_modem_in_port,             "",       0, 0,       JACK)     \
+    X(JACK,        VoiceOutPort,              STRING, jack_voice_out_port,            "",       0, 0,       JACK)     \
+    X(JACK,        NotifyOutPort,             STRING, jack_notify_out_port,           "",       0, 0,       JACK)     \
+    X(JACK,        KeyedState,                STRING, jack_keyed_state,               "",       0, 0,       RESTART)  \
+    X(JACK,        KeyedGuard,                INT,    jack_keyed_guard,               "50",     0, 2000,    LIVE)     \
+                                                                                                                      \
+    X(IQ,          SampleRate,                INT,    iq_sample_rate,                 "48000",  8000, 3072000, RESTART) \
+    X(IQ,          Format,                    STRING, iq_format,                      "cs16",   0, 0,       RESTART)  \
+    X(IQ,          Offset,                    INT,    iq_offset,                      "0",  -1536000, 1536000, RESTART) \
+    X(IQ,          ModemCentre,               INT,    iq_modem_centre,                "1500",   0, 96000,   RESTART)  \
+    X(IQ,          AFC,                       INT,    iq_afc,                         "1",      0, 1,       RESTART)  \
+                                                                                                                      \
+    X(Network,     TXLink,                    STRING, net_tx_link,                    "",       0, 0,       RESTART)  \
+    X(Network,     RXLink,                    STRING, net_rx_link,                    "",       0, 0,       RESTART)  \
+    X(Network,     LinkRate,                  INT,    net_link_rate,                  "8000",   8000, 48000, RESTART) \
+    X(Network,     FramesPerPacket,           INT,    net_frames_per_packet,          "2",      1, 16,      RESTART)
+
+#endif
@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <stdint.h>
+#include <math.h>
 
 #include "freedv_api.h"
 
@@ -29,6 +30,30 @@ uint64_t int_sqrt(uint64_t s)
     return x0;
 }
 
+void get_runtime_params(struct freedv* freedv, struct runtime_params* params) {
+    if (freedv != NULL) {
+        params->speech_sample_rate = freedv_get_speech_sample_rate(freedv);
+        params->modem_sample_rate = freedv_get_modem_sample_rate(freedv);
+        params->speech_samples_per_frame = freedv_get_n_speech_samples(freedv);
+        params->max_speech_samples_per_frame = freedv_get_n_max_speech_samples(freedv);
+        params->modem_samples_per_frame = freedv_get_n_nom_modem_samples(freedv);
+        params->max_modem_samples_per_frame = freedv_get_n_max_modem_samples(freedv);
+    }
+    else {
+        params->speech_sample_rate = ANALOG_SAMPLE_RATE;
+        params->modem_sample_rate = ANALOG_SAMPLE_RATE;
+        params->speech_samples_per_frame = ANALOG_SAMPLES_PER_FRAME;
+        params->max_speech_samples_per_frame = ANALOG_SAMPLES_PER_FRAME;
+        params->modem_samples_per_frame = ANALOG_SAMPLES_PER_FRAME;
+        params->max_modem_samples_per_frame = ANALOG_SAMPLES_PER_FRAME;
+    }
+
+    params->speech_frames_per_second =
+        params->speech_sample_rate / params->speech_samples_per_frame;
+    params->modem_frames_per_second =
+        params->modem_sample_rate / params->modem_samples_per_frame;
+}
+
 short rms(const short vals[], size_t len) {
     if (len > 0) {
         uint64_t total = 0;
@@ -44,6 +69,21 @@ short rms(const short vals[], size_t len) {
     }
 }
 
+short rms_float(const float vals[], size_t len) {
+    if (len > 0) {
+        double total = 0;
+        for (size_t i = 0; i < len; ++i) {
+            total += (double)vals[i] * vals[i];
+        }
+
+        const double val = sqrt(total / len) * 32768.0;
+        return val < 32767.0 ? (short)val : 32767;
+    }
+    else {
+        return 0;
+    }
+}
+
 size_t read_input_file(short* buffer, size_t buffer_elems, FILE* file){
     size_t elems_read = 0;
     do {
@@ -88,3 +128,14 @@ void configure_freedv(struct freedv* f, const struct config* cfg){
             break;
     }
 }
+
+int freedv_mode_has_text(int mode){
+    switch(mode) {
+        case FREEDV_MODE_1600:
+        case FREEDV_MODE_700D:
+        case FREEDV_MODE_700E:
+            return 1;
+        default:
+            return 0;
+    }
+}
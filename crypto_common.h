@@ -18,12 +18,39 @@ struct config;
 #define ANALOG_SAMPLES_PER_FRAME 320
 
 
+// Values derived from the config and the modem that stay fixed until the
+// config is reloaded. They are worked out once so the audio path doesn't
+// have to keep asking the modem for them
+struct runtime_params
+{
+    unsigned speech_sample_rate;
+    unsigned modem_sample_rate;
+    size_t   speech_samples_per_frame;
+    size_t   max_speech_samples_per_frame;
+    size_t   modem_samples_per_frame;
+    size_t   max_modem_samples_per_frame;
+    unsigned speech_frames_per_second;
+    unsigned modem_frames_per_second;
+};
+
+// freedv may be NULL for analog audio
+void get_runtime_params(struct freedv* freedv, struct runtime_params* params);
+
 short rms(const short vals[], size_t len);
+// RMS of +/-1.0 samples, on the same scale as rms()
+short rms_float(const float vals[], size_t len);
 
 size_t read_input_file(short* buffer, size_t buffer_elems, FILE* file);
 
 void configure_freedv(struct freedv* freedv, const struct config* cfg);
 
+// Longest message sent on the FreeDV text channel, the same limit as
+// alert broadcasts
+#define FREEDV_TEXT_MAX 160
+
+// Whether the mode carries the FreeDV text channel alongside the voice
+int freedv_mode_has_text(int mode);
+
 #ifdef __cplusplus
 }
 
@@ -0,0 +1,68 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cstring>
+#include <stdexcept>
+
+#include "freedv_api.h"
+#include "crypto_context.h"
+
+crypto_context::crypto_context(const char* name, const char* config_file)
+    : m_config_file(config_file),
+      m_key(FREEDV_MASTER_KEY_LENGTH),
+      m_key_bytes(0),
+      m_generation(0)
+{
+    memset(&m_config, 0, sizeof(m_config));
+    if (!read_config(config_file, &m_config))
+    {
+        throw std::runtime_error("Could not read the config");
+    }
+    m_key_bytes = read_key_file(m_config.key_file, m_key.data());
+
+    std::string log_file(m_config.log_file);
+    const size_t name_idx = log_file.find("{name}");
+    if (name_idx != std::string::npos)
+    {
+        log_file.replace(name_idx, 6, name);
+    }
+    m_logger = create_logger(log_file.c_str(), m_config.log_level);
+}
+
+crypto_context::~crypto_context()
+{
+    explicit_bzero(m_key.data(), m_key.size());
+    destroy_logger(m_logger);
+}
+
+bool crypto_context::reread()
+{
+    struct config next;
+    memset(&next, 0, sizeof(next));
+    if (!read_config(m_config_file.c_str(), &next))
+    {
+        log_message(m_logger, LOG_ERROR, "Could not reread the config, keeping the running one");
+        return false;
+    }
+
+    m_config = next;
+    m_key_bytes = read_key_file(m_config.key_file, m_key.data());
+    ++m_generation;
+    return true;
+}
+
+bool crypto_context::reread(unsigned seen)
+{
+    return seen != m_generation || reread();
+}
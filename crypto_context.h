@@ -0,0 +1,93 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef CRYPTO_CONTEXT_H
+#define CRYPTO_CONTEXT_H
+
+#include <string>
+#include <vector>
+
+#include "crypto_cfg.h"
+#include "crypto_log.h"
+
+// The config, key and logger read from one config file, shared by every
+// pipeline built from it, such as the transmitter and receiver of
+// jack_crypto_trx. Each pipeline keeps its own
+// running copy of the config, taken when it is built and on each reload,
+// so one can be rebuilt without the other.
+//
+// The logger may be used from any thread, the rest only from the main
+// thread
+class crypto_context
+{
+public:
+    // Reads the config and key and opens the logger, with {name} in the
+    // log file path replaced by name. Throws if the config can't be read
+    crypto_context(const char* name, const char* config_file);
+    ~crypto_context();
+
+    crypto_context(const crypto_context&) = delete;
+    crypto_context& operator=(const crypto_context&) = delete;
+
+    const char* config_file() const
+    {
+        return m_config_file.c_str();
+    }
+
+    const struct config* config() const
+    {
+        return &m_config;
+    }
+
+    // FREEDV_MASTER_KEY_LENGTH bytes, zero padded past key_bytes
+    const unsigned char* key() const
+    {
+        return m_key.data();
+    }
+
+    size_t key_bytes() const
+    {
+        return m_key_bytes;
+    }
+
+    crypto_log logger() const
+    {
+        return m_logger;
+    }
+
+    // Goes up by one with each reread that succeeds
+    unsigned generation() const
+    {
+        return m_generation;
+    }
+
+    // Rereads the config file and key. Returns false, keeping the last
+    // ones, if the config can't be read
+    bool reread();
+
+    // The same, unless they have been reread since generation seen. A
+    // pipeline passes the generation it last took, so when several are
+    // told to reload at once the files are only read once
+    bool reread(unsigned seen);
+
+private:
+    const std::string          m_config_file;
+    struct config              m_config;
+    std::vector<unsigned char> m_key;
+    size_t                     m_key_bytes;
+    crypto_log                 m_logger;
+    unsigned                   m_generation;
+};
+
+#endif
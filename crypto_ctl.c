@@ -0,0 +1,104 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define CONTROL_MSG_MAX 256
+#define REPLY_TIMEOUT_MS 1000
+
+// Sends one command to a jack_crypto_* control socket and prints the reply
+int main(int argc, char* argv[])
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s <socket> <command> [args] ...\n", argv[0]);
+        return 1;
+    }
+
+    char msg[CONTROL_MSG_MAX] = {0};
+    size_t len = 0;
+    for (int i = 2; i < argc; ++i)
+    {
+        const int written = snprintf(msg + len,
+                                     sizeof(msg) - len,
+                                     i == 2 ? "%s" : " %s",
+                                     argv[i]);
+        if (written < 0 || (size_t)written >= sizeof(msg) - len)
+        {
+            fprintf(stderr, "Command too long\n");
+            return 1;
+        }
+        len += written;
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        perror("socket");
+        return 1;
+    }
+
+    // Bind to an abstract address so the daemon has somewhere to reply to
+    struct sockaddr_un local;
+    memset(&local, 0, sizeof(local));
+    local.sun_family = AF_UNIX;
+    const int local_len = snprintf(local.sun_path + 1,
+                                   sizeof(local.sun_path) - 1,
+                                   "crypto_ctl.%d",
+                                   (int)getpid());
+    bind(fd,
+         (struct sockaddr*)&local,
+         offsetof(struct sockaddr_un, sun_path) + 1 + local_len);
+
+    struct sockaddr_un remote;
+    memset(&remote, 0, sizeof(remote));
+    remote.sun_family = AF_UNIX;
+    strncpy(remote.sun_path, argv[1], sizeof(remote.sun_path) - 1);
+
+    if (sendto(fd, msg, len, 0, (struct sockaddr*)&remote, sizeof(remote)) < 0)
+    {
+        perror(argv[1]);
+        close(fd);
+        return 1;
+    }
+
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    if (poll(&pfd, 1, REPLY_TIMEOUT_MS) <= 0)
+    {
+        fprintf(stderr, "No reply from %s\n", argv[1]);
+        close(fd);
+        return 1;
+    }
+
+    char reply[CONTROL_MSG_MAX] = {0};
+    const ssize_t reply_len = recv(fd, reply, sizeof(reply) - 1, 0);
+    close(fd);
+
+    if (reply_len <= 0)
+    {
+        return 1;
+    }
+
+    printf("%s\n", reply);
+
+    // Replies starting with "ERROR" map to a failing exit code for scripts
+    return strncmp(reply, "ERROR", 5) == 0 ? 1 : 0;
+}
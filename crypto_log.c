@@ -35,8 +35,13 @@ void log_message(crypto_log logger, int level, const char* format, ...) {
         char buf[256] = { 0 };
 
         time_t cur_time = time(NULL);
-        struct tm* local_time = localtime(&cur_time);
-        strftime(buf, sizeof(buf) - 1, "%F %X", local_time);
+        struct tm local_time;
+        localtime_r(&cur_time, &local_time);
+        strftime(buf, sizeof(buf) - 1, "%F %X", &local_time);
+
+        // One logger can be shared by several pipelines, so keep each
+        // message's pieces together
+        flockfile(logger.file);
         fprintf(logger.file, "%s ", buf);
 
         switch (level) {
@@ -67,5 +72,6 @@ void log_message(crypto_log logger, int level, const char* format, ...) {
 
         fprintf(logger.file, "\n");
         fflush(logger.file);
+        funlockfile(logger.file);
     }
 }
\ No newline at end of file
@@ -22,12 +22,17 @@
 #include <stdio.h>
 #include <errno.h>
 #include <signal.h>
+#include <string.h>
 
 #include "crypto_rx_common.h"
 #include "crypto_common.h"
 #include "crypto_cfg.h"
 #include "crypto_log.h"
 
+/* Frames demodulated per call, so reloads are looked at once per batch
+   rather than once per frame */
+#define FRAMES_PER_BATCH 50
+
 static volatile sig_atomic_t reload_config = 0;
 
 static void handle_sighup(int sig) {
@@ -39,8 +44,9 @@ int main(int argc, char *argv[]) {
     FILE* fout = stdout;
 
     HCRYPTO_RX* crypto_rx = NULL;
-    int         nin, nout;
-    
+    struct crypto_rx_frame_stats stats[FRAMES_PER_BATCH];
+    int         demod_size, speech_size, filled, nread, frames, used, nout, i;
+
     if (argc < 2) {
         fprintf(stderr, "usage: %s ConfigFile\n", argv[0]);
         exit(1);
@@ -55,17 +61,45 @@ int main(int argc, char *argv[]) {
     }
 
     /* note use of API functions to tell us how big our buffers need to be -----*/
-    
-    short* speech_out = malloc(sizeof(short) * crypto_rx_max_speech_samples_per_frame(crypto_rx));
-    short* demod_in = malloc(sizeof(short) * crypto_rx_max_modem_samples_per_frame(crypto_rx));
 
-    nin = crypto_rx_needed_modem_samples(crypto_rx);
-    while(read_input_file(demod_in, nin, fin) == nin) {
-        nout = crypto_rx_receive(crypto_rx, speech_out, demod_in);
+    demod_size = crypto_rx_max_modem_samples_per_frame(crypto_rx) * FRAMES_PER_BATCH;
+    speech_size = crypto_rx_max_speech_samples_per_frame(crypto_rx) * FRAMES_PER_BATCH;
+    short* speech_out = malloc(sizeof(short) * speech_size);
+    short* demod_in = malloc(sizeof(short) * demod_size);
+
+    /* The number of samples each frame needs varies as the modem tracks
+       timing, so read a batch worth, demodulate as many whole frames as it
+       holds and keep the rest for the next batch */
+    filled = 0;
+    do {
+        nread = read_input_file(demod_in + filled, demod_size - filled, fin);
+        filled += nread;
+
+        frames = crypto_rx_receive_frames(crypto_rx,
+                                          speech_out,
+                                          speech_size,
+                                          demod_in,
+                                          filled,
+                                          stats,
+                                          FRAMES_PER_BATCH);
+        if (frames < 0) {
+            fprintf(stderr, "Could not demodulate frames");
+            exit(1);
+        }
+
+        used = 0;
+        nout = 0;
+        for (i = 0; i < frames; i++) {
+            used += stats[i].modem_samples;
+            nout += stats[i].speech_samples;
+        }
 
         fwrite(speech_out, sizeof(short) * nout, 1, fout);
         fflush(fout);
 
+        filled -= used;
+        memmove(demod_in, demod_in + used, sizeof(short) * filled);
+
         if (reload_config != 0) {
             reload_config = 0;
 
@@ -76,15 +110,18 @@ int main(int argc, char *argv[]) {
                 exit(1);
             }
 
-            speech_out = realloc(speech_out, sizeof(short) * crypto_rx_max_speech_samples_per_frame(crypto_rx));
-            demod_in = realloc(demod_in, sizeof(short) * crypto_rx_max_modem_samples_per_frame(crypto_rx));
+            demod_size = crypto_rx_max_modem_samples_per_frame(crypto_rx) * FRAMES_PER_BATCH;
+            speech_size = crypto_rx_max_speech_samples_per_frame(crypto_rx) * FRAMES_PER_BATCH;
+            if (filled > demod_size) {
+                filled = demod_size;
+            }
+            speech_out = realloc(speech_out, sizeof(short) * speech_size);
+            demod_in = realloc(demod_in, sizeof(short) * demod_size);
         }
-
-        /* IMPORTANT: don't forget to do this in the while loop to
-           ensure we fread the correct number of samples: ie update
-           "nin" before every call to freedv_rx()/freedv_comprx() */
-        nin = crypto_rx_needed_modem_samples(crypto_rx);
     }
+    /* Carry on until the input runs out and nothing more can be done with
+       what is left of it */
+    while (nread > 0 || frames > 0);
 
     free(speech_out);
     free(demod_in);
@@ -94,4 +131,3 @@ int main(int argc, char *argv[]) {
 
     return 0;
 }
-
@@ -18,65 +18,125 @@
   along with this program; if not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <cstdio>
 #include <cstring>
 #include <cmath>
 #include <climits>
 #include <string>
 #include <memory>
+#include <vector>
 #include <stdexcept>
 
 #include "freedv_api.h"
+#include "codec2.h"
 #include "crypto_cfg.h"
 #include "crypto_log.h"
+#include "crypto_context.h"
 
 #include "crypto_common.h"
+#include "payload_log.h"
+#include "spsc_queue.h"
+#include "simd.h"
 #include "crypto_rx_common.h"
 
 using namespace std;
 
+// A reloaded config on its way to the audio thread
+struct rx_config_update
+{
+    struct config cfg;
+    unsigned      changes;
+    bool          set_key;
+    unsigned char key[FREEDV_MASTER_KEY_LENGTH];
+};
+
+// A complete message from the FreeDV text channel
+struct rx_text
+{
+    char text[FREEDV_TEXT_MAX + 1];
+};
+
 struct crypto_rx_common::rx_parms
 {
-    rx_parms(const char* cfg)
-        : config_file(cfg)
+    rx_parms(shared_ptr<crypto_context> ctx, bool own)
+        : context(std::move(ctx)),
+          own_context(own),
+          logger(context->logger())
     {
-        memset(&logger, 0, sizeof(logger));
     }
     ~rx_parms()
     {
         if (cur != nullptr) free(cur);
         if (freedv != nullptr) freedv_close(freedv);
-        destroy_logger(logger);
     }
 
-    const string      config_file;
+    // The logger belongs to the context, which may be shared with a
+    // transmitter. A context of our own is reread by check_reload
+    const shared_ptr<crypto_context> context;
+    const bool        own_context;
+    crypto_log        logger;
     struct config*    cur = nullptr;
     struct freedv*    freedv = nullptr;
-    crypto_log        logger;
     encryption_status crypto_status = CRYPTO_STATUS_PLAIN;
+    runtime_params    params;
     bool              modem_has_signal = false;
     int               modem_flush_frames = 0;
+
+    // The audio thread's copy of the config and the one read by
+    // check_reload. Reloads reach the audio thread through updates
+    struct config     live;
+    struct config     next;
+    unsigned char     key[FREEDV_MASTER_KEY_LENGTH] = {0};
+    unsigned char     next_key[FREEDV_MASTER_KEY_LENGTH] = {0};
+    size_t            key_bytes = 0;
+    size_t            next_key_bytes = 0;
+
+    spsc_queue<rx_config_update, 4> updates;
+
+    // The message being received is only touched by the audio thread
+    spsc_queue<rx_text, 4> texts;
+    rx_text           text = {};
+    size_t            text_len = 0;
+    bool              text_overflow = false;
+
+    // Scratch space for the float and complex receive
+    vector<float>     float_in;
+    vector<short>     short_in;
+    vector<COMP>      comp_in;
+
+    unique_ptr<MODEM_STATS> stats;
+
+    // Only set up when payload logging is enabled
+    unique_ptr<payload_log> payload;
+    vector<unsigned char>   codec_bits;
 };
 
 crypto_rx_common::~crypto_rx_common() {}
 
 crypto_rx_common::crypto_rx_common(const char* name, const char* config_file)
-    : m_parms(new rx_parms(config_file))
+    : crypto_rx_common(name, std::make_shared<crypto_context>(name, config_file), true)
 {
-    unsigned char  key[FREEDV_MASTER_KEY_LENGTH];
-    unsigned char  iv[IV_LEN];
+}
 
-    m_parms->cur = static_cast<struct config*>(calloc(1, sizeof(struct config)));
-    read_config(config_file, m_parms->cur);
+crypto_rx_common::crypto_rx_common(const char* name, std::shared_ptr<crypto_context> context)
+    : crypto_rx_common(name, std::move(context), false)
+{
+}
 
-    string config_file_name(m_parms->cur->log_file);
-    size_t name_idx = config_file_name.find("{name}");
-    if (name_idx != string::npos)
-    {
-        config_file_name.replace(name_idx, 6, name);
-    }
+crypto_rx_common::crypto_rx_common(const char*                     name,
+                                   std::shared_ptr<crypto_context> context,
+                                   bool                            own_context)
+    : m_parms(new rx_parms(std::move(context), own_context))
+{
+    const crypto_context& ctx = *m_parms->context;
+    unsigned char* const key = m_parms->key;
+    unsigned char  iv[IV_LEN] = {0};
 
-    m_parms->logger = create_logger(config_file_name.c_str(),
-                                    m_parms->cur->log_level);
+    m_parms->cur = static_cast<struct config*>(calloc(1, sizeof(struct config)));
+    *m_parms->cur = *ctx.config();
+    m_parms->live = *m_parms->cur;
+    memcpy(key, ctx.key(), sizeof(m_parms->key));
+    m_parms->key_bytes = ctx.key_bytes();
 
     if (m_parms->cur->freedv_enabled != 0)
     {
@@ -88,7 +148,7 @@ crypto_rx_common::crypto_rx_common(const char* name, const char* config_file)
 
     if (m_parms->freedv != nullptr)
     {
-        size_t key_bytes_read = read_key_file(m_parms->cur->key_file, key);
+        const size_t key_bytes_read = m_parms->key_bytes;
         if (str_has_value(m_parms->cur->key_file) &&
             key_bytes_read != FREEDV_MASTER_KEY_LENGTH) {
             log_message(m_parms->logger,
@@ -109,66 +169,166 @@ crypto_rx_common::crypto_rx_common(const char* name, const char* config_file)
         }
 
         configure_freedv(m_parms->freedv, m_parms->cur);
+        freedv_set_callback_txt(m_parms->freedv, put_text_char, nullptr, m_parms.get());
+
+        if (str_has_value(m_parms->cur->payload_log_dir))
+        {
+            open_payload_log(name);
+        }
     }
     else
     {
         m_parms->crypto_status = CRYPTO_STATUS_PLAIN;
     }
 
+    ::get_runtime_params(m_parms->freedv, &m_parms->params);
+    m_parms->float_in.resize(m_parms->params.max_modem_samples_per_frame);
+    m_parms->short_in.resize(m_parms->params.max_modem_samples_per_frame);
+    m_parms->comp_in.resize(m_parms->params.max_modem_samples_per_frame);
     m_parms->modem_flush_frames = m_parms->cur->modem_num_quiet_flush_frames;
 }
 
-bool crypto_rx_common::using_freedv() const
+unsigned crypto_rx_common::check_reload()
 {
-    return m_parms->freedv != nullptr;
-}
+    const crypto_context& ctx = *m_parms->context;
+    if (m_parms->own_context && !m_parms->context->reread())
+    {
+        return 0;
+    }
 
-size_t crypto_rx_common::max_speech_samples_per_frame() const
-{
-    if (using_freedv())
+    struct config* const next = &m_parms->next;
+    *next = *ctx.config();
+    unsigned changes = config_diff(m_parms->cur, next);
+
+    // A key can be loaded into the same slot without the config changing
+    memcpy(m_parms->next_key, ctx.key(), sizeof(m_parms->next_key));
+    m_parms->next_key_bytes = ctx.key_bytes();
+    if (m_parms->next_key_bytes != m_parms->key_bytes ||
+        memcmp(m_parms->next_key, m_parms->key, sizeof(m_parms->key)) != 0)
     {
-        return freedv_get_n_max_speech_samples(m_parms->freedv);
+        changes |= CONFIG_CHANGE_KEY;
     }
-    else
+
+    // FreeDV can't turn decryption back off once it has a key
+    const bool next_encrypted = str_has_value(next->key_file) && next->crypto_enabled;
+    if ((changes & CONFIG_CHANGE_KEY) &&
+        m_parms->crypto_status != CRYPTO_STATUS_PLAIN &&
+        !next_encrypted)
     {
-        return ANALOG_SAMPLES_PER_FRAME;
+        changes |= CONFIG_CHANGE_CODEC;
     }
+
+    return changes;
 }
 
-size_t crypto_rx_common::speech_samples_per_frame() const
+bool crypto_rx_common::apply_reload(unsigned changes)
 {
-    if (using_freedv())
+    rx_config_update* const update = m_parms->updates.begin_push();
+    if (update == nullptr)
     {
-        return static_cast<size_t>(freedv_get_n_speech_samples(m_parms->freedv));
+        log_message(m_parms->logger, LOG_WARN, "Audio thread hasn't taken the last config yet");
+        return false;
     }
-    else
+
+    struct config* const next = &m_parms->next;
+    update->cfg = *next;
+    update->changes = changes;
+    update->set_key = false;
+
+    if (using_freedv() && (changes & CONFIG_CHANGE_KEY))
     {
-        return ANALOG_SAMPLES_PER_FRAME;
+        if (str_has_value(next->key_file) && next->crypto_enabled)
+        {
+            update->set_key = true;
+            memcpy(update->key, m_parms->next_key, sizeof(update->key));
+            m_parms->crypto_status = m_parms->next_key_bytes == FREEDV_MASTER_KEY_LENGTH ?
+                CRYPTO_STATUS_ENCRYPTED : CRYPTO_STATUS_WEAK_KEY;
+            log_message(m_parms->logger, LOG_INFO, "Decryption key changed");
+        }
+        else
+        {
+            m_parms->crypto_status = CRYPTO_STATUS_PLAIN;
+        }
     }
+
+    memcpy(m_parms->key, m_parms->next_key, sizeof(m_parms->key));
+    m_parms->key_bytes = m_parms->next_key_bytes;
+    *m_parms->cur = *next;
+
+    m_parms->updates.end_push();
+    return true;
 }
 
-size_t crypto_rx_common::max_modem_samples_per_frame() const
+// Runs on the audio thread
+void crypto_rx_common::take_updates()
 {
-    if (using_freedv())
-    {
-        return freedv_get_n_max_modem_samples(m_parms->freedv);
-    }
-    else
+    for (rx_config_update* update = m_parms->updates.front();
+         update != nullptr;
+         update = m_parms->updates.front())
     {
-        return ANALOG_SAMPLES_PER_FRAME;
+        m_parms->live = update->cfg;
+        if (using_freedv())
+        {
+            if (update->set_key)
+            {
+                unsigned char iv[IV_LEN] = {0};
+                freedv_set_crypto(m_parms->freedv, update->key, iv);
+            }
+            if (update->changes & CONFIG_CHANGE_LIVE)
+            {
+                configure_freedv(m_parms->freedv, &m_parms->live);
+            }
+        }
+        m_parms->updates.pop_front();
     }
 }
 
-size_t crypto_rx_common::modem_samples_per_frame() const
+void crypto_rx_common::open_payload_log(const char* name)
 {
-    if (using_freedv())
+    const size_t codec_bytes =
+        (freedv_get_bits_per_modem_frame(m_parms->freedv) + 7) / 8;
+    if (codec_bytes > payload_log::MAX_PAYLOAD_BYTES)
     {
-        return static_cast<size_t>(freedv_get_n_nom_modem_samples(m_parms->freedv));
+        log_message(m_parms->logger, LOG_WARN, "Payload logging not supported in this mode");
+        return;
     }
-    else
+
+    m_parms->payload.reset(new payload_log());
+    if (!m_parms->payload->open(m_parms->cur->payload_log_dir,
+                                name,
+                                m_parms->cur->freedv_mode))
     {
-        return ANALOG_SAMPLES_PER_FRAME;
+        log_message(m_parms->logger, LOG_WARN, "Could not open payload log");
+        m_parms->payload = nullptr;
+        return;
     }
+
+    m_parms->codec_bits.resize(codec_bytes);
+}
+
+bool crypto_rx_common::using_freedv() const
+{
+    return m_parms->freedv != nullptr;
+}
+
+size_t crypto_rx_common::max_speech_samples_per_frame() const
+{
+    return m_parms->params.max_speech_samples_per_frame;
+}
+
+size_t crypto_rx_common::speech_samples_per_frame() const
+{
+    return m_parms->params.speech_samples_per_frame;
+}
+
+size_t crypto_rx_common::max_modem_samples_per_frame() const
+{
+    return m_parms->params.max_modem_samples_per_frame;
+}
+
+size_t crypto_rx_common::modem_samples_per_frame() const
+{
+    return m_parms->params.modem_samples_per_frame;
 }
 
 size_t crypto_rx_common::needed_modem_samples() const
@@ -202,52 +362,311 @@ encryption_status crypto_rx_common::get_encryption_status() const
 
 uint crypto_rx_common::speech_sample_rate() const
 {
-    if (using_freedv())
+    return m_parms->params.speech_sample_rate;
+}
+
+uint crypto_rx_common::modem_sample_rate() const
+{
+    return m_parms->params.modem_sample_rate;
+}
+
+const runtime_params& crypto_rx_common::get_runtime_params() const
+{
+    return m_parms->params;
+}
+
+const struct config* crypto_rx_common::get_config() const
+{
+    return m_parms->cur;
+}
+
+void crypto_rx_common::log_to_logger(int level, const char* msg)
+{
+    log_message(m_parms->logger, level, "%s", msg);
+}
+
+int crypto_rx_common::modem_frames_per_second() const
+{
+    return m_parms->params.modem_frames_per_second;
+}
+
+// Same as freedv_rx, except that when payload logging is enabled the codec
+// bits are pulled out of the modem first so they can be logged, and then
+// decoded here
+size_t crypto_rx_common::demodulate(short* speech_out, const short* demod_in)
+{
+    struct freedv* const freedv = m_parms->freedv;
+    if (!m_parms->payload)
     {
-        return freedv_get_speech_sample_rate(m_parms->freedv);
+        return freedv_rx(freedv, speech_out, const_cast<short*>(demod_in));
     }
-    else
+
+    unsigned char* const bits = m_parms->codec_bits.data();
+    const int nbytes = freedv_codecrx(freedv, bits, const_cast<short*>(demod_in));
+    if (nbytes <= 0)
     {
-        return ANALOG_SAMPLE_RATE;
+        const size_t nout = freedv_get_n_speech_samples(freedv);
+        zeroize_frames(speech_out, nout);
+        return nout;
     }
+
+    const size_t nout = decode_payload(freedv, bits, nbytes, speech_out);
+
+    int sync = 0;
+    float snr_est = 0.0;
+    freedv_get_modem_stats(freedv, &sync, &snr_est);
+    m_parms->payload->write(sync != 0, snr_est, bits, nbytes);
+
+    return nout;
 }
 
-uint crypto_rx_common::modem_sample_rate() const
+// FreeDV's float demodulator takes samples on the same scale as shorts
+size_t crypto_rx_common::demodulate(short* speech_out, const float* demod_in)
+{
+    const size_t nin = needed_modem_samples();
+
+    // Only the short entry point gives back the codec bits for the log
+    if (m_parms->payload)
+    {
+        short* const in = m_parms->short_in.data();
+        simd_float_to_short(in, demod_in, nin, SHORT_SAMPLE_SCALE);
+        return demodulate(speech_out, in);
+    }
+
+    float* const in = m_parms->float_in.data();
+    memcpy(in, demod_in, nin * sizeof(float));
+    simd_scale(in, nin, SHORT_SAMPLE_SCALE);
+    return freedv_floatrx(m_parms->freedv, speech_out, in);
+}
+
+// The real part of a complex signal is the audio a radio would have given,
+// which is what the squelch thresholds and the analog path are set for
+static void real_part(float* out, const iq_sample* in, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        out[i] = in[i].i;
+    }
+}
+
+size_t crypto_rx_common::demodulate(short* speech_out, const iq_sample* demod_in)
+{
+    const size_t nin = needed_modem_samples();
+
+    // 2400B's FM demodulator only takes real samples, and only the short
+    // entry point gives back the codec bits for the log. So with payload
+    // logging on an I/Q input is demodulated from its real part alone, as
+    // a radio's audio would be: the image half of the spectrum isn't
+    // rejected, so its noise folds in and costs up to 3 dB of SNR. Leave
+    // logging off on an SDR receiver that is short of signal
+    if (m_parms->payload || m_parms->live.freedv_mode == FREEDV_MODE_2400B)
+    {
+        float real[nin];
+        real_part(real, demod_in, nin);
+        return demodulate(speech_out, static_cast<const float*>(real));
+    }
+
+    COMP* const in = m_parms->comp_in.data();
+    static_assert(sizeof(COMP) == sizeof(iq_sample), "COMP and iq_sample differ");
+    memcpy(in, demod_in, nin * sizeof(COMP));
+    simd_scale(reinterpret_cast<float*>(in), nin * 2, SHORT_SAMPLE_SCALE);
+    return freedv_comprx(m_parms->freedv, speech_out, in);
+}
+
+void crypto_rx_common::resync()
 {
     if (using_freedv())
     {
-        return freedv_get_modem_sample_rate(m_parms->freedv);
+        freedv_set_sync(m_parms->freedv, FREEDV_SYNC_UNSYNC);
     }
-    else
+    m_parms->modem_has_signal = false;
+    m_parms->modem_flush_frames = m_parms->live.modem_num_quiet_flush_frames + 1;
+}
+
+float crypto_rx_common::frequency_offset()
+{
+    if (!using_freedv() || !is_synced())
+    {
+        return 0.0f;
+    }
+
+    if (!m_parms->stats)
     {
-        return ANALOG_SAMPLE_RATE;
+        m_parms->stats.reset(new MODEM_STATS());
     }
+    freedv_get_modem_extended_stats(m_parms->freedv, m_parms->stats.get());
+    return m_parms->stats->foff;
 }
 
-const struct config* crypto_rx_common::get_config() const
+static short sample_rms(const short* demod_in, size_t nin)
 {
-    return m_parms->cur;
+    return rms(demod_in, nin);
 }
 
-void crypto_rx_common::log_to_logger(int level, const char* msg)
+static short sample_rms(const float* demod_in, size_t nin)
 {
-    log_message(m_parms->logger, level, "%s", msg);
+    return rms_float(demod_in, nin);
 }
 
-int crypto_rx_common::modem_frames_per_second() const
+static short sample_rms(const iq_sample* demod_in, size_t nin)
+{
+    float real[nin];
+    real_part(real, demod_in, nin);
+    return rms_float(real, nin);
+}
+
+static void copy_analog(short* speech_out, const short* demod_in, size_t nin)
+{
+    memcpy(speech_out, demod_in, nin * sizeof(short));
+}
+
+static void copy_analog(short* speech_out, const float* demod_in, size_t nin)
+{
+    simd_float_to_short(speech_out, demod_in, nin, SHORT_SAMPLE_SCALE);
+}
+
+static void copy_analog(short* speech_out, const iq_sample* demod_in, size_t nin)
+{
+    float real[nin];
+    real_part(real, demod_in, nin);
+    simd_float_to_short(speech_out, real, nin, SHORT_SAMPLE_SCALE);
+}
+
+// Called by freedv_rx for each character decoded from the text channel.
+// Messages end with a carriage return. Anything unprintable, like the NULs
+// sent between messages, is dropped, and so is a message too long to be
+// one of ours. On an encrypted net the text is dropped as it arrives: it
+// goes out in the clear, so anyone on frequency could inject it
+void crypto_rx_common::put_text_char(void* state, char c)
+{
+    rx_parms* const parms = static_cast<rx_parms*>(state);
+
+    if (str_has_value(parms->live.key_file) && parms->live.crypto_enabled)
+    {
+        parms->text_len = 0;
+        parms->text_overflow = false;
+        return;
+    }
+
+    if (c == '\r' || c == '\n')
+    {
+        if (parms->text_len > 0 && !parms->text_overflow)
+        {
+            rx_text* const msg = parms->texts.begin_push();
+            if (msg != nullptr)
+            {
+                memcpy(msg->text, parms->text.text, parms->text_len);
+                msg->text[parms->text_len] = '\0';
+                parms->texts.end_push();
+            }
+        }
+        parms->text_len = 0;
+        parms->text_overflow = false;
+    }
+    else if (c >= ' ' && c <= '~')
+    {
+        if (parms->text_len < FREEDV_TEXT_MAX)
+        {
+            parms->text.text[parms->text_len++] = c;
+        }
+        else
+        {
+            parms->text_overflow = true;
+        }
+    }
+}
+
+bool crypto_rx_common::take_text(char* buffer, size_t buffer_size)
 {
-    return modem_sample_rate() / modem_samples_per_frame();
+    // Also drops anything queued before decryption was turned on
+    if (m_parms->crypto_status != CRYPTO_STATUS_PLAIN)
+    {
+        while (m_parms->texts.front() != nullptr)
+        {
+            m_parms->texts.pop_front();
+        }
+        return false;
+    }
+
+    const rx_text* const msg = m_parms->texts.front();
+    if (msg == nullptr)
+    {
+        return false;
+    }
+
+    snprintf(buffer, buffer_size, "%s", msg->text);
+    m_parms->texts.pop_front();
+    return true;
 }
 
 size_t crypto_rx_common::receive(short* speech_out, const short* demod_in)
 {
+    take_updates();
+    return receive_frame(speech_out, demod_in, nullptr);
+}
+
+size_t crypto_rx_common::receive(short* speech_out, const float* demod_in)
+{
+    take_updates();
+    return receive_frame(speech_out, demod_in, nullptr);
+}
+
+size_t crypto_rx_common::receive(short* speech_out, const iq_sample* demod_in)
+{
+    take_updates();
+    return receive_frame(speech_out, demod_in, nullptr);
+}
+
+size_t crypto_rx_common::receive_frames(short*                 speech_out,
+                                        size_t                 speech_out_size,
+                                        const short*           demod_in,
+                                        size_t                 num_samples,
+                                        crypto_rx_frame_stats* stats,
+                                        size_t                 max_frames)
+{
+    take_updates();
+
+    const size_t max_speech = max_speech_samples_per_frame();
+    size_t frames = 0;
+    size_t used = 0;
+    size_t written = 0;
+
+    while (frames < max_frames)
+    {
+        // nin changes from frame to frame as the modem tracks timing, so
+        // stop as soon as the next frame might not fit either way
+        const size_t nin = needed_modem_samples();
+        if (nin > num_samples - used || max_speech > speech_out_size - written)
+        {
+            break;
+        }
+
+        crypto_rx_frame_stats* const frame_stats =
+            stats != nullptr ? &stats[frames] : nullptr;
+        written += receive_frame(speech_out + written, demod_in + used, frame_stats);
+        used += nin;
+        ++frames;
+    }
+
+    return frames;
+}
+
+template<class Sample>
+size_t crypto_rx_common::receive_frame(short*                 speech_out,
+                                       const Sample*          demod_in,
+                                       crypto_rx_frame_stats* stats)
+{
+    const struct config* const cfg = &m_parms->live;
     const int nin = needed_modem_samples();
     size_t nout = 0;
+    short modem_rms = 0;
+    int sync = 0;
+    float snr_est = 0.0;
 
     if (using_freedv())
     {
         // Only do the modem squelch when using digital
-        const short modem_rms = rms(demod_in, nin);
+        modem_rms = sample_rms(demod_in, nin);
 
         // RMS-based modem squelch with hysteresis. The built in squelch
         // in FreeDV (especially with the 2400B mode) can sometimes fail at very
@@ -259,11 +678,11 @@ size_t crypto_rx_common::receive(short* speech_out, const short* demod_in)
         {
             m_parms->modem_has_signal = true;
         }
-        else if (modem_rms < m_parms->cur->modem_quiet_max_thresh)
+        else if (modem_rms < cfg->modem_quiet_max_thresh)
         {
             m_parms->modem_has_signal = false;
         }
-        else if (modem_rms >= m_parms->cur->modem_signal_min_thresh)
+        else if (modem_rms >= cfg->modem_signal_min_thresh)
         {
             m_parms->modem_has_signal = true;
         }
@@ -273,7 +692,7 @@ size_t crypto_rx_common::receive(short* speech_out, const short* demod_in)
             m_parms->modem_flush_frames = 0;
         }
         else if (m_parms->modem_flush_frames <=
-                 m_parms->cur->modem_num_quiet_flush_frames)
+                 cfg->modem_num_quiet_flush_frames)
         {
             ++m_parms->modem_flush_frames;
         }
@@ -281,17 +700,16 @@ size_t crypto_rx_common::receive(short* speech_out, const short* demod_in)
         // Only call freedv_rx if there is signal or for the first few
         // "silent" frames to flush out the system
         if (m_parms->modem_has_signal == true ||
-            m_parms->modem_flush_frames <= m_parms->cur->modem_num_quiet_flush_frames)
+            m_parms->modem_flush_frames <= cfg->modem_num_quiet_flush_frames)
         {
-            nout = freedv_rx(m_parms->freedv, speech_out, const_cast<short*>(demod_in));
+            nout = demodulate(speech_out, demod_in);
             if (m_parms->modem_has_signal == false && nout > 0)
             {
                 // If we are flushing frames, Call freedv_rx but discard the output
                 zeroize_frames(speech_out, nout);
             }
 
-            float snr_est = 0.0;
-            freedv_get_modem_stats(m_parms->freedv, nullptr, &snr_est);
+            freedv_get_modem_stats(m_parms->freedv, &sync, &snr_est);
             log_message(m_parms->logger,
                         LOG_DEBUG,
                         "nout: %u, SNR est.: %f, modem RMS: %d",
@@ -311,10 +729,19 @@ size_t crypto_rx_common::receive(short* speech_out, const short* demod_in)
     }
     else
     {
-        memcpy(speech_out, demod_in, nin * sizeof(short));
+        copy_analog(speech_out, demod_in, nin);
         nout = nin;
     }
 
+    if (stats != nullptr)
+    {
+        stats->modem_samples = nin;
+        stats->speech_samples = nout;
+        stats->sync = sync;
+        stats->snr_est = snr_est;
+        stats->modem_rms = modem_rms;
+    }
+
     return nout;
 }
 
@@ -364,3 +791,31 @@ int crypto_rx_receive(HCRYPTO_RX* hnd, short* speech_out, const short* demod_in)
 {
     return reinterpret_cast<crypto_rx_common*>(hnd)->receive(speech_out, demod_in);
 }
+
+int crypto_rx_receive_frames(HCRYPTO_RX*                   hnd,
+                             short*                        speech_out,
+                             int                           speech_out_size,
+                             const short*                  demod_in,
+                             int                           num_samples,
+                             struct crypto_rx_frame_stats* stats,
+                             int                           max_frames)
+{
+    if (speech_out_size < 0 || num_samples < 0 || max_frames < 0)
+    {
+        return -1;
+    }
+
+    try
+    {
+        return reinterpret_cast<crypto_rx_common*>(hnd)->receive_frames(speech_out,
+                                                                         speech_out_size,
+                                                                         demod_in,
+                                                                         num_samples,
+                                                                         stats,
+                                                                         max_frames);
+    }
+    catch (...)
+    {
+        return -1;
+    }
+}
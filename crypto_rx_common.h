@@ -1,7 +1,29 @@
 #ifndef CRYPTO_RX_COMMON_H
 #define CRYPTO_RX_COMMON_H
 
+#include <sys/types.h>
+
 struct config;
+struct runtime_params;
+
+// What happened to each frame of a batch. The modem_samples of consecutive
+// frames give where each one started in the input, and likewise
+// speech_samples in the output
+struct crypto_rx_frame_stats
+{
+    int modem_samples;   // Consumed from demod_in by this frame
+    int speech_samples;  // Written to speech_out by this frame
+    int sync;            // Modem was in sync after this frame
+    float snr_est;       // Modem's SNR estimate in dB, 0 when squelched
+    int modem_rms;       // RMS of this frame's modem samples
+};
+
+// One complex modem sample, laid out the same as FreeDV's COMP
+struct iq_sample
+{
+    float i;
+    float q;
+};
 
 #ifdef __cplusplus
 
@@ -14,10 +36,16 @@ enum encryption_status
     CRYPTO_STATUS_ENCRYPTED
 };
 
+class crypto_context;
+
 class crypto_rx_common
 {
 public:
+    // Reads a config of its own, which check_reload rereads
     crypto_rx_common(const char* name, const char* config_file_path);
+    // Shares the config, key and logger with other pipelines. Whoever owns
+    // the context rereads it before calling check_reload
+    crypto_rx_common(const char* name, std::shared_ptr<crypto_context> context);
     ~crypto_rx_common();
 
     size_t max_speech_samples_per_frame() const;
@@ -33,18 +61,82 @@ public:
     uint speech_sample_rate() const;
     uint modem_sample_rate() const;
 
+    const struct runtime_params& get_runtime_params() const;
     const struct config* get_config() const;
 
     void log_to_logger(int level, const char* msg);
 
+    // Takes the config and key from the context, rereading them first if
+    // the context is our own, and returns the CONFIG_CHANGE_* flags for
+    // everything that differs from the running config. Nothing changes
+    // until apply_reload is called
+    unsigned check_reload();
+
+    // Makes the config read by check_reload current. Key and LIVE changes
+    // reach the modem on the next call to receive. Anything needing
+    // CONFIG_CHANGE_CODEC needs a new crypto_rx_common instead. Returns
+    // false if the audio thread is too far behind to take it
+    bool apply_reload(unsigned changes);
+
     size_t receive(short* speech_out, const short* demod_in);
 
+    // The same with the modem samples as +/-1.0 floats, handed to FreeDV's
+    // float demodulator without being rounded to shorts first
+    size_t receive(short* speech_out, const float* demod_in);
+
+    // The same with the modem signal as complex +/-1.0 samples, centred
+    // where the mode's real signal would be (see iq_ddc.h). Modes with a
+    // complex demodulator get them through freedv_comprx, the rest get the
+    // real part
+    size_t receive(short* speech_out, const iq_sample* demod_in);
+
+    // Drops the modem's sync and treats the input as quiet until signal
+    // shows up again, so nothing heard before a gap in the input, such as
+    // while the radio was transmitting, carries over into what follows it.
+    // Called from the thread calling receive
+    void resync();
+
+    // How far the modem reckons the signal is off frequency, in Hz, or 0
+    // if it isn't synced. Called from the thread calling receive
+    float frequency_offset();
+
+    // Demodulates as many whole frames of demod_in as fit in both buffers,
+    // up to max_frames, picking up reloads once for the whole batch. Speech
+    // from each frame follows on from the last in speech_out. Returns the
+    // number of frames done, whose stats, if not null, are filled in
+    size_t receive_frames(short*                 speech_out,
+                          size_t                 speech_out_size,
+                          const short*           demod_in,
+                          size_t                 num_samples,
+                          crypto_rx_frame_stats* stats,
+                          size_t                 max_frames);
+
+    // Takes the oldest complete message received on the FreeDV text
+    // channel, if any. Called from any one thread other than the audio
+    // thread. The text channel isn't encrypted or authenticated, so
+    // nothing is returned while decryption is on
+    bool take_text(char* buffer, size_t buffer_size);
+
 private:
     struct rx_parms;
 
 private:
+    crypto_rx_common(const char*                     name,
+                     std::shared_ptr<crypto_context> context,
+                     bool                            own_context);
+
     int modem_frames_per_second() const;
     bool using_freedv() const;
+    void open_payload_log(const char* name);
+    size_t demodulate(short* speech_out, const short* demod_in);
+    size_t demodulate(short* speech_out, const float* demod_in);
+    size_t demodulate(short* speech_out, const iq_sample* demod_in);
+    template<class Sample>
+    size_t receive_frame(short*                 speech_out,
+                         const Sample*          demod_in,
+                         crypto_rx_frame_stats* stats);
+    void take_updates();
+    static void put_text_char(void* state, char c);
 
 private:
     const std::unique_ptr<rx_parms> m_parms;
@@ -71,6 +163,18 @@ void crypto_rx_log_to_logger(HCRYPTO_RX* hnd, int level, const char* msg);
 
 int crypto_rx_receive(HCRYPTO_RX* hnd, short* speech_out, const short* demod_in);
 
+// Demodulates up to max_frames frames from num_samples samples of demod_in
+// in one call. Returns the number of frames done, or -1. stats, if not
+// NULL, needs room for max_frames entries and says how much input each
+// frame consumed, so the caller can keep any leftover samples for next time
+int crypto_rx_receive_frames(HCRYPTO_RX*                   hnd,
+                             short*                        speech_out,
+                             int                           speech_out_size,
+                             const short*                  demod_in,
+                             int                           num_samples,
+                             struct crypto_rx_frame_stats* stats,
+                             int                           max_frames);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -0,0 +1,287 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+// crypto_rx for SDRs. Reads complex baseband from stdin, which can be a
+// recorded IQ file or a pipe from the SDR's own tools, or from a UDP port,
+// takes one channel out of it (see iq_ddc.h) and writes the decoded speech
+// to stdout as crypto_rx does. The [IQ] settings say what the input is.
+//
+// With -b it instead times the down-converter and demodulator on noise at
+// the common SDR rates and prints the CPU each takes per channel.
+//
+// usage: crypto_rx_iq [-u <port>] [-b <seconds>] <ConfigFile>
+
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+#include <stdexcept>
+
+#include "crypto_cfg.h"
+#include "crypto_log.h"
+#include "crypto_rx_common.h"
+#include "iq_ddc.h"
+#include "iq_input.h"
+
+// Input samples read at a time
+static const size_t READ_SAMPLES = 4096;
+// Rates timed by -b
+static const unsigned BENCH_RATES[] = { 48000, 96000, 192000 };
+
+static volatile sig_atomic_t reload_config = 0;
+
+static void handle_sighup(int sig)
+{
+    reload_config = 1;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-u <port>] [-b <seconds>] <ConfigFile>\n", name);
+}
+
+static double thread_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
+
+// One channel of IQ in, speech out
+class iq_receiver
+{
+public:
+    explicit iq_receiver(const char* config_file)
+        : m_rx(new crypto_rx_common("crypto_rx_iq", config_file)),
+          m_modem_fill(0)
+    {
+        const struct config* cfg = m_rx->get_config();
+        if (!parse_iq_format(cfg->iq_format, &m_format))
+        {
+            throw std::runtime_error("Unknown IQ format");
+        }
+        if (!m_ddc.configure(cfg->iq_sample_rate,
+                             m_rx->modem_sample_rate(),
+                             cfg->iq_offset,
+                             cfg->iq_modem_centre))
+        {
+            throw std::runtime_error("IQ sample rate is not a multiple of the modem sample rate");
+        }
+
+        m_modem.resize((READ_SAMPLES / m_ddc.decimation()) + 1 +
+                       m_rx->max_modem_samples_per_frame());
+        m_speech.resize(m_rx->max_speech_samples_per_frame());
+    }
+
+    iq_format format() const
+    {
+        return m_format;
+    }
+
+    // Down-converts count interleaved samples
+    void convert(const float* iq, size_t count)
+    {
+        m_modem_fill += m_ddc.process(iq, count, m_modem.data() + m_modem_fill);
+    }
+
+    // Demodulates every whole frame converted so far, writing the speech
+    // to fout
+    void demodulate(FILE* fout)
+    {
+        const struct config* cfg = m_rx->get_config();
+        size_t used = 0;
+
+        size_t nin = m_rx->needed_modem_samples();
+        while (m_modem_fill - used >= nin)
+        {
+            const size_t nout = m_rx->receive(m_speech.data(), m_modem.data() + used);
+            fwrite(m_speech.data(), sizeof(short), nout, fout);
+            used += nin;
+
+            if (cfg->iq_afc)
+            {
+                follow(m_rx->frequency_offset());
+            }
+            nin = m_rx->needed_modem_samples();
+        }
+
+        m_modem_fill -= used;
+        memmove(m_modem.data(), m_modem.data() + used, m_modem_fill * sizeof(iq_sample));
+    }
+
+private:
+    // Takes part of the modem's frequency estimate out with the NCO, so
+    // the signal stays where the modem can lock to it as the SDR drifts
+    void follow(float offset_hz)
+    {
+        m_ddc.correct(iq_afc_step(m_ddc.correction(), offset_hz));
+    }
+
+private:
+    std::unique_ptr<crypto_rx_common> m_rx;
+    iq_ddc                            m_ddc;
+    iq_format                         m_format;
+
+    std::vector<iq_sample> m_modem;
+    size_t                 m_modem_fill;
+    std::vector<short>     m_speech;
+};
+
+// Times the down-converter and the demodulator separately on noise, for
+// each of the usual SDR rates the mode's modem rate divides
+static int benchmark(const char* config_file, double seconds)
+{
+    std::mt19937 rng(1);
+    std::normal_distribution<float> noise(0.0f, 0.1f);
+
+    for (unsigned rate : BENCH_RATES)
+    {
+        std::unique_ptr<crypto_rx_common> rx(new crypto_rx_common("crypto_rx_iq", config_file));
+        const struct config* cfg = rx->get_config();
+
+        iq_ddc ddc;
+        if (!ddc.configure(rate, rx->modem_sample_rate(), cfg->iq_offset, cfg->iq_modem_centre))
+        {
+            continue;
+        }
+
+        std::vector<float> iq(READ_SAMPLES * 2);
+        std::vector<iq_sample> modem((READ_SAMPLES / ddc.decimation()) + 1 +
+                                     rx->max_modem_samples_per_frame());
+        std::vector<short> speech(rx->max_speech_samples_per_frame());
+        size_t fill = 0;
+        double ddc_cost = 0.0;
+        double demod_cost = 0.0;
+
+        const size_t total = rate * seconds;
+        for (size_t done = 0; done < total; done += READ_SAMPLES)
+        {
+            for (float& v : iq)
+            {
+                v = noise(rng);
+            }
+
+            double start = thread_seconds();
+            fill += ddc.process(iq.data(), READ_SAMPLES, modem.data() + fill);
+            ddc_cost += thread_seconds() - start;
+
+            start = thread_seconds();
+            size_t used = 0;
+            for (size_t nin = rx->needed_modem_samples();
+                 fill - used >= nin;
+                 nin = rx->needed_modem_samples())
+            {
+                rx->receive(speech.data(), modem.data() + used);
+                used += nin;
+            }
+            demod_cost += thread_seconds() - start;
+
+            fill -= used;
+            memmove(modem.data(), modem.data() + used, fill * sizeof(iq_sample));
+        }
+
+        const double signal_seconds = (double)total / rate;
+        printf("%u S/s: down-converter %.2f%%, demodulator %.2f%% of one core\n",
+               rate,
+               (ddc_cost / signal_seconds) * 100.0,
+               (demod_cost / signal_seconds) * 100.0);
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    int port = -1;
+    double bench_seconds = 0.0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "u:b:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'u':
+            port = atoi(optarg);
+            break;
+        case 'b':
+            bench_seconds = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    const char* config_file = argv[optind];
+
+    try
+    {
+        if (bench_seconds > 0.0)
+        {
+            return benchmark(config_file, bench_seconds);
+        }
+
+        iq_source source;
+        if (port >= 0 && !source.open_udp(port))
+        {
+            fprintf(stderr, "Could not listen on UDP port %d\n", port);
+            return 1;
+        }
+
+        signal(SIGHUP, handle_sighup);
+
+        std::unique_ptr<iq_receiver> receiver(new iq_receiver(config_file));
+        source.set_format(receiver->format());
+
+        std::vector<float> iq(READ_SAMPLES * 2);
+        while (true)
+        {
+            const size_t n = source.read(iq.data(), READ_SAMPLES);
+            if (n == 0)
+            {
+                break;
+            }
+
+            receiver->convert(iq.data(), n);
+            receiver->demodulate(stdout);
+            fflush(stdout);
+
+            // Starting over is simplest, the down-converter's settings
+            // can all change
+            if (reload_config != 0)
+            {
+                reload_config = 0;
+                receiver.reset(new iq_receiver(config_file));
+                source.set_format(receiver->format());
+            }
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        fprintf(stderr, "%s\n", ex.what());
+        return 1;
+    }
+
+    return 0;
+}
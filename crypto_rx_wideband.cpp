@@ -0,0 +1,674 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+// crypto_rx for a whole net at once. Reads a wideband capture the same way
+// crypto_rx_iq does, splits it into channels with one polyphase filter
+// bank (see channelizer.h) and runs a demodulator on each channel only
+// while something is there. The channels' speech is mixed and written to
+// stdout, and channels opening, syncing and closing are reported on
+// stderr. Its own config file says where the channels are:
+//
+//   [Wideband]
+//   Config  = /etc/crypto.ini   ; mode, key and [IQ] input for every channel
+//   Spacing = 2000              ; Hz between the filter bank's bins
+//   Threads = 0                 ; 0 for one per core
+//   Squelch = 6                 ; dB above the band's noise floor
+//   Hang    = 5                 ; seconds a quiet channel stays open
+//
+//   [Channel1]
+//   Offset = -24000             ; Hz from the middle of the capture
+//
+// Without any [Channel<N>] sections every bin in the capture is a channel.
+// The filter bank and the demodulators are shared out over a pool of
+// threads (see dsp_pool.h). SIGHUP closes every open channel, so each
+// reopens with the crypto config as it is then.
+//
+// usage: crypto_rx_wideband [-u <port>] <wideband config file>
+
+#include <unistd.h>
+#include <signal.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include "crypto_cfg.h"
+#include "crypto_rx_common.h"
+#include "channelizer.h"
+#include "dsp_pool.h"
+#include "iq_input.h"
+#include "simd.h"
+#include "minIni.h"
+
+// Input samples read at a time
+static const size_t READ_SAMPLES = 4096;
+static const unsigned MAX_CHANNELS = 256;
+// Time constant of each bin's level, which the squelch goes by
+static const double DETECT_SECONDS = 0.2;
+
+static volatile sig_atomic_t reload_config = 0;
+
+static void handle_sighup(int sig)
+{
+    reload_config = 1;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-u <port>] <wideband config file>\n", name);
+}
+
+// One channel of the net, with a demodulator only while it is open. open,
+// close and should_close are called from the main thread, run from any
+// pool thread
+class wideband_channel
+{
+public:
+    wideband_channel(unsigned number, double offset_hz, const channelizer& bank)
+        : m_number(number),
+          m_offset(offset_hz),
+          m_bank(bank),
+          m_bin(bank.bin(offset_hz)),
+          m_residual(offset_hz - bank.bin_frequency(m_bin)),
+          m_outputs(0),
+          m_phase(0),
+          m_correction(0),
+          m_modem_fill(0),
+          m_speech_fill(0),
+          m_quiet(0),
+          m_synced(false),
+          m_announced_sync(false),
+          m_lead(0)
+    {
+    }
+
+    unsigned number() const
+    {
+        return m_number;
+    }
+
+    double offset() const
+    {
+        return m_offset;
+    }
+
+    size_t bin() const
+    {
+        return m_bin;
+    }
+
+    bool is_open() const
+    {
+        return m_rx != nullptr;
+    }
+
+    void open(const char* config_file, size_t max_outputs)
+    {
+        m_rx.reset(new crypto_rx_common("crypto_rx_wideband", config_file));
+
+        m_re.resize(max_outputs);
+        m_im.resize(max_outputs);
+        m_modem.resize(max_outputs + m_rx->max_modem_samples_per_frame());
+        m_speech.resize(m_rx->max_speech_samples_per_frame() *
+                        ((max_outputs / m_rx->modem_samples_per_frame()) + 2));
+
+        m_phase = 0;
+        m_correction = 0;
+        m_modem_fill = 0;
+        m_speech_fill = 0;
+        m_quiet = 0;
+        m_synced = false;
+        m_announced_sync = false;
+        // A frame's worth of silence in hand, so frames arriving a little
+        // unevenly never run the mix dry
+        m_lead = m_rx->max_speech_samples_per_frame();
+    }
+
+    void close()
+    {
+        m_rx.reset();
+    }
+
+    // Counts how long the channel has had neither signal nor sync. True
+    // once that is longer than hang_samples
+    bool should_close(bool detected, size_t outputs, size_t hang_samples)
+    {
+        if (detected || m_synced)
+        {
+            m_quiet = 0;
+            return false;
+        }
+        m_quiet += outputs;
+        return m_quiet >= hang_samples;
+    }
+
+    // Takes a change in sync since the last call, for reporting
+    bool take_sync_change(bool* synced)
+    {
+        if (m_synced == m_announced_sync)
+        {
+            return false;
+        }
+        m_announced_sync = m_synced;
+        *synced = m_synced;
+        return true;
+    }
+
+    // Hands the channel the filter bank's last push, for run
+    void begin(size_t outputs)
+    {
+        m_outputs = outputs;
+        m_speech_fill = 0;
+    }
+
+    static void run(void* arg)
+    {
+        static_cast<wideband_channel*>(arg)->process();
+    }
+
+    const short* speech() const
+    {
+        return m_speech.data();
+    }
+
+    size_t speech_size() const
+    {
+        return m_speech_fill;
+    }
+
+    // Where the channel's speech goes next in the mix, see mix_speech
+    size_t& lead()
+    {
+        return m_lead;
+    }
+
+private:
+    // Moves the channel from wherever it sits in its bin to where the mode
+    // expects its centre, then demodulates every whole frame there is
+    void process()
+    {
+        const struct config* cfg = m_rx->get_config();
+        const size_t count = m_outputs;
+
+        memcpy(m_re.data(), m_bank.re(m_bin), count * sizeof(float));
+        memcpy(m_im.data(), m_bank.im(m_bin), count * sizeof(float));
+
+        const double step = (2.0 * M_PI * (cfg->iq_modem_centre - m_residual - m_correction)) /
+                            m_rx->modem_sample_rate();
+        simd_mix_nco(m_re.data(), m_im.data(), count, m_phase, step);
+        m_phase = fmod(m_phase + (step * count), 2.0 * M_PI);
+
+        iq_sample* const modem = m_modem.data() + m_modem_fill;
+        for (size_t i = 0; i < count; ++i)
+        {
+            modem[i].i = m_re[i];
+            modem[i].q = m_im[i];
+        }
+        m_modem_fill += count;
+
+        const size_t max_speech = m_rx->max_speech_samples_per_frame();
+        size_t used = 0;
+        size_t nin = m_rx->needed_modem_samples();
+        while (m_modem_fill - used >= nin && m_speech_fill + max_speech <= m_speech.size())
+        {
+            m_speech_fill += m_rx->receive(m_speech.data() + m_speech_fill,
+                                           m_modem.data() + used);
+            used += nin;
+
+            if (cfg->iq_afc)
+            {
+                m_correction += iq_afc_step(m_correction, m_rx->frequency_offset());
+            }
+            nin = m_rx->needed_modem_samples();
+        }
+
+        m_modem_fill -= used;
+        memmove(m_modem.data(), m_modem.data() + used, m_modem_fill * sizeof(iq_sample));
+        m_synced = m_rx->is_synced();
+    }
+
+private:
+    const unsigned     m_number;
+    const double       m_offset;
+    const channelizer& m_bank;
+    const size_t       m_bin;
+    // How far the channel is from the middle of its bin
+    const double       m_residual;
+
+    std::unique_ptr<crypto_rx_common> m_rx;
+
+    size_t m_outputs;
+    double m_phase;
+    double m_correction;
+
+    std::vector<float>     m_re;
+    std::vector<float>     m_im;
+    std::vector<iq_sample> m_modem;
+    size_t                 m_modem_fill;
+    std::vector<short>     m_speech;
+    size_t                 m_speech_fill;
+
+    size_t m_quiet;
+    bool   m_synced;
+    bool   m_announced_sync;
+    size_t m_lead;
+};
+
+// A share of the filter bank's outputs for one pool thread
+struct bank_slice
+{
+    channelizer* bank;
+    size_t       first;
+    size_t       count;
+
+    static void run(void* arg)
+    {
+        bank_slice* const self = static_cast<bank_slice*>(arg);
+        self->bank->run(self->first, self->count);
+    }
+};
+
+class wideband_monitor
+{
+public:
+    explicit wideband_monitor(const char* wideband_file)
+        : m_raster(false),
+          m_speech_due(0)
+    {
+        ini_gets("Wideband", "Config", "", m_config_file, sizeof(m_config_file), wideband_file);
+        if (m_config_file[0] == 0)
+        {
+            throw std::runtime_error("No [Wideband] Config");
+        }
+
+        // Every channel runs the same mode, so one instance says how they
+        // all go
+        {
+            crypto_rx_common probe("crypto_rx_wideband", m_config_file);
+            const struct config* cfg = probe.get_config();
+            if (!parse_iq_format(cfg->iq_format, &m_format))
+            {
+                throw std::runtime_error("Unknown IQ format");
+            }
+            m_input_rate = cfg->iq_sample_rate;
+            m_modem_rate = probe.modem_sample_rate();
+            m_speech_rate = probe.speech_sample_rate();
+            m_max_speech = probe.max_speech_samples_per_frame();
+            m_modem_frame = probe.modem_samples_per_frame();
+        }
+
+        const long spacing = ini_getl("Wideband", "Spacing", 2000, wideband_file);
+        if (spacing <= 0 || !m_bank.configure(m_input_rate, m_modem_rate, spacing, READ_SAMPLES))
+        {
+            throw std::runtime_error("Spacing must divide the modem sample rate, "
+                                     "and the modem sample rate the IQ sample rate");
+        }
+        m_max_outputs = (READ_SAMPLES / (m_input_rate / m_modem_rate)) + 1;
+
+        m_squelch = pow(10.0, ini_getf("Wideband", "Squelch", 6.0, wideband_file) / 10.0);
+        m_hang_samples = ini_getf("Wideband", "Hang", 5.0, wideband_file) * m_modem_rate;
+
+        read_channels(wideband_file);
+
+        m_levels.assign(m_bank.num_bins(), 0.0);
+        m_sorted.resize(m_bank.num_bins());
+
+        size_t num_threads = ini_getl("Wideband", "Threads", 0, wideband_file);
+        if (num_threads == 0)
+        {
+            num_threads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        m_pool.reset(new dsp_pool(num_threads, std::max<size_t>(num_threads, m_channels.size())));
+        if (!m_pool->start(nullptr))
+        {
+            throw std::runtime_error("Could not start DSP threads");
+        }
+
+        m_slices.resize(m_pool->num_threads());
+        for (bank_slice& slice : m_slices)
+        {
+            slice.bank = &m_bank;
+            m_slice_jobs.push_back({bank_slice::run, &slice, 0});
+        }
+        m_channel_jobs.reserve(m_channels.size());
+
+        // Room for one push's output, a channel's lead and one push of its
+        // speech on top
+        const size_t channel_speech = m_max_speech * ((m_max_outputs / m_modem_frame) + 2);
+        m_mix.assign(((m_max_outputs * m_speech_rate) / m_modem_rate) + 1 +
+                     m_max_speech + (channel_speech * 2), 0.0f);
+        m_mix_in.resize(m_mix.size());
+        m_out.resize(m_mix.size());
+    }
+
+    iq_format format() const
+    {
+        return m_format;
+    }
+
+    // Channelizes and demodulates count interleaved samples, writing the
+    // mixed speech to fout
+    void process(const float* iq, size_t count, FILE* fout)
+    {
+        const size_t outputs = m_bank.push(iq, count);
+        if (outputs > 0)
+        {
+            const size_t per_slice = (outputs + m_slices.size() - 1) / m_slices.size();
+            for (size_t i = 0; i < m_slices.size(); ++i)
+            {
+                m_slices[i].first = std::min(outputs, i * per_slice);
+                m_slices[i].count = std::min(outputs - m_slices[i].first, per_slice);
+            }
+            m_pool->run(m_slice_jobs.data(), m_slice_jobs.size());
+
+            squelch(outputs);
+
+            m_channel_jobs.clear();
+            for (auto& channel : m_channels)
+            {
+                if (channel->is_open())
+                {
+                    channel->begin(outputs);
+                    m_channel_jobs.push_back({wideband_channel::run, channel.get(), 0});
+                }
+            }
+            m_pool->run(m_channel_jobs.data(), m_channel_jobs.size());
+
+            report_sync();
+            mix_speech(outputs, fout);
+        }
+        m_bank.finish();
+    }
+
+    // Closes every channel, to be reopened with the config as it is now
+    void reload()
+    {
+        for (auto& channel : m_channels)
+        {
+            if (channel->is_open())
+            {
+                channel->close();
+                report(*channel, "closed for reload");
+            }
+        }
+    }
+
+private:
+    void read_channels(const char* wideband_file)
+    {
+        const double edge = (m_input_rate / 2.0) - (m_modem_rate / 2.0);
+
+        for (unsigned number = 1; number <= MAX_CHANNELS; ++number)
+        {
+            char section[32];
+            snprintf(section, sizeof(section), "Channel%u", number);
+
+            char offset[32];
+            if (ini_gets(section, "Offset", "", offset, sizeof(offset), wideband_file) <= 0)
+            {
+                break;
+            }
+
+            const double offset_hz = atof(offset);
+            if (fabs(offset_hz) > edge)
+            {
+                throw std::runtime_error("Channel offset outside the capture");
+            }
+            m_channels.emplace_back(new wideband_channel(number, offset_hz, m_bank));
+        }
+
+        // Otherwise every bin whose channel is wholly inside the capture,
+        // numbered upwards from the lowest
+        if (m_channels.empty())
+        {
+            m_raster = true;
+            const size_t bins = m_bank.num_bins();
+            for (size_t i = 0; i < bins; ++i)
+            {
+                const double offset_hz = m_bank.bin_frequency((i + ((bins + 1) / 2)) % bins);
+                if (fabs(offset_hz) <= edge)
+                {
+                    m_channels.emplace_back(new wideband_channel(m_channels.size() + 1,
+                                                                 offset_hz,
+                                                                 m_bank));
+                }
+            }
+        }
+    }
+
+    // Each bin's level is its power averaged over about a bin's width,
+    // which the filter bank's outputs are wider than when oversampled, so
+    // a signal shows most in its own bin. The band's noise floor is the
+    // median level, most bins being empty most of the time
+    void squelch(size_t outputs)
+    {
+        const size_t width = m_bank.oversampling();
+        if (outputs < width)
+        {
+            return;
+        }
+
+        const double alpha = std::min(1.0, outputs / (m_modem_rate * DETECT_SECONDS));
+        for (size_t bin = 0; bin < m_bank.num_bins(); ++bin)
+        {
+            const float* re = m_bank.re(bin);
+            const float* im = m_bank.im(bin);
+            double sum_re = 0.0;
+            double sum_im = 0.0;
+            double power = 0.0;
+            for (size_t n = 0; n < outputs; ++n)
+            {
+                sum_re += re[n];
+                sum_im += im[n];
+                if (n >= width)
+                {
+                    sum_re -= re[n - width];
+                    sum_im -= im[n - width];
+                }
+                if (n + 1 >= width)
+                {
+                    power += (sum_re * sum_re) + (sum_im * sum_im);
+                }
+            }
+            power /= (outputs + 1 - width) * (double)(width * width);
+            m_levels[bin] += alpha * (power - m_levels[bin]);
+        }
+
+        m_sorted = m_levels;
+        std::nth_element(m_sorted.begin(), m_sorted.begin() + (m_sorted.size() / 2), m_sorted.end());
+        const double threshold = m_sorted[m_sorted.size() / 2] * m_squelch;
+
+        const size_t bins = m_bank.num_bins();
+        for (auto& channel : m_channels)
+        {
+            const size_t bin = channel->bin();
+            bool detected = m_levels[bin] > threshold;
+
+            // On the raster a signal between bins only opens the nearer
+            if (m_raster)
+            {
+                detected = detected &&
+                    m_levels[bin] >= m_levels[(bin + 1) % bins] &&
+                    m_levels[bin] >= m_levels[(bin + bins - 1) % bins];
+            }
+
+            if (!channel->is_open())
+            {
+                if (detected)
+                {
+                    channel->open(m_config_file, m_max_outputs);
+                    report(*channel, "open");
+                }
+            }
+            else if (channel->should_close(detected, outputs, m_hang_samples))
+            {
+                channel->close();
+                report(*channel, "closed");
+            }
+        }
+    }
+
+    void report_sync()
+    {
+        for (auto& channel : m_channels)
+        {
+            bool synced;
+            if (channel->is_open() && channel->take_sync_change(&synced))
+            {
+                report(*channel, synced ? "synced" : "lost sync");
+            }
+        }
+    }
+
+    static void report(const wideband_channel& channel, const char* what)
+    {
+        fprintf(stderr, "Channel %u (%+.0f Hz) %s\n", channel.number(), channel.offset(), what);
+    }
+
+    // Every open channel adds its speech to the mix where it last left off,
+    // then the mix goes out at the speech rate the outputs are worth. The
+    // channels' speech and the output are both counted in the filter
+    // bank's outputs, so each channel stays the same distance ahead
+    void mix_speech(size_t outputs, FILE* fout)
+    {
+        for (auto& channel : m_channels)
+        {
+            if (!channel->is_open())
+            {
+                continue;
+            }
+
+            size_t& lead = channel->lead();
+            const size_t n = std::min(channel->speech_size(), m_mix.size() - lead);
+            simd_short_to_float(m_mix_in.data(), channel->speech(), n, 1.0f);
+            simd_mix(m_mix.data() + lead, m_mix_in.data(), n, 1.0f);
+            lead += n;
+        }
+
+        m_speech_due += outputs * m_speech_rate;
+        const size_t count = m_speech_due / m_modem_rate;
+        m_speech_due -= count * m_modem_rate;
+
+        simd_float_to_short(m_out.data(), m_mix.data(), count, 1.0f);
+        fwrite(m_out.data(), sizeof(short), count, fout);
+
+        memmove(m_mix.data(), m_mix.data() + count, (m_mix.size() - count) * sizeof(float));
+        std::fill(m_mix.end() - count, m_mix.end(), 0.0f);
+        for (auto& channel : m_channels)
+        {
+            size_t& lead = channel->lead();
+            lead = lead > count ? lead - count : 0;
+        }
+    }
+
+private:
+    char      m_config_file[256];
+    iq_format m_format;
+    unsigned  m_input_rate;
+    unsigned  m_modem_rate;
+    unsigned  m_speech_rate;
+    size_t    m_max_speech;
+    size_t    m_modem_frame;
+    size_t    m_max_outputs;
+
+    channelizer                                    m_bank;
+    std::vector<std::unique_ptr<wideband_channel>> m_channels;
+    bool                                           m_raster;
+
+    double              m_squelch;
+    size_t              m_hang_samples;
+    std::vector<double> m_levels;
+    std::vector<double> m_sorted;
+
+    std::unique_ptr<dsp_pool> m_pool;
+    std::vector<bank_slice>   m_slices;
+    std::vector<dsp_job>      m_slice_jobs;
+    std::vector<dsp_job>      m_channel_jobs;
+
+    std::vector<float> m_mix;
+    std::vector<float> m_mix_in;
+    std::vector<short> m_out;
+    size_t             m_speech_due;
+};
+
+int main(int argc, char* argv[])
+{
+    int port = -1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "u:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'u':
+            port = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    try
+    {
+        iq_source source;
+        if (port >= 0 && !source.open_udp(port))
+        {
+            fprintf(stderr, "Could not listen on UDP port %d\n", port);
+            return 1;
+        }
+
+        wideband_monitor monitor(argv[optind]);
+        source.set_format(monitor.format());
+
+        signal(SIGHUP, handle_sighup);
+
+        std::vector<float> iq(READ_SAMPLES * 2);
+        while (true)
+        {
+            const size_t n = source.read(iq.data(), READ_SAMPLES);
+            if (n == 0)
+            {
+                break;
+            }
+
+            monitor.process(iq.data(), n, stdout);
+            fflush(stdout);
+
+            if (reload_config != 0)
+            {
+                reload_config = 0;
+                monitor.reload();
+            }
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        fprintf(stderr, "%s\n", ex.what());
+        return 1;
+    }
+
+    return 0;
+}
@@ -30,6 +30,10 @@
 #include "crypto_cfg.h"
 #include "crypto_log.h"
 
+/* Frames modulated per call, so reloads and the rekey interval are looked
+   at once per batch rather than once per frame */
+#define FRAMES_PER_BATCH 50
+
 static volatile sig_atomic_t reload_config = 0;
 
 static void handle_sighup(int sig) {
@@ -59,13 +63,25 @@ int main(int argc, char *argv[]) {
        returns freedv_get_n_nom_modem_samples() (unlike rx side) */
     int n_speech_samples = crypto_tx_speech_samples_per_frame(crypto_tx);
     int n_nom_modem_samples = crypto_tx_modem_samples_per_frame(crypto_tx);
-    short* speech_in = malloc(sizeof(short) * n_speech_samples);
-    short* mod_out = malloc(sizeof(short) * n_nom_modem_samples);
+    short* speech_in = malloc(sizeof(short) * n_speech_samples * FRAMES_PER_BATCH);
+    short* mod_out = malloc(sizeof(short) * n_nom_modem_samples * FRAMES_PER_BATCH);
 
     /* OK main loop  --------------------------------------- */
-    while(read_input_file(speech_in, n_speech_samples, fin) == n_speech_samples) {
-        crypto_tx_transmit(crypto_tx, mod_out, speech_in);
-        fwrite(mod_out, sizeof(short), n_nom_modem_samples, fout);
+    int frames = FRAMES_PER_BATCH;
+    while(frames == FRAMES_PER_BATCH) {
+        /* A short read means the end of the input, and any partial frame
+           at the end is dropped */
+        frames = read_input_file(speech_in, n_speech_samples * FRAMES_PER_BATCH, fin) / n_speech_samples;
+        if (frames == 0) {
+            break;
+        }
+
+        const int nout = crypto_tx_transmit_frames(crypto_tx, mod_out, speech_in, frames, NULL);
+        if (nout < 0) {
+            fprintf(stderr, "Could not modulate frames");
+            exit(1);
+        }
+        fwrite(mod_out, sizeof(short), nout, fout);
 
         if (reload_config != 0) {
             reload_config = 0;
@@ -80,8 +96,8 @@ int main(int argc, char *argv[]) {
             n_speech_samples = crypto_tx_speech_samples_per_frame(crypto_tx);
             n_nom_modem_samples = crypto_tx_modem_samples_per_frame(crypto_tx);
 
-            speech_in = realloc(speech_in, sizeof(short) * n_speech_samples);
-            mod_out = realloc(mod_out, sizeof(short) * n_nom_modem_samples);
+            speech_in = realloc(speech_in, sizeof(short) * n_speech_samples * FRAMES_PER_BATCH);
+            mod_out = realloc(mod_out, sizeof(short) * n_nom_modem_samples * FRAMES_PER_BATCH);
         }
     }
     
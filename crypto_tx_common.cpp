@@ -19,62 +19,116 @@
 */
 #include <sys/random.h>
 
+#include <cstdio>
 #include <cstring>
 #include <cmath>
 
 #include <string>
 #include <memory>
+#include <vector>
 #include <stdexcept>
 
 #include "freedv_api.h"
 #include "crypto_cfg.h"
 #include "crypto_log.h"
+#include "crypto_context.h"
 
 #include "crypto_tx_common.h"
 #include "crypto_common.h"
+#include "spsc_queue.h"
+#include "simd.h"
 
 using namespace std;
 
+// A reloaded config on its way to the audio thread
+struct tx_config_update
+{
+    struct config cfg;
+    unsigned      changes;
+    bool          set_key;
+    unsigned char key[FREEDV_MASTER_KEY_LENGTH];
+    unsigned char iv[IV_LEN];
+};
+
+// A message on its way to the FreeDV text channel, framed by carriage
+// returns so the receiver can find where it starts and ends
+struct tx_text
+{
+    char text[FREEDV_TEXT_MAX + 3];
+};
+
 struct crypto_tx_common::tx_parms
 {
-    tx_parms()
+    tx_parms(shared_ptr<crypto_context> ctx, bool own)
+        : context(std::move(ctx)),
+          own_context(own),
+          logger(context->logger())
     {
-        memset(&logger, 0, sizeof(logger));
     }
     ~tx_parms()
     {
         if (cur != nullptr) free(cur);
         if (freedv != nullptr) freedv_close(freedv);
-        destroy_logger(logger);
     }
 
+    // The logger belongs to the context, which may be shared with a
+    // receiver. A context of our own is reread by check_reload
+    const shared_ptr<crypto_context> context;
+    const bool     own_context;
+    crypto_log     logger;
     struct config* cur = nullptr;
     struct freedv* freedv = nullptr;
-    crypto_log     logger;
+    runtime_params params;
     unsigned short frames_since_rekey = 0;
     bool           force_rekey = false;
+    bool           encrypted = false;
+
+    // The audio thread's copy of the config and the one read by
+    // check_reload. Reloads reach the audio thread through updates
+    struct config  live;
+    struct config  next;
+    unsigned char  key[FREEDV_MASTER_KEY_LENGTH] = {0};
+    unsigned char  next_key[FREEDV_MASTER_KEY_LENGTH] = {0};
+    size_t         key_bytes = 0;
+    size_t         next_key_bytes = 0;
+
+    spsc_queue<tx_config_update, 4> updates;
+
+    // Scratch space for the float transmit
+    vector<COMP>   comp_out;
+    vector<short>  short_out;
+
+    // Only the audio thread touches the message being sent
+    spsc_queue<tx_text, 4> texts;
+    tx_text        text = {};
+    size_t         text_pos = 0;
+    bool           text_active = false;
 };
 
 crypto_tx_common::~crypto_tx_common() {}
 
 crypto_tx_common::crypto_tx_common(const char* name, const char* config_file)
-    : m_parms(new tx_parms())
+    : crypto_tx_common(std::make_shared<crypto_context>(name, config_file), true)
 {
-    unsigned char  key[FREEDV_MASTER_KEY_LENGTH];
-    unsigned char  iv[IV_LEN];
+}
 
-    m_parms->cur = static_cast<struct config*>(calloc(1, sizeof(struct config)));
-    read_config(config_file, m_parms->cur);
+crypto_tx_common::crypto_tx_common(std::shared_ptr<crypto_context> context)
+    : crypto_tx_common(std::move(context), false)
+{
+}
 
-    string config_file_name(m_parms->cur->log_file);
-    size_t name_idx = config_file_name.find("{name}");
-    if (name_idx != string::npos)
-    {
-        config_file_name.replace(name_idx, 6, name);
-    }
+crypto_tx_common::crypto_tx_common(std::shared_ptr<crypto_context> context, bool own_context)
+    : m_parms(new tx_parms(std::move(context), own_context))
+{
+    const crypto_context& ctx = *m_parms->context;
+    unsigned char* const key = m_parms->key;
+    unsigned char  iv[IV_LEN];
 
-    m_parms->logger = create_logger(config_file_name.c_str(),
-                                    m_parms->cur->log_level);
+    m_parms->cur = static_cast<struct config*>(calloc(1, sizeof(struct config)));
+    *m_parms->cur = *ctx.config();
+    m_parms->live = *m_parms->cur;
+    memcpy(key, ctx.key(), sizeof(m_parms->key));
+    m_parms->key_bytes = ctx.key_bytes();
 
     if (m_parms->cur->freedv_enabled)
     {
@@ -95,7 +149,7 @@ crypto_tx_common::crypto_tx_common(const char* name, const char* config_file)
             log_message(m_parms->logger, LOG_INFO, "Read initialization vector");
         }
 
-        const size_t key_bytes_read = read_key_file(m_parms->cur->key_file, key);
+        const size_t key_bytes_read = m_parms->key_bytes;
         if (str_has_value(m_parms->cur->key_file) &&
             key_bytes_read != FREEDV_MASTER_KEY_LENGTH)
         {
@@ -108,13 +162,19 @@ crypto_tx_common::crypto_tx_common(const char* name, const char* config_file)
 
         if (str_has_value(m_parms->cur->key_file) && m_parms->cur->crypto_enabled) {
             freedv_set_crypto(m_parms->freedv, key, iv);
+            m_parms->encrypted = true;
         }
         else {
             log_message(m_parms->logger, LOG_WARN, "Encryption disabled");
         }
 
         configure_freedv(m_parms->freedv, m_parms->cur);
+        freedv_set_callback_txt(m_parms->freedv, nullptr, next_text_char, m_parms.get());
     }
+
+    ::get_runtime_params(m_parms->freedv, &m_parms->params);
+    m_parms->comp_out.resize(m_parms->params.max_modem_samples_per_frame);
+    m_parms->short_out.resize(m_parms->params.max_modem_samples_per_frame);
 }
 
 bool crypto_tx_common::using_freedv() const
@@ -124,122 +184,362 @@ bool crypto_tx_common::using_freedv() const
 
 size_t crypto_tx_common::speech_samples_per_frame() const
 {
-    if (using_freedv())
+    return m_parms->params.speech_samples_per_frame;
+}
+
+uint crypto_tx_common::speech_sample_rate() const
+{
+    return m_parms->params.speech_sample_rate;
+}
+
+size_t crypto_tx_common::modem_samples_per_frame() const
+{
+    return m_parms->params.modem_samples_per_frame;
+}
+
+uint crypto_tx_common::modem_sample_rate() const
+{
+    return m_parms->params.modem_sample_rate;
+}
+
+const runtime_params& crypto_tx_common::get_runtime_params() const
+{
+    return m_parms->params;
+}
+
+const struct config* crypto_tx_common::get_config() const
+{
+    return m_parms->cur;
+}
+
+void crypto_tx_common::log_to_logger(int level, const char* msg)
+{
+    log_message(m_parms->logger, level, "%s", msg);
+}
+
+unsigned crypto_tx_common::check_reload()
+{
+    const crypto_context& ctx = *m_parms->context;
+    if (m_parms->own_context && !m_parms->context->reread())
     {
-        return static_cast<size_t>(freedv_get_n_speech_samples(m_parms->freedv));
+        return 0;
     }
-    else
+
+    struct config* const next = &m_parms->next;
+    *next = *ctx.config();
+    unsigned changes = config_diff(m_parms->cur, next);
+
+    // A key can be loaded into the same slot without the config changing
+    memcpy(m_parms->next_key, ctx.key(), sizeof(m_parms->next_key));
+    m_parms->next_key_bytes = ctx.key_bytes();
+    if (m_parms->next_key_bytes != m_parms->key_bytes ||
+        memcmp(m_parms->next_key, m_parms->key, sizeof(m_parms->key)) != 0)
     {
-        return ANALOG_SAMPLES_PER_FRAME;
+        changes |= CONFIG_CHANGE_KEY;
     }
+
+    // FreeDV can't turn encryption back off once it has a key
+    const bool next_encrypted = str_has_value(next->key_file) && next->crypto_enabled;
+    if ((changes & CONFIG_CHANGE_KEY) && m_parms->encrypted && !next_encrypted)
+    {
+        changes |= CONFIG_CHANGE_CODEC;
+    }
+
+    return changes;
 }
 
-uint crypto_tx_common::speech_sample_rate() const
+bool crypto_tx_common::apply_reload(unsigned changes)
 {
-    if (using_freedv())
+    tx_config_update* const update = m_parms->updates.begin_push();
+    if (update == nullptr)
     {
-        return freedv_get_speech_sample_rate(m_parms->freedv);
+        log_message(m_parms->logger, LOG_WARN, "Audio thread hasn't taken the last config yet");
+        return false;
     }
-    else
+
+    struct config* const next = &m_parms->next;
+    update->cfg = *next;
+    update->changes = changes;
+    update->set_key = false;
+
+    if (using_freedv() &&
+        (changes & CONFIG_CHANGE_KEY) &&
+        str_has_value(next->key_file) &&
+        next->crypto_enabled)
     {
-        return ANALOG_SAMPLE_RATE;
+        // Start the new key with a new IV, read here rather than on the
+        // audio thread
+        if (getrandom(update->iv, sizeof(update->iv), 0) != sizeof(update->iv)) {
+            log_message(m_parms->logger, LOG_WARN, "Did not fully read initialization vector");
+        }
+        update->set_key = true;
+        memcpy(update->key, m_parms->next_key, sizeof(update->key));
+        m_parms->encrypted = true;
+        log_message(m_parms->logger, LOG_INFO, "Encryption key changed");
     }
+
+    memcpy(m_parms->key, m_parms->next_key, sizeof(m_parms->key));
+    m_parms->key_bytes = m_parms->next_key_bytes;
+    *m_parms->cur = *next;
+
+    m_parms->updates.end_push();
+    return true;
 }
 
-size_t crypto_tx_common::modem_samples_per_frame() const
+// Runs on the audio thread
+void crypto_tx_common::take_updates()
 {
-    if (using_freedv())
+    for (tx_config_update* update = m_parms->updates.front();
+         update != nullptr;
+         update = m_parms->updates.front())
     {
-        return static_cast<size_t>(freedv_get_n_nom_modem_samples(m_parms->freedv));
+        m_parms->live = update->cfg;
+        if (using_freedv())
+        {
+            if (update->set_key)
+            {
+                freedv_set_crypto(m_parms->freedv, update->key, update->iv);
+                m_parms->frames_since_rekey = 0;
+            }
+            if (update->changes & CONFIG_CHANGE_LIVE)
+            {
+                configure_freedv(m_parms->freedv, &m_parms->live);
+            }
+        }
+        m_parms->updates.pop_front();
     }
-    else
+}
+
+void crypto_tx_common::force_rekey_next_frame()
+{
+    m_parms->force_rekey = true;
+}
+
+bool crypto_tx_common::send_text(const char* text)
+{
+    if (!using_freedv() || !freedv_mode_has_text(m_parms->cur->freedv_mode))
+    {
+        log_message(m_parms->logger, LOG_WARN, "No text channel in this mode");
+        return false;
+    }
+    if (m_parms->encrypted)
+    {
+        log_message(m_parms->logger, LOG_WARN, "Not sending text in the clear while encrypted");
+        return false;
+    }
+
+    tx_text* const msg = m_parms->texts.begin_push();
+    if (msg == nullptr)
     {
-        return ANALOG_SAMPLES_PER_FRAME;
+        log_message(m_parms->logger, LOG_WARN, "Too many text messages queued");
+        return false;
     }
+    snprintf(msg->text, sizeof(msg->text), "\r%.*s\r", FREEDV_TEXT_MAX, text);
+    m_parms->texts.end_push();
+
+    log_message(m_parms->logger, LOG_INFO, "Queued text message");
+    return true;
 }
 
-uint crypto_tx_common::modem_sample_rate() const
+// Runs on the audio thread
+bool crypto_tx_common::sending_text()
 {
-    if (using_freedv())
+    return m_parms->text_active || m_parms->texts.front() != nullptr;
+}
+
+// Called by freedv_tx each time the previous character has been sent.
+// Between messages it sends NULs, which the receiver ignores
+char crypto_tx_common::next_text_char(void* state)
+{
+    tx_parms* const parms = static_cast<tx_parms*>(state);
+
+    if (parms->text_active && parms->text.text[parms->text_pos] == '\0')
     {
-        return freedv_get_modem_sample_rate(m_parms->freedv);
+        parms->text_active = false;
     }
-    else
+    if (!parms->text_active)
+    {
+        const tx_text* const msg = parms->texts.front();
+        if (msg == nullptr)
+        {
+            return '\0';
+        }
+        parms->text = *msg;
+        parms->text_pos = 0;
+        parms->text_active = true;
+        parms->texts.pop_front();
+    }
+
+    // Encryption may have been turned on since the message was queued
+    const struct config* const cfg = &parms->live;
+    if (str_has_value(cfg->key_file) && cfg->crypto_enabled)
     {
-        return ANALOG_SAMPLE_RATE;
+        parms->text_active = false;
+        return '\0';
     }
+
+    return parms->text.text[parms->text_pos++];
 }
 
-const struct config* crypto_tx_common::get_config() const
+// FreeDV only has complex modulator output for the PSK and OFDM modes
+static bool has_complex_tx(int mode)
 {
-    return m_parms->cur;
+    switch (mode)
+    {
+        case FREEDV_MODE_1600:
+        case FREEDV_MODE_700C:
+        case FREEDV_MODE_700D:
+        case FREEDV_MODE_700E:
+            return true;
+        default:
+            return false;
+    }
 }
 
-void crypto_tx_common::log_to_logger(int level, const char* msg)
+// Frames between IVs, 0 if the IV only changes when forced, or -1 if not
+// encrypting at all. Only changes with the config, so a batch of frames
+// works it out once
+int crypto_tx_common::rekey_frames() const
 {
-    log_message(m_parms->logger, level, "%s", msg);
+    const struct config* const cfg = &m_parms->live;
+    if (!using_freedv() ||
+        !str_has_value(cfg->key_file) ||
+        !cfg->crypto_enabled)
+    {
+        return -1;
+    }
+
+    return m_parms->params.speech_frames_per_second * cfg->rekey_period;
 }
 
-void crypto_tx_common::force_rekey_next_frame()
+// Counts a frame about to be encrypted and starts a new IV if one is due.
+// Returns true if it did
+bool crypto_tx_common::count_frame(int rekey_frames)
 {
-    m_parms->force_rekey = true;
+    if (rekey_frames < 0)
+    {
+        return false;
+    }
+
+    ++m_parms->frames_since_rekey;
+
+    bool reset_iv = m_parms->force_rekey;
+    // Reset IV at regular intervals (if configured)
+    if (rekey_frames > 0 && (m_parms->frames_since_rekey % rekey_frames) == 0)
+    {
+        log_message(m_parms->logger,
+                    LOG_INFO,
+                    "New initialization vector due to auto rekey");
+        reset_iv = true;
+    }
+
+    if (reset_iv)
+    {
+        m_parms->force_rekey = false;
+        m_parms->frames_since_rekey = 0;
+
+        unsigned char iv[IV_LEN];
+        // Use getrandom with the urandom device because it will block
+        // until the entropy pool is initialized
+        if (getrandom(iv, sizeof(iv), 0) != sizeof(iv)) {
+            log_message(m_parms->logger,
+                        LOG_WARN,
+                        "Did not fully read initialization vector");
+        }
+        else {
+            log_message(m_parms->logger,
+                        LOG_INFO,
+                        "Read initialization vector");
+        }
+
+        freedv_set_crypto(m_parms->freedv, NULL, iv);
+    }
+
+    return reset_iv;
+}
+
+// Everything done before modulating each frame, whichever format the
+// samples are in
+void crypto_tx_common::start_frame()
+{
+    take_updates();
+    count_frame(rekey_frames());
+}
+
+void crypto_tx_common::modulate(short* mod_out, const short* speech_in)
+{
+    if (using_freedv())
+    {
+        freedv_tx(m_parms->freedv, mod_out, const_cast<short*>(speech_in));
+    }
+    else
+    {
+        memcpy(mod_out, speech_in, m_parms->params.speech_samples_per_frame * sizeof(short));
+    }
 }
 
 size_t crypto_tx_common::transmit(short* mod_out, const short* speech_in)
 {
-    const int n_speech_samples = speech_samples_per_frame();
-    const int n_nom_modem_samples = modem_samples_per_frame();
-    const int speech_samples_per_second = speech_sample_rate();
-    const int speech_frames_per_second = speech_samples_per_second / n_speech_samples;
+    start_frame();
+    modulate(mod_out, speech_in);
 
-    if (using_freedv() &&
-        str_has_value(m_parms->cur->key_file) &&
-        m_parms->cur->crypto_enabled)
+    return m_parms->params.modem_samples_per_frame;
+}
+
+size_t crypto_tx_common::transmit_frames(short*                 mod_out,
+                                         const short*           speech_in,
+                                         size_t                 num_frames,
+                                         crypto_tx_frame_stats* stats)
+{
+    take_updates();
+
+    const int rekey = rekey_frames();
+    const size_t n_speech_samples = m_parms->params.speech_samples_per_frame;
+    const size_t n_nom_modem_samples = m_parms->params.modem_samples_per_frame;
+
+    for (size_t i = 0; i < num_frames; ++i)
     {
-        ++m_parms->frames_since_rekey;
+        const bool rekeyed = count_frame(rekey);
+        modulate(mod_out + (i * n_nom_modem_samples), speech_in + (i * n_speech_samples));
 
-        bool reset_iv = m_parms->force_rekey;
-        // Reset IV at regular intervals (if configured)
-        const int rekey_frames = speech_frames_per_second *
-                                 m_parms->cur->rekey_period;
-        if (rekey_frames > 0 && (m_parms->frames_since_rekey % rekey_frames) == 0)
+        if (stats != nullptr)
         {
-            log_message(m_parms->logger,
-                        LOG_INFO,
-                        "New initialization vector due to auto rekey");
-            reset_iv = true;
+            stats[i].modem_samples = n_nom_modem_samples;
+            stats[i].rekeyed = rekeyed;
         }
+    }
 
-        if (reset_iv)
-        {
-            m_parms->force_rekey = false;
-            m_parms->frames_since_rekey = 0;
-
-            unsigned char iv[IV_LEN];
-            // Use getrandom with the urandom device because it will block
-            // until the entropy pool is initialized
-            if (getrandom(iv, sizeof(iv), 0) != sizeof(iv)) {
-                log_message(m_parms->logger,
-                            LOG_WARN,
-                            "Did not fully read initialization vector");
-            }
-            else {
-                log_message(m_parms->logger,
-                            LOG_INFO,
-                            "Read initialization vector");
-            }
+    return num_frames * n_nom_modem_samples;
+}
 
-            freedv_set_crypto(m_parms->freedv, NULL, iv);
+size_t crypto_tx_common::transmit(float* mod_out, const short* speech_in)
+{
+    start_frame();
+
+    const runtime_params& params = m_parms->params;
+    const int n_speech_samples = params.speech_samples_per_frame;
+    const int n_nom_modem_samples = params.modem_samples_per_frame;
+    static const float scale = 1.0f / SHORT_SAMPLE_SCALE;
+
+    if (using_freedv() && has_complex_tx(freedv_get_mode(m_parms->freedv)))
+    {
+        // The real part is what freedv_tx would have rounded to shorts
+        COMP* const comp_out = m_parms->comp_out.data();
+        freedv_comptx(m_parms->freedv, comp_out, const_cast<short*>(speech_in));
+        for (int i = 0; i < n_nom_modem_samples; ++i)
+        {
+            mod_out[i] = comp_out[i].real * scale;
         }
     }
-
-    if (using_freedv())
+    else if (using_freedv())
     {
-        freedv_tx(m_parms->freedv, mod_out, const_cast<short*>(speech_in));
+        short* const short_out = m_parms->short_out.data();
+        freedv_tx(m_parms->freedv, short_out, const_cast<short*>(speech_in));
+        simd_short_to_float(mod_out, short_out, n_nom_modem_samples, scale);
     }
     else
     {
-        memcpy(mod_out, speech_in, n_speech_samples * sizeof(short));
+        simd_short_to_float(mod_out, speech_in, n_speech_samples, scale);
     }
 
     return n_nom_modem_samples;
@@ -293,3 +593,27 @@ int crypto_tx_transmit(HCRYPTO_TX* hnd, short* mod_out, const short* speech_in)
         return -1;
     }
 }
+
+int crypto_tx_transmit_frames(HCRYPTO_TX*                   hnd,
+                              short*                        mod_out,
+                              const short*                  speech_in,
+                              int                           num_frames,
+                              struct crypto_tx_frame_stats* stats)
+{
+    if (num_frames < 0)
+    {
+        return -1;
+    }
+
+    try
+    {
+        return reinterpret_cast<crypto_tx_common*>(hnd)->transmit_frames(mod_out,
+                                                                          speech_in,
+                                                                          num_frames,
+                                                                          stats);
+    }
+    catch(...)
+    {
+        return -1;
+    }
+}
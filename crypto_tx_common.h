@@ -2,15 +2,29 @@
 #define CRYPTO_TX_COMMON_H
 
 struct config;
+struct runtime_params;
+
+// What happened to each frame of a batch
+struct crypto_tx_frame_stats
+{
+    int modem_samples;  // Written to mod_out for this frame
+    int rekeyed;        // A new IV started with this frame
+};
 
 #ifdef __cplusplus
 
 #include <memory>
 
+class crypto_context;
+
 class crypto_tx_common
 {
 public:
+    // Reads a config of its own, which check_reload rereads
     crypto_tx_common(const char* name, const char* config_file_path);
+    // Shares the config, key and logger with other pipelines. Whoever owns
+    // the context rereads it before calling check_reload
+    explicit crypto_tx_common(std::shared_ptr<crypto_context> context);
     ~crypto_tx_common();
 
     size_t speech_samples_per_frame() const;
@@ -19,19 +33,63 @@ public:
     uint speech_sample_rate() const;
     uint modem_sample_rate() const;
 
+    const struct runtime_params& get_runtime_params() const;
     const struct config* get_config() const;
 
     void log_to_logger(int level, const char* msg);
 
+    // Takes the config and key from the context, rereading them first if
+    // the context is our own, and returns the CONFIG_CHANGE_* flags for
+    // everything that differs from the running config. Nothing changes
+    // until apply_reload is called
+    unsigned check_reload();
+
+    // Makes the config read by check_reload current. Key and LIVE changes
+    // reach the modem on the next call to transmit. Anything needing
+    // CONFIG_CHANGE_CODEC needs a new crypto_tx_common instead. Returns
+    // false if the audio thread is too far behind to take it
+    bool apply_reload(unsigned changes);
+
     void force_rekey_next_frame();
 
+    // Queues a message for the FreeDV text channel, sent alongside the
+    // frames passed to transmit. The channel isn't encrypted, so this
+    // fails while encryption is on, as well as for modes without one
+    bool send_text(const char* text);
+
+    // True until every queued message has gone out. Called from the
+    // thread calling transmit, which has to keep transmitting until then
+    bool sending_text();
+
     size_t transmit(short* mod_out, const short* speech_in);
 
+    // The same with the modem samples as +/-1.0 floats, taken from
+    // FreeDV's complex output where the mode has one so they are never
+    // rounded to shorts. Speech stays in shorts, which is all Codec2 takes
+    size_t transmit(float* mod_out, const short* speech_in);
+
+    // Modulates num_frames frames of contiguous speech into contiguous
+    // modem samples, picking up reloads and working out the rekey interval
+    // once for the whole batch. Returns the number of modem samples
+    // written. stats may be null
+    size_t transmit_frames(short*                 mod_out,
+                           const short*           speech_in,
+                           size_t                 num_frames,
+                           crypto_tx_frame_stats* stats);
+
 private:
     struct tx_parms;
 
 private:
+    crypto_tx_common(std::shared_ptr<crypto_context> context, bool own_context);
+
     bool using_freedv() const;
+    void take_updates();
+    int rekey_frames() const;
+    bool count_frame(int rekey_frames);
+    void start_frame();
+    void modulate(short* mod_out, const short* speech_in);
+    static char next_text_char(void* state);
 
 private:
     const std::unique_ptr<tx_parms> m_parms;
@@ -56,6 +114,16 @@ void crypto_tx_log_to_logger(HCRYPTO_TX* hnd, int level, const char* msg);
 
 int crypto_tx_transmit(HCRYPTO_TX* hnd, short* mod_out, const short* speech_in);
 
+// Modulates num_frames frames at once. speech_in holds num_frames *
+// crypto_tx_speech_samples_per_frame() samples and mod_out gets num_frames
+// * crypto_tx_modem_samples_per_frame(). stats, if not NULL, gets one entry
+// per frame. Returns the number of modem samples written or -1
+int crypto_tx_transmit_frames(HCRYPTO_TX*                   hnd,
+                              short*                        mod_out,
+                              const short*                  speech_in,
+                              int                           num_frames,
+                              struct crypto_tx_frame_stats* stats);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -0,0 +1,260 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sched.h>
+#include <pthread.h>
+
+#include <thread>
+#include <algorithm>
+
+#include "dsp_pool.h"
+
+// Spins waiting for the last jobs before yielding to any worker sharing the
+// core, which at the same realtime priority would otherwise never get it
+static const int WAIT_SPINS = 1000;
+
+static const uint64_t FIELD_MASK = 0xffff;
+
+static uint64_t pack(uint32_t period, size_t end, size_t next)
+{
+    return ((uint64_t)period << 32) | ((uint64_t)end << 16) | next;
+}
+
+dsp_pool::dsp_pool(size_t num_threads, size_t max_jobs)
+    : m_client(nullptr),
+      m_jobs(nullptr),
+      m_period(0),
+      m_stopping(false),
+      m_remaining(0),
+      m_steals(0),
+      m_waits(0)
+{
+    if (num_threads == 0)
+    {
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    // No point having threads with nothing to do
+    num_threads = std::max<size_t>(1, std::min(num_threads, max_jobs));
+
+    for (size_t i = 0; i < num_threads; ++i)
+    {
+        std::unique_ptr<share> s(new share);
+        s->state.store(pack(0, 0, 0), std::memory_order_relaxed);
+        s->jobs.resize((max_jobs + num_threads - 1) / num_threads);
+        sem_init(&s->wake, 0, 0);
+        m_shares.push_back(std::move(s));
+    }
+    m_order.resize(max_jobs);
+    m_ends.resize(num_threads);
+}
+
+dsp_pool::~dsp_pool()
+{
+    stop();
+    for (auto& s : m_shares)
+    {
+        sem_destroy(&s->wake);
+    }
+}
+
+bool dsp_pool::start(jack_client_t* client)
+{
+    m_client = client;
+    m_stopping.store(false, std::memory_order_relaxed);
+
+    // The JACK thread is share 0, the workers take the rest
+    m_args.resize(m_shares.size());
+    for (size_t i = 1; i < m_shares.size(); ++i)
+    {
+        m_args[i].pool = this;
+        m_args[i].index = i;
+
+        jack_native_thread_t thread;
+        const int err = client != nullptr ?
+            jack_client_create_thread(client,
+                                      &thread,
+                                      jack_client_real_time_priority(client),
+                                      jack_is_realtime(client),
+                                      worker_main,
+                                      &m_args[i]) :
+            pthread_create(&thread, nullptr, worker_main, &m_args[i]);
+        if (err != 0)
+        {
+            stop();
+            return false;
+        }
+        m_threads.push_back(thread);
+    }
+    return true;
+}
+
+void dsp_pool::stop()
+{
+    m_stopping.store(true, std::memory_order_release);
+    for (size_t i = 1; i < m_shares.size(); ++i)
+    {
+        sem_post(&m_shares[i]->wake);
+    }
+    for (jack_native_thread_t thread : m_threads)
+    {
+        pthread_join(thread, nullptr);
+    }
+    m_threads.clear();
+}
+
+void dsp_pool::run(const dsp_job* jobs, size_t num_jobs)
+{
+    num_jobs = std::min(num_jobs, m_order.size());
+    if (num_jobs == 0)
+    {
+        return;
+    }
+
+    // Insertion sort, there are only ever a few jobs and this can't
+    // allocate. Equal priorities keep their order
+    for (size_t i = 0; i < num_jobs; ++i)
+    {
+        size_t j = i;
+        for (; j > 0 && jobs[m_order[j - 1]].priority < jobs[i].priority; --j)
+        {
+            m_order[j] = m_order[j - 1];
+        }
+        m_order[j] = i;
+    }
+
+    // No worker can still be inside a job from the last period, so the
+    // shares can be refilled before publishing the new period number
+    const size_t num_shares = m_shares.size();
+    std::fill(m_ends.begin(), m_ends.end(), 0);
+    for (size_t i = 0; i < num_jobs; ++i)
+    {
+        share& s = *m_shares[i % num_shares];
+        s.jobs[m_ends[i % num_shares]++] = m_order[i];
+    }
+
+    m_jobs = jobs;
+    ++m_period;
+    m_remaining.store(num_jobs, std::memory_order_relaxed);
+    for (size_t i = 0; i < num_shares; ++i)
+    {
+        m_shares[i]->state.store(pack(m_period, m_ends[i], 0), std::memory_order_release);
+    }
+
+    for (size_t i = 1; i < num_shares && i < num_jobs; ++i)
+    {
+        sem_post(&m_shares[i]->wake);
+    }
+
+    work(0);
+
+    if (m_remaining.load(std::memory_order_acquire) != 0)
+    {
+        m_waits.fetch_add(1, std::memory_order_relaxed);
+        for (int spins = 0; m_remaining.load(std::memory_order_acquire) != 0; ++spins)
+        {
+            if (spins >= WAIT_SPINS)
+            {
+                sched_yield();
+            }
+        }
+    }
+}
+
+void* dsp_pool::worker_main(void* arg)
+{
+    worker_arg* const self = static_cast<worker_arg*>(arg);
+    dsp_pool* const pool = self->pool;
+    share& own = *pool->m_shares[self->index];
+
+    while (true)
+    {
+        sem_wait(&own.wake);
+        if (pool->m_stopping.load(std::memory_order_acquire))
+        {
+            break;
+        }
+        pool->work(self->index);
+    }
+    return nullptr;
+}
+
+// Works through this thread's own share, then steals from the share with
+// the most left until there is nothing left anywhere. The period is the
+// one this thread's share was last given, so a worker that wakes up after
+// its period is over finds nothing to do
+void dsp_pool::work(size_t self)
+{
+    const size_t num_shares = m_shares.size();
+    const uint32_t period = m_shares[self]->state.load(std::memory_order_acquire) >> 32;
+    size_t job;
+
+    while (take(*m_shares[self], period, &job))
+    {
+        m_jobs[job].run(m_jobs[job].arg);
+        m_remaining.fetch_sub(1, std::memory_order_release);
+    }
+
+    while (true)
+    {
+        share* victim = nullptr;
+        size_t most = 0;
+        for (size_t i = 1; i < num_shares; ++i)
+        {
+            share& s = *m_shares[(self + i) % num_shares];
+            const uint64_t state = s.state.load(std::memory_order_acquire);
+            const size_t left = ((state >> 16) & FIELD_MASK) - (state & FIELD_MASK);
+            if ((uint32_t)(state >> 32) == period && left > most)
+            {
+                victim = &s;
+                most = left;
+            }
+        }
+
+        if (victim == nullptr)
+        {
+            return;
+        }
+
+        // Someone else may have got there first, in which case look again
+        if (take(*victim, period, &job))
+        {
+            m_steals.fetch_add(1, std::memory_order_relaxed);
+            m_jobs[job].run(m_jobs[job].arg);
+            m_remaining.fetch_sub(1, std::memory_order_release);
+        }
+    }
+}
+
+bool dsp_pool::take(share& from, uint32_t period, size_t* job)
+{
+    uint64_t state = from.state.load(std::memory_order_acquire);
+    while (true)
+    {
+        const size_t end = (state >> 16) & FIELD_MASK;
+        const size_t next = state & FIELD_MASK;
+        if ((uint32_t)(state >> 32) != period || next >= end)
+        {
+            return false;
+        }
+
+        if (from.state.compare_exchange_weak(state,
+                                             pack(period, end, next + 1),
+                                             std::memory_order_acq_rel,
+                                             std::memory_order_acquire))
+        {
+            *job = from.jobs[next];
+            return true;
+        }
+    }
+}
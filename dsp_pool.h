@@ -0,0 +1,117 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DSP_POOL_H
+#define DSP_POOL_H
+
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <semaphore.h>
+
+#include <jack/jack.h>
+
+struct dsp_job
+{
+    void (*run)(void* arg);
+    void* arg;
+    // Higher priorities are started first
+    int   priority;
+};
+
+// A fixed set of realtime worker threads that the JACK thread hands a
+// period's worth of jobs to. Jobs are dealt out highest priority first,
+// one to each thread in turn, and a thread that runs out of its own takes
+// the next one from whichever thread is furthest behind. The JACK thread
+// works through jobs alongside the workers and returns once they're done,
+// so nothing outlives the period.
+//
+// Each thread's share is a single atomic word holding the period number,
+// how many jobs it was given and how many have been taken, so taking a
+// job is one compare and swap and a worker that wakes up late can never
+// take a job from a later period by mistake
+class dsp_pool
+{
+public:
+    // num_threads counts the JACK thread, so 1 means no workers. 0 means
+    // one thread per core
+    dsp_pool(size_t num_threads, size_t max_jobs);
+    ~dsp_pool();
+
+    // Starts the workers at the client's realtime priority. Without a
+    // client they are ordinary threads, and whichever thread calls run
+    // takes the JACK thread's place
+    bool start(jack_client_t* client);
+    void stop();
+
+    size_t num_threads() const
+    {
+        return m_shares.size();
+    }
+
+    // Runs every job once and returns when they have all finished. Called
+    // from the JACK thread only
+    void run(const dsp_job* jobs, size_t num_jobs);
+
+    // Jobs taken from another thread's share, since starting
+    uint64_t steals() const
+    {
+        return m_steals.load(std::memory_order_relaxed);
+    }
+
+    // Periods in which the JACK thread had to wait for a worker to finish
+    uint64_t waits() const
+    {
+        return m_waits.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct alignas(64) share
+    {
+        // Period << 32 | end << 16 | next
+        std::atomic<uint64_t> state;
+        std::vector<size_t>   jobs;
+        sem_t                 wake;
+    };
+
+    struct worker_arg
+    {
+        dsp_pool* pool;
+        size_t    index;
+    };
+
+    static void* worker_main(void* arg);
+    void work(size_t self);
+    bool take(share& from, uint32_t period, size_t* job);
+
+private:
+    std::vector<std::unique_ptr<share>> m_shares;
+    std::vector<worker_arg>             m_args;
+    std::vector<jack_native_thread_t>   m_threads;
+    std::vector<size_t>                 m_order;
+    std::vector<size_t>                 m_ends;
+    jack_client_t*                      m_client;
+
+    const dsp_job*        m_jobs;
+    // Only touched by the JACK thread, workers go by their share's state
+    uint32_t              m_period;
+    std::atomic<bool>     m_stopping;
+    std::atomic<size_t>   m_remaining;
+    std::atomic<uint64_t> m_steals;
+    std::atomic<uint64_t> m_waits;
+};
+
+#endif
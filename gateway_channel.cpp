@@ -0,0 +1,461 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <time.h>
+#include <stdio.h>
+
+#include <algorithm>
+
+#include <gpiod.h>
+#include <samplerate.h>
+
+#include "crypto_cfg.h"
+#include "crypto_log.h"
+#include "crypto_common.h"
+#include "simd.h"
+#include "gateway_channel.h"
+
+// Voice input above this (about -60 dBFS) keys the channel up
+static const float VOX_LEVEL = 0.001f;
+// And it stays keyed this long after the input goes quiet, to ride over
+// gaps between words and between the frames of a bridged channel
+static const double VOX_HANG_SECONDS = 0.5;
+// How quickly the load averages follow, per period
+static const float LOAD_SMOOTHING = 1.0f / 64.0f;
+// Periods of silence sent after the modem output drains before the PTT
+// output is released, the same as jack_crypto_tx
+static const unsigned PTT_DEAD_KEY_PERIODS = 4;
+
+static std::string channel_name(const char* prefix, unsigned number)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%s%u", prefix, number);
+    return name;
+}
+
+static double now_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
+
+gateway_channel::gateway_channel(unsigned number, const char* config_file, int priority)
+    : m_number(number),
+      m_priority(priority),
+      m_config_file(config_file),
+      m_rx_name(channel_name("gateway_rx", number)),
+      m_tx_name(channel_name("gateway_tx", number)),
+      m_modem_in_port(nullptr),
+      m_voice_out_port(nullptr),
+      m_voice_in_port(nullptr),
+      m_modem_out_port(nullptr),
+      m_nframes(0),
+      m_modem_in(nullptr),
+      m_voice_out(nullptr),
+      m_voice_in(nullptr),
+      m_modem_out(nullptr),
+      m_period_seconds(0),
+      m_vox_hang_len(0),
+      m_vox_hang_left(0),
+      m_transmitting_prev(false),
+      m_ptt_out_line(nullptr),
+      m_ptt_val(-1),
+      m_ptt_delay_periods(0),
+      m_synced(false),
+      m_transmitting(false),
+      m_rx_load(0.0f),
+      m_tx_load(0.0f),
+      m_peak_load(0.0f)
+{
+    initialize();
+}
+
+gateway_channel::~gateway_channel()
+{
+    close_ptt();
+}
+
+void gateway_channel::initialize()
+{
+    m_rx = nullptr;
+    m_tx = nullptr;
+    m_rx.reset(new crypto_rx_common(m_rx_name.c_str(), m_config_file.c_str()));
+    m_tx.reset(new crypto_tx_common(m_tx_name.c_str(), m_config_file.c_str()));
+    initialize_ptt();
+}
+
+// Only the output line of the [PTT] section is used, the voice level
+// stands in for the input
+void gateway_channel::initialize_ptt()
+{
+    const struct config* cfg = m_tx->get_config();
+
+    close_ptt();
+    if (!cfg->ptt_enabled)
+    {
+        return;
+    }
+
+    m_ptt_out_line = gpiod_line_get("gpiochip0", cfg->ptt_output_gpio_num);
+    if (m_ptt_out_line == nullptr)
+    {
+        m_tx->log_to_logger(LOG_WARN, "Could not open PTT output line");
+        return;
+    }
+
+    const int flags = cfg->ptt_output_bias |
+                      cfg->ptt_output_drive |
+                      cfg->ptt_output_active_low;
+    if (gpiod_line_request_output_flags(m_ptt_out_line, m_tx_name.c_str(), flags, 0) != 0)
+    {
+        m_tx->log_to_logger(LOG_WARN, "Could not request PTT output line");
+        close_ptt();
+        return;
+    }
+    m_ptt_val = 0;
+}
+
+void gateway_channel::close_ptt()
+{
+    if (m_ptt_out_line != nullptr)
+    {
+        gpiod_line_close_chip(m_ptt_out_line);
+        m_ptt_out_line = nullptr;
+    }
+    m_ptt_val = -1;
+    m_ptt_delay_periods = 0;
+}
+
+void gateway_channel::set_ptt(bool val)
+{
+    const int cur_val = static_cast<int>(val);
+    if (m_ptt_out_line != nullptr &&
+        m_ptt_val != cur_val &&
+        gpiod_line_set_value(m_ptt_out_line, cur_val) == 0)
+    {
+        m_ptt_val = cur_val;
+    }
+}
+
+bool gateway_channel::register_ports(jack_client_t* client)
+{
+    const std::string prefix = channel_name("ch", m_number);
+
+    m_modem_in_port = jack_port_register(client,
+                                         (prefix + "_modem_in").c_str(),
+                                         JACK_DEFAULT_AUDIO_TYPE,
+                                         JackPortIsInput,
+                                         0);
+    m_voice_out_port = jack_port_register(client,
+                                          (prefix + "_voice_out").c_str(),
+                                          JACK_DEFAULT_AUDIO_TYPE,
+                                          JackPortIsOutput,
+                                          0);
+    m_voice_in_port = jack_port_register(client,
+                                         (prefix + "_voice_in").c_str(),
+                                         JACK_DEFAULT_AUDIO_TYPE,
+                                         JackPortIsInput,
+                                         0);
+    m_modem_out_port = jack_port_register(client,
+                                          (prefix + "_modem_out").c_str(),
+                                          JACK_DEFAULT_AUDIO_TYPE,
+                                          JackPortIsOutput,
+                                          0);
+
+    return m_modem_in_port != nullptr && m_voice_out_port != nullptr &&
+           m_voice_in_port != nullptr && m_modem_out_port != nullptr;
+}
+
+// Everything sized from both the modem and the JACK sample rate
+void gateway_channel::initialize_resamplers(jack_client_t* client)
+{
+    m_rx_params = get_jack_runtime_params(client, m_rx->get_runtime_params());
+    m_tx_params = get_jack_runtime_params(client, m_tx->get_runtime_params());
+
+    const jack_nframes_t jack_sample_rate = jack_get_sample_rate(client);
+    const jack_nframes_t period = jack_get_buffer_size(client);
+
+    m_rx_input.reset(new resampler(SRC_SINC_FASTEST, 1,
+        get_max_resampled_frames(m_rx_params.max_modem_samples_per_frame,
+                                 m_rx_params.modem_sample_rate,
+                                 jack_sample_rate) * 2));
+    m_rx_output.reset(new resampler(SRC_SINC_FASTEST, 1,
+        get_max_resampled_frames(m_rx_params.max_speech_samples_per_frame,
+                                 m_rx_params.speech_sample_rate,
+                                 jack_sample_rate) * 2));
+    m_tx_input.reset(new resampler(SRC_SINC_FASTEST, 1,
+        get_max_resampled_frames(m_tx_params.speech_samples_per_frame,
+                                 m_tx_params.speech_sample_rate,
+                                 jack_sample_rate) * 2));
+    m_tx_output.reset(new resampler(SRC_SINC_FASTEST, 1,
+        get_max_resampled_frames(m_tx_params.modem_samples_per_frame,
+                                 m_tx_params.modem_sample_rate,
+                                 jack_sample_rate) * 2));
+
+    m_rx_input->set_sample_rates(jack_sample_rate, m_rx_params.modem_sample_rate);
+    m_rx_output->set_sample_rates(m_rx_params.speech_sample_rate, jack_sample_rate);
+    m_tx_input->set_sample_rates(jack_sample_rate, m_tx_params.speech_sample_rate);
+    m_tx_output->set_sample_rates(m_tx_params.modem_sample_rate, jack_sample_rate);
+
+    // Prime the receive side the same way jack_crypto_rx does. The
+    // transmit side is primed on each rising edge
+    m_rx_input->enqueue_zeroes(period);
+    m_rx_input->clear();
+    m_rx_output->enqueue_zeroes(m_rx_params.max_speech_samples_per_frame);
+    m_rx_output->clear();
+
+    const struct config* cfg = m_rx->get_config();
+    m_playout.configure(jack_sample_rate, m_rx_params.speech_resampled_frames + period);
+    m_rx_output->set_drift_target(cfg->drift_compensation ? m_playout.target() : 0);
+
+    m_period_seconds = (double)period / jack_sample_rate;
+    m_vox_hang_len = jack_sample_rate * VOX_HANG_SECONDS;
+    m_vox_hang_left = 0;
+    m_transmitting_prev = false;
+    m_transmitting.store(false, std::memory_order_relaxed);
+}
+
+void gateway_channel::prepare(jack_client_t* client)
+{
+    initialize_resamplers(client);
+}
+
+// Only the ports the channel's config names are connected, anything else
+// is left for whoever wires up the gateway
+void gateway_channel::connect(jack_client_t* client)
+{
+    const struct config* cfg = m_rx->get_config();
+
+    if (cfg->jack_modem_in_port[0] &&
+        jack_connect(client, cfg->jack_modem_in_port, jack_port_name(m_modem_in_port)) != 0)
+    {
+        m_rx->log_to_logger(LOG_WARN, "Could not connect modem input port");
+    }
+    if (cfg->jack_voice_in_port[0] &&
+        jack_connect(client, cfg->jack_voice_in_port, jack_port_name(m_voice_in_port)) != 0)
+    {
+        m_tx->log_to_logger(LOG_WARN, "Could not connect voice input port");
+    }
+    if (cfg->jack_voice_out_port[0] &&
+        !connect_input_ports(client, m_voice_out_port, cfg->jack_voice_out_port))
+    {
+        m_rx->log_to_logger(LOG_WARN, "Could not connect voice output port");
+    }
+    if (cfg->jack_modem_out_port[0] &&
+        !connect_input_ports(client, m_modem_out_port, cfg->jack_modem_out_port))
+    {
+        m_tx->log_to_logger(LOG_WARN, "Could not connect modem output port");
+    }
+}
+
+bool gateway_channel::reload()
+{
+    const unsigned rx_changes = m_rx->check_reload();
+    const unsigned tx_changes = m_tx->check_reload();
+    const unsigned changes = rx_changes | tx_changes;
+
+    if (changes & CONFIG_CHANGE_RESTART)
+    {
+        m_rx->log_to_logger(LOG_WARN, "Some settings only take effect after a restart");
+    }
+
+    // Both read the same file, so a codec or JACK change shows up in both.
+    // The PTT line is driven from the transmit job, so it is only reopened
+    // with the client inactive too
+    if ((changes & (CONFIG_CHANGE_CODEC | CONFIG_CHANGE_JACK | CONFIG_CHANGE_PTT)) != 0)
+    {
+        return false;
+    }
+    return m_rx->apply_reload(rx_changes) && m_tx->apply_reload(tx_changes);
+}
+
+void gateway_channel::rebuild(jack_client_t* client)
+{
+    initialize();
+    initialize_resamplers(client);
+}
+
+void gateway_channel::begin_period(jack_nframes_t nframes)
+{
+    m_nframes = nframes;
+    m_modem_in = (const jack_default_audio_sample_t*)jack_port_get_buffer(m_modem_in_port, nframes);
+    m_voice_out = (jack_default_audio_sample_t*)jack_port_get_buffer(m_voice_out_port, nframes);
+    m_voice_in = (const jack_default_audio_sample_t*)jack_port_get_buffer(m_voice_in_port, nframes);
+    m_modem_out = (jack_default_audio_sample_t*)jack_port_get_buffer(m_modem_out_port, nframes);
+}
+
+void gateway_channel::run_rx(void* arg)
+{
+    gateway_channel* const channel = static_cast<gateway_channel*>(arg);
+    const double start = now_seconds();
+    channel->process_rx();
+    channel->account(channel->m_rx_load, start);
+}
+
+void gateway_channel::run_tx(void* arg)
+{
+    gateway_channel* const channel = static_cast<gateway_channel*>(arg);
+    const double start = now_seconds();
+    channel->process_tx();
+    channel->account(channel->m_tx_load, start);
+}
+
+void gateway_channel::account(std::atomic<float>& load, double start)
+{
+    const float used = (now_seconds() - start) / m_period_seconds;
+
+    const float avg = load.load(std::memory_order_relaxed);
+    load.store(avg + ((used - avg) * LOAD_SMOOTHING), std::memory_order_relaxed);
+
+    // Both sides of the channel may finish at once
+    float peak = m_peak_load.load(std::memory_order_relaxed);
+    while (used > peak &&
+           !m_peak_load.compare_exchange_weak(peak, used, std::memory_order_relaxed))
+    {
+    }
+}
+
+// The same as jack_crypto_rx, without the notifications and volume
+void gateway_channel::process_rx()
+{
+    const jack_nframes_t nframes = m_nframes;
+    m_rx_input->enqueue(m_modem_in, nframes);
+
+    const size_t n_max_modem_samples = m_rx_params.max_modem_samples_per_frame;
+    const size_t n_max_speech_samples = m_rx_params.max_speech_samples_per_frame;
+
+    size_t nin = m_rx->needed_modem_samples();
+    while (m_rx_input->available_elems() >= nin)
+    {
+        float demod_in[n_max_modem_samples];
+        short voice_out[n_max_speech_samples] = {0};
+
+        m_rx_input->dequeue(demod_in, nin);
+
+        const size_t nout = m_rx->receive(voice_out, demod_in);
+        m_rx_output->enqueue(voice_out, nout);
+
+        nin = m_rx->needed_modem_samples();
+    }
+    m_synced.store(m_rx->is_synced(), std::memory_order_relaxed);
+
+    m_playout.read(*m_rx_output, m_voice_out, nframes);
+}
+
+// The same as jack_crypto_tx with the PTT input replaced by the voice
+// level, and no prompts
+void gateway_channel::process_tx()
+{
+    const jack_nframes_t nframes = m_nframes;
+    const size_t n_nom_modem_samples = m_tx_params.modem_samples_per_frame;
+    const size_t n_speech_samples = m_tx_params.speech_samples_per_frame;
+
+    if (simd_peak(m_voice_in, nframes) > VOX_LEVEL)
+    {
+        m_vox_hang_left = m_vox_hang_len;
+    }
+    else
+    {
+        m_vox_hang_left -= std::min<size_t>(m_vox_hang_left, nframes);
+    }
+    const bool transmitting_cur = m_vox_hang_left != 0;
+
+    if (transmitting_cur)
+    {
+        // Only "prime" the resamplers on the "rising edge"
+        if (!m_transmitting_prev)
+        {
+            m_tx_input->enqueue_zeroes(nframes);
+            m_tx_input->clear();
+
+            m_tx_output->enqueue_zeroes(n_nom_modem_samples);
+            m_tx_output->clear();
+        }
+
+        set_ptt(true);
+        m_ptt_delay_periods = 0;
+
+        m_tx_input->enqueue(m_voice_in, nframes);
+
+        while (m_tx_input->available_elems() >= n_speech_samples)
+        {
+            float mod_out[n_nom_modem_samples];
+            short voice_in[n_speech_samples];
+            m_tx_input->dequeue(voice_in, n_speech_samples);
+
+            const size_t nout = m_tx->transmit(mod_out, voice_in);
+            m_tx_output->enqueue(mod_out, nout);
+        }
+
+        const uint modem_resampled_frames = m_tx_params.modem_resampled_frames;
+        const uint required_frames =
+            (modem_resampled_frames + (nframes - 1)) / nframes;
+        const uint required_elems = nframes * required_frames;
+        if (m_tx_output->available_elems() >= required_elems)
+        {
+            m_tx_output->dequeue(m_modem_out, nframes);
+        }
+        else
+        {
+            zeroize_frames(m_modem_out, nframes);
+        }
+    }
+    else
+    {
+        // Only flush on the "falling edge"
+        if (m_transmitting_prev)
+        {
+            m_tx_input->flush(n_speech_samples * 2);
+
+            while (m_tx_input->available_elems() != 0)
+            {
+                float mod_out[n_nom_modem_samples];
+                short voice_in[n_speech_samples] = {0};
+                m_tx_input->dequeue(voice_in,
+                                    std::min(n_speech_samples,
+                                             m_tx_input->available_elems()));
+
+                const size_t nout = m_tx->transmit(mod_out, voice_in);
+                m_tx_output->enqueue(mod_out, nout);
+            }
+
+            m_tx_output->flush(nframes * 2);
+        }
+
+        const size_t available_frames =
+            std::min((size_t)nframes, m_tx_output->available_elems());
+        m_tx_output->dequeue(m_modem_out, available_frames);
+        zeroize_frames(m_modem_out + available_frames, nframes - available_frames);
+
+        // Force a new IV next time the channel keys up
+        m_tx->force_rekey_next_frame();
+
+        // Release the PTT output once the modem output has drained
+        if (available_frames == 0)
+        {
+            if (m_ptt_delay_periods == PTT_DEAD_KEY_PERIODS)
+            {
+                set_ptt(false);
+            }
+            else
+            {
+                ++m_ptt_delay_periods;
+            }
+        }
+    }
+
+    m_transmitting_prev = transmitting_cur;
+    m_transmitting.store(transmitting_cur, std::memory_order_relaxed);
+}
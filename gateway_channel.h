@@ -0,0 +1,176 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef GATEWAY_CHANNEL_H
+#define GATEWAY_CHANNEL_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include <jack/jack.h>
+
+#include "crypto_tx_common.h"
+#include "crypto_rx_common.h"
+#include "resampler.h"
+#include "playout_buffer.h"
+#include "jack_common.h"
+
+struct gpiod_line;
+
+// One radio of the gateway. Each channel has its own config file, and so
+// its own mode and key, and its own four JACK ports named after it:
+//
+//   ch<N>_modem_in  -> receive  -> ch<N>_voice_out
+//   ch<N>_voice_in  -> transmit -> ch<N>_modem_out
+//
+// The receive and transmit sides are separate DSP jobs, so they can run on
+// different threads. A channel keys up whenever its voice input carries
+// anything above the noise floor, which is what bridging one channel's
+// voice output to another's input needs, since the receive side outputs
+// exact silence between transmissions. While it transmits it drives the
+// PTT output line its config's [PTT] section names, as jack_crypto_tx
+// does. Without one the radio has to key itself on VOX.
+//
+// Construction, prepare, connect and reload are called from the main
+// thread with the JACK client inactive (reload aside), begin_period from
+// the JACK thread and the jobs from any pool thread. The statistics can be
+// read from any thread
+class gateway_channel
+{
+public:
+    gateway_channel(unsigned number, const char* config_file, int priority);
+    ~gateway_channel();
+
+    unsigned number() const
+    {
+        return m_number;
+    }
+
+    int priority() const
+    {
+        return m_priority;
+    }
+
+    bool register_ports(jack_client_t* client);
+    void prepare(jack_client_t* client);
+    void connect(jack_client_t* client);
+
+    // Picks up key and live changes in place. Returns false if the channel
+    // has to be rebuilt with the client inactive, which rebuild does
+    bool reload();
+    void rebuild(jack_client_t* client);
+
+    // Fetches this period's port buffers, which only the JACK thread can do
+    void begin_period(jack_nframes_t nframes);
+
+    static void run_rx(void* arg);
+    static void run_tx(void* arg);
+
+    bool synced() const
+    {
+        return m_synced.load(std::memory_order_relaxed);
+    }
+
+    bool transmitting() const
+    {
+        return m_transmitting.load(std::memory_order_relaxed);
+    }
+
+    // Fraction of the period each side takes, averaged over about a second,
+    // and the most either has taken since the last call to take_peak_load
+    float rx_load() const
+    {
+        return m_rx_load.load(std::memory_order_relaxed);
+    }
+
+    float tx_load() const
+    {
+        return m_tx_load.load(std::memory_order_relaxed);
+    }
+
+    float take_peak_load()
+    {
+        return m_peak_load.exchange(0.0f, std::memory_order_relaxed);
+    }
+
+    const playout_buffer& playout() const
+    {
+        return m_playout;
+    }
+
+    const struct config* rx_config() const
+    {
+        return m_rx->get_config();
+    }
+
+private:
+    void initialize();
+    void initialize_ptt();
+    void close_ptt();
+    void set_ptt(bool val);
+    void initialize_resamplers(jack_client_t* client);
+    void process_rx();
+    void process_tx();
+    void account(std::atomic<float>& load, double start);
+
+private:
+    const unsigned    m_number;
+    const int         m_priority;
+    const std::string m_config_file;
+    const std::string m_rx_name;
+    const std::string m_tx_name;
+
+    std::unique_ptr<crypto_rx_common> m_rx;
+    std::unique_ptr<crypto_tx_common> m_tx;
+
+    jack_port_t* m_modem_in_port;
+    jack_port_t* m_voice_out_port;
+    jack_port_t* m_voice_in_port;
+    jack_port_t* m_modem_out_port;
+
+    jack_runtime_params m_rx_params;
+    jack_runtime_params m_tx_params;
+
+    std::unique_ptr<resampler> m_rx_input;
+    std::unique_ptr<resampler> m_rx_output;
+    std::unique_ptr<resampler> m_tx_input;
+    std::unique_ptr<resampler> m_tx_output;
+    playout_buffer             m_playout;
+
+    // This period's buffers and length, from begin_period
+    jack_nframes_t                     m_nframes;
+    const jack_default_audio_sample_t* m_modem_in;
+    jack_default_audio_sample_t*       m_voice_out;
+    const jack_default_audio_sample_t* m_voice_in;
+    jack_default_audio_sample_t*       m_modem_out;
+
+    double m_period_seconds;
+    size_t m_vox_hang_len;
+    size_t m_vox_hang_left;
+    bool   m_transmitting_prev;
+
+    // Only touched by the transmit job once the client is active
+    struct gpiod_line* m_ptt_out_line;
+    int                m_ptt_val;
+    unsigned           m_ptt_delay_periods;
+
+    std::atomic<bool>  m_synced;
+    std::atomic<bool>  m_transmitting;
+    std::atomic<float> m_rx_load;
+    std::atomic<float> m_tx_load;
+    std::atomic<float> m_peak_load;
+};
+
+#endif
@@ -0,0 +1,503 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/falloc.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+
+// Writes an SD card image to one or more devices at once and verifies
+// them. The image is read once, in chunks, while the previous chunk is
+// being written to every target. Each chunk's hash is kept so the targets
+// can be read back and checked without a copy of the image.
+//
+// usage: imgwrite [-c] <Image> <Device> [<Device> ...]
+//   -c  Only compare the devices against the image
+
+#define CHUNK_SIZE (1024 * 1024)
+// Covers the logical block size of anything O_DIRECT will be used on
+#define IO_ALIGN 4096
+#define NUM_BUFFERS 2
+#define MAX_TARGETS 8
+
+struct chunk
+{
+    unsigned char* data;
+    size_t len;
+    int zero;
+    long index;     // Which chunk of the image is in the buffer, -1 if none
+    int pending;    // Targets that still have to write it
+};
+
+struct image
+{
+    int fd;
+    off_t size;
+    long num_chunks;
+    uint64_t* hashes;
+    int write;
+    int read_error;     // errno of a failed image read
+
+    struct chunk chunks[NUM_BUFFERS];
+    int num_targets;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+struct target
+{
+    const char* path;
+    struct image* img;
+    int fd;
+    int direct;
+    int is_block;
+    int ok;
+    pthread_t thread;
+};
+
+// FNV-1a over 64 bit words with an extra shift to spread the high bits.
+// Only meant to catch bad writes, not tampering
+static uint64_t hash_block(const unsigned char* data, size_t len)
+{
+    uint64_t hash = 14695981039346656037ull;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t))
+    {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 1099511628211ull;
+        hash ^= hash >> 29;
+    }
+    for (; i < len; ++i)
+    {
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+static int is_zero(const unsigned char* data, size_t len)
+{
+    return len > 0 && data[0] == 0 && memcmp(data, data + 1, len - 1) == 0;
+}
+
+static int pread_all(int fd, unsigned char* data, size_t len, off_t offset, size_t* got)
+{
+    *got = 0;
+    while (*got < len)
+    {
+        const ssize_t ret = pread(fd, data + *got, len - *got, offset + *got);
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret < 0)
+        {
+            return 0;
+        }
+        if (ret == 0)
+        {
+            break;
+        }
+        *got += ret;
+    }
+    return 1;
+}
+
+static int pwrite_all(int fd, const unsigned char* data, size_t len, off_t offset)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        const ssize_t ret = pwrite(fd, data + done, len - done, offset + done);
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            return 0;
+        }
+        done += ret;
+    }
+    return 1;
+}
+
+static int set_direct(struct target* t, int direct)
+{
+    const int flags = fcntl(t->fd, F_GETFL);
+    if (flags < 0 ||
+        fcntl(t->fd, F_SETFL, direct ? (flags | O_DIRECT) : (flags & ~O_DIRECT)) < 0)
+    {
+        return 0;
+    }
+    t->direct = direct;
+    return 1;
+}
+
+// Zeroes a range without sending the zeroes over the bus, where the target
+// can do that
+static int zero_range(struct target* t, off_t offset, size_t len)
+{
+    if (t->is_block)
+    {
+        if (offset % 512 != 0 || len % 512 != 0)
+        {
+            return 0;
+        }
+        uint64_t range[2] = { (uint64_t)offset, (uint64_t)len };
+        return ioctl(t->fd, BLKZEROOUT, range) == 0;
+    }
+
+    return fallocate(t->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len) == 0;
+}
+
+static int write_chunk(struct target* t, const struct chunk* c, off_t offset)
+{
+    if (c->zero && zero_range(t, offset, c->len))
+    {
+        return 1;
+    }
+
+    // O_DIRECT needs whole sectors, so the tail of an odd sized image goes
+    // through the page cache
+    const size_t direct_len = t->direct ? (c->len & ~(size_t)(IO_ALIGN - 1)) : c->len;
+    if (!pwrite_all(t->fd, c->data, direct_len, offset))
+    {
+        return 0;
+    }
+    if (direct_len < c->len)
+    {
+        return set_direct(t, 0) &&
+               pwrite_all(t->fd, c->data + direct_len, c->len - direct_len, offset + direct_len);
+    }
+
+    return 1;
+}
+
+// Makes sure the verify pass reads the device rather than the page cache
+static int flush_target(struct target* t)
+{
+    if (fsync(t->fd) != 0)
+    {
+        return 0;
+    }
+
+    if (!t->direct && !set_direct(t, 1))
+    {
+        if (t->is_block)
+        {
+            ioctl(t->fd, BLKFLSBUF, 0);
+        }
+        posix_fadvise(t->fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    return 1;
+}
+
+static int verify_target(struct target* t, unsigned char* buffer)
+{
+    const struct image* img = t->img;
+    for (long i = 0; i < img->num_chunks; ++i)
+    {
+        const off_t offset = (off_t)i * CHUNK_SIZE;
+        const size_t len = (img->size - offset) < CHUNK_SIZE ? (size_t)(img->size - offset) : CHUNK_SIZE;
+        const size_t read_len = t->direct ? (len + IO_ALIGN - 1) & ~(size_t)(IO_ALIGN - 1) : len;
+
+        size_t got = 0;
+        if (!pread_all(t->fd, buffer, read_len, offset, &got))
+        {
+            fprintf(stderr, "%s: %s\n", t->path, strerror(errno));
+            return 0;
+        }
+        if (got < len || hash_block(buffer, len) != img->hashes[i])
+        {
+            fprintf(stderr, "%s: Mismatch at byte %lld\n", t->path, (long long)offset);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void* target_thread(void* arg)
+{
+    struct target* t = (struct target*)arg;
+    struct image* img = t->img;
+
+    for (long i = 0; i < img->num_chunks; ++i)
+    {
+        struct chunk* c = &img->chunks[i % NUM_BUFFERS];
+
+        pthread_mutex_lock(&img->lock);
+        while (c->index != i && !img->read_error)
+        {
+            pthread_cond_wait(&img->cond, &img->lock);
+        }
+        if (img->read_error)
+        {
+            pthread_mutex_unlock(&img->lock);
+            t->ok = 0;
+            return NULL;
+        }
+        pthread_mutex_unlock(&img->lock);
+
+        // A failed target keeps taking chunks so the others aren't held up
+        if (t->ok && img->write && !write_chunk(t, c, (off_t)i * CHUNK_SIZE))
+        {
+            fprintf(stderr, "%s: %s\n", t->path, strerror(errno));
+            t->ok = 0;
+        }
+
+        pthread_mutex_lock(&img->lock);
+        if (--c->pending == 0)
+        {
+            pthread_cond_broadcast(&img->cond);
+        }
+        pthread_mutex_unlock(&img->lock);
+    }
+
+    if (!t->ok)
+    {
+        return NULL;
+    }
+
+    if (img->write && !flush_target(t))
+    {
+        fprintf(stderr, "%s: %s\n", t->path, strerror(errno));
+        t->ok = 0;
+        return NULL;
+    }
+
+    if (img->write)
+    {
+        fprintf(stderr, "Verifying %s\n", t->path);
+    }
+
+    unsigned char* buffer = NULL;
+    if (posix_memalign((void**)&buffer, IO_ALIGN, CHUNK_SIZE) != 0)
+    {
+        fprintf(stderr, "%s: Out of memory\n", t->path);
+        t->ok = 0;
+        return NULL;
+    }
+    t->ok = verify_target(t, buffer);
+    free(buffer);
+
+    return NULL;
+}
+
+// Reads the image into whichever buffer every target is done with
+static void read_image(struct image* img)
+{
+    int last_percent = -1;
+    for (long i = 0; i < img->num_chunks; ++i)
+    {
+        struct chunk* c = &img->chunks[i % NUM_BUFFERS];
+
+        pthread_mutex_lock(&img->lock);
+        while (c->pending > 0)
+        {
+            pthread_cond_wait(&img->cond, &img->lock);
+        }
+        pthread_mutex_unlock(&img->lock);
+
+        const off_t offset = (off_t)i * CHUNK_SIZE;
+        const size_t len = (img->size - offset) < CHUNK_SIZE ? (size_t)(img->size - offset) : CHUNK_SIZE;
+        size_t got = 0;
+        const int error = !pread_all(img->fd, c->data, len, offset, &got) ? errno :
+                          got != len ? EIO : 0;
+
+        pthread_mutex_lock(&img->lock);
+        if (error != 0)
+        {
+            img->read_error = error;
+            pthread_cond_broadcast(&img->cond);
+            pthread_mutex_unlock(&img->lock);
+            return;
+        }
+        pthread_mutex_unlock(&img->lock);
+
+        img->hashes[i] = hash_block(c->data, len);
+        c->zero = is_zero(c->data, len);
+        c->len = len;
+
+        pthread_mutex_lock(&img->lock);
+        c->index = i;
+        c->pending = img->num_targets;
+        pthread_cond_broadcast(&img->cond);
+        pthread_mutex_unlock(&img->lock);
+
+        const int percent = (int)((i + 1) * 100 / img->num_chunks);
+        if (img->write && percent / 10 != last_percent / 10)
+        {
+            fprintf(stderr, "%3d%%\n", percent);
+            last_percent = percent;
+        }
+    }
+}
+
+static int open_target(struct target* t, off_t size, int write)
+{
+    // Comparing only reads, so a write-protected card can still be checked
+    const int flags = write ? (O_RDWR | O_CREAT) : O_RDONLY;
+
+    t->direct = 1;
+    t->fd = open(t->path, flags | O_DIRECT | O_CLOEXEC, 0644);
+    if (t->fd < 0 && errno == EINVAL)
+    {
+        // Not supported by the filesystem, e.g. tmpfs
+        t->direct = 0;
+        t->fd = open(t->path, flags | O_CLOEXEC, 0644);
+    }
+    if (t->fd < 0)
+    {
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(t->fd, &st) != 0)
+    {
+        return 0;
+    }
+    t->is_block = S_ISBLK(st.st_mode);
+
+    if (t->is_block)
+    {
+        uint64_t dev_size = 0;
+        if (ioctl(t->fd, BLKGETSIZE64, &dev_size) != 0)
+        {
+            return 0;
+        }
+        if (dev_size < (uint64_t)size)
+        {
+            errno = ENOSPC;
+            return 0;
+        }
+    }
+    else if (write && ftruncate(t->fd, size) != 0)
+    {
+        // Same as dd, a file ends up the size of the image
+        return 0;
+    }
+
+    return 1;
+}
+
+int main(int argc, char* argv[])
+{
+    int write = 1;
+    int arg = 1;
+    if (arg < argc && strcmp(argv[arg], "-c") == 0)
+    {
+        write = 0;
+        ++arg;
+    }
+
+    const int num_targets = argc - arg - 1;
+    if (num_targets < 1 || num_targets > MAX_TARGETS)
+    {
+        fprintf(stderr, "usage: %s [-c] <Image> <Device> [<Device> ...]\n", argv[0]);
+        return 1;
+    }
+
+    struct image img;
+    memset(&img, 0, sizeof(img));
+    img.write = write;
+    img.num_targets = num_targets;
+    pthread_mutex_init(&img.lock, NULL);
+    pthread_cond_init(&img.cond, NULL);
+
+    img.fd = open(argv[arg], O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (img.fd < 0 || fstat(img.fd, &st) != 0)
+    {
+        fprintf(stderr, "%s: %s\n", argv[arg], strerror(errno));
+        return 1;
+    }
+    posix_fadvise(img.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    img.size = st.st_size;
+    img.num_chunks = (img.size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+    img.hashes = (uint64_t*)calloc(img.num_chunks + 1, sizeof(uint64_t));
+    for (int i = 0; i < NUM_BUFFERS; ++i)
+    {
+        img.chunks[i].index = -1;
+        if (posix_memalign((void**)&img.chunks[i].data, IO_ALIGN, CHUNK_SIZE) != 0)
+        {
+            img.chunks[i].data = NULL;
+        }
+        if (img.chunks[i].data == NULL || img.hashes == NULL)
+        {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+    }
+
+    struct target targets[MAX_TARGETS];
+    memset(targets, 0, sizeof(targets));
+    for (int i = 0; i < num_targets; ++i)
+    {
+        struct target* t = &targets[i];
+        t->path = argv[arg + 1 + i];
+        t->img = &img;
+        t->ok = 1;
+        if (!open_target(t, img.size, write))
+        {
+            fprintf(stderr, "%s: %s\n", t->path, strerror(errno));
+            return 1;
+        }
+    }
+
+    fprintf(stderr, write ? "Copying\n" : "Verifying\n");
+
+    for (int i = 0; i < num_targets; ++i)
+    {
+        if (pthread_create(&targets[i].thread, NULL, target_thread, &targets[i]) != 0)
+        {
+            fprintf(stderr, "Could not start thread\n");
+            return 1;
+        }
+    }
+
+    read_image(&img);
+    if (img.read_error)
+    {
+        fprintf(stderr, "%s: %s\n", argv[arg], strerror(img.read_error));
+    }
+
+    int ret = img.read_error ? 1 : 0;
+    for (int i = 0; i < num_targets; ++i)
+    {
+        pthread_join(targets[i].thread, NULL);
+        close(targets[i].fd);
+        if (!targets[i].ok)
+        {
+            ret = 1;
+        }
+    }
+
+    if (ret == 0)
+    {
+        fprintf(stderr, "Success\n");
+    }
+
+    return ret;
+}
@@ -1,10 +1,275 @@
+#include <sys/stat.h>
+#include <unistd.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
 
 #include "minIni.h"
+#include "crypto_cfg.h"
+#include "config_snapshot.h"
 
 char buffer[1024] = {0};
 
+// Batch mode resolves or updates many keys with one pass over each file:
+//
+// iniget -e <Spec> [-e <Spec> ...] <Filename> ...
+//
+//   Section/Key        prints Section_Key='value'
+//   NAME=Section/Key   prints NAME='value'
+//   Section/*          prints Section_Key='value' for every key in Section
+//   NAME=Section/*     prints NAME_Key='value' for every key in Section
+//
+// The output is meant for eval. As with a single lookup, the first file
+// with a non-empty value wins. A config snapshot can be given in place of
+// the INI files.
+//
+// iniset -e <Section/Key=Value> [-e ...] <Filename> ...
+//
+// All values are checked before any file is touched, then each file is
+// rewritten once and renamed into place. An empty value deletes the key.
+
+struct lookup
+{
+    char* name;
+    char* section;
+    // NULL for a whole section
+    char* key;
+};
+
+struct result
+{
+    int    lookup;
+    char*  name;
+    char*  key;
+    char*  value;
+    // The file the value came from, so only the first occurrence of a key
+    // in each file is used
+    int    file;
+};
+
+struct batch_get
+{
+    struct lookup* lookups;
+    int            num_lookups;
+    struct result* results;
+    int            num_results;
+    int            file;
+};
+
+struct update
+{
+    const char* section;
+    const char* key;
+    // NULL to delete the key
+    const char* value;
+    int         applied;
+};
+
+// Turns str into a valid shell variable name in place
+static void make_var_name(char* str)
+{
+    if (isdigit((unsigned char)*str))
+    {
+        *str = '_';
+    }
+    for (char* p = str; *p != '\0'; ++p)
+    {
+        if (!isalnum((unsigned char)*p) && *p != '_')
+        {
+            *p = '_';
+        }
+    }
+}
+
+static char* join_var_name(const char* prefix, const char* suffix)
+{
+    char* name = malloc(strlen(prefix) + strlen(suffix) + 2);
+    sprintf(name, "%s_%s", prefix, suffix);
+    make_var_name(name);
+    return name;
+}
+
+static int parse_lookup(char* spec, struct lookup* lookup)
+{
+    char* path = strchr(spec, '=');
+    if (path != NULL)
+    {
+        *path++ = '\0';
+    }
+    else
+    {
+        path = spec;
+    }
+
+    char* key = strchr(path, '/');
+    if (key == NULL || key == path || key[1] == '\0')
+    {
+        return 0;
+    }
+    *key++ = '\0';
+
+    lookup->section = path;
+    lookup->key = strcmp(key, "*") == 0 ? NULL : key;
+    if (path != spec)
+    {
+        lookup->name = strdup(spec);
+        make_var_name(lookup->name);
+    }
+    else if (lookup->key != NULL)
+    {
+        lookup->name = join_var_name(lookup->section, lookup->key);
+    }
+    else
+    {
+        lookup->name = strdup(lookup->section);
+        make_var_name(lookup->name);
+    }
+
+    return *lookup->name != '\0';
+}
+
+static struct result* add_result(struct batch_get* batch, int lookup, const char* name, const char* key)
+{
+    batch->results = realloc(batch->results, (batch->num_results + 1) * sizeof(struct result));
+    struct result* r = &batch->results[batch->num_results++];
+    r->lookup = lookup;
+    r->name = (char*)name;
+    r->key = strdup(key);
+    r->value = strdup("");
+    r->file = -1;
+    return r;
+}
+
+static void set_result(struct result* r, const char* value, int file)
+{
+    if (*r->value == '\0' && r->file != file)
+    {
+        free(r->value);
+        r->value = strdup(value);
+        r->file = file;
+    }
+}
+
+static int batch_get_callback(const mTCHAR *Section, const mTCHAR *Key, const mTCHAR *Value, void *UserData)
+{
+    struct batch_get* batch = (struct batch_get*)UserData;
+
+    for (int i = 0; i < batch->num_lookups; ++i)
+    {
+        const struct lookup* l = &batch->lookups[i];
+        if (strcasecmp(l->section, Section) != 0)
+        {
+            continue;
+        }
+
+        if (l->key != NULL)
+        {
+            if (strcasecmp(l->key, Key) == 0)
+            {
+                set_result(&batch->results[i], Value, batch->file);
+            }
+            continue;
+        }
+
+        struct result* r = NULL;
+        for (int j = batch->num_lookups; j < batch->num_results; ++j)
+        {
+            if (batch->results[j].lookup == i && strcasecmp(batch->results[j].key, Key) == 0)
+            {
+                r = &batch->results[j];
+                break;
+            }
+        }
+        if (r == NULL)
+        {
+            r = add_result(batch, i, join_var_name(l->name, Key), Key);
+        }
+        set_result(r, Value, batch->file);
+    }
+
+    return 1;
+}
+
+static void print_shell_assignment(const char* name, const char* value)
+{
+    printf("%s='", name);
+    for (const char* p = value; *p != '\0'; ++p)
+    {
+        if (*p == '\'')
+        {
+            fputs("'\\''", stdout);
+        }
+        else
+        {
+            putchar(*p);
+        }
+    }
+    printf("'\n");
+}
+
+int iniget_batch(int argc, char* argv[])
+{
+    struct batch_get batch;
+    memset(&batch, 0, sizeof(batch));
+    batch.lookups = calloc(argc, sizeof(struct lookup));
+
+    int i = 1;
+    for (; i + 1 < argc && strcmp(argv[i], "-e") == 0; i += 2)
+    {
+        if (!parse_lookup(argv[i + 1], &batch.lookups[batch.num_lookups]))
+        {
+            fprintf(stderr, "Invalid lookup: %s\n", argv[i + 1]);
+            return 1;
+        }
+        ++batch.num_lookups;
+    }
+
+    if (batch.num_lookups == 0 || i >= argc)
+    {
+        fprintf(stderr, "usage: %s -e <Section/Key> [-e ...] <Filename> ...\n", argv[0]);
+        return 1;
+    }
+
+    // Results for single keys line up with their lookups, whole sections
+    // add theirs at the end as keys turn up
+    for (int j = 0; j < batch.num_lookups; ++j)
+    {
+        const struct lookup* l = &batch.lookups[j];
+        struct result* r = add_result(&batch, j, l->name, l->key != NULL ? l->key : "");
+        r->name = l->key != NULL ? l->name : NULL;
+    }
+
+    for (batch.file = 0; i < argc; ++i, ++batch.file)
+    {
+        if (is_config_snapshot(argv[i]))
+        {
+            struct config_snapshot* snap = config_snapshot_open_current(argv[i]);
+            if (snap == NULL)
+            {
+                fprintf(stderr, "Could not load config snapshot %s\n", argv[i]);
+                return 2;
+            }
+            config_snapshot_browse(snap, batch_get_callback, &batch);
+            config_snapshot_close(snap);
+        }
+        else
+        {
+            ini_browse(batch_get_callback, &batch, argv[i]);
+        }
+    }
+
+    for (int j = 0; j < batch.num_results; ++j)
+    {
+        if (batch.results[j].name != NULL)
+        {
+            print_shell_assignment(batch.results[j].name, batch.results[j].value);
+        }
+    }
+
+    return 0;
+}
+
 int iniget(int argc, char* argv[])
 {
     if (argc < 4)
@@ -30,6 +295,16 @@ int iniset(int argc, char* argv[])
     }
 
     const char* val = *argv[3] ? argv[3] : NULL;
+
+    // Refuse values the daemons would ignore when reading them back
+    const struct config_entry* entry = find_config_entry(argv[1], argv[2]);
+    struct config scratch;
+    if (val != NULL && entry != NULL && !set_config_value(entry, val, &scratch))
+    {
+        fprintf(stderr, "Invalid value for [%s] %s: %s\n", argv[1], argv[2], val);
+        return 1;
+    }
+
     for (int i = 4; i < argc; ++i)
     {
         ini_puts(argv[1], argv[2], val, argv[i]);
@@ -38,16 +313,269 @@ int iniset(int argc, char* argv[])
     return 0;
 }
 
+// Splits a line into a key and a section name, ignoring anything else
+static int parse_ini_line(const char* line, char* section, size_t section_size, char* key, size_t key_size)
+{
+    while (isspace((unsigned char)*line))
+    {
+        ++line;
+    }
+
+    *section = '\0';
+    *key = '\0';
+    if (*line == '[')
+    {
+        const char* end = strchr(line, ']');
+        if (end != NULL)
+        {
+            snprintf(section, section_size, "%.*s", (int)(end - line - 1), line + 1);
+        }
+        return 1;
+    }
+    else if (*line == ';' || *line == '#' || *line == '\0')
+    {
+        return 0;
+    }
+
+    const char* end = line + strcspn(line, "=:");
+    if (*end == '\0')
+    {
+        return 0;
+    }
+    while (end > line && isspace((unsigned char)end[-1]))
+    {
+        --end;
+    }
+    snprintf(key, key_size, "%.*s", (int)(end - line), line);
+    return 0;
+}
+
+// Writes a key the way minIni's ini_puts does, so a batch set reads back
+// the same as a single one: a value with a '"', ';' or '#' in it, or a
+// trailing space, is put in quotes with its own quotes escaped
+static void write_key(FILE* out, const char* key, const char* value)
+{
+    const size_t len = strlen(value);
+    if (strpbrk(value, "\";#") == NULL && (len == 0 || value[len - 1] != ' '))
+    {
+        fprintf(out, "%s=%s\n", key, value);
+        return;
+    }
+
+    fprintf(out, "%s=\"", key);
+    for (const char* p = value; *p != '\0'; ++p)
+    {
+        if (*p == '"')
+        {
+            fputc('\\', out);
+        }
+        fputc(*p, out);
+    }
+    fputs("\"\n", out);
+}
+
+// Adds the updates for section that weren't already applied
+static void write_new_keys(FILE* out, const char* section, struct update* updates, int num_updates)
+{
+    for (int i = 0; i < num_updates; ++i)
+    {
+        struct update* u = &updates[i];
+        if (!u->applied && strcasecmp(u->section, section) == 0)
+        {
+            if (u->value != NULL)
+            {
+                write_key(out, u->key, u->value);
+            }
+            u->applied = 1;
+        }
+    }
+}
+
+static int rewrite_ini(const char* path, struct update* updates, int num_updates)
+{
+    char tmp_path[256];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+
+    FILE* in = fopen(path, "r");
+    FILE* out = fopen(tmp_path, "w");
+    if (out == NULL)
+    {
+        if (in != NULL)
+        {
+            fclose(in);
+        }
+        return 0;
+    }
+
+    struct stat st;
+    if (in != NULL && fstat(fileno(in), &st) == 0)
+    {
+        fchmod(fileno(out), st.st_mode & 07777);
+    }
+
+    for (int i = 0; i < num_updates; ++i)
+    {
+        updates[i].applied = 0;
+    }
+
+    char section[64] = {0};
+    char line_section[64];
+    char line_key[64];
+    // Blank lines are held back so new keys go right after the last one in
+    // their section
+    int blank_lines = 0;
+
+    char* line = NULL;
+    size_t line_size = 0;
+    while (in != NULL && getline(&line, &line_size, in) != -1)
+    {
+        const char* p = line;
+        while (isspace((unsigned char)*p))
+        {
+            ++p;
+        }
+        if (*p == '\0')
+        {
+            ++blank_lines;
+            continue;
+        }
+
+        if (parse_ini_line(line, line_section, sizeof(line_section), line_key, sizeof(line_key)))
+        {
+            write_new_keys(out, section, updates, num_updates);
+            strcpy(section, line_section);
+        }
+
+        for (; blank_lines > 0; --blank_lines)
+        {
+            fputc('\n', out);
+        }
+
+        struct update* match = NULL;
+        for (int i = 0; *line_key != '\0' && i < num_updates; ++i)
+        {
+            if (!updates[i].applied &&
+                strcasecmp(updates[i].section, section) == 0 &&
+                strcasecmp(updates[i].key, line_key) == 0)
+            {
+                match = &updates[i];
+                break;
+            }
+        }
+
+        if (match != NULL)
+        {
+            if (match->value != NULL)
+            {
+                write_key(out, match->key, match->value);
+            }
+            match->applied = 1;
+        }
+        else
+        {
+            fputs(line, out);
+            if (line[strlen(line) - 1] != '\n')
+            {
+                fputc('\n', out);
+            }
+        }
+    }
+    free(line);
+
+    write_new_keys(out, section, updates, num_updates);
+    for (; blank_lines > 0; --blank_lines)
+    {
+        fputc('\n', out);
+    }
+
+    // Sections that didn't exist yet go at the end
+    for (int i = 0; i < num_updates; ++i)
+    {
+        if (!updates[i].applied && updates[i].value != NULL)
+        {
+            fprintf(out, "\n[%s]\n", updates[i].section);
+            write_new_keys(out, updates[i].section, updates, num_updates);
+        }
+    }
+
+    const int ok = !ferror(out) && fflush(out) == 0 && fsync(fileno(out)) == 0;
+    if (in != NULL)
+    {
+        fclose(in);
+    }
+    if (fclose(out) != 0 || !ok || rename(tmp_path, path) != 0)
+    {
+        unlink(tmp_path);
+        return 0;
+    }
+
+    return 1;
+}
+
+int iniset_batch(int argc, char* argv[])
+{
+    struct update* updates = calloc(argc, sizeof(struct update));
+    int num_updates = 0;
+
+    int i = 1;
+    for (; i + 1 < argc && strcmp(argv[i], "-e") == 0; i += 2)
+    {
+        char* section = argv[i + 1];
+        char* key = strchr(section, '/');
+        char* val = key != NULL ? strchr(key, '=') : NULL;
+        if (val == NULL || key == section || val == key + 1)
+        {
+            fprintf(stderr, "Invalid update: %s\n", argv[i + 1]);
+            return 1;
+        }
+        *key++ = '\0';
+        *val++ = '\0';
+
+        // Refuse the whole batch if any value would be ignored
+        const struct config_entry* entry = find_config_entry(section, key);
+        struct config scratch;
+        if (*val != '\0' && entry != NULL && !set_config_value(entry, val, &scratch))
+        {
+            fprintf(stderr, "Invalid value for [%s] %s: %s\n", section, key, val);
+            return 1;
+        }
+
+        updates[num_updates].section = section;
+        updates[num_updates].key = key;
+        updates[num_updates].value = *val != '\0' ? val : NULL;
+        ++num_updates;
+    }
+
+    if (num_updates == 0 || i >= argc)
+    {
+        fprintf(stderr, "usage: %s -e <Section/Key=Value> [-e ...] <Filename> ...\n", argv[0]);
+        return 1;
+    }
+
+    int ret = 0;
+    for (; i < argc; ++i)
+    {
+        if (!rewrite_ini(argv[i], updates, num_updates))
+        {
+            fprintf(stderr, "Could not write %s\n", argv[i]);
+            ret = 1;
+        }
+    }
+
+    return ret;
+}
 
 int main(int argc, char* argv[])
 {
+    const int batch = argc > 1 && strcmp(argv[1], "-e") == 0;
+
     if (strcasestr(argv[0], "get"))
     {
-        return iniget(argc, argv);
+        return batch ? iniget_batch(argc, argv) : iniget(argc, argv);
     }
     else if (strcasestr(argv[0], "set"))
     {
-        return iniset(argc, argv);
+        return batch ? iniset_batch(argc, argv) : iniset(argc, argv);
     }
     else
     {
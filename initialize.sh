@@ -7,6 +7,8 @@ exec 2>/var/log/initialize.err
 
 function main()
 {
+    START=`boot_seconds`
+
     echo "0" > /sys/class/leds/led0/brightness
     echo "0" > /sys/class/leds/led1/brightness
 
@@ -34,16 +36,25 @@ function main()
     alsa_restore
 
     set_initialized
+    log_boot_phase initialize config "$START"
     echo "Initialized!"
 
     # Put a new seed onto the SD card. This call will block until the RNG is
     # initialized, so this needs to run in a background process (it is)
+    START=`boot_seconds`
     echo -n "Saving new seed..." && save_sd_seed && echo "Done!" || echo "Error."
 
     echo -n "Creating SD card image..." && \
         copy_sd_to_img "$SD_IMG" &> /dev/null && \
         extract_img_p1 "$SD_IMG" "$SD_IMG_DOS" && \
         echo "Done!" || echo "Error."
+    log_boot_phase initialize seed_and_image "$START"
+
+    # Runs alongside the audio clients, so it errs on the slow side. They
+    # pick up the new periods when the config changes
+    START=`boot_seconds`
+    echo -n "Calibrating JACK periods..." && calibrate_jack_periods_once && echo "Done!" || echo "Error."
+    log_boot_phase initialize calibrate "$START"
 }
 
 main | logger -t initialize -p daemon.info
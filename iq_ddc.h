@@ -0,0 +1,230 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IQ_DDC_H
+#define IQ_DDC_H
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include "crypto_rx_common.h"
+#include "simd.h"
+
+// Filter taps per output sample. Enough for a Blackman window to get from
+// the passband to 70 dB down within about a third of the output rate
+static const unsigned IQ_DDC_TAPS_PER_PHASE = 16;
+// Input samples mixed at a time, so the NCO's single precision phasor is
+// started over from the exact phase often
+static const size_t IQ_DDC_BLOCK = 2048;
+
+// Blackman windowed sinc with its cutoff given as a fraction of the sample
+// rate, scaled to unity gain at DC so levels match what a radio would give.
+// Decimating filters cut off at the output's Nyquist rate, and what the
+// transition band folds back lands at the top of the output band, well
+// clear of a channel centred on 0 Hz
+inline std::vector<float> iq_lowpass(size_t num_taps, double cutoff)
+{
+    const double mid = (num_taps - 1) / 2.0;
+    std::vector<float> taps(num_taps);
+    double sum = 0.0;
+    for (size_t i = 0; i < num_taps; ++i)
+    {
+        const double x = i - mid;
+        const double sinc = x == 0.0 ? 2.0 * cutoff :
+            sin(2.0 * M_PI * cutoff * x) / (M_PI * x);
+        const double w = 0.42 - (0.5 * cos((2.0 * M_PI * i) / (num_taps - 1))) +
+            (0.08 * cos((4.0 * M_PI * i) / (num_taps - 1)));
+        taps[i] = sinc * w;
+        sum += taps[i];
+    }
+
+    for (float& tap : taps)
+    {
+        tap /= sum;
+    }
+    return taps;
+}
+
+// Digital down-converter taking one channel out of an SDR's complex
+// baseband and handing it to a FreeDV modem. It
+//
+//   1. mixes the input with an NCO to bring the channel down to 0 Hz
+//   2. low pass filters it and decimates by a whole number to the modem's
+//      sample rate
+//   3. mixes it back up to where the mode expects the centre of its signal
+//
+// The result is the complex version of the audio a radio would have given,
+// which FreeDV's complex demodulators take as it is. The NCO can be nudged
+// to follow a signal drifting off frequency, see correct
+class iq_ddc
+{
+public:
+    iq_ddc()
+        : m_decimation(1),
+          m_input_rate(0),
+          m_output_rate(0),
+          m_offset(0),
+          m_correction(0),
+          m_centre(0),
+          m_mix_phase(0),
+          m_centre_phase(0),
+          m_fill(0),
+          m_next(0)
+    {
+    }
+
+    // Returns false unless input_rate is a whole multiple of output_rate
+    bool configure(unsigned input_rate, unsigned output_rate, double offset_hz, double centre_hz)
+    {
+        if (output_rate == 0 || input_rate % output_rate != 0)
+        {
+            return false;
+        }
+
+        m_input_rate = input_rate;
+        m_output_rate = output_rate;
+        m_decimation = input_rate / output_rate;
+        m_offset = offset_hz;
+        m_correction = 0;
+        m_centre = centre_hz;
+        m_mix_phase = 0;
+        m_centre_phase = 0;
+
+        design_filter();
+
+        const size_t history = m_taps.size() - 1;
+        m_re.assign(history + IQ_DDC_BLOCK, 0.0f);
+        m_im.assign(history + IQ_DDC_BLOCK, 0.0f);
+        m_fill = history;
+        m_next = 0;
+
+        m_out_re.resize((IQ_DDC_BLOCK / m_decimation) + 1);
+        m_out_im.resize((IQ_DDC_BLOCK / m_decimation) + 1);
+        return true;
+    }
+
+    unsigned decimation() const
+    {
+        return m_decimation;
+    }
+
+    // Moves the channel a further hz away from the configured offset
+    void correct(double hz)
+    {
+        m_correction += hz;
+    }
+
+    double correction() const
+    {
+        return m_correction;
+    }
+
+    // Converts count interleaved I/Q samples, returning how many modem
+    // samples were written to out. out needs room for
+    // (count / decimation()) + 1
+    size_t process(const float* iq, size_t count, iq_sample* out)
+    {
+        size_t written = 0;
+        while (count > 0)
+        {
+            const size_t n = std::min(count, IQ_DDC_BLOCK);
+            written += process_block(iq, n, out + written);
+            iq += n * 2;
+            count -= n;
+        }
+        return written;
+    }
+
+private:
+    void design_filter()
+    {
+        m_taps = iq_lowpass((IQ_DDC_TAPS_PER_PHASE * m_decimation) + 1, 0.5 / m_decimation);
+    }
+
+    static double wrap_phase(double phase)
+    {
+        return phase - (2.0 * M_PI * floor(phase / (2.0 * M_PI)));
+    }
+
+    size_t process_block(const float* iq, size_t count, iq_sample* out)
+    {
+        float* const re = m_re.data() + m_fill;
+        float* const im = m_im.data() + m_fill;
+        for (size_t i = 0; i < count; ++i)
+        {
+            re[i] = iq[i * 2];
+            im[i] = iq[(i * 2) + 1];
+        }
+
+        const double mix_step = (-2.0 * M_PI * (m_offset + m_correction)) / m_input_rate;
+        simd_mix_nco(re, im, count, m_mix_phase, mix_step);
+        m_mix_phase = wrap_phase(m_mix_phase + (mix_step * count));
+        m_fill += count;
+
+        // The taps are symmetric, so they can be run forwards over the
+        // history
+        const size_t num_taps = m_taps.size();
+        size_t produced = 0;
+        for (; m_next + num_taps <= m_fill; m_next += m_decimation)
+        {
+            m_out_re[produced] = simd_dot(m_taps.data(), m_re.data() + m_next, num_taps);
+            m_out_im[produced] = simd_dot(m_taps.data(), m_im.data() + m_next, num_taps);
+            ++produced;
+        }
+
+        const double centre_step = (2.0 * M_PI * m_centre) / m_output_rate;
+        simd_mix_nco(m_out_re.data(), m_out_im.data(), produced, m_centre_phase, centre_step);
+        m_centre_phase = wrap_phase(m_centre_phase + (centre_step * produced));
+
+        for (size_t i = 0; i < produced; ++i)
+        {
+            out[i].i = m_out_re[i];
+            out[i].q = m_out_im[i];
+        }
+
+        // Keep what the next outputs still need
+        const size_t keep = m_fill - m_next;
+        memmove(m_re.data(), m_re.data() + m_next, keep * sizeof(float));
+        memmove(m_im.data(), m_im.data() + m_next, keep * sizeof(float));
+        m_fill = keep;
+        m_next = 0;
+
+        return produced;
+    }
+
+private:
+    unsigned m_decimation;
+    unsigned m_input_rate;
+    unsigned m_output_rate;
+    double   m_offset;
+    double   m_correction;
+    double   m_centre;
+    double   m_mix_phase;
+    double   m_centre_phase;
+
+    std::vector<float> m_taps;
+
+    // Mixed input, the filter's history first
+    std::vector<float> m_re;
+    std::vector<float> m_im;
+    size_t             m_fill;
+    size_t             m_next;
+
+    std::vector<float> m_out_re;
+    std::vector<float> m_out_im;
+};
+
+#endif
@@ -0,0 +1,160 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <strings.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "iq_input.h"
+#include "simd.h"
+
+bool parse_iq_format(const char* name, iq_format* format)
+{
+    if (strcasecmp(name, "cu8") == 0)
+    {
+        *format = IQ_FORMAT_CU8;
+    }
+    else if (strcasecmp(name, "cs16") == 0)
+    {
+        *format = IQ_FORMAT_CS16;
+    }
+    else if (strcasecmp(name, "cf32") == 0)
+    {
+        *format = IQ_FORMAT_CF32;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+double iq_afc_step(double correction, float offset_hz)
+{
+    const double step = offset_hz * IQ_AFC_GAIN;
+    const double next = correction + step;
+    return (next > -IQ_AFC_MAX_HZ && next < IQ_AFC_MAX_HZ) ? step : 0.0;
+}
+
+iq_source::iq_source()
+    : m_fd(STDIN_FILENO),
+      m_udp(false),
+      m_format(IQ_FORMAT_CS16),
+      m_pending(0)
+{
+}
+
+iq_source::~iq_source()
+{
+    if (m_udp)
+    {
+        close(m_fd);
+    }
+}
+
+bool iq_source::open_udp(int port)
+{
+    m_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (m_fd < 0)
+    {
+        return false;
+    }
+    m_udp = true;
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    return bind(m_fd, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+}
+
+void iq_source::set_format(iq_format format)
+{
+    m_format = format;
+    m_pending = 0;
+}
+
+size_t iq_source::read(float* iq, size_t max_samples)
+{
+    const size_t size = sample_bytes();
+    m_bytes.resize(max_samples * size);
+
+    ssize_t n;
+    while (true)
+    {
+        uint8_t* const buffer = m_bytes.data() + m_pending;
+        const size_t space = m_bytes.size() - m_pending;
+        n = m_udp ? recv(m_fd, buffer, space, 0) : ::read(m_fd, buffer, space);
+        if (n > 0)
+        {
+            break;
+        }
+        if (n == 0 || errno != EINTR)
+        {
+            return 0;
+        }
+    }
+
+    const size_t total = m_pending + n;
+    const size_t count = total / size;
+    to_float(m_bytes.data(), count, iq);
+
+    m_pending = total - (count * size);
+    memmove(m_bytes.data(), m_bytes.data() + (count * size), m_pending);
+
+    // A datagram or read that didn't finish a sample isn't the end
+    return count > 0 ? count : read(iq, max_samples);
+}
+
+size_t iq_source::sample_bytes() const
+{
+    switch (m_format)
+    {
+    case IQ_FORMAT_CU8:  return 2;
+    case IQ_FORMAT_CS16: return 2 * sizeof(int16_t);
+    default:             return 2 * sizeof(float);
+    }
+}
+
+// Converts interleaved samples to +/-1.0 floats
+void iq_source::to_float(const uint8_t* in, size_t count, float* out) const
+{
+    const size_t values = count * 2;
+    switch (m_format)
+    {
+    case IQ_FORMAT_CU8:
+        for (size_t i = 0; i < values; ++i)
+        {
+            out[i] = (in[i] - 127.5f) / 128.0f;
+        }
+        break;
+    case IQ_FORMAT_CS16:
+        for (size_t i = 0; i < values; ++i)
+        {
+            int16_t v;
+            memcpy(&v, in + (i * sizeof(v)), sizeof(v));
+            out[i] = v / SHORT_SAMPLE_SCALE;
+        }
+        break;
+    default:
+        memcpy(out, in, values * sizeof(float));
+        break;
+    }
+}
@@ -0,0 +1,75 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef IQ_INPUT_H
+#define IQ_INPUT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Sample formats written by the usual SDR tools, all interleaved I then Q
+enum iq_format
+{
+    IQ_FORMAT_CU8,
+    IQ_FORMAT_CS16,
+    IQ_FORMAT_CF32
+};
+
+// Takes the [IQ] Format names, cu8, cs16 or cf32
+bool parse_iq_format(const char* name, iq_format* format);
+
+// Fraction of the modem's frequency estimate taken out each frame
+static const float IQ_AFC_GAIN = 0.05f;
+// The correction never goes further than this from the configured offset
+static const double IQ_AFC_MAX_HZ = 2000.0;
+
+// How far to move a channel whose correction is currently correction, given
+// the modem's estimate of how far off it is. 0 once that would take it out
+// of range
+double iq_afc_step(double correction, float offset_hz);
+
+// Where the input comes from. stdin can be a file or a pipe, a UDP port
+// takes whatever is sent to it, one or more whole or part samples per
+// datagram
+class iq_source
+{
+public:
+    iq_source();
+    ~iq_source();
+
+    bool open_udp(int port);
+
+    // Drops any part sample left over, so set before the first read
+    void set_format(iq_format format);
+
+    // Reads up to max_samples whole samples as interleaved +/-1.0 floats,
+    // keeping any part sample for next time. Returns 0 at the end of the
+    // input
+    size_t read(float* iq, size_t max_samples);
+
+private:
+    size_t sample_bytes() const;
+    void to_float(const uint8_t* in, size_t count, float* out) const;
+
+private:
+    int       m_fd;
+    bool      m_udp;
+    iq_format m_format;
+
+    std::vector<uint8_t> m_bytes;
+    size_t               m_pending;
+};
+
+#endif
@@ -0,0 +1,315 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+
+#include "freedv_api.h"
+
+#include "crypto_cfg.h"
+#include "crypto_common.h"
+#include "crypto_tx_common.h"
+#include "crypto_rx_common.h"
+#include "resampler.h"
+#include "test_speech.h"
+#include "minIni.h"
+
+// Works out the smallest JACK periods the configured mode can run with on
+// this hardware. Runs the same resampling and modem path as jack_crypto_tx
+// and jack_crypto_rx offline, timing each frame, then picks for each
+// direction the smallest period whose worst frames still leave
+// JACK/PeriodHeadroom percent of the period spare. Prints the settings to
+// save, e.g. "JACK/TXPeriod700D=1440", for iniset -e
+//
+// usage: jack_calibrate [-n <Frames>] <ConfigFile>
+
+// Periods smaller than this aren't worth the interrupt rate
+static const unsigned MIN_PERIOD = 64;
+// The period settings have to be below this (see crypto.ini)
+static const unsigned MAX_PERIOD = 8192;
+// Frames timed before measuring, while caches and the modem settle
+static const int WARMUP_FRAMES = 10;
+// The frame cost planned for is this percentile, so one slow frame
+// doesn't decide the period
+static const double COST_PERCENTILE = 0.99;
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-n <Frames>] <ConfigFile>\n", name);
+}
+
+static double thread_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
+
+static double percentile(std::vector<double> costs, double fraction)
+{
+    if (costs.empty())
+    {
+        return 0.0;
+    }
+    const size_t index = std::min(costs.size() - 1, (size_t)(costs.size() * fraction));
+    std::nth_element(costs.begin(), costs.begin() + index, costs.end());
+    return costs[index];
+}
+
+// Smallest period where the most frames that can complete in one cycle
+// still fit in what's left after the headroom, or 0 if even one frame per
+// frame's worth of time doesn't fit
+static unsigned pick_period(double   frame_cost,
+                            size_t   frame_elems,
+                            unsigned sample_rate,
+                            unsigned num_buffers,
+                            double   headroom)
+{
+    // (Period / SampleRate) * NumBuffers has to be a whole number of ms
+    const unsigned step = sample_rate / std::gcd(sample_rate, num_buffers * 1000);
+    const unsigned first = std::max(step, ((MIN_PERIOD + step - 1) / step) * step);
+
+    for (unsigned period = first; period < MAX_PERIOD; period += step)
+    {
+        const size_t frames_per_cycle = (period + frame_elems - 1) / frame_elems;
+        const double budget = (1.0 - headroom) * period / sample_rate;
+        if (frames_per_cycle * frame_cost <= budget)
+        {
+            return period;
+        }
+    }
+
+    return 0;
+}
+
+// Times the jack_crypto_tx path one speech frame at a time, keeping the
+// modem output at the JACK rate for the receive side to decode
+static std::vector<double> time_transmit(crypto_tx_common&   tx,
+                                         unsigned            jack_rate,
+                                         int                 num_frames,
+                                         std::vector<float>& modem_out)
+{
+    const size_t n_speech_samples = tx.speech_samples_per_frame();
+    const size_t frame_elems = get_nom_resampled_frames(n_speech_samples,
+                                                        tx.speech_sample_rate(),
+                                                        jack_rate);
+
+    resampler input_resampler(SRC_SINC_FASTEST, 1, frame_elems * 2);
+    resampler output_resampler(SRC_SINC_FASTEST, 1, frame_elems * 2);
+    input_resampler.set_sample_rates(jack_rate, tx.speech_sample_rate());
+    output_resampler.set_sample_rates(tx.modem_sample_rate(), jack_rate);
+
+    const std::vector<float> speech = make_test_speech(frame_elems * num_frames, jack_rate);
+    std::vector<short> voice_in(n_speech_samples);
+    std::vector<float> mod_out(tx.modem_samples_per_frame());
+    std::vector<double> costs;
+
+    for (int frame = 0; frame < num_frames; ++frame)
+    {
+        const double start = thread_seconds();
+
+        input_resampler.enqueue(speech.data() + (frame * frame_elems), frame_elems);
+        while (input_resampler.available_elems() >= n_speech_samples)
+        {
+            input_resampler.dequeue(voice_in.data(), n_speech_samples);
+            const size_t nout = tx.transmit(mod_out.data(), voice_in.data());
+            output_resampler.enqueue(mod_out.data(), nout);
+        }
+
+        const size_t prev_size = modem_out.size();
+        modem_out.resize(prev_size + output_resampler.available_elems());
+        output_resampler.dequeue(modem_out.data() + prev_size, modem_out.size() - prev_size);
+
+        if (frame >= WARMUP_FRAMES)
+        {
+            costs.push_back(thread_seconds() - start);
+        }
+    }
+
+    return costs;
+}
+
+// Times the jack_crypto_rx path on the transmitter's output, a modem
+// frame's worth of JACK samples at a time
+static std::vector<double> time_receive(crypto_rx_common&         rx,
+                                        unsigned                  jack_rate,
+                                        const std::vector<float>& modem_in)
+{
+    const size_t frame_elems = get_nom_resampled_frames(rx.modem_samples_per_frame(),
+                                                        rx.modem_sample_rate(),
+                                                        jack_rate);
+
+    resampler input_resampler(SRC_SINC_FASTEST, 1, frame_elems * 2);
+    resampler output_resampler(SRC_SINC_FASTEST, 1, frame_elems * 2);
+    input_resampler.set_sample_rates(jack_rate, rx.modem_sample_rate());
+    output_resampler.set_sample_rates(rx.speech_sample_rate(), jack_rate);
+
+    std::vector<float> demod_in(rx.max_modem_samples_per_frame());
+    std::vector<short> voice_out(rx.max_speech_samples_per_frame());
+    std::vector<float> voice_frames;
+    std::vector<double> costs;
+
+    for (size_t offset = 0, frame = 0;
+         offset + frame_elems <= modem_in.size();
+         offset += frame_elems, ++frame)
+    {
+        const double start = thread_seconds();
+
+        input_resampler.enqueue(modem_in.data() + offset, frame_elems);
+        size_t nin = rx.needed_modem_samples();
+        while (input_resampler.available_elems() >= nin)
+        {
+            input_resampler.dequeue(demod_in.data(), nin);
+            const size_t nout = rx.receive(voice_out.data(), demod_in.data());
+            output_resampler.enqueue(voice_out.data(), nout);
+            nin = rx.needed_modem_samples();
+        }
+
+        voice_frames.resize(output_resampler.available_elems());
+        output_resampler.dequeue(voice_frames.data(), voice_frames.size());
+
+        if (frame >= WARMUP_FRAMES)
+        {
+            costs.push_back(thread_seconds() - start);
+        }
+    }
+
+    return costs;
+}
+
+// Reports one direction and prints its setting. Returns false if no period
+// is fast enough
+static bool report(const char* direction,
+                   const char* mode,
+                   const std::vector<double>& costs,
+                   size_t   frame_elems,
+                   unsigned sample_rate,
+                   unsigned num_buffers,
+                   double   headroom)
+{
+    const double cost = percentile(costs, COST_PERCENTILE);
+    const unsigned period = pick_period(cost, frame_elems, sample_rate, num_buffers, headroom);
+
+    fprintf(stderr,
+            "%s: frame %.1f ms, median cost %.2f ms, p99 cost %.2f ms over %zu frames",
+            direction,
+            frame_elems * 1000.0 / sample_rate,
+            percentile(costs, 0.5) * 1000.0,
+            cost * 1000.0,
+            costs.size());
+
+    if (period == 0)
+    {
+        fprintf(stderr, ", too slow to leave %d%% headroom\n", (int)(headroom * 100.0));
+        return false;
+    }
+
+    fprintf(stderr, ", period %u (%.1f ms)\n", period, period * 1000.0 / sample_rate);
+    printf("JACK/%sPeriod%s=%u\n", direction, mode, period);
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    int num_frames = 500;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                num_frames = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (optind + 1 != argc || num_frames <= WARMUP_FRAMES)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    const char* config_file = argv[optind];
+
+    const unsigned tx_rate = ini_getl("JACK", "SampleRateTX", 48000, config_file);
+    const unsigned rx_rate = ini_getl("JACK", "SampleRateRX", 48000, config_file);
+    const unsigned tx_buffers = ini_getl("JACK", "NumBuffersTX", 2, config_file);
+    const unsigned rx_buffers = ini_getl("JACK", "NumBuffersRX", 2, config_file);
+    const long headroom_percent = ini_getl("JACK", "PeriodHeadroom", 50, config_file);
+    if (tx_rate == 0 || rx_rate == 0 || tx_buffers == 0 || rx_buffers == 0 ||
+        headroom_percent < 0 || headroom_percent > 95)
+    {
+        fprintf(stderr, "Invalid JACK settings in %s\n", config_file);
+        return 1;
+    }
+    const double headroom = headroom_percent / 100.0;
+
+    try
+    {
+        crypto_tx_common tx("jack_calibrate", config_file);
+        crypto_rx_common rx("jack_calibrate", config_file);
+
+        const struct config* cfg = tx.get_config();
+        const char* mode = mode_name(cfg->freedv_mode);
+        if (!cfg->freedv_enabled || mode == nullptr || cfg->freedv_mode == FREEDV_MODE_2400A)
+        {
+            fprintf(stderr, "The configured mode has no period settings\n");
+            return 1;
+        }
+
+        std::vector<float> modem;
+        const std::vector<double> tx_costs = time_transmit(tx, tx_rate, num_frames, modem);
+
+        // The receiver runs at its own rate, so hand it the signal as its
+        // sound card would see it
+        std::vector<float> modem_rx(get_max_resampled_frames(modem.size(), tx_rate, rx_rate));
+        modem_rx.resize(resample_complete_buffer(SRC_SINC_FASTEST,
+                                                 1,
+                                                 modem.data(),
+                                                 modem.size(),
+                                                 tx_rate,
+                                                 modem_rx.data(),
+                                                 modem_rx.size(),
+                                                 rx_rate));
+        const std::vector<double> rx_costs = time_receive(rx, rx_rate, modem_rx);
+
+        const size_t tx_frame_elems = get_nom_resampled_frames(tx.speech_samples_per_frame(),
+                                                               tx.speech_sample_rate(),
+                                                               tx_rate);
+        const size_t rx_frame_elems = get_nom_resampled_frames(rx.modem_samples_per_frame(),
+                                                               rx.modem_sample_rate(),
+                                                               rx_rate);
+
+        const bool tx_ok = report("TX", mode, tx_costs, tx_frame_elems, tx_rate, tx_buffers, headroom);
+        const bool rx_ok = report("RX", mode, rx_costs, rx_frame_elems, rx_rate, rx_buffers, headroom);
+        return tx_ok && rx_ok ? 0 : 1;
+    }
+    catch (const std::exception& ex)
+    {
+        fprintf(stderr, "%s\n", ex.what());
+        return 1;
+    }
+}
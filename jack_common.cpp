@@ -12,10 +12,16 @@
   along with this program; if not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <poll.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
 #include <sndfile.h>
 #include <freedv_api.h>
 
 #include "crypto_cfg.h"
+#include "crypto_common.h"
 #include "resampler.h"
 #include "jack_common.h"
 
@@ -37,18 +43,11 @@ bool read_wav_file(const char*     filepath,
         return false;
     }
 
-    const size_t block_len = 1024;
-    audio_buffer_t buffer(block_len);
-    sf_count_t readcount = 0;
-    while ((readcount = sf_readf_float(infile,
-                                       (buffer.data() + buffer.size()) - block_len,
-                                       block_len)) == block_len)
-    {
-        buffer.resize(buffer.size() + block_len);
-    }
-
-    size_t toremove = block_len - readcount;
-    buffer.erase(buffer.cend() - toremove, buffer.cend());
+    // WAV headers carry the frame count so the whole file can be read in
+    // one call
+    audio_buffer_t buffer(sfinfo.frames);
+    const sf_count_t readcount = sf_readf_float(infile, buffer.data(), sfinfo.frames);
+    buffer.resize(readcount > 0 ? readcount : 0);
 
     sf_close (infile);
 
@@ -77,22 +76,69 @@ bool read_wav_file(const char*     filepath,
     return true;
 }
 
-int get_jack_period(const struct config* cfg)
+audio_clip_ptr read_audio_clip(const char*    filepath,
+                               jack_nframes_t jack_sample_rate)
+{
+    audio_buffer_t buffer;
+    if (!read_wav_file(filepath, jack_sample_rate, buffer))
+    {
+        return nullptr;
+    }
+
+    return std::make_shared<audio_clip>(std::move(buffer));
+}
+
+jack_client_t* open_jack_client_when_ready(const char*    client_name,
+                                           jack_options_t options,
+                                           jack_status_t* status,
+                                           const char*    server_name)
+{
+    // Same interval the init scripts used to poll the server at
+    static const useconds_t RETRY_US = 100000;
+    // Long enough for jackd to open a slow USB card, short enough that a
+    // server which never comes up still fails the service
+    static const unsigned int TIMEOUT_S = 30;
+    static const unsigned int RETRIES_PER_S = 1000000 / RETRY_US;
+
+    for (unsigned int attempt = 0; ; attempt++)
+    {
+        jack_client_t* client = jack_client_open(client_name, options, status, server_name);
+        if (client != nullptr || (*status & JackServerFailed) == 0)
+        {
+            return client;
+        }
+        if (attempt >= TIMEOUT_S * RETRIES_PER_S)
+        {
+            fprintf(stderr, "%s: JACK server %s did not come up within %u s\n",
+                    client_name, server_name ? server_name : "(default)", TIMEOUT_S);
+            return nullptr;
+        }
+        if (attempt % (5 * RETRIES_PER_S) == 0)
+        {
+            fprintf(stderr, "%s: waiting for JACK server %s\n",
+                    client_name, server_name ? server_name : "(default)");
+        }
+        usleep(RETRY_US);
+    }
+}
+
+int get_jack_period(const struct config* cfg, jack_direction direction)
 {
+    const bool tx = direction == JACK_DIRECTION_TX;
     switch(cfg->freedv_mode)
     {
         case FREEDV_MODE_700C:
-            return cfg->jack_rx_period_700c;
+            return tx ? cfg->jack_tx_period_700c : cfg->jack_rx_period_700c;
         case FREEDV_MODE_700D:
-            return cfg->jack_rx_period_700d;
+            return tx ? cfg->jack_tx_period_700d : cfg->jack_rx_period_700d;
         case FREEDV_MODE_700E:
-            return cfg->jack_rx_period_700e;
+            return tx ? cfg->jack_tx_period_700e : cfg->jack_rx_period_700e;
         case FREEDV_MODE_800XA:
-            return cfg->jack_rx_period_800xa;
+            return tx ? cfg->jack_tx_period_800xa : cfg->jack_rx_period_800xa;
         case FREEDV_MODE_1600:
-            return cfg->jack_rx_period_1600;
+            return tx ? cfg->jack_tx_period_1600 : cfg->jack_rx_period_1600;
         case FREEDV_MODE_2400B:
-            return cfg->jack_rx_period_2400b;
+            return tx ? cfg->jack_tx_period_2400b : cfg->jack_rx_period_2400b;
         default:
             return 0;
     }
@@ -133,3 +179,53 @@ bool connect_input_ports(jack_client_t* client,
     }
 }
 
+
+jack_runtime_params get_jack_runtime_params(jack_client_t*               client,
+                                            const struct runtime_params& params)
+{
+    jack_runtime_params jack_params;
+    jack_params.sample_rate = jack_get_sample_rate(client);
+    jack_params.speech_sample_rate = params.speech_sample_rate;
+    jack_params.modem_sample_rate = params.modem_sample_rate;
+    jack_params.speech_samples_per_frame = params.speech_samples_per_frame;
+    jack_params.max_speech_samples_per_frame = params.max_speech_samples_per_frame;
+    jack_params.modem_samples_per_frame = params.modem_samples_per_frame;
+    jack_params.max_modem_samples_per_frame = params.max_modem_samples_per_frame;
+    jack_params.speech_resampled_frames =
+        get_nom_resampled_frames(params.speech_samples_per_frame,
+                                 params.speech_sample_rate,
+                                 jack_params.sample_rate);
+    jack_params.modem_resampled_frames =
+        get_nom_resampled_frames(params.modem_samples_per_frame,
+                                 params.modem_sample_rate,
+                                 jack_params.sample_rate);
+    return jack_params;
+}
+
+bool file_modified(const char* filepath, struct timespec* last_mtime)
+{
+    struct stat st;
+    if (stat(filepath, &st) != 0 ||
+        (st.st_mtim.tv_sec == last_mtime->tv_sec &&
+         st.st_mtim.tv_nsec == last_mtime->tv_nsec))
+    {
+        return false;
+    }
+
+    *last_mtime = st.st_mtim;
+    return true;
+}
+
+void wait_for_fds(const std::vector<int>& fds, int timeout_ms)
+{
+    std::vector<struct pollfd> pfds;
+    for (const int fd : fds)
+    {
+        if (fd >= 0)
+        {
+            pfds.push_back({ fd, POLLIN, 0 });
+        }
+    }
+
+    poll(pfds.data(), pfds.size(), timeout_ms);
+}
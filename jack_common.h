@@ -15,14 +15,56 @@
 #ifndef JACK_COMMON_H
 #define JACK_COMMON_H
 
+#include <time.h>
+
 #include <vector>
 
 #include <jack/jack.h>
 
+#include "audio_clip.h"
+
+// JACK periods are always less than this
+#define MAX_JACK_PERIOD 8192
+
 struct config;
+struct runtime_params;
 typedef std::vector<jack_default_audio_sample_t> audio_buffer_t;
 
-int get_jack_period(const struct config* cfg);
+// Everything process() needs that stays fixed between config reloads
+struct jack_runtime_params
+{
+    jack_nframes_t sample_rate;
+    unsigned       speech_sample_rate;
+    unsigned       modem_sample_rate;
+    size_t         speech_samples_per_frame;
+    size_t         max_speech_samples_per_frame;
+    size_t         modem_samples_per_frame;
+    size_t         max_modem_samples_per_frame;
+    // Nominal speech and modem frame sizes at the JACK sample rate
+    size_t         speech_resampled_frames;
+    size_t         modem_resampled_frames;
+};
+
+jack_runtime_params get_jack_runtime_params(jack_client_t*               client,
+                                            const struct runtime_params& params);
+
+// Like jack_client_open, except that it keeps trying for up to 30 s until
+// the server is up instead of failing, so a client can start alongside its
+// server. Returns nullptr with JackServerFailed set if it never comes up.
+jack_client_t* open_jack_client_when_ready(const char*    client_name,
+                                           jack_options_t options,
+                                           jack_status_t* status,
+                                           const char*    server_name);
+
+enum jack_direction
+{
+    JACK_DIRECTION_TX,
+    JACK_DIRECTION_RX
+};
+
+// The TXPeriod* or RXPeriod* setting for the configured mode, or 0 if it
+// isn't set and the period should be one speech frame
+int get_jack_period(const struct config* cfg, jack_direction direction);
 
 bool connect_input_ports(jack_client_t* client,
                          jack_port_t*   output_port,
@@ -32,4 +74,16 @@ bool read_wav_file(const char*     filepath,
                    jack_nframes_t  jack_sample_rate,
                    audio_buffer_t& buffer_out);
 
+// Returns nullptr if the file could not be read
+audio_clip_ptr read_audio_clip(const char*    filepath,
+                               jack_nframes_t jack_sample_rate);
+
+// Returns true if the file exists and was written since the modification
+// time in last_mtime, which is then updated
+bool file_modified(const char* filepath, struct timespec* last_mtime);
+
+// Waits up to timeout_ms for any of fds to be readable. Entries of -1 are
+// skipped
+void wait_for_fds(const std::vector<int>& fds, int timeout_ms);
+
 #endif
@@ -0,0 +1,317 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Bridges several radios in one JACK client. Each channel is a receive and
+// transmit pipeline with its own config file, so its own mode and key, and
+// every period the channels' jobs are shared out over a pool of realtime
+// DSP threads (see dsp_pool.h). The gateway's own config lists them:
+//
+//   [Gateway]
+//   Threads       = 0    ; counting the JACK thread, 0 for one per core
+//   Period        = 0    ; JACK period, 0 to leave the server's
+//   ControlSocket = /var/run/crypto_gateway.sock
+//
+//   [Channel1]
+//   Config   = /etc/gateway/channel1.ini
+//   Priority = 0         ; higher priority channels are started first
+//
+// Channels are numbered from 1 with no gaps. SIGHUP rereads every
+// channel's config file.
+//
+// usage: jack_crypto_gateway <jack server name> <gateway config file>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <signal.h>
+
+#include <memory>
+#include <vector>
+#include <stdexcept>
+
+#include <jack/jack.h>
+
+#include "crypto_cfg.h"
+#include "crypto_log.h"
+#include "control_socket.h"
+#include "startup_log.h"
+#include "jack_common.h"
+#include "dsp_pool.h"
+#include "gateway_channel.h"
+#include "minIni.h"
+
+static const unsigned MAX_CHANNELS = 64;
+
+static std::vector<std::unique_ptr<gateway_channel>> channels;
+static std::vector<dsp_job> jobs;
+static std::unique_ptr<dsp_pool> pool;
+
+static jack_client_t* client = nullptr;
+static control_socket control;
+
+static volatile sig_atomic_t reload_config = 0;
+
+static void signal_handler(int sig)
+{
+    jack_client_close(client);
+    fprintf(stderr, "signal received, exiting ...\n");
+    exit(0);
+}
+
+static void handle_sighup(int sig)
+{
+    reload_config = 1;
+}
+
+static void jack_shutdown(void *arg)
+{
+    exit (1);
+}
+
+static int process(jack_nframes_t nframes, void *arg)
+{
+    for (auto& channel : channels)
+    {
+        channel->begin_period(nframes);
+    }
+    pool->run(jobs.data(), jobs.size());
+    return 0;
+}
+
+static void read_channels(const char* gateway_file)
+{
+    for (unsigned number = 1; number <= MAX_CHANNELS; ++number)
+    {
+        char section[32];
+        snprintf(section, sizeof(section), "Channel%u", number);
+
+        char config_file[256];
+        if (ini_gets(section, "Config", "", config_file, sizeof(config_file), gateway_file) <= 0)
+        {
+            break;
+        }
+        const int priority = ini_getl(section, "Priority", 0, gateway_file);
+
+        startup_phase phase("jack_crypto_gateway", "codec");
+        channels.emplace_back(new gateway_channel(number, config_file, priority));
+    }
+}
+
+static void connect_channels()
+{
+    for (auto& channel : channels)
+    {
+        channel->connect(client);
+    }
+}
+
+static void activate_client()
+{
+    if (jack_activate(client))
+    {
+        fprintf(stderr, "cannot activate client");
+        exit(1);
+    }
+    connect_channels();
+}
+
+static void reload()
+{
+    std::vector<gateway_channel*> stale;
+    for (auto& channel : channels)
+    {
+        if (!channel->reload())
+        {
+            stale.push_back(channel.get());
+        }
+    }
+    if (stale.empty())
+    {
+        return;
+    }
+
+    // The pool runs every channel each period, so the client has to stop
+    // while any of them is rebuilt
+    jack_deactivate(client);
+    try
+    {
+        for (gateway_channel* channel : stale)
+        {
+            channel->rebuild(client);
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        fprintf(stderr, "%s", ex.what());
+        exit(1);
+    }
+    activate_client();
+}
+
+static void handle_command(char* cmd)
+{
+    char* save = nullptr;
+    const char* name = strtok_r(cmd, " ", &save);
+    const char* arg = strtok_r(nullptr, " ", &save);
+
+    if (name == nullptr)
+    {
+        control.reply("ERROR empty command");
+    }
+    else if (strcasecmp(name, "channel") == 0)
+    {
+        const unsigned number = arg != nullptr ? strtoul(arg, nullptr, 10) : 0;
+        if (number == 0 || number > channels.size())
+        {
+            control.reply("ERROR channel must be 1 to %u", (uint)channels.size());
+            return;
+        }
+
+        gateway_channel& channel = *channels[number - 1];
+        const jack_nframes_t jack_sample_rate = jack_get_sample_rate(client);
+        control.reply("OK %s, %s, %s, rx %.1f%%, tx %.1f%%, peak %.1f%%, playout %.1f ms",
+                      mode_name(channel.rx_config()->freedv_mode),
+                      channel.synced() ? "synced" : "unsynced",
+                      channel.transmitting() ? "transmitting" : "idle",
+                      channel.rx_load() * 100.0f,
+                      channel.tx_load() * 100.0f,
+                      channel.take_peak_load() * 100.0f,
+                      channel.playout().target() * 1000.0 / jack_sample_rate);
+    }
+    else if (strcasecmp(name, "pool") == 0)
+    {
+        control.reply("OK %u channels on %u threads, load %.1f%%, %llu steals, %llu waits",
+                      (uint)channels.size(),
+                      (uint)pool->num_threads(),
+                      jack_cpu_load(client),
+                      (unsigned long long)pool->steals(),
+                      (unsigned long long)pool->waits());
+    }
+    else
+    {
+        control.reply("ERROR unknown command %s", name);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char* client_name = "crypto_gateway";
+    const jack_options_t options =
+        (jack_options_t)(JackNullOption | JackServerName | JackNoStartServer);
+    jack_status_t status;
+
+    if (argc <= 2)
+    {
+        fprintf(stderr, "Usage: jack_crypto_gateway <jack server name> <gateway config file>");
+        exit(1);
+    }
+    const char* server_name = argv[1];
+    const char* gateway_file = argv[2];
+
+    try
+    {
+        read_channels(gateway_file);
+    }
+    catch (const std::exception& ex)
+    {
+        fprintf(stderr, "%s", ex.what());
+        exit(1);
+    }
+    if (channels.empty())
+    {
+        fprintf(stderr, "No channels in %s\n", gateway_file);
+        exit(1);
+    }
+
+    {
+        startup_phase phase("jack_crypto_gateway", "jack_open");
+        client = open_jack_client_when_ready(client_name, options, &status, server_name);
+    }
+    if (client == NULL)
+    {
+        fprintf(stderr,
+                "jack_client_open() failed, "
+                "status = 0x%2.0x\n",
+                status);
+        exit(1);
+    }
+
+    jack_set_process_callback(client, process, nullptr);
+    jack_on_shutdown(client, jack_shutdown, 0);
+
+    const long period = ini_getl("Gateway", "Period", 0, gateway_file);
+    if (period > 0 && period < MAX_JACK_PERIOD)
+    {
+        jack_set_buffer_size(client, period);
+    }
+
+    for (auto& channel : channels)
+    {
+        if (!channel->register_ports(client))
+        {
+            fprintf(stderr, "no more JACK ports available\n");
+            exit(1);
+        }
+        channel->prepare(client);
+
+        // Receive first, so a channel's voice output is out as early as
+        // possible within its priority
+        jobs.push_back({gateway_channel::run_rx, channel.get(), channel->priority()});
+        jobs.push_back({gateway_channel::run_tx, channel.get(), channel->priority()});
+    }
+
+    pool.reset(new dsp_pool(ini_getl("Gateway", "Threads", 0, gateway_file), jobs.size()));
+    if (!pool->start(client))
+    {
+        fprintf(stderr, "Could not start DSP threads\n");
+        exit(1);
+    }
+
+    char socket_path[80];
+    ini_gets("Gateway", "ControlSocket", "", socket_path, sizeof(socket_path), gateway_file);
+    if (socket_path[0] && !control.open(socket_path))
+    {
+        fprintf(stderr, "Could not open control socket\n");
+    }
+
+    {
+        startup_phase phase("jack_crypto_gateway", "activate");
+        activate_client();
+    }
+
+    signal(SIGQUIT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    signal(SIGHUP, handle_sighup);
+    signal(SIGINT, signal_handler);
+
+    notify_ready("jack_crypto_gateway");
+
+    while (true)
+    {
+        if (reload_config != 0)
+        {
+            reload_config = 0;
+            reload();
+        }
+
+        char cmd[CONTROL_MSG_MAX];
+        if (control.receive(cmd, sizeof(cmd), 1000))
+        {
+            handle_command(cmd);
+        }
+    }
+
+    return 0;
+}
@@ -20,13 +20,18 @@
 
 #include <stdio.h>
 #include <signal.h>
+#include <stdlib.h>
 #include <string.h>
+#include <spawn.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
 #include <vector>
-#include <deque>
 #include <memory>
+#include <string>
+#include <thread>
 
 #include <jack/jack.h>
 #include <samplerate.h>
@@ -36,10 +41,23 @@
 
 #include "crypto_log.h"
 #include "crypto_rx_common.h"
+#include "crypto_context.h"
 #include "crypto_common.h"
 #include "crypto_cfg.h"
+#include "minIni.h"
 #include "resampler.h"
+#include "playout_buffer.h"
+#include "mixer.h"
+#include "voice_manager.h"
+#include "control_socket.h"
+#include "asset_cache.h"
+#include "stream_tap.h"
+#include "config_watcher.h"
+#include "startup_log.h"
 #include "jack_common.h"
+#include "jack_pipelines.h"
+#include "modem_link.h"
+#include "keyed_state.h"
 
 static std::unique_ptr<crypto_rx_common> crypto_rx;
 
@@ -50,114 +68,259 @@ static jack_client_t* client = nullptr;
 
 static std::unique_ptr<resampler> input_resampler;
 static std::unique_ptr<resampler> output_resampler;
+static playout_buffer playout;
 
-static audio_buffer_t crypto_startup;
-static audio_buffer_t plain_startup;
-static audio_buffer_t wave_sound;
+static jack_runtime_params jack_params;
 
-static std::deque<jack_default_audio_sample_t> notification_buffer;
+static audio_clip_ptr crypto_startup;
+static audio_clip_ptr plain_startup;
+static audio_clip_ptr beep_sound;
+
+static voice_manager notifications;
+
+static gain_stage voice_gain;
+static gain_stage notify_gain;
+
+static control_socket control;
+static config_watcher watcher;
+
+static stream_tap tap("rx");
+static int tap_modem_in = -1;
+static int tap_voice_out = -1;
+
+// Set when the modem input comes over the network rather than into the
+// modem port. Fixed at startup
+static modem_link_receiver modem_link;
+static bool link_enabled = false;
+static audio_buffer_t link_frames(MAX_JACK_PERIOD);
+
+// Set when the transmitter says when the radio is keyed (see [JACK]
+// KeyedState). Fixed at startup
+static keyed_state keyed;
+static bool keyed_enabled = false;
+static std::atomic<bool> suspended(false);
+static std::atomic<uint32_t> suspensions(0);
 
 static volatile sig_atomic_t reload_config = 0;
 static volatile sig_atomic_t read_wav = 0;
-static volatile sig_atomic_t initialized = 0;
-static volatile sig_atomic_t play_wav = 0;
 
-static const char* config_file = nullptr;
+// May be shared with the transmitter in jack_crypto_trx. The generation is the
+// last one reloaded from
+static std::shared_ptr<crypto_context> context;
+static unsigned config_generation = 0;
+
+// Written by the last spoken prompt played, so a prompt is only played once
+static struct timespec prompt_mtime = {0, 0};
+
+// Volume values from the most recently loaded config file, used to tell
+// whether a reload actually changed them
+static int cfg_headset_volume = -1;
+static int cfg_notify_volume = -1;
+static bool volume_dirty = false;
+
+// Length of the gain ramp applied when the volume changes
+static const float VOLUME_RAMP_SECONDS = 0.02f;
+// Gain applied to the voice port while a spoken prompt plays
+static const float VOICE_DUCK_GAIN = 0.3f;
 
-static bool read_wav_file(const char* filepath, audio_buffer_t& buffer_out)
+static audio_clip_ptr read_audio_clip(const char* filepath)
 {
     const jack_nframes_t jack_sample_rate = jack_get_sample_rate(client);
-    return read_wav_file(filepath, jack_sample_rate, buffer_out);
+    return read_audio_clip(filepath, jack_sample_rate);
 }
 
-static void signal_handler(int sig)
+// Loads one of the fixed notification sounds through the asset cache
+static audio_clip_ptr read_asset_clip(const char* filepath)
 {
-    jack_client_close(client);
-    fprintf(stderr, "signal received, exiting ...\n");
-    exit(0);
+    const jack_nframes_t jack_sample_rate = jack_get_sample_rate(client);
+    return read_cached_audio_clip(filepath,
+                                  jack_sample_rate,
+                                  crypto_rx->get_config()->jack_asset_cache_dir);
+}
+
+// Notification priorities. A higher priority sound ducks the others
+static const int PRIORITY_BEEP = 0;
+static const int PRIORITY_PROMPT = 1;
+static const int PRIORITY_STARTUP = 2;
+
+static void play_notification(const audio_clip_ptr& clip, int priority, bool duck_voice)
+{
+    voice_params params;
+    params.priority = priority;
+    params.duck_main = duck_voice;
+    notifications.play(clip, params);
+}
+
+static void play_startup_notification()
+{
+    const encryption_status crypto_stat = crypto_rx->get_encryption_status();
+    play_notification(crypto_stat == CRYPTO_STATUS_ENCRYPTED ? crypto_startup : plain_startup,
+                      PRIORITY_STARTUP,
+                      false);
 }
 
-static void handle_sighup(int sig)
+static void load_notification_clips()
+{
+    const struct config* cfg = crypto_rx->get_config();
+    crypto_startup = cfg->jack_secure_notify_file[0] ?
+        read_asset_clip(cfg->jack_secure_notify_file) : nullptr;
+    plain_startup = cfg->jack_insecure_notify_file[0] ?
+        read_asset_clip(cfg->jack_insecure_notify_file) : nullptr;
+    beep_sound = cfg->jack_beep_notify_file[0] ?
+        read_asset_clip(cfg->jack_beep_notify_file) : nullptr;
+}
+
+// Hands a message from the text channel to the configured command, which
+// speaks it in the headset. The text goes in as an argument, not through a
+// shell, since anyone on frequency can send it
+static void notify_text(const char* text)
+{
+    const struct config* cfg = crypto_rx->get_config();
+    crypto_rx->log_to_logger(LOG_INFO, "Received text message");
+    if (!str_has_value(cfg->jack_text_notify_command))
+    {
+        return;
+    }
+
+    char* const argv[] = { const_cast<char*>(cfg->jack_text_notify_command),
+                           const_cast<char*>(text),
+                           nullptr };
+    pid_t pid;
+    if (posix_spawn(&pid, argv[0], nullptr, nullptr, argv, environ) != 0)
+    {
+        crypto_rx->log_to_logger(LOG_WARN, "Could not run the text notify command");
+    }
+}
+
+void request_rx_reload()
 {
     reload_config = 1;
 }
 
-static void handle_sigusr1(int sig)
+void request_rx_prompt()
 {
     read_wav = 1;
 }
 
+void stop_rx_pipeline()
+{
+    jack_client_close(client);
+}
+
 /**
  * JACK calls this shutdown_callback if the server ever shuts down or
  * decides to disconnect the client.
  */
-void jack_shutdown(void *arg)
+static void jack_shutdown(void *arg)
 {
     exit (1);
 }
 
-/**
- * The process callback for this JACK application is called in a
- * special realtime thread once for each audio cycle.
- *
- * This client follows a simple rule: when the JACK transport is
- * running, copy the input port to the output.  When it stops, exit.
- */
-int process(jack_nframes_t nframes, void *arg)
+// True while the radio is keyed and for KeyedGuard ms after, while all the
+// modem input can hold is our own signal or the radio switching back to
+// receive. Demodulation starts again from scratch once it's over
+static bool suspend_while_keyed(jack_nframes_t nframes)
 {
-    const jack_default_audio_sample_t* const modem_frames =
-        (jack_default_audio_sample_t*)jack_port_get_buffer(modem_port, nframes);
-    bool play_notification_sound = false;
-    bool play_wave_sound = false;
-
-    if (initialized != 0) {
-        initialized = 0;
+    static uint32_t keyings_seen = 0;
+    static size_t guard_left = 0;
 
-        play_notification_sound = true;
+    // A keying too short to see between two periods still counts
+    const uint32_t keyings = keyed.keyings();
+    if (keyed.keyed() || keyings != keyings_seen)
+    {
+        if (!suspended.load(std::memory_order_relaxed))
+        {
+            suspended.store(true, std::memory_order_relaxed);
+            suspensions.fetch_add(1, std::memory_order_relaxed);
+        }
+        keyings_seen = keyings;
+        guard_left = ((size_t)crypto_rx->get_config()->jack_keyed_guard *
+                      jack_params.sample_rate) / 1000;
+        return true;
     }
 
-    if (play_wav != 0) {
-        play_wav = 0;
-
-        play_wave_sound = true;
+    if (!suspended.load(std::memory_order_relaxed))
+    {
+        return false;
+    }
+    if (guard_left > nframes)
+    {
+        guard_left -= nframes;
+        return true;
     }
 
-    const jack_nframes_t jack_sample_rate = jack_get_sample_rate(client);
-    const uint voice_sample_rate = crypto_rx->speech_sample_rate();
-    const uint modem_sample_rate = crypto_rx->modem_sample_rate();
-    const int n_nom_speech_samples = crypto_rx->speech_samples_per_frame();
-
-    const uint modem_resampled_frames =
-            get_nom_resampled_frames(crypto_rx->modem_samples_per_frame(),
-                                     modem_sample_rate,
-                                     jack_sample_rate);
-
-    input_resampler->set_sample_rates(jack_sample_rate, modem_sample_rate);
-    output_resampler->set_sample_rates(voice_sample_rate, jack_sample_rate);
+    suspended.store(false, std::memory_order_relaxed);
+    input_resampler->reset();
+    crypto_rx->resync();
+    return false;
+}
 
+// Feeds modem input to the demodulator, queueing whatever speech it decodes
+static void demodulate(const jack_default_audio_sample_t* modem_frames, size_t nframes)
+{
     input_resampler->enqueue(modem_frames, nframes);
 
-    const size_t n_max_modem_samples = crypto_rx->max_modem_samples_per_frame();
-    const size_t n_max_speech_samples = crypto_rx->max_speech_samples_per_frame();
+    const size_t n_max_modem_samples = jack_params.max_modem_samples_per_frame;
+    const size_t n_max_speech_samples = jack_params.max_speech_samples_per_frame;
 
-    size_t nout_this_cycle = 0;
     size_t nin = crypto_rx->needed_modem_samples();
     while (input_resampler->available_elems() >= nin)
     {
-        short demod_in[n_max_modem_samples];
+        float demod_in[n_max_modem_samples];
         short voice_out[n_max_speech_samples] = {0};
 
         input_resampler->dequeue(demod_in, nin);
 
         const size_t nout = crypto_rx->receive(voice_out, demod_in);
         output_resampler->enqueue(voice_out, nout);
-        nout_this_cycle += nout;
 
         /* IMPORTANT: don't forget to do this in the while loop to
            ensure we fread the correct number of samples: ie update
            "nin" before every call to freedv_rx()/freedv_comprx() */
         nin = crypto_rx->needed_modem_samples();
     }
+}
+
+/**
+ * The process callback for this JACK application is called in a
+ * special realtime thread once for each audio cycle.
+ *
+ * This client follows a simple rule: when the JACK transport is
+ * running, copy the input port to the output.  When it stops, exit.
+ */
+static int process(jack_nframes_t nframes, void *arg)
+{
+    // While transmitting the input is left alone altogether, and only
+    // speech decoded before the radio keyed is played out
+    const bool suspend = keyed_enabled && suspend_while_keyed(nframes);
+
+    if (link_enabled)
+    {
+        // The link is read a buffer at a time, so periods of any size
+        // drain it rather than falling back to the unconnected modem port
+        size_t link_read = 0;
+        while (link_read < nframes)
+        {
+            const size_t chunk = std::min<size_t>(nframes - link_read, link_frames.size());
+            modem_link.read(link_frames.data(), chunk);
+            tap.write(tap_modem_in, link_frames.data(), chunk);
+            if (!suspend)
+            {
+                demodulate(link_frames.data(), chunk);
+            }
+            link_read += chunk;
+        }
+    }
+    else
+    {
+        const jack_default_audio_sample_t* const modem_frames =
+            (jack_default_audio_sample_t*)jack_port_get_buffer(modem_port, nframes);
+        tap.write(tap_modem_in, modem_frames, nframes);
+        if (!suspend)
+        {
+            demodulate(modem_frames, nframes);
+        }
+    }
 
     // If modem data going into the demodulator this cycle
     // results in voice data coming out, or there is no modem
@@ -173,62 +336,20 @@ int process(jack_nframes_t nframes, void *arg)
     // When the radio is active and modem data is coming in we
     // are mostly concerned about having enough data to put onto the
     // voice port during the next time this process runs without
-    // underflowing. So make sure the output buffer is "primed"
-    // before starting to output data onto the port
-    const uint voice_resampled_frames =
-        get_nom_resampled_frames(n_nom_speech_samples,
-                                 voice_sample_rate,
-                                 jack_sample_rate);
-    const size_t to_deque = std::min(output_resampler->available_elems(),
-                                     (size_t)nframes);
-    const size_t to_fill = nframes - to_deque;
-    output_resampler->dequeue(voice_frames, to_deque);
-    if (to_fill > 0)
-    {
-        zeroize_frames(voice_frames + to_deque, to_fill);
-    }
-
-    if (play_notification_sound)
-    {
-        const encryption_status crypto_stat = crypto_rx->get_encryption_status();
-        if (crypto_stat == CRYPTO_STATUS_ENCRYPTED) {
-            notification_buffer.insert(notification_buffer.cend(),
-                                       crypto_startup.cbegin(),
-                                       crypto_startup.cend());
-        }
-        else {
-            notification_buffer.insert(notification_buffer.cend(),
-                                       plain_startup.cbegin(),
-                                       plain_startup.cend());
-        }
-    }
-
-    if (play_wave_sound)
-    {
-        notification_buffer.insert(notification_buffer.cend(),
-                                   wave_sound.cbegin(),
-                                   wave_sound.cend());
-    }
+    // underflowing. The playout buffer makes sure the output buffer is
+    // "primed" before starting to output data onto the port
+    playout.read(*output_resampler, voice_frames, nframes);
+    tap.write(tap_voice_out, voice_frames, nframes);
 
     jack_default_audio_sample_t* const notification_frames =
         (jack_default_audio_sample_t*)jack_port_get_buffer(notification_port, nframes);
-    if (notification_buffer.empty() == false)
-    {
-        const jack_nframes_t n_notification_frames =
-            std::min(nframes, static_cast<jack_nframes_t>(notification_buffer.size()));
-        const auto notification_end = notification_buffer.cbegin() + n_notification_frames;
-        std::copy(notification_buffer.cbegin(), notification_end, notification_frames);
-        notification_buffer.erase(notification_buffer.cbegin(), notification_end);
-        if (n_notification_frames < nframes)
-        {
-            zeroize_frames(notification_frames + n_notification_frames,
-                           nframes - n_notification_frames);
-        }
-    }
-    else
-    {
-        zeroize_frames(notification_frames, nframes);
-    }
+    zeroize_frames(notification_frames, nframes);
+    notifications.mix(notification_frames, nframes);
+
+    // Spoken prompts duck the voice port so they can be understood
+    voice_gain.process(voice_frames, nframes,
+                       notifications.ducking_main() ? VOICE_DUCK_GAIN : 1.0f);
+    notify_gain.process(notification_frames, nframes);
 
     return 0;
 }
@@ -251,7 +372,7 @@ static void activate_client()
                                                         speech_sample_rate,
                                                         jack_sample_rate);
 
-    jack_nframes_t period = get_jack_period(cfg);
+    jack_nframes_t period = get_jack_period(cfg, JACK_DIRECTION_RX);
     if (period == 0)
     {
         period = speech_period;
@@ -270,6 +391,12 @@ static void activate_client()
     crypto_rx->log_to_logger(LOG_INFO, buffer);
     jack_set_buffer_size(client, period);
 
+    // Start out keeping a speech frame queued beyond what the next period
+    // takes, so the sawtooth of frames arriving never quite empties the
+    // queue. The playout buffer brings it down from there if it can
+    playout.configure(jack_sample_rate, jack_params.speech_resampled_frames + period);
+    output_resampler->set_drift_target(cfg->drift_compensation ? playout.target() : 0);
+
     /* Tell the JACK server that we are ready to roll.  Our
      * process() callback will start running now. */
     if (jack_activate (client))
@@ -281,7 +408,8 @@ static void activate_client()
     /* Get the port from which we will get data */
     const char* capture_port_name =
         *cfg->jack_modem_in_port ? cfg->jack_modem_in_port : "system:capture_1";
-    if (jack_connect(client, capture_port_name, jack_port_name(modem_port)) != 0)
+    if (!link_enabled &&
+        jack_connect(client, capture_port_name, jack_port_name(modem_port)) != 0)
     {
         fprintf(stderr, "Could not connect modem port");
         exit (1);
@@ -301,27 +429,187 @@ static void activate_client()
         exit(1);
     }
 
-    initialized = 1;
+    play_startup_notification();
 }
 
-static void initialize_crypto()
+static void initialize_volume()
 {
-    crypto_rx = nullptr;
-    input_resampler = nullptr;
-    output_resampler = nullptr;
+    const struct config* cfg = crypto_rx->get_config();
 
-    crypto_rx.reset(new crypto_rx_common("crypto_rx", config_file));
+    const size_t ramp_frames = jack_get_sample_rate(client) * VOLUME_RAMP_SECONDS;
+    voice_gain.set_ramp_frames(ramp_frames);
+    notify_gain.set_ramp_frames(ramp_frames);
 
-    const jack_nframes_t jack_sample_rate = jack_get_sample_rate(client);
-    const uint speech_sample_rate = crypto_rx->speech_sample_rate();
-    const uint modem_sample_rate = crypto_rx->modem_sample_rate();
+    // Only take the volume from the config file when it changed there.
+    // Otherwise a reload for an unrelated setting would undo changes made
+    // with the buttons that haven't been merged into the config file yet
+    if (cfg->headset_volume != cfg_headset_volume)
+    {
+        cfg_headset_volume = cfg->headset_volume;
+        voice_gain.set_volume(cfg->headset_volume);
+    }
+    if (cfg->notify_volume != cfg_notify_volume)
+    {
+        cfg_notify_volume = cfg->notify_volume;
+        notify_gain.set_volume(cfg->notify_volume);
+    }
+}
+
+static void save_volume()
+{
+    const struct config* cfg = crypto_rx->get_config();
+    if (str_has_value(cfg->jack_volume_file))
+    {
+        ini_putl("Audio", "HeadsetVolume", voice_gain.volume(), cfg->jack_volume_file);
+        ini_putl("Audio", "NotifyVolume", notify_gain.volume(), cfg->jack_volume_file);
+    }
+    volume_dirty = false;
+}
+
+// Parses "+N", "-N" or "N" relative to the current volume
+static bool parse_volume(const char* arg, int cur_volume, int* volume)
+{
+    char* end = nullptr;
+    const long val = strtol(arg, &end, 10);
+    if (end == arg || *end != '\0')
+    {
+        return false;
+    }
+
+    if (*arg == '+' || *arg == '-')
+    {
+        *volume = clamp_volume(cur_volume + val);
+    }
+    else
+    {
+        *volume = clamp_volume(val);
+    }
+    return true;
+}
+
+static void handle_volume_command(gain_stage& gain, const char* arg)
+{
+    int volume = gain.volume();
+    if (arg != nullptr && !parse_volume(arg, volume, &volume))
+    {
+        control.reply("ERROR invalid volume %s", arg);
+        return;
+    }
+
+    if (arg != nullptr)
+    {
+        gain.set_volume(volume);
+        volume_dirty = true;
+        play_notification(beep_sound, PRIORITY_BEEP, false);
+    }
+
+    control.reply("OK %d", volume);
+}
+
+static void handle_command(char* cmd)
+{
+    char* save = nullptr;
+    const char* name = strtok_r(cmd, " ", &save);
+    const char* arg = strtok_r(nullptr, " ", &save);
+
+    if (name == nullptr)
+    {
+        control.reply("ERROR empty command");
+    }
+    else if (strcasecmp(name, "volume") == 0)
+    {
+        handle_volume_command(voice_gain, arg);
+    }
+    else if (strcasecmp(name, "notify-volume") == 0)
+    {
+        handle_volume_command(notify_gain, arg);
+    }
+    else if (strcasecmp(name, "drift") == 0)
+    {
+        if (!crypto_rx->get_config()->drift_compensation)
+        {
+            control.reply("ERROR drift compensation is off");
+        }
+        else
+        {
+            const jack_nframes_t jack_sample_rate = jack_get_sample_rate(client);
+            control.reply("OK %+.1f ppm, %.1f ms queued",
+                          output_resampler->drift_ppm(),
+                          output_resampler->average_fill() * 1000.0 / jack_sample_rate);
+        }
+    }
+    else if (strcasecmp(name, "playout") == 0)
+    {
+        const jack_nframes_t jack_sample_rate = jack_get_sample_rate(client);
+        control.reply("OK target %.1f ms, depth %.1f ms, %u underruns, %.1f ms concealed",
+                      playout.target() * 1000.0 / jack_sample_rate,
+                      playout.average_depth() * 1000.0 / jack_sample_rate,
+                      (uint)playout.underruns(),
+                      playout.concealed_elems() * 1000.0 / jack_sample_rate);
+    }
+    else if (strcasecmp(name, "keyed") == 0)
+    {
+        if (!keyed_enabled)
+        {
+            control.reply("ERROR no keyed state");
+        }
+        else
+        {
+            control.reply("OK %s, %u suspensions",
+                          suspended.load(std::memory_order_relaxed) ? "suspended" : "receiving",
+                          (uint)suspensions.load(std::memory_order_relaxed));
+        }
+    }
+    else if (strcasecmp(name, "tap") == 0)
+    {
+        handle_tap_command(tap,
+                           control,
+                           arg,
+                           crypto_rx->get_config(),
+                           jack_get_sample_rate(client));
+    }
+    else if (strcasecmp(name, "link") == 0)
+    {
+        if (!link_enabled)
+        {
+            control.reply("ERROR no network link");
+        }
+        else
+        {
+            const jack_nframes_t jack_sample_rate = jack_get_sample_rate(client);
+            control.reply("OK %llu packets, %lld lost, %llu late, %llu duplicate, "
+                          "%llu concealed, jitter %.1f ms, playout %.1f ms, %+.1f ppm",
+                          (unsigned long long)modem_link.packets_received(),
+                          (long long)modem_link.packets_lost(),
+                          (unsigned long long)modem_link.late_frames(),
+                          (unsigned long long)modem_link.duplicate_frames(),
+                          (unsigned long long)modem_link.concealed_frames(),
+                          modem_link.jitter_ms(),
+                          modem_link.playout().target() * 1000.0 / jack_sample_rate,
+                          modem_link.drift_ppm());
+        }
+    }
+    else
+    {
+        control.reply("ERROR unknown command %s", name);
+    }
+}
+
+// Everything sized from both the modem and the JACK sample rate
+static void initialize_resamplers()
+{
+    jack_params = get_jack_runtime_params(client, crypto_rx->get_runtime_params());
+
+    const jack_nframes_t jack_sample_rate = jack_params.sample_rate;
+    const uint speech_sample_rate = jack_params.speech_sample_rate;
+    const uint modem_sample_rate = jack_params.modem_sample_rate;
 
     const size_t speech_frames =
-        get_max_resampled_frames(crypto_rx->max_speech_samples_per_frame(),
+        get_max_resampled_frames(jack_params.max_speech_samples_per_frame,
                                  speech_sample_rate,
                                  jack_sample_rate);
     const size_t modem_frames =
-        get_max_resampled_frames(crypto_rx->max_modem_samples_per_frame(),
+        get_max_resampled_frames(jack_params.max_modem_samples_per_frame,
                                  modem_sample_rate,
                                  jack_sample_rate);
 
@@ -338,35 +626,133 @@ static void initialize_crypto()
     input_resampler->enqueue_zeroes(jack_get_buffer_size(client));
     input_resampler->clear();
 
-    output_resampler->enqueue_zeroes(crypto_rx->max_speech_samples_per_frame());
+    output_resampler->enqueue_zeroes(jack_params.max_speech_samples_per_frame);
     output_resampler->clear();
 }
 
-int main(int argc, char *argv[])
+static void initialize_crypto()
 {
-    const char* client_name = "crypto_rx";
-    const char* server_name = nullptr;
-    jack_options_t options = JackNullOption;
-    jack_status_t status;
+    crypto_rx = nullptr;
+    input_resampler = nullptr;
+    output_resampler = nullptr;
 
-    if (argc > 2)
+    crypto_rx.reset(new crypto_rx_common("crypto_rx", context));
+    initialize_resamplers();
+    initialize_volume();
+}
+
+static void restart_tap()
+{
+    const struct config* cfg = crypto_rx->get_config();
+    tap.stop();
+    if (cfg->tap_enabled && !tap.start(cfg, jack_get_sample_rate(client)))
     {
-        server_name = argv[1];
-        options = (jack_options_t)(JackNullOption | JackServerName | JackNoStartServer);
+        crypto_rx->log_to_logger(LOG_WARN, "Could not start stream tap");
+    }
+}
 
-        config_file = argv[2];
+// Only redoes what the changed settings need. Key and squelch changes are
+// handed to the audio thread without stopping it
+static void reload()
+{
+    const unsigned changes = crypto_rx->check_reload();
+    if (changes == 0)
+    {
+        return;
     }
-    else
+
+    bool restart_client = (changes & (CONFIG_CHANGE_CODEC | CONFIG_CHANGE_JACK)) != 0;
+    if (restart_client)
     {
-        fprintf(stderr, "Usage: jack_crypto_rx <jack server name> <config file>");
-        exit(1);
+        jack_deactivate(client);
+    }
+
+    // Starting over is also the way out if the audio thread hasn't taken
+    // the last update
+    if ((changes & CONFIG_CHANGE_CODEC) != 0 || !crypto_rx->apply_reload(changes))
+    {
+        if (!restart_client)
+        {
+            jack_deactivate(client);
+            restart_client = true;
+        }
+
+        try
+        {
+            initialize_crypto();
+        }
+        catch (const std::exception& ex)
+        {
+            fprintf(stderr, "%s", ex.what());
+            exit(1);
+        }
+    }
+    else if (changes & CONFIG_CHANGE_VOLUME)
+    {
+        initialize_volume();
+    }
+
+    if (changes & CONFIG_CHANGE_NOTIFY)
+    {
+        load_notification_clips();
+    }
+    if (changes & CONFIG_CHANGE_TAP)
+    {
+        restart_tap();
+    }
+    if (changes & CONFIG_CHANGE_RESTART)
+    {
+        crypto_rx->log_to_logger(LOG_WARN, "Some settings only take effect after a restart");
     }
 
+    // Activating plays the startup notification, otherwise announce a new
+    // key the same way
+    if (restart_client)
+    {
+        activate_client();
+    }
+    else if (changes & CONFIG_CHANGE_KEY)
+    {
+        play_startup_notification();
+    }
+}
+
+void start_rx_pipeline(const char* server_name, std::shared_ptr<crypto_context> ctx)
+{
+    const char* client_name = "crypto_rx";
+    const jack_options_t options =
+        (jack_options_t)(JackNullOption | JackServerName | JackNoStartServer);
+    jack_status_t status;
+
+    context = std::move(ctx);
+    config_generation = context->generation();
+
     fprintf(stderr, "Server name: %s\n", server_name ? server_name : "");
 
+    // The modem doesn't need JACK, so set it up while the server is still
+    // starting
+    std::string init_error;
+    std::thread init_thread([&]()
+    {
+        try
+        {
+            startup_phase phase("jack_crypto_rx", "codec");
+            crypto_rx.reset(new crypto_rx_common("crypto_rx", context));
+        }
+        catch (const std::exception& ex)
+        {
+            init_error = ex.what();
+        }
+    });
+
     /* open a client connection to the JACK server */
 
-    client = jack_client_open (client_name, options, &status, server_name);
+    {
+        startup_phase phase("jack_crypto_rx", "jack_open");
+        client = open_jack_client_when_ready(client_name, options, &status, server_name);
+    }
+    init_thread.join();
+
     if (client == NULL)
     {
         fprintf (stderr,
@@ -425,66 +811,136 @@ int main(int argc, char *argv[])
         exit (1);
     }
 
-    try
-    {
-        initialize_crypto();
-    }
-    catch (const std::exception& ex)
+    if (!init_error.empty())
     {
-        fprintf(stderr, "%s", ex.what());
+        fprintf(stderr, "%s", init_error.c_str());
         exit(1);
     }
 
+    // Notification sounds are resampled to the JACK rate, so they can only
+    // be loaded now. Do it alongside the rest of the setup
+    std::thread asset_thread([]()
+    {
+        startup_phase phase("jack_crypto_rx", "assets");
+        load_notification_clips();
+    });
+
+    initialize_resamplers();
+    initialize_volume();
+
     const struct config* cfg = crypto_rx->get_config();
-    if (cfg->jack_secure_notify_file[0])
+
+    if (cfg->net_rx_link[0])
     {
-        read_wav_file(cfg->jack_secure_notify_file, crypto_startup);
+        if (!modem_link.open(cfg->net_rx_link,
+                             jack_get_sample_rate(client),
+                             cfg->net_link_rate,
+                             cfg->net_frames_per_packet,
+                             cfg->drift_compensation))
+        {
+            fprintf(stderr, "Could not listen for the network link on %s\n", cfg->net_rx_link);
+            exit(1);
+        }
+        link_enabled = true;
     }
-    if (cfg->jack_insecure_notify_file[0])
+
+    if (cfg->jack_keyed_state[0])
     {
-        read_wav_file(cfg->jack_insecure_notify_file, plain_startup);
+        keyed_enabled = keyed.open(cfg->jack_keyed_state);
+        if (!keyed_enabled)
+        {
+            crypto_rx->log_to_logger(LOG_WARN, "Could not open the keyed state");
+        }
     }
 
-    activate_client();
+    if (cfg->jack_rx_control_socket[0] &&
+        !control.open(cfg->jack_rx_control_socket))
+    {
+        crypto_rx->log_to_logger(LOG_WARN, "Could not open control socket");
+    }
 
-    signal(SIGQUIT, signal_handler);
-    signal(SIGTERM, signal_handler);
-    signal(SIGHUP, handle_sighup);
-    signal(SIGUSR1, handle_sigusr1);
-    signal(SIGINT, signal_handler);
+    tap_modem_in = tap.add_stream("modem_in");
+    tap_voice_out = tap.add_stream("voice_out");
+    if (cfg->tap_enabled && !tap.start(cfg, jack_get_sample_rate(client)))
+    {
+        crypto_rx->log_to_logger(LOG_WARN, "Could not start stream tap");
+    }
 
-    while (true)
+    if (!watcher.open(context->config_file()))
     {
-        if (reload_config != 0)
-        {
-            reload_config = 0;
+        crypto_rx->log_to_logger(LOG_WARN, "Could not watch config files, reload with SIGHUP");
+    }
 
-            jack_deactivate(client);
-            try
-            {
-                initialize_crypto();
-            }
-            catch (const std::exception& ex)
-            {
-                fprintf(stderr, "%s", ex.what());
-                exit(1);
-            }
-            activate_client();
-        }
+    asset_thread.join();
 
-        if (read_wav != 0)
-        {
-            read_wav = 0;
+    {
+        startup_phase phase("jack_crypto_rx", "activate");
+        activate_client();
+    }
+}
 
-            if (read_wav_file("/tmp/notify.wav", wave_sound))
-            {
-                play_wav = 1;
-            }
+void add_rx_pipeline_fds(std::vector<int>& fds)
+{
+    fds.push_back(control.fd());
+    fds.push_back(watcher.fd());
+}
+
+void poll_rx_pipeline()
+{
+    if (watcher.changed())
+    {
+        reload_config = 1;
+    }
+
+    // When both pipelines are told to reload, whichever gets here first
+    // rereads the config for both
+    if (reload_config != 0)
+    {
+        reload_config = 0;
+        context->reread(config_generation);
+    }
+    if (context->generation() != config_generation)
+    {
+        config_generation = context->generation();
+        reload();
+    }
+
+    // The same signal may be meant for the transmitter's prompt when both
+    // run in one process, so only play a prompt that has been rewritten
+    if (read_wav != 0)
+    {
+        read_wav = 0;
+
+        const char* const prompt_file = "/tmp/notify.wav";
+        const audio_clip_ptr prompt = file_modified(prompt_file, &prompt_mtime) ?
+            read_audio_clip(prompt_file) : nullptr;
+        if (prompt)
+        {
+            play_notification(prompt, PRIORITY_PROMPT, true);
         }
-        sleep(1);
     }
-    
-    jack_client_close (client);
-    return 0;
-}
+    notifications.collect();
 
+    char text[FREEDV_TEXT_MAX + 1];
+    while (crypto_rx->take_text(text, sizeof(text)))
+    {
+        notify_text(text);
+    }
+    // Reap finished notify commands
+    while (waitpid(-1, nullptr, WNOHANG) > 0)
+    {
+    }
+
+    char cmd[CONTROL_MSG_MAX];
+    bool received = false;
+    while (control.receive(cmd, sizeof(cmd), 0))
+    {
+        handle_command(cmd);
+        received = true;
+    }
+    if (!received && volume_dirty)
+    {
+        // Save once the buttons have gone quiet instead of on every press
+        save_volume();
+    }
+}
@@ -0,0 +1,69 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#include <vector>
+
+#include "startup_log.h"
+#include "jack_common.h"
+#include "jack_pipelines.h"
+
+static void signal_handler(int sig)
+{
+    stop_rx_pipeline();
+    fprintf(stderr, "signal received, exiting ...\n");
+    exit(0);
+}
+
+static void handle_sighup(int sig)
+{
+    request_rx_reload();
+}
+
+static void handle_sigusr1(int sig)
+{
+    request_rx_prompt();
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc <= 2)
+    {
+        fprintf(stderr, "Usage: jack_crypto_rx <jack server name> <config file>");
+        exit(1);
+    }
+
+    start_rx_pipeline(argv[1], open_pipeline_context("crypto_rx", argv[2]));
+
+    signal(SIGQUIT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    signal(SIGHUP, handle_sighup);
+    signal(SIGUSR1, handle_sigusr1);
+    signal(SIGINT, signal_handler);
+
+    notify_ready("jack_crypto_rx");
+
+    std::vector<int> fds;
+    add_rx_pipeline_fds(fds);
+    while (true)
+    {
+        poll_rx_pipeline();
+        wait_for_fds(fds, 1000);
+    }
+
+    return 0;
+}
@@ -0,0 +1,103 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Hosts the transmit and receive pipelines in one process, to save the
+// memory and context switches of a second process on small boards. Each
+// pipeline is still its own JACK client, so audio runs on the RT thread of
+// whichever server it is attached to and nothing in the audio path changes.
+// What is shared is everything outside it: one crypto_context holding the
+// config, key and logger, the codec2 library code and this one main loop.
+// The asset cache is only used by the receiver.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+
+#include <vector>
+
+#include "startup_log.h"
+#include "jack_common.h"
+#include "jack_pipelines.h"
+
+// Tells the init scripts that signals for the receiver go to this process
+static const char* const TRX_MARKER = "/var/run/jack_crypto_trx";
+
+static void signal_handler(int sig)
+{
+    stop_rx_pipeline();
+    stop_tx_pipeline();
+    fprintf(stderr, "signal received, exiting ...\n");
+    exit(0);
+}
+
+static void handle_sighup(int sig)
+{
+    request_tx_reload();
+    request_rx_reload();
+}
+
+static void handle_sigusr1(int sig)
+{
+    // Each side only plays its own prompt file if it has been rewritten
+    request_tx_prompt();
+    request_rx_prompt();
+}
+
+static void handle_sigptt(int sig)
+{
+    toggle_tx_ptt();
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc <= 3)
+    {
+        fprintf(stderr, "Usage: jack_crypto_trx <tx jack server name> <rx jack server name> <config file>");
+        exit(1);
+    }
+
+    // Both may be given the same server, in which case the two clients
+    // share its RT thread
+    // One config, key and logger for both
+    const std::shared_ptr<crypto_context> context =
+        open_pipeline_context("crypto_trx", argv[3]);
+    start_tx_pipeline(argv[1], context);
+    start_rx_pipeline(argv[2], context);
+
+    signal(SIGQUIT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    signal(SIGHUP, handle_sighup);
+    signal(SIGUSR1, handle_sigusr1);
+    signal(SIGRTMIN, handle_sigptt);
+    signal(SIGINT, signal_handler);
+
+    FILE* marker = fopen(TRX_MARKER, "w");
+    if (marker)
+    {
+        fclose(marker);
+    }
+    notify_ready("jack_crypto_trx");
+
+    std::vector<int> fds;
+    add_tx_pipeline_fds(fds);
+    add_rx_pipeline_fds(fds);
+    while (true)
+    {
+        poll_tx_pipeline();
+        poll_rx_pipeline();
+        wait_for_fds(fds, 1000);
+    }
+
+    return 0;
+}
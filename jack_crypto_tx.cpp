@@ -24,8 +24,9 @@
 #include <unistd.h>
 
 #include <vector>
-#include <deque>
 #include <memory>
+#include <string>
+#include <thread>
 
 #include <gpiod.h>
 
@@ -37,8 +38,17 @@
 #include "crypto_cfg.h"
 #include "crypto_log.h"
 #include "crypto_tx_common.h"
+#include "crypto_context.h"
 #include "crypto_common.h"
+#include "voice_manager.h"
+#include "control_socket.h"
+#include "stream_tap.h"
+#include "config_watcher.h"
+#include "startup_log.h"
 #include "jack_common.h"
+#include "jack_pipelines.h"
+#include "modem_link.h"
+#include "keyed_state.h"
 
 static std::unique_ptr<crypto_tx_common> crypto_tx;
 
@@ -49,42 +59,65 @@ static jack_client_t* client = nullptr;
 static std::unique_ptr<resampler> input_resampler;
 static std::unique_ptr<resampler> output_resampler;
 
-static audio_buffer_t tts_file;
-static std::deque<jack_default_audio_sample_t> tts_buffer;
+static jack_runtime_params jack_params;
+
+static voice_manager tts_voices;
+static audio_buffer_t tts_frames(MAX_JACK_PERIOD);
+
+static control_socket control;
+static config_watcher watcher;
+
+static stream_tap tap("tx");
+
+// Set when the modem output goes over the network rather than out of the
+// modem port. Fixed at startup
+static modem_link_sender modem_link;
+static bool link_enabled = false;
+
+// Tells the receiver when the radio is keyed (see [JACK] KeyedState)
+static keyed_state keyed;
+
+static int tap_voice_in = -1;
+static int tap_modem_out = -1;
 
 static volatile sig_atomic_t reload_config = 0;
 static volatile sig_atomic_t read_wav = 0;
-static volatile sig_atomic_t play_wav = 0;
 
 static volatile sig_atomic_t sig_ptt_val = 0;
 
-static const char* config_file = nullptr;
+// May be shared with the receiver in jack_crypto_trx. The generation is the
+// last one reloaded from
+static std::shared_ptr<crypto_context> context;
+static unsigned config_generation = 0;
+
+// Written by the last TTS prompt played, so a prompt is only played once
+static struct timespec tts_mtime = {0, 0};
 
 static struct gpiod_line* ptt_in_line = nullptr;
 static struct gpiod_line* ptt_out_line = nullptr;
 
-static void signal_handler(int sig)
-{
-    jack_client_close(client);
-    fprintf(stderr, "signal received, exiting ...\n");
-    exit(0);
-}
-
-static void handle_sighup(int sig)
+void request_tx_reload()
 {
     reload_config = 1;
 }
 
-static void handle_sigusr1(int sig)
+void request_tx_prompt()
 {
     read_wav = 1;
 }
 
-static void handle_sigptt(int sig)
+void toggle_tx_ptt()
 {
     sig_ptt_val = !sig_ptt_val;
 }
 
+// Every way out unkeys first, so the receiver doesn't stay suspended
+void stop_tx_pipeline()
+{
+    jack_client_close(client);
+    keyed.publish(false);
+}
+
 static bool microphone_enabled(const struct config* cfg)
 {
     if (cfg->ptt_enabled && cfg->ptt_gpio_num < 0)
@@ -113,8 +146,17 @@ static bool microphone_enabled(const struct config* cfg)
 static void set_ptt_val(const struct config* cfg, bool val)
 {
     static int prev_val = -1;
+    static int published_val = -1;
     const int cur_val = static_cast<int>(val);
 
+    // The receiver hears about every edge, whether or not there is a PTT
+    // line to drive
+    if (published_val != cur_val)
+    {
+        keyed.publish(val);
+        published_val = cur_val;
+    }
+
     if (ptt_out_line == nullptr)
     {
         prev_val = -1;
@@ -131,8 +173,9 @@ static void set_ptt_val(const struct config* cfg, bool val)
  * JACK calls this shutdown_callback if the server ever shuts down or
  * decides to disconnect the client.
  */
-void jack_shutdown(void *arg)
+static void jack_shutdown(void *arg)
 {
+    keyed.publish(false);
     exit (1);
 }
 
@@ -143,40 +186,27 @@ void jack_shutdown(void *arg)
  * This client follows a simple rule: when the JACK transport is
  * running, copy the input port to the output.  When it stops, exit.
  */
-int process(jack_nframes_t nframes, void *arg)
+static int process(jack_nframes_t nframes, void *arg)
 {
     const jack_default_audio_sample_t* const voice_frames =
         (jack_default_audio_sample_t*)jack_port_get_buffer(voice_port, nframes);
     jack_default_audio_sample_t* const modem_frames =
             (jack_default_audio_sample_t*)jack_port_get_buffer(modem_port, nframes);
-
-    const jack_nframes_t jack_sample_rate = jack_get_sample_rate(client);
-    const uint voice_sample_rate = crypto_tx->speech_sample_rate();
-    const uint modem_sample_rate = crypto_tx->modem_sample_rate();
-
-    input_resampler->set_sample_rates(jack_sample_rate, voice_sample_rate);
-    output_resampler->set_sample_rates(modem_sample_rate, jack_sample_rate);
+    tap.write(tap_voice_in, voice_frames, nframes);
+    keyed.heartbeat();
 
     const struct config* cfg = crypto_tx->get_config();
 
-    const size_t n_nom_modem_samples = crypto_tx->modem_samples_per_frame();
-    const size_t n_speech_samples = crypto_tx->speech_samples_per_frame();
-
-    if (play_wav != 0)
-    {
-        play_wav = 0;
-
-        // Zero-pad a few frames at the start to give the encryption a
-        // chance to sync
-        tts_buffer.insert(tts_buffer.cend(), nframes * 6, 0.0);
-        tts_buffer.insert(tts_buffer.cend(), tts_file.cbegin(), tts_file.cend());
-    }
+    const size_t n_nom_modem_samples = jack_params.modem_samples_per_frame;
+    const size_t n_speech_samples = jack_params.speech_samples_per_frame;
 
     static uint delay_periods = 0;
     static bool transmitting_prev = false;
 
     const bool mic_enabled = microphone_enabled(cfg);
-    const bool transmitting_cur = mic_enabled || !tts_buffer.empty();
+    const bool transmitting_cur = mic_enabled ||
+                                  tts_voices.active() ||
+                                  crypto_tx->sending_text();
     if (transmitting_cur)
     {
         delay_periods = 0;
@@ -194,12 +224,20 @@ int process(jack_nframes_t nframes, void *arg)
         // Turn on the PTT output
         set_ptt_val(cfg, true);
 
-        const size_t tts_to_add = std::min(tts_buffer.size(), (size_t)nframes);
-        if (tts_to_add > 0)
+        // Mixed a buffer at a time, since a period can be longer than the
+        // buffer, until the voices stop covering all of it
+        size_t tts_to_add = 0;
+        while (tts_to_add < nframes)
         {
-            input_resampler->enqueue(tts_buffer.begin(),
-                                     tts_buffer.begin() + tts_to_add);
-            tts_buffer.erase(tts_buffer.begin(), tts_buffer.begin() + tts_to_add);
+            const size_t chunk = std::min<size_t>(nframes - tts_to_add, tts_frames.size());
+            zeroize_frames(tts_frames.data(), chunk);
+            const size_t covered = tts_voices.mix(tts_frames.data(), chunk);
+            input_resampler->enqueue(tts_frames.data(), covered);
+            tts_to_add += covered;
+            if (covered < chunk)
+            {
+                break;
+            }
         }
 
         // Offset the voice samples so TTS doesn't add delay to the signal
@@ -217,7 +255,7 @@ int process(jack_nframes_t nframes, void *arg)
         // Now add the remaining frames without zero-padding
         while (input_resampler->available_elems() >= n_speech_samples)
         {
-            short mod_out[n_nom_modem_samples];
+            float mod_out[n_nom_modem_samples];
             short voice_in[n_speech_samples];
             input_resampler->dequeue(voice_in, n_speech_samples);
 
@@ -226,10 +264,7 @@ int process(jack_nframes_t nframes, void *arg)
             output_resampler->enqueue(mod_out, nout);
         }
 
-        const uint modem_resampled_frames =
-            get_nom_resampled_frames(n_nom_modem_samples,
-                                     modem_sample_rate,
-                                     jack_sample_rate);
+        const uint modem_resampled_frames = jack_params.modem_resampled_frames;
         const uint required_frames =
             (modem_resampled_frames + (nframes - 1)) / nframes;
         const uint required_elems = nframes * required_frames;
@@ -259,7 +294,7 @@ int process(jack_nframes_t nframes, void *arg)
             // Run all the input data through the modem
             while (input_resampler->available_elems() != 0)
             {
-                short mod_out[n_nom_modem_samples];
+                float mod_out[n_nom_modem_samples];
                 // Initializing this buffer to zero will zero-fill the end
                 // if there aren't a multiple of n_speech_samples in the
                 // input queue
@@ -309,6 +344,12 @@ int process(jack_nframes_t nframes, void *arg)
         }
     }
 
+    tap.write(tap_modem_out, modem_frames, nframes);
+    if (link_enabled)
+    {
+        modem_link.write(modem_frames, nframes);
+    }
+
     transmitting_prev = transmitting_cur;
 
     return 0;
@@ -320,26 +361,76 @@ static bool connect_input_ports(jack_port_t* output_port,
     return connect_input_ports(client, output_port, input_port_regex);
 }
 
+static void handle_command(char* cmd)
+{
+    char* save = nullptr;
+    const char* name = strtok_r(cmd, " ", &save);
+    // The text command takes the rest of the line, spaces and all
+    const std::string rest = save != nullptr ? save : "";
+    const char* arg = strtok_r(nullptr, " ", &save);
+
+    if (name == nullptr)
+    {
+        control.reply("ERROR empty command");
+    }
+    else if (strcasecmp(name, "text") == 0)
+    {
+        if (rest.empty() || rest.size() > FREEDV_TEXT_MAX)
+        {
+            control.reply("ERROR text must be 1 to %d characters", FREEDV_TEXT_MAX);
+        }
+        else if (!crypto_tx->send_text(rest.c_str()))
+        {
+            control.reply("ERROR text channel not available");
+        }
+        else
+        {
+            control.reply("OK");
+        }
+    }
+    else if (strcasecmp(name, "tap") == 0)
+    {
+        handle_tap_command(tap,
+                           control,
+                           arg,
+                           crypto_tx->get_config(),
+                           jack_get_sample_rate(client));
+    }
+    else if (strcasecmp(name, "link") == 0)
+    {
+        if (!link_enabled)
+        {
+            control.reply("ERROR no network link");
+        }
+        else
+        {
+            control.reply("OK %llu packets, %llu bytes, %llu overflows, %llu send errors",
+                          (unsigned long long)modem_link.packets_sent(),
+                          (unsigned long long)modem_link.bytes_sent(),
+                          (unsigned long long)modem_link.overflows(),
+                          (unsigned long long)modem_link.send_errors());
+        }
+    }
+    else
+    {
+        control.reply("ERROR unknown command %s", name);
+    }
+}
+
 static void activate_client()
 {
     const struct config* cfg = crypto_tx->get_config();
-    jack_nframes_t period = get_jack_period(cfg);
+    jack_nframes_t period = get_jack_period(cfg, JACK_DIRECTION_TX);
     char buffer[128] = {0};
     if (period == 0)
     {
-        const jack_nframes_t jack_sample_rate = jack_get_sample_rate(client);
-        const uint modem_sample_rate = crypto_tx->modem_sample_rate();
-        const uint modem_samples_per_frame = crypto_tx->modem_samples_per_frame();
-
-        period = get_nom_resampled_frames(modem_samples_per_frame,
-                                          modem_sample_rate,
-                                          jack_sample_rate);
+        period = jack_params.modem_resampled_frames;
         snprintf(buffer,
                  sizeof(buffer),
                  "Buffer size: %u, Modem frame size: %u, Modem sample rate: %u",
                  period,
-                 modem_samples_per_frame,
-                 modem_sample_rate);
+                 (uint)jack_params.modem_samples_per_frame,
+                 jack_params.modem_sample_rate);
     }
     else
     {
@@ -366,33 +457,41 @@ static void activate_client()
         exit (1);
     }
 
+    // The port still carries the modem output with a link, for monitoring,
+    // but isn't connected to the radio's sound card
     const char* playback_port_regex =
         *cfg->jack_modem_out_port ? cfg->jack_modem_out_port : "system:playback_*";
-    if (!connect_input_ports(modem_port, playback_port_regex))
+    if (!link_enabled && !connect_input_ports(modem_port, playback_port_regex))
     {
         exit(1);
     }
 }
 
+// Everything sized from both the modem and the JACK sample rate
+static void initialize_resamplers()
+{
+    jack_params = get_jack_runtime_params(client, crypto_tx->get_runtime_params());
+
+    const size_t speech_frames = jack_params.speech_resampled_frames;
+    const size_t modem_frames = jack_params.modem_resampled_frames;
+
+    input_resampler.reset(new resampler(SRC_SINC_FASTEST, 1, speech_frames * 2));
+    output_resampler.reset(new resampler(SRC_SINC_FASTEST, 1, modem_frames * 2));
+
+    // The rates only change when the config is reloaded, so set them here
+    // rather than on every cycle
+    input_resampler->set_sample_rates(jack_params.sample_rate, jack_params.speech_sample_rate);
+    output_resampler->set_sample_rates(jack_params.modem_sample_rate, jack_params.sample_rate);
+}
+
 static void initialize_crypto()
 {
     crypto_tx = nullptr;
     input_resampler = nullptr;
     output_resampler = nullptr;
 
-    crypto_tx.reset(new crypto_tx_common("crypto_tx", config_file));
-
-    const size_t speech_frames =
-        get_nom_resampled_frames(crypto_tx->speech_samples_per_frame(),
-                                 crypto_tx->speech_sample_rate(),
-                                 jack_get_sample_rate(client));
-    const size_t modem_frames =
-        get_nom_resampled_frames(crypto_tx->modem_samples_per_frame(),
-                                 crypto_tx->modem_sample_rate(),
-                                 jack_get_sample_rate(client));
-
-    input_resampler.reset(new resampler(SRC_SINC_FASTEST, 1, speech_frames * 2));
-    output_resampler.reset(new resampler(SRC_SINC_FASTEST, 1, modem_frames * 2));
+    crypto_tx.reset(new crypto_tx_common(context));
+    initialize_resamplers();
 }
 
 static void initialize_ptt()
@@ -433,33 +532,116 @@ static void initialize_ptt()
     }
 }
 
-int main(int argc, char *argv[])
+static void restart_tap()
 {
-    const char* client_name = "crypto_tx";
-    const char* server_name = nullptr;
-    jack_options_t options = JackNullOption;
-    jack_status_t status;
+    const struct config* cfg = crypto_tx->get_config();
+    tap.stop();
+    if (cfg->tap_enabled && !tap.start(cfg, jack_get_sample_rate(client)))
+    {
+        crypto_tx->log_to_logger(LOG_WARN, "Could not start stream tap");
+    }
+}
 
-    struct config *cur = NULL;
+// Only redoes what the changed settings need. Key and squelch changes are
+// handed to the audio thread without stopping it
+static void reload()
+{
+    const unsigned changes = crypto_tx->check_reload();
+    if (changes == 0)
+    {
+        return;
+    }
 
-    if (argc > 2)
+    // process() uses the PTT lines and the port connections, so it has to
+    // be stopped while they change
+    bool restart_client = (changes & (CONFIG_CHANGE_CODEC |
+                                      CONFIG_CHANGE_PTT |
+                                      CONFIG_CHANGE_JACK)) != 0;
+    if (restart_client)
     {
-        server_name = argv[1];
-        options = (jack_options_t)(JackNullOption | JackServerName | JackNoStartServer);
+        jack_deactivate(client);
+    }
 
-        config_file = argv[2];
+    // Starting over is also the way out if the audio thread hasn't taken
+    // the last update
+    if ((changes & CONFIG_CHANGE_CODEC) != 0 || !crypto_tx->apply_reload(changes))
+    {
+        if (!restart_client)
+        {
+            jack_deactivate(client);
+            restart_client = true;
+        }
+
+        try
+        {
+            initialize_crypto();
+        }
+        catch (const std::exception& ex)
+        {
+            fprintf(stderr, "%s", ex.what());
+            exit(1);
+        }
     }
-    else
+
+    if (changes & CONFIG_CHANGE_PTT)
     {
-        fprintf(stderr, "Usage: jack_crypto_tx <jack server name> <config file>");
-        exit(1);
+        initialize_ptt();
     }
+    if (changes & CONFIG_CHANGE_TAP)
+    {
+        restart_tap();
+    }
+    if (changes & CONFIG_CHANGE_RESTART)
+    {
+        crypto_tx->log_to_logger(LOG_WARN, "Some settings only take effect after a restart");
+    }
+
+    if (restart_client)
+    {
+        activate_client();
+    }
+}
+
+void start_tx_pipeline(const char* server_name, std::shared_ptr<crypto_context> ctx)
+{
+    const char* client_name = "crypto_tx";
+    const jack_options_t options =
+        (jack_options_t)(JackNullOption | JackServerName | JackNoStartServer);
+    jack_status_t status;
+
+    context = std::move(ctx);
+    config_generation = context->generation();
 
     fprintf(stderr, "Server name: %s\n", server_name ? server_name : "");
 
+    // The modem and the GPIO lines don't need JACK, so set them up while
+    // the server is still starting
+    std::string init_error;
+    std::thread init_thread([&]()
+    {
+        try
+        {
+            startup_phase phase("jack_crypto_tx", "codec");
+            crypto_tx.reset(new crypto_tx_common(context));
+        }
+        catch (const std::exception& ex)
+        {
+            init_error = ex.what();
+            return;
+        }
+
+        startup_phase phase("jack_crypto_tx", "ptt");
+        initialize_ptt();
+    });
+
     /* open a client connection to the JACK server */
 
-    client = jack_client_open (client_name, options, &status, server_name);
+    {
+        startup_phase phase("jack_crypto_tx", "jack_open");
+        client = open_jack_client_when_ready(client_name, options, &status, server_name);
+    }
+    init_thread.join();
+
     if (client == NULL)
     {
         fprintf (stderr,
@@ -512,25 +694,63 @@ int main(int argc, char *argv[])
         exit (1);
     }
 
-    try
+    if (!init_error.empty())
     {
-        initialize_crypto();
+        fprintf(stderr, "%s", init_error.c_str());
+        exit(1);
     }
-    catch (const std::exception& ex)
+
+    initialize_resamplers();
+
+    const struct config* cfg = crypto_tx->get_config();
+    if (cfg->net_tx_link[0])
     {
-        fprintf(stderr, "%s", ex.what());
-        exit(1);
+        if (!modem_link.open(cfg->net_tx_link,
+                             jack_get_sample_rate(client),
+                             cfg->net_link_rate,
+                             cfg->net_frames_per_packet))
+        {
+            fprintf(stderr, "Could not open the network link to %s\n", cfg->net_tx_link);
+            exit(1);
+        }
+        link_enabled = true;
     }
 
-    initialize_ptt();
-    activate_client();
+    // Unkeyed to start with, in case the last run was stopped mid-transmission
+    if (cfg->jack_keyed_state[0])
+    {
+        if (keyed.open(cfg->jack_keyed_state))
+        {
+            keyed.publish(false);
+        }
+        else
+        {
+            crypto_tx->log_to_logger(LOG_WARN, "Could not open the keyed state");
+        }
+    }
+
+    if (cfg->jack_tx_control_socket[0] &&
+        !control.open(cfg->jack_tx_control_socket))
+    {
+        crypto_tx->log_to_logger(LOG_WARN, "Could not open control socket");
+    }
+
+    tap_voice_in = tap.add_stream("voice_in");
+    tap_modem_out = tap.add_stream("modem_out");
+    if (cfg->tap_enabled && !tap.start(cfg, jack_get_sample_rate(client)))
+    {
+        crypto_tx->log_to_logger(LOG_WARN, "Could not start stream tap");
+    }
+
+    if (!watcher.open(context->config_file()))
+    {
+        crypto_tx->log_to_logger(LOG_WARN, "Could not watch config files, reload with SIGHUP");
+    }
 
-    signal(SIGQUIT, signal_handler);
-    signal(SIGTERM, signal_handler);
-    signal(SIGHUP, handle_sighup);
-    signal(SIGUSR1, handle_sigusr1);
-    signal(SIGRTMIN, handle_sigptt);
-    signal(SIGINT, signal_handler);
+    {
+        startup_phase phase("jack_crypto_tx", "activate");
+        activate_client();
+    }
 
     // Create a zero length file to indicate when the transmitter is
     // initialized
@@ -539,43 +759,58 @@ int main(int argc, char *argv[])
     {
         fclose(initialized);
     }
+}
 
+void add_tx_pipeline_fds(std::vector<int>& fds)
+{
+    fds.push_back(control.fd());
+    fds.push_back(watcher.fd());
+}
 
-    const jack_nframes_t jack_sample_rate = jack_get_sample_rate(client);
-    while (true)
+void poll_tx_pipeline()
+{
+    if (watcher.changed())
     {
-        if (reload_config != 0) {
-            reload_config = 0;
+        reload_config = 1;
+    }
 
-            jack_deactivate(client);
-            crypto_tx = nullptr;
-            try
-            {
-                initialize_crypto();
-            }
-            catch (const std::exception& ex)
-            {
-                fprintf(stderr, "%s", ex.what());
-                exit(1);
-            }
+    // When both pipelines are told to reload, whichever gets here first
+    // rereads the config for both
+    if (reload_config != 0)
+    {
+        reload_config = 0;
+        context->reread(config_generation);
+    }
+    if (context->generation() != config_generation)
+    {
+        config_generation = context->generation();
+        reload();
+    }
 
-            initialize_ptt();
-            activate_client();
-        }
+    // The same signal may be meant for the receiver's prompt when both
+    // run in one process, so only play a prompt that has been rewritten
+    if (read_wav != 0)
+    {
+        read_wav = 0;
 
-        if (read_wav != 0)
+        const char* const tts_file = "/tmp/tts.wav";
+        const audio_clip_ptr tts = file_modified(tts_file, &tts_mtime) ?
+            read_audio_clip(tts_file, jack_get_sample_rate(client)) : nullptr;
+        if (tts)
         {
-            read_wav = 0;
-
-            if (read_wav_file("/tmp/tts.wav", jack_sample_rate, tts_file))
-            {
-                play_wav = 1;
-            }
+            // Lead in with a few periods of silence to give the
+            // encryption a chance to sync
+            voice_params params;
+            params.delay_frames = jack_get_buffer_size(client) * 6;
+            tts_voices.play(tts, params);
         }
-        sleep(1);
     }
-    
-    jack_client_close (client);
-    return 0;
+    tts_voices.collect();
+
+    char cmd[CONTROL_MSG_MAX];
+    while (control.receive(cmd, sizeof(cmd), 0))
+    {
+        handle_command(cmd);
+    }
 }
 
@@ -0,0 +1,223 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Runs at a remote radio's end of the modem link (see modem_link.h). The
+// radio's receive audio, from the modem_in port, goes to the transceiver's
+// RXLink, and the transceiver's TXLink comes back out of modem_out to the
+// radio's transmit audio.
+//
+// The radio keys itself, with VOX on its data input. The transceiver only
+// sends while transmitting, so modem_out is silent otherwise. Receive audio
+// is sent all the time, since the radio's noise between overs is never
+// exact silence.
+//
+// usage: jack_modem_bridge [-k <link rate>] [-f <frames per packet>]
+//                          [-c <capture port>] [-p <playback port regex>]
+//                          [-s <stats seconds>]
+//                          <jack server name> <listen [address:]port> <send host:port>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <jack/jack.h>
+
+#include "startup_log.h"
+#include "jack_common.h"
+#include "modem_link.h"
+
+static jack_client_t* client = nullptr;
+static jack_port_t* modem_in_port = nullptr;
+static jack_port_t* modem_out_port = nullptr;
+
+static modem_link_sender sender;
+static modem_link_receiver receiver;
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [-k <link rate>] [-f <frames per packet>]\n"
+            "       [-c <capture port>] [-p <playback port regex>] [-s <stats seconds>]\n"
+            "       <jack server name> <listen [address:]port> <send host:port>\n",
+            name);
+}
+
+static void signal_handler(int sig)
+{
+    jack_client_close(client);
+    fprintf(stderr, "signal received, exiting ...\n");
+    exit(0);
+}
+
+static void jack_shutdown(void *arg)
+{
+    exit (1);
+}
+
+static int process(jack_nframes_t nframes, void *arg)
+{
+    const jack_default_audio_sample_t* const modem_in =
+        (jack_default_audio_sample_t*)jack_port_get_buffer(modem_in_port, nframes);
+    jack_default_audio_sample_t* const modem_out =
+        (jack_default_audio_sample_t*)jack_port_get_buffer(modem_out_port, nframes);
+
+    sender.write(modem_in, nframes);
+    receiver.read(modem_out, nframes);
+    return 0;
+}
+
+static void print_stats(jack_nframes_t sample_rate)
+{
+    fprintf(stderr,
+            "sent %llu packets, %llu overflows, %llu send errors; "
+            "received %llu packets, %lld lost, %llu late, %llu concealed, "
+            "jitter %.1f ms, playout %.1f ms, %+.1f ppm\n",
+            (unsigned long long)sender.packets_sent(),
+            (unsigned long long)sender.overflows(),
+            (unsigned long long)sender.send_errors(),
+            (unsigned long long)receiver.packets_received(),
+            (long long)receiver.packets_lost(),
+            (unsigned long long)receiver.late_frames(),
+            (unsigned long long)receiver.concealed_frames(),
+            receiver.jitter_ms(),
+            receiver.playout().target() * 1000.0 / sample_rate,
+            receiver.drift_ppm());
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned link_rate = 8000;
+    unsigned frames_per_packet = 2;
+    const char* capture_port = "system:capture_1";
+    const char* playback_port_regex = "system:playback_*";
+    unsigned stats_seconds = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "k:f:c:p:s:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'k':
+            link_rate = atoi(optarg);
+            break;
+        case 'f':
+            frames_per_packet = atoi(optarg);
+            break;
+        case 'c':
+            capture_port = optarg;
+            break;
+        case 'p':
+            playback_port_regex = optarg;
+            break;
+        case 's':
+            stats_seconds = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (argc - optind != 3)
+    {
+        usage(argv[0]);
+        exit(1);
+    }
+    const char* server_name = argv[optind];
+    const char* listen_address = argv[optind + 1];
+    const char* send_address = argv[optind + 2];
+
+    const jack_options_t options =
+        (jack_options_t)(JackNullOption | JackServerName | JackNoStartServer);
+    jack_status_t status;
+    {
+        startup_phase phase("jack_modem_bridge", "jack_open");
+        client = open_jack_client_when_ready("modem_bridge", options, &status, server_name);
+    }
+    if (client == NULL)
+    {
+        fprintf(stderr,
+                "jack_client_open() failed, "
+                "status = 0x%2.0x\n",
+                status);
+        exit(1);
+    }
+
+    jack_set_process_callback(client, process, nullptr);
+    jack_on_shutdown(client, jack_shutdown, 0);
+
+    modem_in_port = jack_port_register(client,
+                                       "modem_in",
+                                       JACK_DEFAULT_AUDIO_TYPE,
+                                       JackPortIsInput,
+                                       0);
+    modem_out_port = jack_port_register(client,
+                                        "modem_out",
+                                        JACK_DEFAULT_AUDIO_TYPE,
+                                        JackPortIsOutput,
+                                        0);
+    if ((modem_in_port == NULL) || (modem_out_port == NULL))
+    {
+        fprintf(stderr, "no more JACK ports available\n");
+        exit(1);
+    }
+
+    const jack_nframes_t sample_rate = jack_get_sample_rate(client);
+    if (!receiver.open(listen_address, sample_rate, link_rate, frames_per_packet, true))
+    {
+        fprintf(stderr, "Could not listen for the network link on %s\n", listen_address);
+        exit(1);
+    }
+    if (!sender.open(send_address, sample_rate, link_rate, frames_per_packet))
+    {
+        fprintf(stderr, "Could not open the network link to %s\n", send_address);
+        exit(1);
+    }
+
+    {
+        startup_phase phase("jack_modem_bridge", "activate");
+        if (jack_activate(client))
+        {
+            fprintf(stderr, "cannot activate client");
+            exit(1);
+        }
+    }
+
+    if (jack_connect(client, capture_port, jack_port_name(modem_in_port)) != 0)
+    {
+        fprintf(stderr, "Could not connect modem port");
+        exit(1);
+    }
+    if (!connect_input_ports(client, modem_out_port, playback_port_regex))
+    {
+        exit(1);
+    }
+
+    signal(SIGQUIT, signal_handler);
+    signal(SIGTERM, signal_handler);
+    signal(SIGINT, signal_handler);
+
+    notify_ready("jack_modem_bridge");
+
+    while (true)
+    {
+        sleep(stats_seconds > 0 ? stats_seconds : 60);
+        if (stats_seconds > 0)
+        {
+            print_stats(sample_rate);
+        }
+    }
+
+    return 0;
+}
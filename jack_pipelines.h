@@ -0,0 +1,75 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef JACK_PIPELINES_H
+#define JACK_PIPELINES_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+#include "crypto_context.h"
+
+// The transmit and receive sides, each a JACK client on its own server.
+// jack_crypto_tx and jack_crypto_rx each host one, and jack_crypto_trx hosts
+// both in one process. The host owns the signals and the main loop, and
+// reads the config into a crypto_context that jack_crypto_trx passes to
+// both, so they share one config, key and logger:
+//
+//   start_*_pipeline opens the client and activates it, exiting on failure
+//   add_*_pipeline_fds adds the descriptors that mean there is work to do
+//   poll_*_pipeline does any reloads, prompts and commands without blocking
+//
+// The request and stop functions are safe to call from signal handlers
+
+// Reads the config for the pipelines of one process, exiting if it can't
+inline std::shared_ptr<crypto_context> open_pipeline_context(const char* name,
+                                                             const char* config_file)
+{
+    try
+    {
+        return std::make_shared<crypto_context>(name, config_file);
+    }
+    catch (const std::exception& ex)
+    {
+        fprintf(stderr, "%s\n", ex.what());
+        exit(1);
+    }
+}
+
+// jack_crypto_tx.cpp
+void start_tx_pipeline(const char* server_name, std::shared_ptr<crypto_context> context);
+void add_tx_pipeline_fds(std::vector<int>& fds);
+void poll_tx_pipeline();
+void request_tx_reload();
+// Plays /tmp/tts.wav over the air, if it has been written since last time
+void request_tx_prompt();
+// Keys or unkeys the transmitter when PTT is signal driven (GPIONum = -1)
+void toggle_tx_ptt();
+void stop_tx_pipeline();
+
+// jack_crypto_rx.cpp
+void start_rx_pipeline(const char* server_name, std::shared_ptr<crypto_context> context);
+void add_rx_pipeline_fds(std::vector<int>& fds);
+void poll_rx_pipeline();
+void request_rx_reload();
+// Plays /tmp/notify.wav in the headset, if it has been written since last
+// time
+void request_rx_prompt();
+void stop_rx_pipeline();
+
+#endif
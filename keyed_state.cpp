@@ -0,0 +1,121 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "keyed_state.h"
+
+static uint32_t now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((ts.tv_sec * 1000ULL) + (ts.tv_nsec / 1000000));
+}
+
+keyed_state::keyed_state()
+    : m_shared(nullptr)
+{
+}
+
+keyed_state::~keyed_state()
+{
+    close();
+}
+
+bool keyed_state::open(const char* name)
+{
+    close();
+
+    if (name == nullptr || *name == '\0')
+    {
+        return false;
+    }
+
+    const int fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    // A new object is all zeroes, which is unkeyed. Sizing one the other
+    // side has already sized leaves what's in it alone
+    if (ftruncate(fd, sizeof(shared)) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    void* mapping = mmap(nullptr, sizeof(shared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        return false;
+    }
+
+    m_shared = static_cast<shared*>(mapping);
+    return true;
+}
+
+void keyed_state::close()
+{
+    if (m_shared != nullptr)
+    {
+        munmap(m_shared, sizeof(shared));
+        m_shared = nullptr;
+    }
+}
+
+void keyed_state::publish(bool keyed)
+{
+    if (m_shared == nullptr)
+    {
+        return;
+    }
+
+    if (keyed)
+    {
+        m_shared->heartbeat_ms.store(now_ms(), std::memory_order_relaxed);
+        m_shared->keyings.fetch_add(1, std::memory_order_relaxed);
+    }
+    m_shared->keyed.store(keyed ? 1 : 0, std::memory_order_release);
+}
+
+void keyed_state::heartbeat()
+{
+    if (m_shared != nullptr)
+    {
+        m_shared->heartbeat_ms.store(now_ms(), std::memory_order_relaxed);
+    }
+}
+
+bool keyed_state::keyed() const
+{
+    if (m_shared == nullptr ||
+        m_shared->keyed.load(std::memory_order_acquire) == 0)
+    {
+        return false;
+    }
+
+    const uint32_t age = now_ms() - m_shared->heartbeat_ms.load(std::memory_order_relaxed);
+    return age < STALE_MS;
+}
+
+uint32_t keyed_state::keyings() const
+{
+    return m_shared != nullptr ? m_shared->keyings.load(std::memory_order_acquire) : 0;
+}
@@ -0,0 +1,76 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef KEYED_STATE_H
+#define KEYED_STATE_H
+
+#include <atomic>
+#include <cstdint>
+
+// Whether the radio is keyed, shared from the transmitter to the receiver
+// through a POSIX shared memory object, so the receiver can stop
+// demodulating its own transmission. Both sides only touch lock-free
+// atomics in it, so publishing and polling are safe from the JACK threads
+// and neither side can hold the other up. Either can be started first, and
+// jack_crypto_trx simply opens it twice.
+//
+// The transmitter also stamps it every period, and the receiver takes a
+// stamp older than STALE_MS to mean the transmitter has died, keyed or
+// not, so a crash mid-transmission can't leave the receiver deaf.
+//
+// open and close are called from the main thread with the JACK client
+// inactive
+class keyed_state
+{
+public:
+    static const uint32_t STALE_MS = 1000;
+
+    keyed_state();
+    ~keyed_state();
+
+    // Maps the named object (e.g. "/crypto_keyed"), creating it if needed
+    bool open(const char* name);
+    void close();
+
+    bool is_open() const
+    {
+        return m_shared != nullptr;
+    }
+
+    // Transmitter side, called on each PTT edge and from every period
+    // respectively
+    void publish(bool keyed);
+    void heartbeat();
+
+    // Receiver side. Counts keyings as well, so one too short to be seen
+    // between two polls isn't missed. keyed is false while the stamp is
+    // stale
+    bool keyed() const;
+    uint32_t keyings() const;
+
+private:
+    struct shared
+    {
+        std::atomic<uint32_t> keyed;
+        std::atomic<uint32_t> keyings;
+        // CLOCK_MONOTONIC in ms, which wraps but is only ever compared
+        std::atomic<uint32_t> heartbeat_ms;
+    };
+    static_assert(std::atomic<uint32_t>::is_always_lock_free,
+                  "keyed_state needs lock-free atomics to share them between processes");
+
+    shared* m_shared;
+};
+
+#endif
@@ -91,15 +91,14 @@ toggle_digital()
     fi
 }
 
+# The receiver applies the volume and plays the beep itself
 adjust_volume()
 {
-    amixer -q -D "$HEADSET" sset Speaker "$1" && \
-        cp /usr/share/sounds/beep.wav "$NOTIFY_FILE" && \
-        /etc/init.d/S31jack_crypto_rx signal SIGUSR1
+    crypto_ctl "$RX_CONTROL" volume "$1" > /dev/null
 }
 
 KEY_IDX=`reset_key_idx`
-HEADSET=`get_sound_hw_device VoiceDevice`
+RX_CONTROL=`get_config_val JACK RXControlSocket`
 
 while read -r button event
 do
@@ -171,10 +170,10 @@ do
                     toggle_digital
                     ;;
                 up)
-                    adjust_volume '10%+'
+                    adjust_volume +10
                     ;;
                 down)
-                    adjust_volume '10%-'
+                    adjust_volume -10
                     ;;
             esac
             ;;
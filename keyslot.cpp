@@ -0,0 +1,200 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "keyslots.h"
+
+// Answers questions about the key slots with one directory listing, so
+// scripts don't have to test every slot's file
+//
+// usage: keyslot [-d <Dir>] list|any|count
+//        keyslot [-d <Dir>] has|next|prev <Slot>
+//        keyslot [-d <Dir>] generate|remove <Slot> ...
+//        keyslot [-d <Dir>] import [-n] [-f] <SrcDir>
+//        keyslot [-d <Dir>] export [-f] <DstDir>
+//
+// import makes the key directory hold exactly the keys in SrcDir (e.g.
+// copied off an SD card), or with -n only does so if there are no keys
+// yet. export does the same the other way around. Both refuse a source
+// with no keys, which would delete every key at the destination, unless
+// -f is given
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-d <Dir>] list|any|count\n", name);
+    fprintf(stderr, "       %s [-d <Dir>] has|next|prev <Slot>\n", name);
+    fprintf(stderr, "       %s [-d <Dir>] generate|remove <Slot> ...\n", name);
+    fprintf(stderr, "       %s [-d <Dir>] import [-n] [-f] <SrcDir>\n", name);
+    fprintf(stderr, "       %s [-d <Dir>] export [-f] <DstDir>\n", name);
+}
+
+// next and prev also take 0, meaning before the first slot
+static bool parse_slot(const char* arg, unsigned min, unsigned* slot)
+{
+    char* end = nullptr;
+    const unsigned long value = strtoul(arg, &end, 10);
+    if (end == arg || *end != '\0' || value < min || value > MAX_KEY_SLOTS)
+    {
+        fprintf(stderr, "Invalid key slot %s\n", arg);
+        return false;
+    }
+    *slot = value;
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    const char* dir = nullptr;
+    int arg = 1;
+    if (arg + 1 < argc && strcmp(argv[arg], "-d") == 0)
+    {
+        dir = argv[arg + 1];
+        arg += 2;
+    }
+
+    if (arg >= argc)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char* cmd = argv[arg++];
+    const int num_args = argc - arg;
+    key_slots slots(dir);
+
+    if (strcmp(cmd, "list") == 0 && num_args == 0)
+    {
+        for (unsigned slot : slots.list())
+        {
+            printf("%u\n", slot);
+        }
+        return 0;
+    }
+    else if (strcmp(cmd, "any") == 0 && num_args == 0)
+    {
+        return slots.any() ? 0 : 1;
+    }
+    else if (strcmp(cmd, "count") == 0 && num_args == 0)
+    {
+        printf("%zu\n", slots.count());
+        return 0;
+    }
+    else if ((strcmp(cmd, "has") == 0 || strcmp(cmd, "next") == 0 || strcmp(cmd, "prev") == 0) &&
+             num_args == 1)
+    {
+        unsigned slot = 0;
+        if (!parse_slot(argv[arg], cmd[0] == 'h' ? 1 : 0, &slot))
+        {
+            return 1;
+        }
+
+        if (cmd[0] == 'h')
+        {
+            return slots.has(slot) ? 0 : 1;
+        }
+        printf("%u\n", cmd[0] == 'n' ? slots.next(slot) : slots.prev(slot));
+        return 0;
+    }
+    else if ((strcmp(cmd, "generate") == 0 || strcmp(cmd, "remove") == 0) && num_args > 0)
+    {
+        std::vector<unsigned> list;
+        for (int i = arg; i < argc; ++i)
+        {
+            unsigned slot = 0;
+            if (!parse_slot(argv[i], 1, &slot))
+            {
+                return 1;
+            }
+            list.push_back(slot);
+        }
+
+        bool ok = true;
+        if (cmd[0] == 'g')
+        {
+            ok = slots.generate(list);
+        }
+        else
+        {
+            for (unsigned slot : list)
+            {
+                ok = slots.remove(slot) && ok;
+            }
+        }
+
+        if (!ok)
+        {
+            fprintf(stderr, "%s: %s\n", slots.dir().c_str(), strerror(errno));
+        }
+        return ok ? 0 : 1;
+    }
+    else if ((strcmp(cmd, "import") == 0 || strcmp(cmd, "export") == 0) && num_args > 0)
+    {
+        const bool import = cmd[0] == 'i';
+        bool noclobber = false;
+        bool force = false;
+        for (int i = arg; i < argc - 1; ++i)
+        {
+            if (import && strcmp(argv[i], "-n") == 0)
+            {
+                noclobber = true;
+            }
+            else if (strcmp(argv[i], "-f") == 0)
+            {
+                force = true;
+            }
+            else
+            {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+
+        key_slots other(argv[argc - 1]);
+        const key_slots& src = import ? other : slots;
+        key_slots& dst = import ? slots : other;
+
+        if (!src.ok() || !dst.ok())
+        {
+            fprintf(stderr, "%s: Cannot open directory\n",
+                    (src.ok() ? dst : src).dir().c_str());
+            return 1;
+        }
+        if (noclobber && (dst.any() || !src.any()))
+        {
+            return 1;
+        }
+        if (!src.any() && !force)
+        {
+            fprintf(stderr, "%s: No keys, use -f to remove all keys from %s\n",
+                    src.dir().c_str(), dst.dir().c_str());
+            return 1;
+        }
+
+        if (!dst.copy_from(src))
+        {
+            fprintf(stderr, "%s: %s\n", dst.dir().c_str(), strerror(errno));
+            return 1;
+        }
+        return 0;
+    }
+
+    usage(argv[0]);
+    return 1;
+}
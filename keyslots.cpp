@@ -0,0 +1,370 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+
+#include <cstdlib>
+
+#include "freedv_api.h"
+#include "crypto_cfg.h"
+#include "keyslots.h"
+
+// Key files are FREEDV_MASTER_KEY_LENGTH bytes, but copy anything a user
+// put there as it is
+#define MAX_KEY_FILE_SIZE 4096
+
+static bool read_all(int fd, unsigned char* data, size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        const ssize_t ret = read(fd, data + done, len - done);
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            return false;
+        }
+        done += ret;
+    }
+    return true;
+}
+
+static bool write_all(int fd, const unsigned char* data, size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        const ssize_t ret = write(fd, data + done, len - done);
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            return false;
+        }
+        done += ret;
+    }
+    return true;
+}
+
+// getrandom() blocks until the RNG is seeded, like reading /dev/random
+static bool get_random(unsigned char* data, size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        const ssize_t ret = getrandom(data + done, len - done, 0);
+        if (ret < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (ret <= 0)
+        {
+            return false;
+        }
+        done += ret;
+    }
+    return true;
+}
+
+// Stirs the hardware RNG into the kernel pool first, as gen_key used to.
+// Not all boards have one
+static void mix_hwrng()
+{
+    unsigned char seed[512];
+    const int in = open("/dev/hwrng", O_RDONLY | O_CLOEXEC);
+    if (in < 0)
+    {
+        return;
+    }
+    if (read_all(in, seed, sizeof(seed)))
+    {
+        const int out = open("/dev/urandom", O_WRONLY | O_CLOEXEC);
+        if (out >= 0)
+        {
+            write_all(out, seed, sizeof(seed));
+            close(out);
+        }
+    }
+    close(in);
+    explicit_bzero(seed, sizeof(seed));
+}
+
+key_slots::key_slots(const char* dir)
+{
+    if (dir != nullptr)
+    {
+        m_dir = dir;
+    }
+    else
+    {
+        char path[PATH_MAX];
+        get_key_path(path, sizeof(path), 1);
+        const char* slash = strrchr(path, '/');
+        m_dir = slash != nullptr ? std::string(path, slash - path) : ".";
+    }
+
+    rescan();
+}
+
+std::string key_slots::file_name(unsigned slot)
+{
+    char path[PATH_MAX];
+    get_key_path(path, sizeof(path), slot);
+    const char* slash = strrchr(path, '/');
+    return slash != nullptr ? slash + 1 : path;
+}
+
+unsigned key_slots::slot_of(const char* name)
+{
+    const std::string first = file_name(1);
+    if (strncmp(name, first.c_str(), first.size()) != 0)
+    {
+        return 0;
+    }
+    if (name[first.size()] == '\0')
+    {
+        return 1;
+    }
+
+    // Only the exact spelling get_key_path() uses, so "key01" or "key1"
+    // aren't taken for a slot
+    char* end = nullptr;
+    const unsigned long slot = strtoul(name + first.size(), &end, 10);
+    if (*end != '\0' || slot < 2 || slot > MAX_KEY_SLOTS || file_name(slot) != name)
+    {
+        return 0;
+    }
+    return slot;
+}
+
+bool key_slots::rescan()
+{
+    m_slots.reset();
+
+    DIR* dir = opendir(m_dir.c_str());
+    m_ok = dir != nullptr;
+    if (dir == nullptr)
+    {
+        return false;
+    }
+
+    const int dir_fd = dirfd(dir);
+    while (const struct dirent* entry = readdir(dir))
+    {
+        const unsigned slot = slot_of(entry->d_name);
+        if (slot == 0)
+        {
+            continue;
+        }
+
+        struct stat st;
+        if (entry->d_type == DT_REG ||
+            (entry->d_type == DT_UNKNOWN &&
+             fstatat(dir_fd, entry->d_name, &st, 0) == 0 &&
+             S_ISREG(st.st_mode)))
+        {
+            m_slots.set(slot - 1);
+        }
+    }
+
+    closedir(dir);
+    return true;
+}
+
+bool key_slots::has(unsigned slot) const
+{
+    return slot >= 1 && slot <= MAX_KEY_SLOTS && m_slots.test(slot - 1);
+}
+
+std::vector<unsigned> key_slots::list() const
+{
+    std::vector<unsigned> slots;
+    for (unsigned slot = 1; slot <= MAX_KEY_SLOTS; ++slot)
+    {
+        if (has(slot))
+        {
+            slots.push_back(slot);
+        }
+    }
+    return slots;
+}
+
+unsigned key_slots::next(unsigned slot) const
+{
+    for (unsigned step = 1; step <= MAX_KEY_SLOTS; ++step)
+    {
+        const unsigned candidate = (slot - 1 + step) % MAX_KEY_SLOTS + 1;
+        if (has(candidate))
+        {
+            return candidate;
+        }
+    }
+    return slot;
+}
+
+unsigned key_slots::prev(unsigned slot) const
+{
+    for (unsigned step = 1; step <= MAX_KEY_SLOTS; ++step)
+    {
+        const unsigned candidate = (slot - 1 + MAX_KEY_SLOTS - step) % MAX_KEY_SLOTS + 1;
+        if (has(candidate))
+        {
+            return candidate;
+        }
+    }
+    return slot;
+}
+
+std::string key_slots::path(unsigned slot) const
+{
+    return m_dir + "/" + file_name(slot);
+}
+
+bool key_slots::write_key(unsigned slot, const unsigned char* key, size_t len)
+{
+    const std::string dst = path(slot);
+    const std::string tmp = m_dir + "/." + file_name(slot) + ".tmp";
+
+    const int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    const bool ok = write_all(fd, key, len) && fsync(fd) == 0;
+    if (close(fd) != 0 || !ok || rename(tmp.c_str(), dst.c_str()) != 0)
+    {
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    m_slots.set(slot - 1);
+    return true;
+}
+
+bool key_slots::sync_dir() const
+{
+    const int fd = open(m_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+    const bool ok = fsync(fd) == 0;
+    close(fd);
+    return ok;
+}
+
+bool key_slots::generate(const std::vector<unsigned>& slots)
+{
+    for (unsigned slot : slots)
+    {
+        if (slot < 1 || slot > MAX_KEY_SLOTS)
+        {
+            errno = EINVAL;
+            return false;
+        }
+    }
+
+    mix_hwrng();
+
+    std::vector<unsigned char> keys(slots.size() * FREEDV_MASTER_KEY_LENGTH);
+    bool ok = get_random(keys.data(), keys.size());
+    for (size_t i = 0; ok && i < slots.size(); ++i)
+    {
+        ok = write_key(slots[i], &keys[i * FREEDV_MASTER_KEY_LENGTH], FREEDV_MASTER_KEY_LENGTH);
+    }
+    explicit_bzero(keys.data(), keys.size());
+
+    return sync_dir() && ok;
+}
+
+bool key_slots::remove(unsigned slot)
+{
+    if (slot < 1 || slot > MAX_KEY_SLOTS)
+    {
+        errno = EINVAL;
+        return false;
+    }
+
+    if (unlink(path(slot).c_str()) != 0 && errno != ENOENT)
+    {
+        return false;
+    }
+    m_slots.reset(slot - 1);
+    return true;
+}
+
+bool key_slots::copy_from(const key_slots& other)
+{
+    // An unreadable source would otherwise look empty and wipe every key
+    if (!m_ok || !other.m_ok)
+    {
+        errno = ENOENT;
+        return false;
+    }
+
+    unsigned char key[MAX_KEY_FILE_SIZE];
+    bool ok = true;
+
+    for (unsigned slot : other.list())
+    {
+        const int fd = open(other.path(slot).c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            ok = false;
+            continue;
+        }
+
+        size_t len = 0;
+        ssize_t ret = 0;
+        while (len < sizeof(key) &&
+               ((ret = read(fd, key + len, sizeof(key) - len)) > 0 || (ret < 0 && errno == EINTR)))
+        {
+            len += ret > 0 ? ret : 0;
+        }
+        close(fd);
+
+        if (ret < 0 || !write_key(slot, key, len))
+        {
+            ok = false;
+        }
+    }
+    explicit_bzero(key, sizeof(key));
+
+    // Only drop keys once all the new ones are in place
+    if (ok)
+    {
+        for (unsigned slot : list())
+        {
+            if (!other.has(slot) && !remove(slot))
+            {
+                ok = false;
+            }
+        }
+    }
+
+    return sync_dir() && ok;
+}
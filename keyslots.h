@@ -0,0 +1,76 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef KEYSLOTS_H
+#define KEYSLOTS_H
+
+#include <bitset>
+#include <string>
+#include <vector>
+
+#define MAX_KEY_SLOTS 256
+
+// The key files in a directory, named the way get_key_path() names them
+// ("key" for slot 1, "key<N>" for the others). The directory is listed
+// once and kept as a bitmap of occupied slots, so lookups don't touch the
+// filesystem
+class key_slots
+{
+public:
+    // Defaults to the directory get_key_path() uses
+    explicit key_slots(const char* dir = nullptr);
+
+    const std::string& dir() const { return m_dir; }
+
+    // False if the directory couldn't be listed, which isn't the same as
+    // it holding no keys
+    bool rescan();
+    bool ok() const { return m_ok; }
+
+    bool has(unsigned slot) const;
+    bool any() const { return m_slots.any(); }
+    size_t count() const { return m_slots.count(); }
+    std::vector<unsigned> list() const;
+
+    // The next or previous occupied slot, wrapping around 1..MAX_KEY_SLOTS.
+    // Returns slot itself if no other slot has a key
+    unsigned next(unsigned slot) const;
+    unsigned prev(unsigned slot) const;
+
+    std::string path(unsigned slot) const;
+
+    // Fills the slots with new keys from a single read of the system RNG
+    bool generate(const std::vector<unsigned>& slots);
+    bool remove(unsigned slot);
+
+    // Makes this directory hold exactly the keys in other. Every key is
+    // written to a temporary file and renamed into place. Fails without
+    // touching anything if either directory couldn't be listed
+    bool copy_from(const key_slots& other);
+
+    // The slot a key file name belongs to, or 0 if it isn't a key file
+    static unsigned slot_of(const char* name);
+    static std::string file_name(unsigned slot);
+
+private:
+    bool write_key(unsigned slot, const unsigned char* key, size_t len);
+    bool sync_dir() const;
+
+private:
+    std::string                  m_dir;
+    std::bitset<MAX_KEY_SLOTS>   m_slots;
+    bool                         m_ok = false;
+};
+
+#endif
@@ -0,0 +1,125 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MIXER_H
+#define MIXER_H
+
+#include <cmath>
+#include <atomic>
+#include <algorithm>
+
+#include "simd.h"
+
+#define MAX_VOLUME 100
+
+// Maps a 0-100 volume setting onto a linear gain. 100 is unity, every
+// step below that is 0.4 dB, and 0 is a hard mute
+inline float volume_to_gain(int volume)
+{
+    if (volume <= 0)
+    {
+        return 0.0f;
+    }
+    else if (volume >= MAX_VOLUME)
+    {
+        return 1.0f;
+    }
+    else
+    {
+        return powf(10.0f, ((volume - MAX_VOLUME) * 0.4f) / 20.0f);
+    }
+}
+
+inline int clamp_volume(int volume)
+{
+    return volume < 0 ? 0 : (volume > MAX_VOLUME ? MAX_VOLUME : volume);
+}
+
+// Per-port gain with a linear ramp between settings so volume changes
+// don't click. set_volume may be called from any thread, process is called
+// from the JACK thread
+class gain_stage
+{
+public:
+    gain_stage(int volume = MAX_VOLUME, float limiter_knee = 0.9f)
+        : m_volume(clamp_volume(volume)),
+          m_cur_gain(volume_to_gain(m_volume)),
+          m_target_gain(m_cur_gain),
+          m_step(0.0f),
+          m_ramp_left(0),
+          m_ramp_frames(0),
+          m_knee(limiter_knee)
+    {
+    }
+
+    void set_ramp_frames(size_t ramp_frames)
+    {
+        m_ramp_frames = ramp_frames;
+    }
+
+    int volume() const
+    {
+        return m_volume.load(std::memory_order_relaxed);
+    }
+
+    void set_volume(int volume)
+    {
+        m_volume.store(clamp_volume(volume), std::memory_order_relaxed);
+    }
+
+    // duck is an additional gain factor that is ramped the same way as the
+    // volume, used to lower this port while something else is playing
+    void process(float* frames, size_t count, float duck = 1.0f)
+    {
+        const float target = volume_to_gain(volume()) * duck;
+        size_t offset = 0;
+
+        // A new target starts a fresh ramp from wherever the gain is, with
+        // a fixed step counted down over the following periods
+        if (target != m_target_gain)
+        {
+            m_target_gain = target;
+            m_ramp_left = std::max<size_t>(m_ramp_frames, 1);
+            m_step = (target - m_cur_gain) / m_ramp_left;
+        }
+
+        if (m_ramp_left > 0)
+        {
+            const size_t steps = std::min(count, m_ramp_left);
+            simd_ramp(frames, steps, m_cur_gain + m_step, m_step);
+
+            offset = steps;
+            m_ramp_left -= steps;
+            m_cur_gain = m_ramp_left == 0 ? m_target_gain : m_cur_gain + (m_step * steps);
+        }
+
+        if (m_cur_gain != 1.0f)
+        {
+            simd_scale(frames + offset, count - offset, m_cur_gain);
+        }
+
+        simd_soft_limit(frames, count, m_knee);
+    }
+
+private:
+    std::atomic<int> m_volume;
+    float            m_cur_gain;
+    float            m_target_gain;
+    float            m_step;
+    size_t           m_ramp_left;
+    size_t           m_ramp_frames;
+    const float      m_knee;
+};
+
+#endif
@@ -0,0 +1,686 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <unistd.h>
+#include <netdb.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <algorithm>
+
+#include "modem_link.h"
+
+// Frames held waiting their turn. Far more than the reordering ever waits
+// for, anything further ahead than this means the sender started over
+static const size_t LINK_SLOTS = 64;
+// How often the threads look up from a quiet socket or queue to see if
+// they should stop
+static const int LINK_POLL_MS = 100;
+
+static uint64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ull) + ts.tv_nsec;
+}
+
+static void put_u16(uint8_t* p, uint16_t v)
+{
+    v = htons(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static void put_u32(uint8_t* p, uint32_t v)
+{
+    v = htonl(v);
+    memcpy(p, &v, sizeof(v));
+}
+
+static uint16_t get_u16(const uint8_t* p)
+{
+    uint16_t v;
+    memcpy(&v, p, sizeof(v));
+    return ntohs(v);
+}
+
+static uint32_t get_u32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return ntohl(v);
+}
+
+bool parse_link_address(const char*              text,
+                        bool                     listening,
+                        struct sockaddr_storage* addr,
+                        socklen_t*               addr_len)
+{
+    std::string host;
+    std::string port;
+
+    const std::string s = text;
+    const size_t colon = s.rfind(':');
+    if (colon == std::string::npos)
+    {
+        if (!listening)
+        {
+            return false;
+        }
+        port = s;
+    }
+    else
+    {
+        host = s.substr(0, colon);
+        port = s.substr(colon + 1);
+        // [::1]:port for IPv6
+        if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+        {
+            host = host.substr(1, host.size() - 2);
+        }
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_NUMERICSERV | (listening ? AI_PASSIVE : 0);
+
+    struct addrinfo* result = nullptr;
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &result) != 0)
+    {
+        return false;
+    }
+    memcpy(addr, result->ai_addr, result->ai_addrlen);
+    *addr_len = result->ai_addrlen;
+    freeaddrinfo(result);
+    return true;
+}
+
+modem_link_sender::modem_link_sender()
+    : m_fd(-1),
+      m_addr_len(0),
+      m_frame_samples(0),
+      m_frames_per_packet(1),
+      m_timestamp(0),
+      m_silent(true),
+      m_running(false),
+      m_packet_frames(0),
+      m_packet_started_ns(0),
+      m_sequence(0),
+      m_next_timestamp(0),
+      m_impairment_changed(false),
+      m_rng(std::random_device()()),
+      m_packets_sent(0),
+      m_bytes_sent(0),
+      m_overflows(0),
+      m_send_errors(0)
+{
+    sem_init(&m_wake, 0, 0);
+}
+
+modem_link_sender::~modem_link_sender()
+{
+    close();
+    sem_destroy(&m_wake);
+}
+
+bool modem_link_sender::open(const char* address,
+                             unsigned    jack_sample_rate,
+                             unsigned    link_sample_rate,
+                             unsigned    frames_per_packet)
+{
+    close();
+
+    m_frame_samples = link_sample_rate / MODEM_LINK_FRAMES_PER_SECOND;
+    if (link_sample_rate % MODEM_LINK_FRAMES_PER_SECOND != 0 ||
+        m_frame_samples > MODEM_LINK_MAX_FRAME_SAMPLES)
+    {
+        return false;
+    }
+    m_frames_per_packet = std::max(1u, std::min<unsigned>(frames_per_packet, MODEM_LINK_MAX_FRAMES));
+
+    if (!parse_link_address(address, false, &m_addr, &m_addr_len))
+    {
+        return false;
+    }
+    m_fd = socket(m_addr.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (m_fd < 0)
+    {
+        return false;
+    }
+
+    m_resampler.reset(new resampler(SRC_SINC_FASTEST, 1, jack_sample_rate / 5));
+    m_resampler->set_sample_rates(jack_sample_rate, link_sample_rate);
+    m_frame.resize(m_frame_samples);
+    m_timestamp = 0;
+    m_silent = true;
+
+    while (m_queue.front() != nullptr)
+    {
+        m_queue.pop_front();
+    }
+
+    m_packet.resize(MODEM_LINK_HEADER_BYTES +
+                    (MODEM_LINK_MAX_FRAMES * MODEM_LINK_MAX_FRAME_SAMPLES * sizeof(int16_t)));
+    m_packet_frames = 0;
+    m_delayed.clear();
+
+    m_running = true;
+    m_thread = std::thread(&modem_link_sender::sender_thread, this);
+    return true;
+}
+
+void modem_link_sender::close()
+{
+    m_running = false;
+    if (m_thread.joinable())
+    {
+        sem_post(&m_wake);
+        m_thread.join();
+    }
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+void modem_link_sender::set_impairment(const link_impairment& impairment)
+{
+    m_impairment_in = impairment;
+    m_impairment_changed.store(true, std::memory_order_release);
+}
+
+void modem_link_sender::write(const float* frames, size_t count)
+{
+    m_resampler->enqueue(frames, count);
+
+    while (m_resampler->available_elems() >= m_frame_samples)
+    {
+        m_resampler->dequeue(m_frame.data(), m_frame_samples);
+
+        const bool silent = std::all_of(m_frame.begin(), m_frame.end(),
+                                        [](short s) { return s == 0; });
+        if (!silent)
+        {
+            frame* const f = m_queue.begin_push();
+            if (f != nullptr)
+            {
+                f->timestamp = m_timestamp;
+                f->marker = m_silent;
+                std::copy(m_frame.begin(), m_frame.end(), f->samples);
+                m_queue.end_push();
+                sem_post(&m_wake);
+            }
+            else
+            {
+                m_overflows.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        m_silent = silent;
+        m_timestamp += m_frame_samples;
+    }
+}
+
+// Packs frames as they come. A datagram goes when it is full, when the
+// next frame doesn't follow on from it, or a frame time after it should
+// have filled, which is how the last of a burst goes
+void modem_link_sender::sender_thread()
+{
+    const uint64_t flush_ns =
+        ((m_frames_per_packet + 1) * 1000000000ull) / MODEM_LINK_FRAMES_PER_SECOND;
+
+    while (m_running.load(std::memory_order_acquire))
+    {
+        const uint64_t now = monotonic_ns();
+        uint64_t wait_ns = LINK_POLL_MS * 1000000ull;
+        if (m_packet_frames > 0)
+        {
+            const uint64_t due = m_packet_started_ns + flush_ns;
+            wait_ns = due > now ? due - now : 0;
+        }
+        for (const delayed& d : m_delayed)
+        {
+            wait_ns = std::min(wait_ns, d.due_ns > now ? d.due_ns - now : 0);
+        }
+
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        const uint64_t until_ns = ((uint64_t)until.tv_sec * 1000000000ull) + until.tv_nsec + wait_ns;
+        until.tv_sec = until_ns / 1000000000ull;
+        until.tv_nsec = until_ns % 1000000000ull;
+        sem_timedwait(&m_wake, &until);
+
+        if (m_impairment_changed.exchange(false, std::memory_order_acquire))
+        {
+            m_impairment = m_impairment_in;
+        }
+
+        uint8_t* const payload = m_packet.data() + MODEM_LINK_HEADER_BYTES;
+        for (frame* f = m_queue.front(); f != nullptr; f = m_queue.front())
+        {
+            if (m_packet_frames > 0 && (f->marker || f->timestamp != m_next_timestamp))
+            {
+                send_packet();
+            }
+            if (m_packet_frames == 0)
+            {
+                m_packet_started_ns = monotonic_ns();
+                m_packet[4] = f->marker ? MODEM_LINK_MARKER : 0;
+                put_u32(m_packet.data() + 12, f->timestamp);
+            }
+
+            uint8_t* const out = payload + (m_packet_frames * m_frame_samples * sizeof(int16_t));
+            for (size_t i = 0; i < m_frame_samples; ++i)
+            {
+                put_u16(out + (i * sizeof(int16_t)), f->samples[i]);
+            }
+            ++m_packet_frames;
+            m_next_timestamp = f->timestamp + m_frame_samples;
+            m_queue.pop_front();
+
+            if (m_packet_frames == m_frames_per_packet)
+            {
+                send_packet();
+            }
+        }
+
+        if (m_packet_frames > 0 && monotonic_ns() >= m_packet_started_ns + flush_ns)
+        {
+            send_packet();
+        }
+        release_delayed(monotonic_ns());
+    }
+}
+
+void modem_link_sender::send_packet()
+{
+    uint8_t* const p = m_packet.data();
+    put_u32(p, MODEM_LINK_MAGIC);
+    p[5] = m_packet_frames;
+    put_u16(p + 6, m_frame_samples);
+    put_u32(p + 8, m_sequence++);
+
+    transmit(p, MODEM_LINK_HEADER_BYTES + (m_packet_frames * m_frame_samples * sizeof(int16_t)));
+    m_packet_frames = 0;
+}
+
+void modem_link_sender::transmit(const uint8_t* data, size_t size)
+{
+    m_packets_sent.fetch_add(1, std::memory_order_relaxed);
+    m_bytes_sent.fetch_add(size, std::memory_order_relaxed);
+
+    int copies = 1;
+    if (m_impairment.active())
+    {
+        std::uniform_real_distribution<double> percent(0.0, 100.0);
+        if (percent(m_rng) < m_impairment.loss_percent)
+        {
+            return;
+        }
+        if (percent(m_rng) < m_impairment.duplicate_percent)
+        {
+            copies = 2;
+        }
+
+        std::normal_distribution<double> jitter(0.0, m_impairment.jitter_ms);
+        const double delay_ms = std::max(0.0, m_impairment.delay_ms + jitter(m_rng));
+        if (delay_ms > 0.0)
+        {
+            const uint64_t due = monotonic_ns() + (uint64_t)(delay_ms * 1e6);
+            for (int i = 0; i < copies; ++i)
+            {
+                m_delayed.push_back({due, std::vector<uint8_t>(data, data + size)});
+            }
+            return;
+        }
+    }
+
+    for (int i = 0; i < copies; ++i)
+    {
+        if (sendto(m_fd, data, size, 0, (struct sockaddr*)&m_addr, m_addr_len) < 0)
+        {
+            m_send_errors.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+void modem_link_sender::release_delayed(uint64_t now_ns)
+{
+    auto due = std::stable_partition(m_delayed.begin(), m_delayed.end(),
+                                     [now_ns](const delayed& d) { return d.due_ns > now_ns; });
+    std::sort(due, m_delayed.end(),
+              [](const delayed& a, const delayed& b) { return a.due_ns < b.due_ns; });
+    for (auto it = due; it != m_delayed.end(); ++it)
+    {
+        if (sendto(m_fd, it->data.data(), it->data.size(), 0,
+                   (struct sockaddr*)&m_addr, m_addr_len) < 0)
+        {
+            m_send_errors.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    m_delayed.erase(due, m_delayed.end());
+}
+
+modem_link_receiver::modem_link_receiver()
+    : m_fd(-1),
+      m_link_rate(0),
+      m_frame_samples(0),
+      m_reorder_frames(0),
+      m_running(false),
+      m_seen_first(false),
+      m_first_sequence(0),
+      m_highest_sequence(0),
+      m_last_timestamp(0),
+      m_last_arrival_ns(0),
+      m_jitter(0.0),
+      m_started(false),
+      m_next_timestamp(0),
+      m_highest_timestamp(0),
+      m_packets(0),
+      m_late(0),
+      m_duplicates(0),
+      m_concealed(0),
+      m_discarded(0),
+      m_expected(0),
+      m_jitter_ms(0.0f)
+{
+}
+
+modem_link_receiver::~modem_link_receiver()
+{
+    close();
+}
+
+bool modem_link_receiver::open(const char* address,
+                               unsigned    jack_sample_rate,
+                               unsigned    link_sample_rate,
+                               unsigned    frames_per_packet,
+                               bool        drift_compensation)
+{
+    close();
+
+    m_link_rate = link_sample_rate;
+    m_frame_samples = link_sample_rate / MODEM_LINK_FRAMES_PER_SECOND;
+    if (link_sample_rate % MODEM_LINK_FRAMES_PER_SECOND != 0 ||
+        m_frame_samples > MODEM_LINK_MAX_FRAME_SAMPLES)
+    {
+        return false;
+    }
+    frames_per_packet = std::max(1u, std::min<unsigned>(frames_per_packet, MODEM_LINK_MAX_FRAMES));
+    // Wait for a couple of packets past a gap before giving up on it
+    m_reorder_frames = frames_per_packet * 2;
+
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    if (!parse_link_address(address, true, &addr, &addr_len))
+    {
+        return false;
+    }
+    m_fd = socket(addr.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (m_fd < 0)
+    {
+        return false;
+    }
+    struct timeval timeout = { 0, LINK_POLL_MS * 1000 };
+    setsockopt(m_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (bind(m_fd, (struct sockaddr*)&addr, addr_len) != 0)
+    {
+        close();
+        return false;
+    }
+
+    while (m_queue.front() != nullptr)
+    {
+        m_queue.pop_front();
+    }
+    m_seen_first = false;
+    m_last_arrival_ns = 0;
+    m_jitter = 0.0;
+
+    m_slots.assign(LINK_SLOTS * m_frame_samples, 0);
+    m_slot_timestamps.assign(LINK_SLOTS, 0);
+    m_slot_full.assign(LINK_SLOTS, 0);
+    m_started = false;
+
+    m_resampler.reset(new resampler(SRC_SINC_FASTEST, 1, jack_sample_rate / 5));
+    m_resampler->set_sample_rates(link_sample_rate, jack_sample_rate);
+
+    // Frames come a packet's worth at a time, so never aim to hold less
+    // than that. The playout buffer raises it from there if the network
+    // needs more
+    const size_t packet_frames = get_nom_resampled_frames(frames_per_packet * m_frame_samples,
+                                                          link_sample_rate,
+                                                          jack_sample_rate);
+    m_playout.configure(jack_sample_rate, packet_frames, packet_frames);
+    m_resampler->set_drift_target(drift_compensation ? m_playout.target() : 0);
+
+    m_running = true;
+    m_thread = std::thread(&modem_link_receiver::receiver_thread, this);
+    return true;
+}
+
+void modem_link_receiver::close()
+{
+    m_running = false;
+    if (m_thread.joinable())
+    {
+        m_thread.join();
+    }
+    if (m_fd >= 0)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+unsigned modem_link_receiver::local_port() const
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len = sizeof(addr);
+    if (m_fd < 0 || getsockname(m_fd, (struct sockaddr*)&addr, &addr_len) != 0)
+    {
+        return 0;
+    }
+    return addr.ss_family == AF_INET6 ?
+        ntohs(((struct sockaddr_in6*)&addr)->sin6_port) :
+        ntohs(((struct sockaddr_in*)&addr)->sin_port);
+}
+
+int64_t modem_link_receiver::packets_lost() const
+{
+    return m_expected.load(std::memory_order_relaxed) -
+           (int64_t)m_packets.load(std::memory_order_relaxed);
+}
+
+void modem_link_receiver::receiver_thread()
+{
+    uint8_t buffer[MODEM_LINK_HEADER_BYTES +
+                   (MODEM_LINK_MAX_FRAMES * MODEM_LINK_MAX_FRAME_SAMPLES * sizeof(int16_t))];
+
+    while (m_running.load(std::memory_order_acquire))
+    {
+        const ssize_t n = recv(m_fd, buffer, sizeof(buffer), 0);
+        if (n < 0)
+        {
+            continue;
+        }
+        const uint64_t arrival_ns = monotonic_ns();
+
+        packet* const p = m_queue.begin_push();
+        uint32_t sequence;
+        if (p == nullptr || !parse(buffer, n, p, &sequence))
+        {
+            m_discarded.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        track_arrival(*p, sequence, arrival_ns);
+        m_queue.end_push();
+        m_packets.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool modem_link_receiver::parse(const uint8_t* data, size_t size, packet* out, uint32_t* sequence)
+{
+    if (size < MODEM_LINK_HEADER_BYTES || get_u32(data) != MODEM_LINK_MAGIC)
+    {
+        return false;
+    }
+
+    const size_t frames = data[5];
+    if (frames == 0 ||
+        frames > MODEM_LINK_MAX_FRAMES ||
+        get_u16(data + 6) != m_frame_samples ||
+        size != MODEM_LINK_HEADER_BYTES + (frames * m_frame_samples * sizeof(int16_t)))
+    {
+        return false;
+    }
+
+    out->flags = data[4];
+    out->frames = frames;
+    *sequence = get_u32(data + 8);
+    out->timestamp = get_u32(data + 12);
+
+    const uint8_t* const payload = data + MODEM_LINK_HEADER_BYTES;
+    for (size_t i = 0; i < frames * m_frame_samples; ++i)
+    {
+        out->samples[i] = (int16_t)get_u16(payload + (i * sizeof(int16_t)));
+    }
+    return true;
+}
+
+// Counts the sequence numbers expected so far, and keeps the interarrival
+// jitter: how much the gap between arrivals differs from the gap between
+// their timestamps, smoothed over 16 packets. The gap across a pause in
+// sending doesn't count
+void modem_link_receiver::track_arrival(const packet& p, uint32_t sequence, uint64_t arrival_ns)
+{
+    if (!m_seen_first)
+    {
+        m_seen_first = true;
+        m_first_sequence = sequence;
+        m_highest_sequence = sequence;
+    }
+    else if ((int32_t)(sequence - m_highest_sequence) > 0)
+    {
+        m_highest_sequence = sequence;
+    }
+    m_expected.store((int64_t)(uint32_t)(m_highest_sequence - m_first_sequence) + 1,
+                     std::memory_order_relaxed);
+
+    if (m_last_arrival_ns != 0 && (p.flags & MODEM_LINK_MARKER) == 0)
+    {
+        const double arrival_gap = ((arrival_ns - m_last_arrival_ns) * 1e-9) * m_link_rate;
+        const double timestamp_gap = (int32_t)(p.timestamp - m_last_timestamp);
+        m_jitter += (fabs(arrival_gap - timestamp_gap) - m_jitter) / 16.0;
+        m_jitter_ms.store((m_jitter * 1000.0) / m_link_rate, std::memory_order_relaxed);
+    }
+    m_last_timestamp = p.timestamp;
+    m_last_arrival_ns = arrival_ns;
+}
+
+void modem_link_receiver::read(float* frames, size_t count)
+{
+    for (packet* p = m_queue.front(); p != nullptr; p = m_queue.front())
+    {
+        insert(*p);
+        m_queue.pop_front();
+    }
+    release(false);
+
+    m_playout.read(*m_resampler, frames, count);
+}
+
+void modem_link_receiver::insert(const packet& p)
+{
+    for (size_t f = 0; f < p.frames; ++f)
+    {
+        const uint32_t timestamp = p.timestamp + (f * m_frame_samples);
+
+        // A new burst, so nothing before it is coming
+        if (!m_started || (f == 0 && (p.flags & MODEM_LINK_MARKER) != 0))
+        {
+            release(true);
+            m_started = true;
+            m_next_timestamp = timestamp;
+            m_highest_timestamp = timestamp;
+        }
+
+        const int32_t ahead = timestamp - m_next_timestamp;
+        if (ahead < 0)
+        {
+            m_late.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        if ((size_t)ahead / m_frame_samples >= LINK_SLOTS)
+        {
+            // The sender started over, or the marker went missing after a
+            // long pause
+            release(true);
+            m_next_timestamp = timestamp;
+            m_highest_timestamp = timestamp;
+        }
+
+        const size_t slot = (timestamp / m_frame_samples) % LINK_SLOTS;
+        if (m_slot_full[slot] && m_slot_timestamps[slot] == timestamp)
+        {
+            m_duplicates.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+
+        std::copy(p.samples + (f * m_frame_samples),
+                  p.samples + ((f + 1) * m_frame_samples),
+                  m_slots.begin() + (slot * m_frame_samples));
+        m_slot_full[slot] = 1;
+        m_slot_timestamps[slot] = timestamp;
+        if ((int32_t)(timestamp - m_highest_timestamp) > 0)
+        {
+            m_highest_timestamp = timestamp;
+        }
+    }
+}
+
+// Hands frames over in order for as long as they are there. A missing one
+// is filled with silence once there are enough frames after it, or when
+// flushing, since the modem copes with a gap far better than with the
+// frames after it arriving early
+void modem_link_receiver::release(bool flush)
+{
+    while (m_started && (int32_t)(m_highest_timestamp - m_next_timestamp) >= 0)
+    {
+        const size_t slot = (m_next_timestamp / m_frame_samples) % LINK_SLOTS;
+        if (m_slot_full[slot] && m_slot_timestamps[slot] == m_next_timestamp)
+        {
+            m_resampler->enqueue(&m_slots[slot * m_frame_samples], m_frame_samples);
+            m_slot_full[slot] = 0;
+        }
+        else if (flush ||
+                 (m_highest_timestamp - m_next_timestamp) / m_frame_samples >= m_reorder_frames)
+        {
+            m_resampler->enqueue_zeroes(m_frame_samples);
+            m_concealed.fetch_add(1, std::memory_order_relaxed);
+        }
+        else
+        {
+            break;
+        }
+        m_next_timestamp += m_frame_samples;
+    }
+}
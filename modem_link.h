@@ -0,0 +1,308 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MODEM_LINK_H
+#define MODEM_LINK_H
+
+#include <sys/socket.h>
+#include <semaphore.h>
+
+#include <cstdint>
+#include <atomic>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "resampler.h"
+#include "playout_buffer.h"
+#include "spsc_queue.h"
+
+// Carries modem audio over UDP, so a radio can be sited away from the
+// transceiver. It stands in for a JACK port at either end: the sender takes
+// periods at the JACK rate and the receiver gives them back, with the link
+// itself running at a lower rate as 16 bit PCM.
+//
+// Each datagram holds one or more 10 ms frames behind a 16 byte header,
+// all in network byte order:
+//
+//   uint32 magic          MODEM_LINK_MAGIC
+//   uint8  flags          MODEM_LINK_MARKER on the first packet of a burst
+//   uint8  frames         frames in this datagram
+//   uint16 frame_samples  samples per frame, link rate / 100
+//   uint32 sequence       counts datagrams
+//   uint32 timestamp      link samples before the first frame
+//
+// Frames of exact silence aren't sent, so a transmitter costs nothing
+// between overs. The timestamp keeps counting through them, and the marker
+// tells the receiver not to wait for what was never sent
+
+static const uint32_t MODEM_LINK_MAGIC = 0x46444d31;
+static const uint8_t  MODEM_LINK_MARKER = 0x01;
+static const size_t   MODEM_LINK_HEADER_BYTES = 16;
+static const unsigned MODEM_LINK_FRAMES_PER_SECOND = 100;
+static const size_t   MODEM_LINK_MAX_FRAMES = 16;
+// 10 ms at 48000
+static const size_t   MODEM_LINK_MAX_FRAME_SAMPLES = 480;
+
+// Parses "host:port", or for listening "port" or "address:port"
+bool parse_link_address(const char*              text,
+                        bool                     listening,
+                        struct sockaddr_storage* addr,
+                        socklen_t*               addr_len);
+
+// netem style impairment of the datagrams sent, for trying a link out on
+// one machine
+struct link_impairment
+{
+    double loss_percent = 0.0;
+    double duplicate_percent = 0.0;
+    double delay_ms = 0.0;
+    // Standard deviation of extra delay, enough of which reorders packets
+    double jitter_ms = 0.0;
+
+    bool active() const
+    {
+        return loss_percent > 0.0 || duplicate_percent > 0.0 ||
+               delay_ms > 0.0 || jitter_ms > 0.0;
+    }
+};
+
+// The sending end. write is called from the JACK thread, which only
+// resamples and queues frames, and a thread of its own packs and sends
+// them
+class modem_link_sender
+{
+public:
+    modem_link_sender();
+    ~modem_link_sender();
+
+    bool open(const char* address,
+              unsigned    jack_sample_rate,
+              unsigned    link_sample_rate,
+              unsigned    frames_per_packet);
+    void close();
+
+    // Takes effect from the next datagram
+    void set_impairment(const link_impairment& impairment);
+
+    void write(const float* frames, size_t count);
+
+    uint64_t packets_sent() const
+    {
+        return m_packets_sent.load(std::memory_order_relaxed);
+    }
+
+    uint64_t bytes_sent() const
+    {
+        return m_bytes_sent.load(std::memory_order_relaxed);
+    }
+
+    // Frames the sending thread didn't take in time, and datagrams the
+    // network wouldn't take
+    uint64_t overflows() const
+    {
+        return m_overflows.load(std::memory_order_relaxed);
+    }
+
+    uint64_t send_errors() const
+    {
+        return m_send_errors.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct frame
+    {
+        uint32_t timestamp;
+        bool     marker;
+        int16_t  samples[MODEM_LINK_MAX_FRAME_SAMPLES];
+    };
+
+    // A datagram held back by the impairment until it is due
+    struct delayed
+    {
+        uint64_t             due_ns;
+        std::vector<uint8_t> data;
+    };
+
+    void sender_thread();
+    void send_packet();
+    void transmit(const uint8_t* data, size_t size);
+    void release_delayed(uint64_t now_ns);
+
+private:
+    int                     m_fd;
+    struct sockaddr_storage m_addr;
+    socklen_t               m_addr_len;
+    size_t                  m_frame_samples;
+    size_t                  m_frames_per_packet;
+
+    // JACK thread
+    std::unique_ptr<resampler> m_resampler;
+    std::vector<short>         m_frame;
+    uint32_t                   m_timestamp;
+    bool                       m_silent;
+
+    spsc_queue<frame, 64> m_queue;
+    sem_t                 m_wake;
+    std::thread           m_thread;
+    std::atomic<bool>     m_running;
+
+    // Sending thread
+    std::vector<uint8_t> m_packet;
+    size_t               m_packet_frames;
+    uint64_t             m_packet_started_ns;
+    uint32_t             m_sequence;
+    uint32_t             m_next_timestamp;
+
+    std::atomic<bool>    m_impairment_changed;
+    link_impairment      m_impairment_in;
+    link_impairment      m_impairment;
+    std::mt19937         m_rng;
+    std::vector<delayed> m_delayed;
+
+    std::atomic<uint64_t> m_packets_sent;
+    std::atomic<uint64_t> m_bytes_sent;
+    std::atomic<uint64_t> m_overflows;
+    std::atomic<uint64_t> m_send_errors;
+};
+
+// The receiving end. A thread of its own takes datagrams off the socket
+// and read, from the JACK thread, puts their frames back in order, fills
+// in for any lost, and plays them out through a playout_buffer. That
+// adapts how much it holds to the jitter and, with drift compensation on,
+// steers the resampler to the sender's clock.
+//
+// A frame that hasn't arrived is given up on once frames a couple of
+// packets later have, so a reordered packet can still make it in time
+class modem_link_receiver
+{
+public:
+    modem_link_receiver();
+    ~modem_link_receiver();
+
+    bool open(const char* address,
+              unsigned    jack_sample_rate,
+              unsigned    link_sample_rate,
+              unsigned    frames_per_packet,
+              bool        drift_compensation);
+    void close();
+
+    // The port bound to, which may have been picked by the system
+    unsigned local_port() const;
+
+    void read(float* frames, size_t count);
+
+    uint64_t packets_received() const
+    {
+        return m_packets.load(std::memory_order_relaxed);
+    }
+
+    // Datagrams never seen, from gaps in the sequence numbers
+    int64_t packets_lost() const;
+
+    // Frames that came after they had been given up on or played, frames
+    // that came twice and frames filled in because they never came
+    uint64_t late_frames() const
+    {
+        return m_late.load(std::memory_order_relaxed);
+    }
+
+    uint64_t duplicate_frames() const
+    {
+        return m_duplicates.load(std::memory_order_relaxed);
+    }
+
+    uint64_t concealed_frames() const
+    {
+        return m_concealed.load(std::memory_order_relaxed);
+    }
+
+    // Datagrams that weren't ours, or that the reading side had no room
+    // for
+    uint64_t discarded() const
+    {
+        return m_discarded.load(std::memory_order_relaxed);
+    }
+
+    // Interarrival jitter in ms, worked out as RTP does
+    float jitter_ms() const
+    {
+        return m_jitter_ms.load(std::memory_order_relaxed);
+    }
+
+    const playout_buffer& playout() const
+    {
+        return m_playout;
+    }
+
+    float drift_ppm() const
+    {
+        return m_resampler ? m_resampler->drift_ppm() : 0.0f;
+    }
+
+private:
+    struct packet
+    {
+        uint8_t  flags;
+        uint8_t  frames;
+        uint32_t timestamp;
+        int16_t  samples[MODEM_LINK_MAX_FRAMES * MODEM_LINK_MAX_FRAME_SAMPLES];
+    };
+
+    void receiver_thread();
+    bool parse(const uint8_t* data, size_t size, packet* out, uint32_t* sequence);
+    void track_arrival(const packet& p, uint32_t sequence, uint64_t arrival_ns);
+    void insert(const packet& p);
+    void release(bool flush);
+
+private:
+    int               m_fd;
+    unsigned          m_link_rate;
+    size_t            m_frame_samples;
+    size_t            m_reorder_frames;
+    std::thread       m_thread;
+    std::atomic<bool> m_running;
+
+    spsc_queue<packet, 32> m_queue;
+
+    // Receiving thread
+    bool     m_seen_first;
+    uint32_t m_first_sequence;
+    uint32_t m_highest_sequence;
+    uint32_t m_last_timestamp;
+    uint64_t m_last_arrival_ns;
+    double   m_jitter;
+
+    // JACK thread. Frames wait in slots by timestamp until their turn
+    std::vector<short>    m_slots;
+    std::vector<uint32_t> m_slot_timestamps;
+    std::vector<uint8_t>  m_slot_full;
+    bool                  m_started;
+    uint32_t              m_next_timestamp;
+    uint32_t              m_highest_timestamp;
+
+    std::unique_ptr<resampler> m_resampler;
+    playout_buffer             m_playout;
+
+    std::atomic<uint64_t> m_packets;
+    std::atomic<uint64_t> m_late;
+    std::atomic<uint64_t> m_duplicates;
+    std::atomic<uint64_t> m_concealed;
+    std::atomic<uint64_t> m_discarded;
+    std::atomic<int64_t>  m_expected;
+    std::atomic<float>    m_jitter_ms;
+};
+
+#endif
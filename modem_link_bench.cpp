@@ -0,0 +1,220 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Tries the modem link out on one machine. A sender and a receiver run in
+// this process over the loopback interface, each paced by a thread standing
+// in for JACK, with the sender's datagrams impaired as netem would. The
+// signal is low level noise, so nothing is suppressed as silence, with a
+// 1 ms pulse every second whose arrival gives the latency through the
+// link and its jitter buffer. Latencies of a second or more can't be told
+// apart from a lost pulse.
+//
+// usage: modem_link_bench [-r <JACK rate>] [-k <link rate>] [-f <frames per packet>]
+//                         [-p <period>] [-t <seconds>] [-l <loss %>] [-u <duplicate %>]
+//                         [-d <delay ms>] [-j <jitter ms>]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cmath>
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+#include "modem_link.h"
+
+// Bytes of IPv4 and UDP header on every datagram
+static const size_t UDP_IP_OVERHEAD = 28;
+static const float NOISE_LEVEL = 0.01f;
+static const float PULSE_LEVEL = 0.9f;
+static const double PULSE_SECONDS = 0.001;
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [-r <JACK rate>] [-k <link rate>] [-f <frames per packet>]\n"
+            "       [-p <period>] [-t <seconds>] [-l <loss %%>] [-u <duplicate %%>]\n"
+            "       [-d <delay ms>] [-j <jitter ms>]\n",
+            name);
+}
+
+// Sleeps until period number n after start, as a JACK cycle would wake
+static void wait_for_period(const struct timespec& start, uint64_t n, size_t period, unsigned rate)
+{
+    const uint64_t ns = ((uint64_t)start.tv_sec * 1000000000ull) + start.tv_nsec +
+        ((n * period * 1000000000ull) / rate);
+    struct timespec until;
+    until.tv_sec = ns / 1000000000ull;
+    until.tv_nsec = ns % 1000000000ull;
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, nullptr);
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned jack_rate = 48000;
+    unsigned link_rate = 8000;
+    unsigned frames_per_packet = 2;
+    size_t period = 256;
+    double seconds = 10.0;
+    link_impairment impairment;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "r:k:f:p:t:l:u:d:j:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            jack_rate = atoi(optarg);
+            break;
+        case 'k':
+            link_rate = atoi(optarg);
+            break;
+        case 'f':
+            frames_per_packet = atoi(optarg);
+            break;
+        case 'p':
+            period = atoi(optarg);
+            break;
+        case 't':
+            seconds = atof(optarg);
+            break;
+        case 'l':
+            impairment.loss_percent = atof(optarg);
+            break;
+        case 'u':
+            impairment.duplicate_percent = atof(optarg);
+            break;
+        case 'd':
+            impairment.delay_ms = atof(optarg);
+            break;
+        case 'j':
+            impairment.jitter_ms = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (jack_rate == 0 || period == 0 || period > jack_rate)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    modem_link_receiver receiver;
+    if (!receiver.open("127.0.0.1:0", jack_rate, link_rate, frames_per_packet, true))
+    {
+        fprintf(stderr, "Could not open the receiver, the link rate has to be a multiple of 100 up to 48000\n");
+        return 1;
+    }
+    char address[32];
+    snprintf(address, sizeof(address), "127.0.0.1:%u", receiver.local_port());
+
+    modem_link_sender sender;
+    if (!sender.open(address, jack_rate, link_rate, frames_per_packet))
+    {
+        fprintf(stderr, "Could not open the sender\n");
+        return 1;
+    }
+    sender.set_impairment(impairment);
+
+    const uint64_t num_periods = (seconds * jack_rate) / period;
+    const size_t pulse_len = PULSE_SECONDS * jack_rate;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Pulses go out at the start of each second, counted in samples from
+    // the start, and both sides count samples the same way
+    std::thread writer([&]()
+    {
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<float> noise(-NOISE_LEVEL, NOISE_LEVEL);
+        std::vector<float> frames(period);
+        for (uint64_t n = 0; n < num_periods; ++n)
+        {
+            wait_for_period(start, n, period, jack_rate);
+            for (size_t i = 0; i < period; ++i)
+            {
+                const uint64_t sample = (n * period) + i;
+                frames[i] = sample % jack_rate < pulse_len ? PULSE_LEVEL : noise(rng);
+            }
+            sender.write(frames.data(), period);
+        }
+    });
+
+    std::vector<double> latencies;
+    std::vector<float> frames(period);
+    uint64_t holdoff_until = 0;
+    for (uint64_t n = 0; n < num_periods; ++n)
+    {
+        wait_for_period(start, n, period, jack_rate);
+        receiver.read(frames.data(), period);
+
+        for (size_t i = 0; i < period; ++i)
+        {
+            const uint64_t sample = (n * period) + i;
+            if (sample >= holdoff_until && fabsf(frames[i]) > PULSE_LEVEL / 2.0f)
+            {
+                const uint64_t sent = (sample / jack_rate) * jack_rate;
+                latencies.push_back((double)(sample - sent) / jack_rate);
+                holdoff_until = sent + jack_rate;
+            }
+        }
+    }
+    writer.join();
+    sender.close();
+    receiver.close();
+
+    const double elapsed = (double)(num_periods * period) / jack_rate;
+    const uint64_t packets = sender.packets_sent();
+    const uint64_t wire_bytes = sender.bytes_sent() + (packets * UDP_IP_OVERHEAD);
+    printf("link %u S/s, %u frames per packet: %.1f packets/s, %.1f kbit/s with UDP/IP headers\n",
+           link_rate,
+           frames_per_packet,
+           packets / elapsed,
+           (wire_bytes * 8.0) / (elapsed * 1000.0));
+    printf("received %llu, lost %lld, discarded %llu, send overflows %llu\n",
+           (unsigned long long)receiver.packets_received(),
+           (long long)receiver.packets_lost(),
+           (unsigned long long)receiver.discarded(),
+           (unsigned long long)sender.overflows());
+    printf("frames late %llu, duplicate %llu, concealed %llu\n",
+           (unsigned long long)receiver.late_frames(),
+           (unsigned long long)receiver.duplicate_frames(),
+           (unsigned long long)receiver.concealed_frames());
+    printf("jitter %.2f ms, playout target %.1f ms, %u underruns, drift %.1f ppm\n",
+           receiver.jitter_ms(),
+           receiver.playout().target() * 1000.0 / jack_rate,
+           (uint)receiver.playout().underruns(),
+           receiver.drift_ppm());
+
+    if (latencies.empty())
+    {
+        printf("no pulses came through\n");
+        return 1;
+    }
+    // The first pulse is played out before the jitter buffer has settled
+    std::vector<double> settled(latencies.begin() + (latencies.size() > 1 ? 1 : 0), latencies.end());
+    std::sort(settled.begin(), settled.end());
+    printf("latency over %zu pulses: median %.1f ms, max %.1f ms\n",
+           settled.size(),
+           settled[settled.size() / 2] * 1000.0,
+           settled.back() * 1000.0);
+    return 0;
+}
@@ -0,0 +1,305 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Decodes payload logs written by the receiver back into WAV files. Each
+// log <name>.c2pl becomes <name>.wav next to it. Logs are decoded in
+// parallel, one per thread.
+//
+// With -t it instead checks, for every mode, that frames taken apart the
+// way the receiver logs them decode to the same speech as FreeDV's own
+// decoder gives.
+//
+// usage: payload_decode [-j jobs] <log> ...
+//        payload_decode -t
+
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sndfile.h>
+
+#include "freedv_api.h"
+#include "codec2.h"
+
+#include "payload_log.h"
+#include "test_speech.h"
+
+// Silence inserted for a gap between frames is capped at this, so hours
+// between transmissions don't turn into hours of silence
+static const uint32_t MAX_GAP_MS = 1000;
+// Length of the signal each mode is checked with by -t
+static const double CHECK_SECONDS = 5.0;
+
+static const struct
+{
+    int         mode;
+    const char* name;
+} CHECK_MODES[] = {
+    { FREEDV_MODE_1600,  "1600" },
+    { FREEDV_MODE_700C,  "700C" },
+    { FREEDV_MODE_700D,  "700D" },
+    { FREEDV_MODE_700E,  "700E" },
+    { FREEDV_MODE_2400A, "2400A" },
+    { FREEDV_MODE_2400B, "2400B" },
+    { FREEDV_MODE_800XA, "800XA" },
+};
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-j jobs] <log> ...\n       %s -t\n", name, name);
+}
+
+static bool decode_log(const std::string& log_path)
+{
+    FILE* f = fopen(log_path.c_str(), "rb");
+    if (f == nullptr)
+    {
+        fprintf(stderr, "%s: could not open\n", log_path.c_str());
+        return false;
+    }
+
+    payload_log_header header;
+    if (!read_payload_log_header(f, &header))
+    {
+        fprintf(stderr, "%s: not a payload log\n", log_path.c_str());
+        fclose(f);
+        return false;
+    }
+
+    struct freedv* freedv = freedv_open(header.freedv_mode);
+    if (freedv == nullptr)
+    {
+        fprintf(stderr, "%s: unsupported mode %d\n", log_path.c_str(), (int)header.freedv_mode);
+        fclose(f);
+        return false;
+    }
+
+    const int sample_rate = freedv_get_speech_sample_rate(freedv);
+
+    std::string wav_path = log_path;
+    const size_t suffix_len = strlen(PAYLOAD_LOG_SUFFIX);
+    if (wav_path.size() > suffix_len &&
+        wav_path.compare(wav_path.size() - suffix_len, suffix_len, PAYLOAD_LOG_SUFFIX) == 0)
+    {
+        wav_path.resize(wav_path.size() - suffix_len);
+    }
+    wav_path += ".wav";
+
+    SF_INFO info;
+    memset(&info, 0, sizeof(info));
+    info.samplerate = sample_rate;
+    info.channels = 1;
+    info.format = SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+    SNDFILE* wav = sf_open(wav_path.c_str(), SFM_WRITE, &info);
+    if (wav == nullptr)
+    {
+        fprintf(stderr, "%s: could not create\n", wav_path.c_str());
+        freedv_close(freedv);
+        fclose(f);
+        return false;
+    }
+
+    std::vector<short> speech(freedv_get_n_max_speech_samples(freedv));
+    std::vector<short> silence(sample_rate * MAX_GAP_MS / 1000);
+    unsigned char bytes[payload_log::MAX_PAYLOAD_BYTES];
+    payload_record_header rec;
+
+    // Time in ms up to which audio has been written
+    uint64_t written_ms = 0;
+    bool first = true;
+    while (read_payload_record(f, &rec, bytes))
+    {
+        if (first)
+        {
+            written_ms = rec.time_ms;
+            first = false;
+        }
+        else if (rec.time_ms > written_ms)
+        {
+            const uint32_t gap_ms = std::min<uint64_t>(rec.time_ms - written_ms, MAX_GAP_MS);
+            sf_writef_short(wav, silence.data(), (sf_count_t)sample_rate * gap_ms / 1000);
+            written_ms = rec.time_ms;
+        }
+
+        const size_t nout = decode_payload(freedv, bytes, rec.nbytes, speech.data());
+        sf_writef_short(wav, speech.data(), nout);
+        written_ms += nout * 1000 / sample_rate;
+    }
+
+    sf_close(wav);
+    freedv_close(freedv);
+    fclose(f);
+    return true;
+}
+
+// Runs a clean test signal into two receivers in step, one decoding with
+// freedv_rx and the other with freedv_codecrx and decode_payload, and
+// compares their speech frame by frame
+static bool check_mode(int mode, const char* name)
+{
+    struct freedv* tx = freedv_open(mode);
+    struct freedv* rx = freedv_open(mode);
+    struct freedv* rx_payload = freedv_open(mode);
+    if (tx == nullptr || rx == nullptr || rx_payload == nullptr)
+    {
+        printf("%s: could not open\n", name);
+        for (struct freedv* f : { tx, rx, rx_payload })
+        {
+            if (f != nullptr)
+            {
+                freedv_close(f);
+            }
+        }
+        return false;
+    }
+
+    const size_t n_speech = freedv_get_n_speech_samples(tx);
+    const size_t n_modem = freedv_get_n_nom_modem_samples(tx);
+    const size_t num_frames = (CHECK_SECONDS * freedv_get_modem_sample_rate(tx)) / n_modem;
+    const std::vector<float> speech = make_test_speech(num_frames * n_speech,
+                                                       freedv_get_speech_sample_rate(tx));
+
+    std::vector<short> modem;
+    std::vector<short> speech_in(n_speech);
+    std::vector<short> mod_out(n_modem);
+    for (size_t frame = 0; frame < num_frames; ++frame)
+    {
+        for (size_t i = 0; i < n_speech; ++i)
+        {
+            speech_in[i] = speech[(frame * n_speech) + i] * 32767.0f;
+        }
+        freedv_tx(tx, mod_out.data(), speech_in.data());
+        modem.insert(modem.end(), mod_out.begin(), mod_out.end());
+    }
+
+    const size_t max_speech = freedv_get_n_max_speech_samples(rx);
+    std::vector<short> expected(max_speech);
+    std::vector<short> decoded(max_speech);
+    std::vector<unsigned char> bytes((freedv_get_bits_per_modem_frame(rx_payload) + 7) / 8);
+    size_t compared = 0;
+    size_t mismatched = 0;
+    bool diverged = false;
+
+    size_t used = 0;
+    for (size_t nin = freedv_nin(rx); used + nin <= modem.size(); nin = freedv_nin(rx))
+    {
+        if ((size_t)freedv_nin(rx_payload) != nin)
+        {
+            diverged = true;
+            break;
+        }
+
+        const size_t nout = freedv_rx(rx, expected.data(), &modem[used]);
+        const int nbytes = freedv_codecrx(rx_payload, bytes.data(), &modem[used]);
+        used += nin;
+        if (nbytes <= 0)
+        {
+            continue;
+        }
+
+        const size_t nout_payload = decode_payload(rx_payload, bytes.data(), nbytes, decoded.data());
+        ++compared;
+        if (nout_payload != nout ||
+            memcmp(expected.data(), decoded.data(), nout * sizeof(short)) != 0)
+        {
+            ++mismatched;
+        }
+    }
+
+    freedv_close(tx);
+    freedv_close(rx);
+    freedv_close(rx_payload);
+
+    const bool ok = !diverged && compared > 0 && mismatched == 0;
+    printf("%s: %s, %zu of %zu frames differ\n",
+           name,
+           ok ? "OK" : (diverged ? "receivers diverged" : "FAILED"),
+           mismatched,
+           compared);
+    return ok;
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned jobs = std::thread::hardware_concurrency();
+    bool check = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:t")) != -1)
+    {
+        if (opt == 'j')
+        {
+            jobs = atoi(optarg);
+        }
+        else if (opt == 't')
+        {
+            check = true;
+        }
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (check)
+    {
+        bool ok = true;
+        for (const auto& mode : CHECK_MODES)
+        {
+            ok = check_mode(mode.mode, mode.name) && ok;
+        }
+        return ok ? 0 : 1;
+    }
+
+    if (optind >= argc)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const std::vector<std::string> logs(argv + optind, argv + argc);
+    jobs = std::max(1u, std::min<unsigned>(jobs, logs.size()));
+
+    std::atomic<size_t> next(0);
+    std::atomic<int> failures(0);
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i < jobs; ++i)
+    {
+        workers.emplace_back([&]()
+        {
+            for (size_t idx = next++; idx < logs.size(); idx = next++)
+            {
+                if (!decode_log(logs[idx]))
+                {
+                    ++failures;
+                }
+            }
+        });
+    }
+
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,220 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <algorithm>
+
+#include "freedv_api.h"
+#include "codec2.h"
+
+#include "payload_log.h"
+
+static int64_t wall_clock_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+payload_log::payload_log()
+    : m_file(nullptr),
+      m_start_time_us(0),
+      m_running(false),
+      m_overflows(0)
+{
+}
+
+payload_log::~payload_log()
+{
+    close();
+}
+
+bool payload_log::open(const char* dir, const char* name, int freedv_mode)
+{
+    close();
+
+    m_start_time_us = wall_clock_us();
+
+    const time_t now = m_start_time_us / 1000000;
+    struct tm local_time;
+    char stamp[32];
+    localtime_r(&now, &local_time);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local_time);
+
+    mkdir(dir, 0755);
+    const std::string path =
+        std::string(dir) + "/" + name + "_" + stamp + PAYLOAD_LOG_SUFFIX;
+
+    m_file = fopen(path.c_str(), "a+b");
+    if (m_file == nullptr)
+    {
+        return false;
+    }
+
+    // A log reopened within the same second (e.g. a config reload) is
+    // continued, keeping its original start time
+    payload_log_header header;
+    fseek(m_file, 0, SEEK_SET);
+    const bool continued =
+        read_payload_log_header(m_file, &header) && header.freedv_mode == freedv_mode;
+    fseek(m_file, 0, SEEK_END);
+
+    if (continued)
+    {
+        m_start_time_us = header.start_time_us;
+    }
+    else
+    {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, PAYLOAD_LOG_MAGIC, sizeof(PAYLOAD_LOG_MAGIC));
+        header.version = PAYLOAD_LOG_VERSION;
+        header.freedv_mode = freedv_mode;
+        header.start_time_us = m_start_time_us;
+        if (ftruncate(fileno(m_file), 0) != 0 ||
+            fwrite(&header, sizeof(header), 1, m_file) != 1)
+        {
+            fclose(m_file);
+            m_file = nullptr;
+            return false;
+        }
+    }
+
+    m_running = true;
+    m_writer = std::thread(&payload_log::writer_thread, this);
+    return true;
+}
+
+void payload_log::close()
+{
+    m_running = false;
+    if (m_writer.joinable())
+    {
+        m_writer.join();
+    }
+    if (m_file != nullptr)
+    {
+        fclose(m_file);
+        m_file = nullptr;
+    }
+}
+
+void payload_log::write(bool sync, float snr, const unsigned char* bytes, size_t nbytes)
+{
+    if (!m_running.load(std::memory_order_relaxed) || nbytes > MAX_PAYLOAD_BYTES)
+    {
+        return;
+    }
+
+    record* rec = m_queue.begin_push();
+    if (rec == nullptr)
+    {
+        m_overflows.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    rec->header.time_ms = (wall_clock_us() - m_start_time_us) / 1000;
+    rec->header.snr_db = (int8_t)std::max(-128.0f, std::min(127.0f, roundf(snr)));
+    rec->header.flags = sync ? PAYLOAD_FLAG_SYNC : 0;
+    rec->header.nbytes = nbytes;
+    memcpy(rec->bytes, bytes, nbytes);
+    m_queue.end_push();
+}
+
+void payload_log::writer_thread()
+{
+    bool pending = false;
+    while (m_running || m_queue.front() != nullptr)
+    {
+        record* rec = m_queue.front();
+        if (rec == nullptr)
+        {
+            // Flush once things go quiet rather than after every frame
+            if (pending)
+            {
+                fflush(m_file);
+                pending = false;
+            }
+            usleep(100000);
+            continue;
+        }
+
+        fwrite(&rec->header, sizeof(rec->header), 1, m_file);
+        fwrite(rec->bytes, 1, rec->header.nbytes, m_file);
+        pending = true;
+
+        m_queue.pop_front();
+    }
+}
+
+// Copies frame index of bits_per_frame bits, most significant bit first,
+// out of packed into the (bits_per_frame + 7) / 8 bytes codec2_decode takes
+static void unpack_codec_frame(const unsigned char* packed,
+                               int                  bits_per_frame,
+                               int                  index,
+                               unsigned char*       frame)
+{
+    memset(frame, 0, (bits_per_frame + 7) / 8);
+    const int first = index * bits_per_frame;
+    for (int bit = 0; bit < bits_per_frame; ++bit)
+    {
+        const int src = first + bit;
+        if (packed[src / 8] & (0x80 >> (src % 8)))
+        {
+            frame[bit / 8] |= 0x80 >> (bit % 8);
+        }
+    }
+}
+
+size_t decode_payload(struct freedv*       freedv,
+                      const unsigned char* bytes,
+                      size_t               nbytes,
+                      short*               speech)
+{
+    struct CODEC2* const codec2 = freedv_get_codec2(freedv);
+    const int bits_per_frame = codec2_bits_per_frame(codec2);
+    const int samples_per_frame = codec2_samples_per_frame(codec2);
+    const int num_frames = freedv_get_bits_per_modem_frame(freedv) / bits_per_frame;
+
+    size_t nout = 0;
+    for (int i = 0; i < num_frames && (size_t)(i + 1) * bits_per_frame <= nbytes * 8; ++i)
+    {
+        unsigned char frame[payload_log::MAX_PAYLOAD_BYTES];
+        unpack_codec_frame(bytes, bits_per_frame, i, frame);
+        codec2_decode(codec2, speech + nout, frame);
+        nout += samples_per_frame;
+    }
+    return nout;
+}
+
+bool read_payload_log_header(FILE* f, payload_log_header* header)
+{
+    return fread(header, sizeof(*header), 1, f) == 1 &&
+           memcmp(header->magic, PAYLOAD_LOG_MAGIC, sizeof(PAYLOAD_LOG_MAGIC)) == 0 &&
+           header->version == PAYLOAD_LOG_VERSION;
+}
+
+bool read_payload_record(FILE* f,
+                         payload_record_header* header,
+                         unsigned char bytes[payload_log::MAX_PAYLOAD_BYTES])
+{
+    return fread(header, sizeof(*header), 1, f) == 1 &&
+           header->nbytes <= payload_log::MAX_PAYLOAD_BYTES &&
+           fread(bytes, 1, header->nbytes, f) == header->nbytes;
+}
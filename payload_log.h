@@ -0,0 +1,119 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PAYLOAD_LOG_H
+#define PAYLOAD_LOG_H
+
+#include <cstdio>
+#include <cstdint>
+#include <atomic>
+#include <thread>
+
+#include "spsc_queue.h"
+
+struct freedv;
+
+// A payload log holds the decrypted Codec2 bits of every received modem
+// frame instead of the decoded audio. The file starts with a
+// payload_log_header followed by one payload_record_header per modem frame,
+// each immediately followed by nbytes of packed codec bits as
+// freedv_codecrx gives them (see decode_payload). All values are stored
+// in host byte order
+#define PAYLOAD_LOG_SUFFIX ".c2pl"
+
+static const char     PAYLOAD_LOG_MAGIC[4] = { 'C', '2', 'P', 'L' };
+static const uint32_t PAYLOAD_LOG_VERSION = 1;
+
+static const uint8_t  PAYLOAD_FLAG_SYNC = 0x01;
+
+struct payload_log_header
+{
+    char     magic[4];
+    uint32_t version;
+    int32_t  freedv_mode;
+    uint32_t reserved;
+    // Wall clock time of the start of the log in microseconds
+    int64_t  start_time_us;
+};
+
+struct payload_record_header
+{
+    // Milliseconds since start_time_us
+    uint32_t time_ms;
+    // Modem SNR estimate rounded to the nearest dB
+    int8_t   snr_db;
+    uint8_t  flags;
+    uint16_t nbytes;
+};
+
+// Writes a payload log. write() may be called from the JACK thread: it
+// only copies the frame into a preallocated queue, and a background thread
+// appends queued frames to the file. Frames are dropped and counted if the
+// queue is full
+class payload_log
+{
+public:
+    static const size_t MAX_PAYLOAD_BYTES = 64;
+
+    payload_log();
+    ~payload_log();
+
+    // Starts a new log named <dir>/<name>_<date>-<time>.c2pl
+    bool open(const char* dir, const char* name, int freedv_mode);
+    void close();
+
+    uint64_t overflows() const
+    {
+        return m_overflows.load(std::memory_order_relaxed);
+    }
+
+    void write(bool sync, float snr, const unsigned char* bytes, size_t nbytes);
+
+private:
+    struct record
+    {
+        payload_record_header header;
+        unsigned char         bytes[MAX_PAYLOAD_BYTES];
+    };
+
+    void writer_thread();
+
+private:
+    FILE*   m_file;
+    int64_t m_start_time_us;
+
+    std::atomic<bool>     m_running;
+    std::atomic<uint64_t> m_overflows;
+
+    spsc_queue<record, 256> m_queue;
+    std::thread m_writer;
+};
+
+// Decodes one modem frame's codec bits from freedv_codecrx into speech,
+// returning the number of samples written. freedv_codecrx packs the codec
+// frames back to back, so in the modes with 28 bit frames most of them
+// don't start on a byte boundary and are taken apart bit by bit
+size_t decode_payload(struct freedv*       freedv,
+                      const unsigned char* bytes,
+                      size_t               nbytes,
+                      short*               speech);
+
+// Reading side used by payload_decode. Both return false at the end of
+// the file or if the data is malformed
+bool read_payload_log_header(FILE* f, payload_log_header* header);
+bool read_payload_record(FILE* f,
+                         payload_record_header* header,
+                         unsigned char bytes[payload_log::MAX_PAYLOAD_BYTES]);
+
+#endif
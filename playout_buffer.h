@@ -0,0 +1,358 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PLAYOUT_BUFFER_H
+#define PLAYOUT_BUFFER_H
+
+#include <cstdint>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+#include "resampler.h"
+#include "simd.h"
+
+// How far below the shallowest point of the last window the queue is
+// allowed to go, as headroom for jitter not seen yet
+static const double PLAYOUT_MARGIN_SECONDS = 0.002;
+// The target is never allowed above this, however bad the jitter
+static const double PLAYOUT_MAX_SECONDS = 0.25;
+// Window over which the queue depth is watched before lowering the target
+static const double PLAYOUT_WINDOW_SECONDS = 2.0;
+// An underrun longer than this is taken as the end of a transmission
+static const double PLAYOUT_IDLE_SECONDS = 0.5;
+// Audio replayed to cover a gap, and how long it takes to fade out
+static const double PLAYOUT_HISTORY_SECONDS = 0.01;
+static const double PLAYOUT_CONCEAL_SECONDS = 0.02;
+// Fade in when playout starts again, so it never starts on a step
+static const double PLAYOUT_FADE_IN_SECONDS = 0.005;
+
+// Plays decoded speech out of a resampler's queue onto the voice port. It
+// waits for the queue to reach a target depth before starting and covers
+// short gaps by replaying the last few milliseconds backwards and forwards
+// while fading out, rather than dropping straight to silence. The target
+// goes up by however late speech was after each underrun and comes back
+// down towards the worst-case depth seen in each window, so latency only
+// stays high while the modem is actually delivering in bursts.
+//
+// If the resampler has drift compensation on, the target is handed to it,
+// which is what lets the depth settle lower mid-transmission. Otherwise a
+// new target takes effect from the start of the next transmission.
+//
+// configure and read are called with the JACK client inactive and from the
+// JACK thread respectively. The statistics can be read from any thread
+class playout_buffer
+{
+public:
+    playout_buffer()
+        : m_state(IDLE),
+          m_target(0),
+          m_min_target(0),
+          m_max_target(0),
+          m_margin(0),
+          m_window_len(0),
+          m_idle_len(0),
+          m_conceal_len(0),
+          m_fade_in_len(0),
+          m_history_pos(0),
+          m_dry_elems(0),
+          m_late_elems(0),
+          m_speech_back(false),
+          m_conceal_pos(0),
+          m_conceal_dir(-1),
+          m_fade_in_pos(0),
+          m_window_elems(0),
+          m_window_min(0),
+          m_window_sum(0),
+          m_window_count(0),
+          m_stat_target(0),
+          m_stat_depth(0),
+          m_stat_underruns(0),
+          m_stat_concealed(0)
+    {
+    }
+
+    // min_target keeps the target from coming down below what the source
+    // is known to need, such as a network link's packet interval, however
+    // steady delivery has been
+    void configure(unsigned sample_rate, size_t initial_target, size_t min_target = 0)
+    {
+        m_margin = sample_rate * PLAYOUT_MARGIN_SECONDS;
+        m_min_target = std::max(m_margin, min_target);
+        m_max_target = sample_rate * PLAYOUT_MAX_SECONDS;
+        m_window_len = sample_rate * PLAYOUT_WINDOW_SECONDS;
+        m_idle_len = sample_rate * PLAYOUT_IDLE_SECONDS;
+        m_conceal_len = sample_rate * PLAYOUT_CONCEAL_SECONDS;
+        m_fade_in_len = sample_rate * PLAYOUT_FADE_IN_SECONDS;
+        m_history.assign(std::max<size_t>(sample_rate * PLAYOUT_HISTORY_SECONDS, 1), 0.0f);
+        m_history_pos = 0;
+
+        m_state = IDLE;
+        m_target = std::max(m_min_target, std::min(m_max_target, initial_target));
+        start_window();
+
+        m_stat_target.store(m_target, std::memory_order_relaxed);
+        m_stat_depth.store(m_target, std::memory_order_relaxed);
+    }
+
+    size_t target() const
+    {
+        return m_stat_target.load(std::memory_order_relaxed);
+    }
+
+    // Average depth left in the queue after each period over the last window
+    size_t average_depth() const
+    {
+        return m_stat_depth.load(std::memory_order_relaxed);
+    }
+
+    // Gaps in speech that were covered, not counting ends of transmissions
+    uint32_t underruns() const
+    {
+        return m_stat_underruns.load(std::memory_order_relaxed);
+    }
+
+    uint64_t concealed_elems() const
+    {
+        return m_stat_concealed.load(std::memory_order_relaxed);
+    }
+
+    // Fills one period of the voice port from the queue
+    void read(resampler& queue, float* frames, size_t count)
+    {
+        const size_t available = queue.available_elems();
+
+        if (m_state != PLAYING)
+        {
+            wait_for_speech(queue, available, count);
+        }
+
+        if (m_state != PLAYING)
+        {
+            conceal(frames, count);
+            return;
+        }
+
+        const size_t to_deque = std::min(available, count);
+        queue.dequeue(frames, to_deque);
+        fade_in(frames, to_deque);
+        remember(frames, to_deque);
+
+        if (to_deque < count)
+        {
+            // Ran dry, which is also how a transmission ends. Which one it
+            // was is only known once speech comes back or doesn't
+            m_state = CONCEALING;
+            m_dry_elems = 0;
+            m_late_elems = count - to_deque;
+            m_speech_back = false;
+            m_conceal_pos = m_history.size() - 1;
+            m_conceal_dir = -1;
+            conceal(frames + to_deque, count - to_deque);
+            return;
+        }
+
+        track_depth(available - count, count);
+
+        // Only steer while speech is flowing, so gaps between transmissions
+        // don't wind up the loop
+        if (queue.drift_target() != 0)
+        {
+            queue.set_drift_target(m_target);
+            queue.track_fill(count);
+        }
+    }
+
+private:
+    enum state
+    {
+        IDLE,
+        CONCEALING,
+        PLAYING
+    };
+
+    void start_window()
+    {
+        m_window_elems = 0;
+        m_window_min = SIZE_MAX;
+        m_window_sum = 0;
+        m_window_count = 0;
+    }
+
+    void set_target(size_t target)
+    {
+        m_target = std::max(m_min_target, std::min(m_max_target, target));
+        m_stat_target.store(m_target, std::memory_order_relaxed);
+    }
+
+    void wait_for_speech(resampler& queue, size_t available, size_t count)
+    {
+        if (m_state == CONCEALING && !m_speech_back)
+        {
+            if (available == 0)
+            {
+                m_late_elems += count;
+            }
+            else
+            {
+                // Speech came back mid-transmission, so make room for it
+                // being that late next time
+                m_speech_back = true;
+                set_target(m_target + m_late_elems + m_margin);
+                m_stat_underruns.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        if (m_state == CONCEALING && !m_speech_back && m_dry_elems >= m_idle_len)
+        {
+            m_state = IDLE;
+        }
+
+        if (available < m_target + count)
+        {
+            return;
+        }
+
+        m_state = PLAYING;
+        m_fade_in_pos = 0;
+        start_window();
+        if (queue.drift_target() != 0)
+        {
+            queue.set_drift_target(m_target);
+        }
+    }
+
+    // Watches how low the queue gets, and once a window has gone by lowers
+    // the target towards the depth that would have just covered it
+    void track_depth(size_t depth, size_t count)
+    {
+        m_window_min = std::min(m_window_min, depth);
+        m_window_sum += depth;
+        ++m_window_count;
+        m_window_elems += count;
+
+        if (m_window_elems < m_window_len)
+        {
+            return;
+        }
+
+        const size_t average = m_window_sum / m_window_count;
+        m_stat_depth.store(average, std::memory_order_relaxed);
+
+        // The swing below the average is how much the queue needs to hold
+        // to ride out the jitter seen this window
+        const size_t needed = (average - m_window_min) + m_margin;
+        if (needed < m_target)
+        {
+            // Come down gradually, a burst may only be a few windows apart
+            set_target(m_target - ((m_target - needed) / 2));
+        }
+
+        start_window();
+    }
+
+    void fade_in(float* frames, size_t count)
+    {
+        if (m_fade_in_pos >= m_fade_in_len)
+        {
+            return;
+        }
+
+        const float step = 1.0f / m_fade_in_len;
+        const size_t steps = std::min(count, m_fade_in_len - m_fade_in_pos);
+        simd_ramp(frames, steps, m_fade_in_pos * step, step);
+        m_fade_in_pos += steps;
+    }
+
+    void remember(const float* frames, size_t count)
+    {
+        const size_t len = m_history.size();
+        if (count >= len)
+        {
+            std::copy(frames + count - len, frames + count, m_history.begin());
+            m_history_pos = 0;
+            return;
+        }
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            m_history[m_history_pos] = frames[i];
+            m_history_pos = (m_history_pos + 1) % len;
+        }
+    }
+
+    // Replays the history, starting from the newest sample and bouncing
+    // between its ends so there is never a step, while fading out
+    void conceal(float* frames, size_t count)
+    {
+        const size_t len = m_history.size();
+        size_t i = 0;
+
+        if (m_state == CONCEALING)
+        {
+            const float step = 1.0f / m_conceal_len;
+            for (; i < count && m_dry_elems < m_conceal_len; ++i, ++m_dry_elems)
+            {
+                frames[i] = m_history[(m_history_pos + m_conceal_pos) % len] *
+                    (1.0f - (m_dry_elems * step));
+
+                if (len > 1 &&
+                    ((m_conceal_dir < 0 && m_conceal_pos == 0) ||
+                     (m_conceal_dir > 0 && m_conceal_pos == len - 1)))
+                {
+                    m_conceal_dir = -m_conceal_dir;
+                }
+                m_conceal_pos += len > 1 ? m_conceal_dir : 0;
+            }
+            m_stat_concealed.fetch_add(i, std::memory_order_relaxed);
+            m_dry_elems += count - i;
+        }
+
+        std::fill(frames + i, frames + count, 0.0f);
+    }
+
+private:
+    state m_state;
+
+    size_t m_target;
+    size_t m_min_target;
+    size_t m_max_target;
+    size_t m_margin;
+    size_t m_window_len;
+    size_t m_idle_len;
+    size_t m_conceal_len;
+    size_t m_fade_in_len;
+
+    // The most recent output, oldest first from m_history_pos
+    std::vector<float> m_history;
+    size_t m_history_pos;
+
+    size_t m_dry_elems;
+    size_t m_late_elems;
+    bool   m_speech_back;
+    size_t m_conceal_pos;
+    int    m_conceal_dir;
+    size_t m_fade_in_pos;
+
+    size_t m_window_elems;
+    size_t m_window_min;
+    size_t m_window_sum;
+    size_t m_window_count;
+
+    std::atomic<size_t>   m_stat_target;
+    std::atomic<size_t>   m_stat_depth;
+    std::atomic<uint32_t> m_stat_underruns;
+    std::atomic<uint64_t> m_stat_concealed;
+};
+
+#endif
@@ -7,9 +7,13 @@
 #include <stdexcept>
 #include <algorithm>
 #include <limits>
+#include <atomic>
+#include <cmath>
 
 #include <samplerate.h>
 
+#include "simd.h"
+
 inline size_t get_nom_resampled_frames(size_t src_frames,
                                        uint   src_sample_rate,
                                        uint   dst_sample_rate)
@@ -54,12 +58,28 @@ static size_t resample_complete_buffer(      int    converter_type,
     return parms.output_frames_gen;
 }
 
+// Drift compensation steers the conversion ratio with a PI loop on how much
+// output is queued, so a source and sink running from different clocks
+// stay in step. The gains give a critically damped loop with a time
+// constant of about 20 seconds, slow enough that the pitch change can't be
+// heard while still pulling in a 1000 ppm offset within a minute or so
+static const double DRIFT_MAX_PPM = 1000.0;
+static const double DRIFT_AVERAGE_SECONDS = 1.0;
+static const double DRIFT_GAIN_P = 0.1;
+static const double DRIFT_GAIN_I = 0.0025;
+
 class resampler
 {
 public:
     resampler(int converter_type, int channels, size_t initial_capacity = 0)
         : m_source_rate(0),
-          m_dest_rate(0)
+          m_dest_rate(0),
+          m_drift_target(0),
+          m_avg_fill(0.0),
+          m_drift_integral(0.0),
+          m_ratio_adjust(1.0),
+          m_drift_ppm(0.0f),
+          m_avg_fill_elems(0)
     {
         if (initial_capacity > 0)
         {
@@ -85,6 +105,91 @@ public:
         m_dest_rate = dest_rate;
     }
 
+    // Turns on drift compensation, aiming to keep target_elems queued
+    // between calls to track_fill, or turns it off with a target of 0,
+    // dropping the drift estimate. The ratio is resampled even if the
+    // nominal rates are the same. Moving the target while it's on keeps the
+    // drift estimate
+    void set_drift_target(size_t target_elems)
+    {
+        const bool was_on = m_drift_target != 0;
+        m_drift_target = target_elems;
+        if (was_on && target_elems != 0)
+        {
+            return;
+        }
+
+        // Turning it off goes back to the nominal ratio, and turning it on
+        // starts from there
+        m_avg_fill = target_elems;
+        m_drift_integral = 0.0;
+        m_ratio_adjust = 1.0;
+        m_drift_ppm.store(0.0f, std::memory_order_relaxed);
+        m_avg_fill_elems.store(target_elems, std::memory_order_relaxed);
+    }
+
+    size_t drift_target() const
+    {
+        return m_drift_target;
+    }
+
+    // Called once per output period, after the period's samples have been
+    // dequeued, with the number of samples in the period. Updates the
+    // ratio used from the next enqueue on. libsamplerate ramps between
+    // ratios across a call, so the steering itself never clicks
+    void track_fill(size_t elapsed_elems)
+    {
+        if (m_drift_target == 0 || m_dest_rate == 0)
+        {
+            return;
+        }
+
+        // Output arrives a frame at a time, so the fill is a sawtooth.
+        // Average it over a second or so before steering on it
+        const double dt = (double)elapsed_elems / m_dest_rate;
+        m_avg_fill += (available_elems() - m_avg_fill) *
+            std::min(1.0, dt / DRIFT_AVERAGE_SECONDS);
+
+        // Seconds of audio queued beyond the target. The integral settles
+        // on the clock offset between the two sides
+        const double max_adjust = DRIFT_MAX_PPM * 1e-6;
+        const double error = (m_avg_fill - m_drift_target) / m_dest_rate;
+        // While the proportional term alone is at the limit, as it is
+        // working off a queue that started out well away from the target,
+        // the error says nothing about the clocks. Integrating it anyway
+        // winds the estimate up and overshoots into an underrun
+        if (fabs(error * DRIFT_GAIN_P) < max_adjust)
+        {
+            m_drift_integral = std::max(-max_adjust,
+                                        std::min(max_adjust,
+                                                 m_drift_integral + (error * dt * DRIFT_GAIN_I)));
+        }
+
+        const double adjust =
+            std::max(-max_adjust,
+                     std::min(max_adjust, m_drift_integral + (error * DRIFT_GAIN_P)));
+        // Too much queued means the source is fast, so make less output
+        m_ratio_adjust = 1.0 - adjust;
+
+        m_drift_ppm.store(m_drift_integral * 1e6, std::memory_order_relaxed);
+        m_avg_fill_elems.store(m_avg_fill, std::memory_order_relaxed);
+    }
+
+    // How much faster the source clock runs than the sink, in parts per
+    // million, as estimated by drift compensation. Safe to call from any
+    // thread
+    float drift_ppm() const
+    {
+        return m_drift_ppm.load(std::memory_order_relaxed);
+    }
+
+    // The averaged number of elements queued after each output period.
+    // Safe to call from any thread
+    size_t average_fill() const
+    {
+        return m_avg_fill_elems.load(std::memory_order_relaxed);
+    }
+
     template<class Iterator>
     void enqueue(Iterator begin, Iterator end)
     {
@@ -92,7 +197,7 @@ public:
         {
             return;
         }
-        else if (m_source_rate == m_dest_rate)
+        else if (!resampling())
         {
             m_resampled_data.insert(m_resampled_data.end(), begin, end);
         }
@@ -110,7 +215,7 @@ public:
         {
             return;
         }
-        else if (m_source_rate == m_dest_rate)
+        else if (!resampling())
         {
             m_resampled_data.insert(m_resampled_data.end(), data, data + count);
         }
@@ -128,21 +233,23 @@ public:
         {
             return;
         }
-        else if (m_source_rate == m_dest_rate)
+        else if (!resampling())
         {
             const size_t prev_size = m_resampled_data.size();
             m_resampled_data.resize(prev_size + count);
-            src_short_to_float_array(data,
-                                     m_resampled_data.data() + prev_size,
-                                     count);
+            simd_short_to_float(m_resampled_data.data() + prev_size,
+                                data,
+                                count,
+                                1.0f / SHORT_SAMPLE_SCALE);
         }
         else
         {
             const size_t prev_size = m_data_to_resample.size();
             m_data_to_resample.resize(prev_size + count);
-            src_short_to_float_array(data,
-                                     m_data_to_resample.data() + prev_size,
-                                     count);
+            simd_short_to_float(m_data_to_resample.data() + prev_size,
+                                data,
+                                count,
+                                1.0f / SHORT_SAMPLE_SCALE);
 
             do_resample();
         }
@@ -154,7 +261,7 @@ public:
         {
             return;
         }
-        else if (m_source_rate == m_dest_rate)
+        else if (!resampling())
         {
             m_resampled_data.resize(m_resampled_data.size() + count, 0.0f);
         }
@@ -192,7 +299,8 @@ public:
         }
         else if (count <= available_elems())
         {
-            src_float_to_short_array(m_resampled_data.data(), data, count);
+            // Scaled, rounded and clamped in the same pass as the copy
+            simd_float_to_short(data, m_resampled_data.data(), count, SHORT_SAMPLE_SCALE);
             m_resampled_data.erase(m_resampled_data.cbegin(),
                                    m_resampled_data.cbegin() + count);
             return true;
@@ -205,7 +313,7 @@ public:
 
     void flush(size_t max_elems_to_flush)
     {
-        if (m_source_rate != m_dest_rate)
+        if (resampling())
         {
             do_resample(max_elems_to_flush);
             src_reset(m_state);
@@ -218,6 +326,14 @@ public:
         m_resampled_data.clear();
     }
 
+    // Clears the queues and the converter's history, for a stream that
+    // starts again from scratch rather than carrying on
+    void reset()
+    {
+        clear();
+        src_reset(m_state);
+    }
+
     size_t available_elems() const
     {
         return m_resampled_data.size();
@@ -225,12 +341,20 @@ public:
 
 private:
 
+    bool resampling() const
+    {
+        return m_source_rate != m_dest_rate || m_drift_target != 0;
+    }
+
     void do_resample(size_t max_elems_to_flush = 0)
     {
-        const uint max_output_frames =
-            get_max_resampled_frames(m_data_to_resample.size() + max_elems_to_flush,
-                                     m_source_rate,
-                                     m_dest_rate);
+        const double ratio = ((double)m_dest_rate / (double)m_source_rate) * m_ratio_adjust;
+        const size_t max_output_frames =
+            m_drift_target == 0 ?
+                get_max_resampled_frames(m_data_to_resample.size() + max_elems_to_flush,
+                                         m_source_rate,
+                                         m_dest_rate) :
+                (size_t)std::ceil((m_data_to_resample.size() + max_elems_to_flush) * ratio) + 1;
 
         const size_t prev_resampled_size = m_resampled_data.size();
 
@@ -245,7 +369,7 @@ private:
 
         resample_parms.end_of_input = max_elems_to_flush != 0;
 
-        resample_parms.src_ratio = (double)m_dest_rate / (double)m_source_rate;
+        resample_parms.src_ratio = ratio;
 
         if (src_process(m_state, &resample_parms) != 0)
         {
@@ -269,6 +393,15 @@ private:
     uint m_source_rate;
     uint m_dest_rate;
 
+    size_t m_drift_target;
+    double m_avg_fill;
+    double m_drift_integral;
+    double m_ratio_adjust;
+
+    // Drift telemetry for other threads
+    std::atomic<float> m_drift_ppm;
+    std::atomic<size_t> m_avg_fill_elems;
+
     std::vector<float> m_data_to_resample;
     std::vector<float> m_resampled_data;
 
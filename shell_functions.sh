@@ -6,6 +6,9 @@ VERSION="0.13.0"
 CRYPTO_INI_SYS=/etc/crypto.ini
 CRYPTO_INI_USR=/etc/crypto.ini.sd
 CRYPTO_INI_ALL=/etc/crypto.ini.all
+CRYPTO_CFG_BIN=/var/run/crypto.ini.bin
+
+BOOT_PHASES=/var/run/boot_phases
 
 ASOUND_CFG=/var/lib/alsa/asound.state
 SEED_FILE=/var/run/random-seed
@@ -45,8 +48,10 @@ alias seed_rng_with_sd="mcopy_bin_sd ::seed $SEED_FILE && dd if=$SEED_FILE of=/d
 # Saves a new random seed with data from the RNG
 alias save_sd_seed="dd if=/dev/random of=$SEED_FILE bs=512 count=1 && mcopy_bin_sd $SEED_FILE ::seed"
 
-# Generates the crypto.ini.all from the user config and system config
-alias gen_combined_crypto_config="cat $CRYPTO_INI_SYS $CRYPTO_INI_USR > $CRYPTO_INI_ALL"
+# Generates the crypto.ini.all and the compiled config snapshot from the user
+# config and system config. Readers fall back to the INI files if the
+# snapshot can't be compiled
+alias gen_combined_crypto_config="cat $CRYPTO_INI_SYS $CRYPTO_INI_USR > $CRYPTO_INI_ALL && { cfgsnap compile $CRYPTO_CFG_BIN $CRYPTO_INI_USR $CRYPTO_INI_SYS || true; }"
 
 # Restores ALSA sound config for all sound cards
 alias alsa_restore="aplay_ls | grep -o -E 'USB_[UL][LR]' | xargs restore.sh"
@@ -181,6 +186,27 @@ wait_initialized()
     return 0
 }
 
+# Prints the seconds since boot, for timing startup phases
+boot_seconds()
+{
+    cut -d ' ' -f 1 /proc/uptime
+}
+
+# Logs a startup phase that began at the given boot_seconds time and ends
+# now. Usage: log_boot_phase <service> <phase> <start>
+log_boot_phase()
+{
+    echo "$3 `boot_seconds` $1 $2" >> "$BOOT_PHASES"
+}
+
+# Prints the startup phases logged by the scripts and daemons in the
+# order they started, with how long each took
+boot_report()
+{
+    sort -n "$BOOT_PHASES" | \
+        awk '{ printf "%8.3f %8.3f  %-16s %s\n", $1, $2 - $1, $3, $4 }'
+}
+
 # Blocks until the jack server with the specified name
 # is running
 wait_jackd()
@@ -222,7 +248,34 @@ get_config_val()
         return 1
     fi
 
-    iniget "$1" "$2" "$CRYPTO_INI_USR" "$CRYPTO_INI_SYS"
+    # The snapshot is kept up to date by cfgsnap itself, so the INI files
+    # only need to be parsed if it can't be used at all
+    cfgsnap get "$CRYPTO_CFG_BIN" "$1" "$2" 2>/dev/null ||
+        iniget "$1" "$2" "$CRYPTO_INI_USR" "$CRYPTO_INI_SYS"
+}
+
+# Gets many configuration values in one pass, printing shell assignments for
+# eval. Each argument is NAME=Section/Key, Section/Key or Section/*
+# (see iniget), e.g. eval "$(get_config_vals RATE=JACK/SampleRateRX)"
+get_config_vals()
+{
+    if test -z "$1"
+    then
+        echo "usage: get_config_vals <spec> ..." >&2
+        return 1
+    fi
+
+    for spec in "$@"
+    do
+        shift
+        set -- "$@" -e "$spec"
+    done
+
+    if test -s "$CRYPTO_CFG_BIN" && iniget "$@" "$CRYPTO_CFG_BIN" 2>/dev/null
+    then
+        return 0
+    fi
+    iniget "$@" "$CRYPTO_INI_USR" "$CRYPTO_INI_SYS"
 }
 
 # Gets a configuration value from the user config file, if present
@@ -261,6 +314,25 @@ set_config_val()
     iniset "$1" "$2" "$3" "$CRYPTO_INI_USR" && gen_combined_crypto_config
 }
 
+# Saves many configuration values to the user config file with one rewrite.
+# Each argument is Section/Key=Value
+set_config_vals()
+{
+    if test -z "$1"
+    then
+        echo "usage: set_config_vals <Section/Key=Value> ..." >&2
+        return 1
+    fi
+
+    for update in "$@"
+    do
+        shift
+        set -- "$@" -e "$update"
+    done
+
+    iniset "$@" "$CRYPTO_INI_USR" && gen_combined_crypto_config
+}
+
 # Saves a configuration value to the system config file
 set_sys_config_val()
 {
@@ -273,6 +345,39 @@ set_sys_config_val()
     iniset "$1" "$2" "$3" "$CRYPTO_INI_SYS" && gen_combined_crypto_config
 }
 
+# Times the configured mode with jack_calibrate and saves the smallest JACK
+# periods it can keep up with. They depend on the hardware, so they go in
+# the system config rather than travelling with the SD card
+calibrate_jack_periods()
+{
+    PERIODS="`jack_calibrate "$CRYPTO_INI_ALL"`"
+    if test -z "$PERIODS"
+    then
+        return 1
+    fi
+
+    set --
+    for update in $PERIODS
+    do
+        set -- "$@" -e "$update"
+    done
+
+    iniset "$@" "$CRYPTO_INI_SYS" && gen_combined_crypto_config
+}
+
+# Calibrates the JACK periods unless the configured mode already has them
+calibrate_jack_periods_once()
+{
+    MODE="`get_config_val Codec Mode`"
+    if test -n "`get_sys_config_val JACK "TXPeriod$MODE"`" ||
+       test -n "`get_sys_config_val JACK "RXPeriod$MODE"`"
+    then
+        return 0
+    fi
+
+    calibrate_jack_periods
+}
+
 # Takes a parameter "VoiceDevice" or "ModemDevice"
 # and returns the configuration value for that setting
 get_sound_hw_device()
@@ -336,38 +441,28 @@ combine_img_p1()
     dd if="$2" of="$1" bs="$BLOCK_SIZE" seek="$START_BLOCK"
 }
 
-# Copies SD card image to SD card
+# Copies SD card image to SD card, or to each of the specified devices at
+# once, and verifies what was written
 copy_img_to_sd()
 {
     if test -z "$1"
     then
-        echo "usage: copy_img_to_sd <filepath>" >&2
+        echo "usage: copy_img_to_sd <filepath> [<device> ...]" >&2
         return 1
     fi
 
-    if test -n "$2"
+    SRC_IMG="$1"
+    shift
+    if test -z "$1"
     then
-        DST_DEV="$2"
-    else
-        DST_DEV="/dev/mmcblk0"
+        set -- /dev/mmcblk0
     fi
 
-    SRC_SIZE=`stat -c '%s' "$1"`
-    SRC_BLOCKS=$(((SRC_SIZE+511)/512))
-    VER_FILE=`mktemp`
-
-    echo "Copying" 1>&2 && \
-        dd if="$1" of="$DST_DEV" bs=512 conv=fsync status=progress && \
-        echo "Verifying" 1>&2 && \
-        dd if="$DST_DEV" of="$VER_FILE" bs=512 count="$SRC_BLOCKS" status=progress && \
-        diff "$VER_FILE" "$1" && \
-        partprobe "$DST_DEV" && \
-        echo "Success" 1>&2
-    RET="$?"
-
-    rm -f "$VER_FILE"
-
-    return "$RET"
+    imgwrite "$SRC_IMG" "$@" && \
+        for DST_DEV in "$@"
+        do
+            test ! -b "$DST_DEV" || partprobe "$DST_DEV" || return 1
+        done
 }
 
 ensure_sd_has_config_dir()
@@ -486,25 +581,22 @@ get_key_path()
     echo "$KEY_PATH"
 }
 
-# Generates a new key and stores it to the specified Key Slot
+# Generates new keys and stores them to the specified Key Slots (slot 1 if
+# none are given)
 gen_key()
 {
     if test -z "$1"
     then
-        KEY_PATH=`get_key_path 1`
+        keyslot generate 1
     else
-        KEY_PATH=`get_key_path "$1"`
+        keyslot generate "$@"
     fi
-
-    dd if=/dev/hwrng of=/dev/urandom bs=512 count=1 && \
-        dd if=/dev/random of="$KEY_PATH" bs=131 count=1
 }
 
 # Tests whether or not a key is in a particular Key Slot
 has_key()
 {
-    KEY_PATH=`get_key_path "$1"`
-    test -f "$KEY_PATH"
+    keyslot has "$1" 2>/dev/null
 }
 
 sd_has_any_keys()
@@ -524,7 +616,7 @@ ext_has_any_keys()
 
 has_any_keys()
 {
-    test `find /etc -type f -name 'key*' | wc -l` -gt 0
+    keyslot any
 }
 
 set_key_index()
@@ -543,55 +635,44 @@ set_key_index()
 # 2. There is at least one key on the SD card (first) or USB drive (second)
 load_sd_key_noclobber()
 {
-    if ! has_any_keys
+    if has_any_keys
     then
-        if sd_has_any_keys
-        then
-            mcopy_bin_sd ::config/key* /etc/
-        elif usb_has_any_keys
-        then
-            mcopy_bin_usb ::config/key* /etc/
-        else
-            return 1
-        fi
-    else
         return 1
     fi
+
+    KEY_DIR=`mktemp -d`
+    if sd_has_any_keys
+    then
+        mcopy_bin_sd ::config/key* "$KEY_DIR/"
+    elif usb_has_any_keys
+    then
+        mcopy_bin_usb ::config/key* "$KEY_DIR/"
+    fi
+
+    keyslot import -n "$KEY_DIR"
+    RET=$?
+
+    rm -rf "$KEY_DIR"
+    return $RET
 }
 
-# Loads the keys from the SD card
+# Loads the keys from the SD card, replacing the local ones
 load_sd_key()
 {
-    MDIR_OUT=`mktemp`
     # We want this to succeed if the SD card is inserted but no keys are found
-    # and fail if there is no SD card. So don't wildcard on the mdir call but
-    # instead pass it through grep
-    if mdir_sd -b ::config/ > "$MDIR_OUT"
+    # and fail if there is no SD card. So check the config dir first
+    if ! mdir_sd -b ::config/ > /dev/null
     then
-        SD_KEYS=`mktemp`
-
-        grep key < "$MDIR_OUT" | sed -e 's|::/config/||g' | sort > "$SD_KEYS"
-        NUM_KEYS=`wc -l < "$SD_KEYS"`
-
-        if test "$NUM_KEYS" -eq 0 || mcopy_bin_sd ::config/key* /etc/
-        then
-            PI_KEYS=`mktemp`
-
-            find /etc/ -type f -name 'key*' | sed -e 's|/etc/||g' | sort > "$PI_KEYS"
-
-            comm -23 "$PI_KEYS" "$SD_KEYS" | sed -e 's|^|/etc/|' | xargs -r rm -f
-            RET=$?
-
-            rm -f "$PI_KEYS" "$SD_KEYS" "$MDIR_OUT"
-            return $RET
-        else
-            rm -f "$SD_KEYS" "$MDIR_OUT"
-            return 1
-        fi
-    else
-        rm -f "$MDIR_OUT"
         return 1
     fi
+
+    KEY_DIR=`mktemp -d`
+    { ! sd_has_any_keys > /dev/null || mcopy_bin_sd ::config/key* "$KEY_DIR/"; } && \
+        keyslot import -f "$KEY_DIR"
+    RET=$?
+
+    rm -rf "$KEY_DIR"
+    return $RET
 }
 
 # Saves the keys to the SD card
@@ -622,21 +703,11 @@ save_sd_key()
     fi
 }
 
+# Prints the next Key Slot after $1 that has a key, wrapping around after
+# 256. Prints $1 if no other slot has one
 next_key_idx()
 {
-    NEXT_KEY_IDX=$(($1+1))
-    # Prevent infinite loop if no key
-    while test "$NEXT_KEY_IDX" -ne "$1" && ! has_key "$NEXT_KEY_IDX"
-    do
-        if test "$NEXT_KEY_IDX" -ge 256
-        then
-            NEXT_KEY_IDX=1
-        else
-            NEXT_KEY_IDX=$((NEXT_KEY_IDX+1))
-        fi
-    done
-
-    echo "$NEXT_KEY_IDX"
+    keyslot next "$1"
 }
 
 headset_tts()
@@ -645,9 +716,19 @@ headset_tts()
         /etc/init.d/S31jack_crypto_rx signal SIGUSR1
 }
 
+# Sends an alert on the FreeDV text channel, which takes far less airtime
+# than speaking it. The transmitter refuses when encryption is on (the text
+# channel isn't encrypted) or the mode has no text channel, and then the
+# alert is spoken over the air instead
 execute_alert_broadcast()
 {
-     espeak_radio -w "$TTS_FILE" "$@" &> /dev/null && \
+    if crypto_ctl "`get_config_val JACK TXControlSocket`" text "$*" &> /dev/null
+    then
+        headset_tts "$@"
+        return
+    fi
+
+    espeak_radio -w "$TTS_FILE" "$@" &> /dev/null && \
         /etc/init.d/S30jack_crypto_tx signal SIGUSR1 && \
         headset_tts "$@"
 }
@@ -0,0 +1,291 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <cstring>
+#include <cstddef>
+#include <cmath>
+
+// Small set of buffer kernels written with the GCC vector extensions so they
+// compile to NEON on the Pi and SSE on x86 without any intrinsics. Each
+// kernel works on 4 lanes at a time and finishes the tail with scalar code
+
+typedef float v4sf __attribute__((vector_size(16)));
+typedef short v4hi __attribute__((vector_size(8)));
+
+#define SIMD_LANES 4
+
+// Scale between shorts and the +/-1.0 floats JACK uses, the same as
+// libsamplerate's conversion functions
+#define SHORT_SAMPLE_SCALE 32768.0f
+
+inline v4sf simd_load(const float* p)
+{
+    v4sf v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline void simd_store(float* p, v4sf v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+inline v4sf simd_splat(float f)
+{
+    const v4sf v = { f, f, f, f };
+    return v;
+}
+
+inline v4sf simd_min(v4sf a, v4sf b)
+{
+    return a < b ? a : b;
+}
+
+inline v4sf simd_max(v4sf a, v4sf b)
+{
+    return a > b ? a : b;
+}
+
+inline v4sf simd_abs(v4sf a)
+{
+    return a < 0.0f ? -a : a;
+}
+
+// dst[i] *= gain
+inline void simd_scale(float* dst, size_t count, float gain)
+{
+    const v4sf g = simd_splat(gain);
+    size_t i = 0;
+    for (; i + SIMD_LANES <= count; i += SIMD_LANES)
+    {
+        simd_store(dst + i, simd_load(dst + i) * g);
+    }
+    for (; i < count; ++i)
+    {
+        dst[i] *= gain;
+    }
+}
+
+// dst[i] *= start + (i * step)
+inline void simd_ramp(float* dst, size_t count, float start, float step)
+{
+    const v4sf step4 = simd_splat(step * SIMD_LANES);
+    v4sf g = { start, start + step, start + (step * 2), start + (step * 3) };
+    size_t i = 0;
+    for (; i + SIMD_LANES <= count; i += SIMD_LANES)
+    {
+        simd_store(dst + i, simd_load(dst + i) * g);
+        g += step4;
+    }
+    for (; i < count; ++i)
+    {
+        dst[i] *= start + (i * step);
+    }
+}
+
+// dst[i] += src[i] * gain
+inline void simd_mix(float* dst, const float* src, size_t count, float gain)
+{
+    const v4sf g = simd_splat(gain);
+    size_t i = 0;
+    for (; i + SIMD_LANES <= count; i += SIMD_LANES)
+    {
+        simd_store(dst + i, simd_load(dst + i) + (simd_load(src + i) * g));
+    }
+    for (; i < count; ++i)
+    {
+        dst[i] += src[i] * gain;
+    }
+}
+
+// dst[i] = src[i] * gain, rounded and clamped to the range of a short.
+// Converting at the point the samples are copied means they only cross
+// between float and short once
+inline void simd_float_to_short(short* dst, const float* src, size_t count, float gain)
+{
+    const v4sf g = simd_splat(gain);
+    const v4sf lo = simd_splat(-32768.0f);
+    const v4sf hi = simd_splat(32767.0f);
+    const v4sf half = simd_splat(0.5f);
+    const v4sf zero = simd_splat(0.0f);
+
+    size_t i = 0;
+    for (; i + SIMD_LANES <= count; i += SIMD_LANES)
+    {
+        v4sf x = simd_min(simd_max(simd_load(src + i) * g, lo), hi);
+        x += x < zero ? -half : half;
+        const v4hi s = __builtin_convertvector(x, v4hi);
+        memcpy(dst + i, &s, sizeof(s));
+    }
+    for (; i < count; ++i)
+    {
+        float x = src[i] * gain;
+        x = x < -32768.0f ? -32768.0f : (x > 32767.0f ? 32767.0f : x);
+        dst[i] = (short)(x < 0.0f ? x - 0.5f : x + 0.5f);
+    }
+}
+
+// dst[i] = src[i] * gain
+inline void simd_short_to_float(float* dst, const short* src, size_t count, float gain)
+{
+    const v4sf g = simd_splat(gain);
+    size_t i = 0;
+    for (; i + SIMD_LANES <= count; i += SIMD_LANES)
+    {
+        v4hi s;
+        memcpy(&s, src + i, sizeof(s));
+        simd_store(dst + i, __builtin_convertvector(s, v4sf) * g);
+    }
+    for (; i < count; ++i)
+    {
+        dst[i] = src[i] * gain;
+    }
+}
+
+// Largest |src[i]|
+inline float simd_peak(const float* src, size_t count)
+{
+    v4sf peak4 = simd_splat(0.0f);
+    size_t i = 0;
+    for (; i + SIMD_LANES <= count; i += SIMD_LANES)
+    {
+        peak4 = simd_max(peak4, simd_abs(simd_load(src + i)));
+    }
+
+    float peak = 0.0f;
+    for (size_t lane = 0; lane < SIMD_LANES; ++lane)
+    {
+        peak = peak4[lane] > peak ? peak4[lane] : peak;
+    }
+    for (; i < count; ++i)
+    {
+        const float a = src[i] < 0.0f ? -src[i] : src[i];
+        peak = a > peak ? a : peak;
+    }
+    return peak;
+}
+
+// sum of a[i] * b[i]
+inline float simd_dot(const float* a, const float* b, size_t count)
+{
+    v4sf sum4 = simd_splat(0.0f);
+    size_t i = 0;
+    for (; i + SIMD_LANES <= count; i += SIMD_LANES)
+    {
+        sum4 += simd_load(a + i) * simd_load(b + i);
+    }
+
+    float sum = (sum4[0] + sum4[1]) + (sum4[2] + sum4[3]);
+    for (; i < count; ++i)
+    {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+// dst[i] += a[i] * b[i]
+inline void simd_mul_add(float* dst, const float* a, const float* b, size_t count)
+{
+    size_t i = 0;
+    for (; i + SIMD_LANES <= count; i += SIMD_LANES)
+    {
+        simd_store(dst + i, simd_load(dst + i) + (simd_load(a + i) * simd_load(b + i)));
+    }
+    for (; i < count; ++i)
+    {
+        dst[i] += a[i] * b[i];
+    }
+}
+
+// (re[i], im[i]) *= e^(j * (phase + (i * step))), mixing a complex signal
+// with an NCO. The phasor is rotated in single precision, so call it a few
+// thousand samples at a time with the phase worked out exactly each time
+inline void simd_mix_nco(float* re, float* im, size_t count, double phase, double step)
+{
+    v4sf pr = { (float)cos(phase),
+                (float)cos(phase + step),
+                (float)cos(phase + (step * 2)),
+                (float)cos(phase + (step * 3)) };
+    v4sf pi = { (float)sin(phase),
+                (float)sin(phase + step),
+                (float)sin(phase + (step * 2)),
+                (float)sin(phase + (step * 3)) };
+    const v4sf rr = simd_splat((float)cos(step * SIMD_LANES));
+    const v4sf ri = simd_splat((float)sin(step * SIMD_LANES));
+
+    size_t i = 0;
+    for (; i + SIMD_LANES <= count; i += SIMD_LANES)
+    {
+        const v4sf xr = simd_load(re + i);
+        const v4sf xi = simd_load(im + i);
+        simd_store(re + i, (xr * pr) - (xi * pi));
+        simd_store(im + i, (xr * pi) + (xi * pr));
+
+        const v4sf next_pr = (pr * rr) - (pi * ri);
+        pi = (pr * ri) + (pi * rr);
+        pr = next_pr;
+    }
+    for (; i < count; ++i)
+    {
+        const float cr = cos(phase + (i * step));
+        const float ci = sin(phase + (i * step));
+        const float xr = re[i];
+        re[i] = (xr * cr) - (im[i] * ci);
+        im[i] = (xr * ci) + (im[i] * cr);
+    }
+}
+
+// Soft knee limiter. Samples below the knee pass through untouched, samples
+// above it are compressed with a rational tanh approximation so the output
+// approaches but never exceeds +/-1.0
+inline void simd_soft_limit(float* dst, size_t count, float knee)
+{
+    const float range = 1.0f - knee;
+    const v4sf k = simd_splat(knee);
+    const v4sf r = simd_splat(range);
+    const v4sf inv_r = simd_splat(1.0f / range);
+    const v4sf zmax = simd_splat(3.0f);
+    const v4sf c27 = simd_splat(27.0f);
+    const v4sf c9 = simd_splat(9.0f);
+    const v4sf zero = simd_splat(0.0f);
+
+    size_t i = 0;
+    for (; i + SIMD_LANES <= count; i += SIMD_LANES)
+    {
+        const v4sf x = simd_load(dst + i);
+        const v4sf a = simd_abs(x);
+        const v4sf z = simd_min(simd_max(a - k, zero) * inv_r, zmax);
+        const v4sf z2 = z * z;
+        const v4sf shaped = z * (c27 + z2) / (c27 + (c9 * z2));
+        const v4sf y = simd_min(a, k) + (r * shaped);
+        simd_store(dst + i, x < zero ? -y : y);
+    }
+    for (; i < count; ++i)
+    {
+        const float x = dst[i];
+        const float a = x < 0.0f ? -x : x;
+        if (a > knee)
+        {
+            float z = (a - knee) / range;
+            z = z < 3.0f ? z : 3.0f;
+            const float y = knee + (range * (z * (27.0f + z * z) / (27.0f + 9.0f * z * z)));
+            dst[i] = x < 0.0f ? -y : y;
+        }
+    }
+}
+
+#endif
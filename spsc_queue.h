@@ -0,0 +1,118 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <cstddef>
+#include <atomic>
+
+// Fixed capacity lock-free queue for exactly one producer thread and one
+// consumer thread. Neither push nor pop allocate or block, so either end
+// can be used from the JACK realtime thread. Capacity must be a power of 2
+template<class T, size_t Capacity>
+class spsc_queue
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of 2");
+
+public:
+    spsc_queue()
+        : m_head(0),
+          m_tail(0)
+    {
+    }
+
+    bool push(const T& val)
+    {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == Capacity)
+        {
+            return false;
+        }
+
+        m_items[tail & (Capacity - 1)] = val;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& val)
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+
+        val = m_items[head & (Capacity - 1)];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // In-place variants for large items. begin_push returns the slot to
+    // fill (or nullptr if full) and end_push publishes it. front returns the
+    // oldest item (or nullptr if empty) and pop_front releases it
+    T* begin_push()
+    {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_head.load(std::memory_order_acquire) == Capacity)
+        {
+            return nullptr;
+        }
+        return &m_items[tail & (Capacity - 1)];
+    }
+
+    void end_push()
+    {
+        m_tail.store(m_tail.load(std::memory_order_relaxed) + 1,
+                     std::memory_order_release);
+    }
+
+    T* front()
+    {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tail.load(std::memory_order_acquire))
+        {
+            return nullptr;
+        }
+        return &m_items[head & (Capacity - 1)];
+    }
+
+    void pop_front()
+    {
+        m_head.store(m_head.load(std::memory_order_relaxed) + 1,
+                     std::memory_order_release);
+    }
+
+    bool empty() const
+    {
+        return m_head.load(std::memory_order_acquire) ==
+               m_tail.load(std::memory_order_acquire);
+    }
+
+    size_t size() const
+    {
+        return m_tail.load(std::memory_order_acquire) -
+               m_head.load(std::memory_order_acquire);
+    }
+
+private:
+    T m_items[Capacity];
+
+    // Keep the indices on separate cache lines so the two threads don't
+    // fight over one line
+    alignas(64) std::atomic<size_t> m_head;
+    alignas(64) std::atomic<size_t> m_tail;
+};
+
+#endif
@@ -3,6 +3,24 @@ trap 'exit 0' INT TERM
 
 . /etc/profile.d/shell_functions.sh
 
-wait_jackd rx
+# The client waits for the JACK server itself and sets up everything else
+# while it starts, so only the config has to be ready
+START=`boot_seconds`
+wait_initialized
+log_boot_phase jack_crypto_rx wait_config "$START"
 
-exec jack_crypto_rx rx /etc/crypto.ini.all
+# With SingleProcess set jack_crypto_trx, started in place of the
+# transmitter, hosts the receiver. Stop this service rather than have it
+# respawned, and leave the init script to follow jack_crypto_tx instead
+if test "`get_config_val JACK SingleProcess`" = "1"
+then
+    echo "Receiver is hosted by jack_crypto_tx"
+    exec daemon --stop -n jack_crypto_rx
+fi
+
+if cfgsnap compile "$CRYPTO_CFG_BIN" "$CRYPTO_INI_USR" "$CRYPTO_INI_SYS"
+then
+    exec jack_crypto_rx rx "$CRYPTO_CFG_BIN"
+fi
+
+exec jack_crypto_rx rx "$CRYPTO_INI_ALL"
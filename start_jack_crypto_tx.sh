@@ -3,6 +3,22 @@ trap 'exit 0' INT TERM
 
 . /etc/profile.d/shell_functions.sh
 
-wait_jackd tx
+# The client waits for the JACK server itself and sets up everything else
+# while it starts, so only the config has to be ready
+START=`boot_seconds`
+wait_initialized
+log_boot_phase jack_crypto_tx wait_config "$START"
 
-exec jack_crypto_tx tx /etc/crypto.ini.all
+# With SingleProcess set the receiver is hosted in this process too
+CLIENT="jack_crypto_tx tx"
+if test "`get_config_val JACK SingleProcess`" = "1"
+then
+    CLIENT="jack_crypto_trx tx rx"
+fi
+
+if cfgsnap compile "$CRYPTO_CFG_BIN" "$CRYPTO_INI_USR" "$CRYPTO_INI_SYS"
+then
+    exec $CLIENT "$CRYPTO_CFG_BIN"
+fi
+
+exec $CLIENT "$CRYPTO_INI_ALL"
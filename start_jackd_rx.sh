@@ -4,13 +4,20 @@ trap 'exit 0' INT TERM
 . /etc/profile.d/shell_functions.sh
 
 echo "Wait for Config Initialization"
+START=`boot_seconds`
 wait_initialized
+log_boot_phase jackd_rx wait_config "$START"
 
-IN_HW=`get_sound_hw_device ModemDevice`
-OUT_HW=`get_sound_hw_device VoiceDevice`
+eval "`get_config_vals \
+    IN_HW=JACK/ModemDevice \
+    OUT_HW=JACK/VoiceDevice \
+    SAMPLE_RATE=JACK/SampleRateRX \
+    BUFFERS=JACK/NumBuffersRX`"
 
 echo "Wait for Sound Cards"
+START=`boot_seconds`
 wait_sound_dev_active_all "$IN_HW" "$OUT_HW" &>/dev/null
+log_boot_phase jackd_rx wait_sound "$START"
 
 if test "$IN_HW" = "$OUT_HW"
 then
@@ -19,7 +26,4 @@ else
     HW_ARGS="-C $IN_HW -P $OUT_HW"
 fi
 
-SAMPLE_RATE=`get_config_val JACK SampleRateRX`
-BUFFERS=`get_config_val JACK NumBuffersRX`
-
 exec jackd -n rx -d alsa $HW_ARGS -r "$SAMPLE_RATE" -p 1024 -n "$BUFFERS"
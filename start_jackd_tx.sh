@@ -4,13 +4,20 @@ trap 'exit 0' INT TERM
 . /etc/profile.d/shell_functions.sh
 
 echo "Wait for Config Initialization"
+START=`boot_seconds`
 wait_initialized
+log_boot_phase jackd_tx wait_config "$START"
 
-IN_HW=`get_sound_hw_device VoiceDevice`
-OUT_HW=`get_sound_hw_device ModemDevice`
+eval "`get_config_vals \
+    IN_HW=JACK/VoiceDevice \
+    OUT_HW=JACK/ModemDevice \
+    SAMPLE_RATE=JACK/SampleRateTX \
+    BUFFERS=JACK/NumBuffersTX`"
 
 echo "Wait for Sound Cards"
+START=`boot_seconds`
 wait_sound_dev_active_all "$IN_HW" "$OUT_HW" &>/dev/null
+log_boot_phase jackd_tx wait_sound "$START"
 
 if test "$IN_HW" = "$OUT_HW"
 then
@@ -19,7 +26,4 @@ else
     HW_ARGS="-C $IN_HW -P $OUT_HW"
 fi
 
-SAMPLE_RATE=`get_config_val JACK SampleRateTX`
-BUFFERS=`get_config_val JACK NumBuffersTX`
-
 exec jackd -n tx -d alsa $HW_ARGS -r "$SAMPLE_RATE" -p 1024 -n "$BUFFERS"
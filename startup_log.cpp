@@ -0,0 +1,130 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "startup_log.h"
+
+double boot_seconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void log_startup_phase(const char* service, const char* phase, double start)
+{
+    char line[128];
+    const int len = snprintf(line,
+                             sizeof(line),
+                             "%.3f %.3f %s %s\n",
+                             start,
+                             boot_seconds(),
+                             service,
+                             phase);
+    if (len <= 0 || len >= (int)sizeof(line))
+    {
+        return;
+    }
+
+    // One short O_APPEND write per line, so lines from other threads and
+    // processes never interleave
+    const int fd = open(STARTUP_LOG_PATH, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd >= 0)
+    {
+        if (write(fd, line, len) != len)
+        {
+            // Timing is best effort, startup carries on without it
+        }
+        close(fd);
+    }
+}
+
+startup_phase::startup_phase(const char* service, const char* phase)
+    : m_service(service),
+      m_phase(phase),
+      m_start(boot_seconds())
+{
+}
+
+startup_phase::~startup_phase()
+{
+    log_startup_phase(m_service, m_phase, m_start);
+}
+
+static void notify_socket(const char* path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        return;
+    }
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    // A leading '@' is an abstract socket
+    if (addr.sun_path[0] == '@')
+    {
+        addr.sun_path[0] = '\0';
+    }
+
+    const int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    static const char READY[] = "READY=1";
+    sendto(fd,
+           READY,
+           sizeof(READY) - 1,
+           MSG_NOSIGNAL,
+           (struct sockaddr*)&addr,
+           offsetof(struct sockaddr_un, sun_path) + strlen(path));
+    close(fd);
+}
+
+void notify_ready(const char* service)
+{
+    const double now = boot_seconds();
+
+    const char* socket_path = getenv("NOTIFY_SOCKET");
+    if (socket_path != nullptr && *socket_path != '\0')
+    {
+        notify_socket(socket_path);
+    }
+
+    const char* ready_fd = getenv("READY_FD");
+    if (ready_fd != nullptr && *ready_fd != '\0')
+    {
+        const int fd = atoi(ready_fd);
+        if (write(fd, "\n", 1) != 1)
+        {
+            // The supervisor isn't listening any more
+        }
+        close(fd);
+    }
+
+    log_startup_phase(service, "ready", now);
+}
@@ -0,0 +1,48 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STARTUP_LOG_H
+#define STARTUP_LOG_H
+
+// The daemons and init scripts all append their startup phases here, one
+// "<start> <end> <service> <phase>" line each with the times in seconds
+// since boot. boot_report in shell_functions.sh sorts it into a timeline
+#define STARTUP_LOG_PATH "/var/run/boot_phases"
+
+// Seconds since boot, counting time spent suspended like /proc/uptime
+double boot_seconds();
+
+void log_startup_phase(const char* service, const char* phase, double start);
+
+// Logs the time between construction and destruction as one phase. Safe
+// to use from several threads at once
+class startup_phase
+{
+public:
+    startup_phase(const char* service, const char* phase);
+    ~startup_phase();
+
+private:
+    const char* const m_service;
+    const char* const m_phase;
+    const double      m_start;
+};
+
+// Tells whoever started the daemon that it is ready. Sends READY=1 to
+// $NOTIFY_SOCKET (the systemd protocol) and writes a newline to the file
+// descriptor in $READY_FD (the s6 protocol), whichever are set. The ready
+// time is logged as a phase of its own
+void notify_ready(const char* service);
+
+#endif
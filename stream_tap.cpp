@@ -0,0 +1,231 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+
+#include <sndfile.h>
+
+#include "crypto_cfg.h"
+#include "control_socket.h"
+#include "stream_tap.h"
+
+struct stream_tap::output
+{
+    SNDFILE* file = nullptr;
+    uint64_t bytes = 0;
+    time_t   last_sync = 0;
+
+    ~output()
+    {
+        close();
+    }
+
+    void close()
+    {
+        if (file != nullptr)
+        {
+            sf_write_sync(file);
+            sf_close(file);
+            file = nullptr;
+        }
+        bytes = 0;
+    }
+};
+
+stream_tap::stream_tap(const char* client_name)
+    : m_client_name(client_name),
+      m_enabled(false),
+      m_running(false),
+      m_overflows(0),
+      m_frames_written(0)
+{
+}
+
+stream_tap::~stream_tap()
+{
+    stop();
+}
+
+int stream_tap::add_stream(const char* stream_name)
+{
+    m_stream_names.push_back(stream_name);
+    return static_cast<int>(m_stream_names.size() - 1);
+}
+
+bool stream_tap::start(const struct config* cfg, unsigned sample_rate)
+{
+    stop();
+
+    if (!str_has_value(cfg->tap_dir))
+    {
+        return false;
+    }
+
+    m_dir = cfg->tap_dir;
+    m_format = strcasecmp(cfg->tap_format, "flac") == 0 ?
+        (SF_FORMAT_FLAC | SF_FORMAT_PCM_16) : (SF_FORMAT_WAV | SF_FORMAT_FLOAT);
+    m_max_file_bytes = static_cast<uint64_t>(cfg->tap_max_file_size) * 1024 * 1024;
+    m_sync_interval = cfg->tap_sync_interval;
+    m_sample_rate = sample_rate;
+
+    mkdir(m_dir.c_str(), 0755);
+
+    // Anything left over from the last run belongs to old files
+    while (m_ring.front() != nullptr)
+    {
+        m_ring.pop_front();
+    }
+
+    m_running = true;
+    m_writer = std::thread(&stream_tap::writer_thread, this);
+    m_enabled = true;
+
+    return true;
+}
+
+void stream_tap::stop()
+{
+    m_enabled = false;
+    m_running = false;
+    if (m_writer.joinable())
+    {
+        m_writer.join();
+    }
+}
+
+void stream_tap::write(int stream, const float* frames, size_t count)
+{
+    if (!enabled())
+    {
+        return;
+    }
+
+    while (count > 0)
+    {
+        block* blk = m_ring.begin_push();
+        if (blk == nullptr)
+        {
+            m_overflows.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        const size_t n = std::min(count, BLOCK_FRAMES);
+        blk->stream = stream;
+        blk->frames = n;
+        memcpy(blk->data, frames, n * sizeof(float));
+        m_ring.end_push();
+
+        frames += n;
+        count -= n;
+    }
+}
+
+void stream_tap::writer_thread()
+{
+    std::vector<output> outputs(m_stream_names.size());
+    const bool flac = (m_format & SF_FORMAT_FLAC) != 0;
+    const unsigned bytes_per_frame = flac ? sizeof(short) : sizeof(float);
+
+    // Keep draining after stop so nothing queued before it is lost
+    while (m_running || m_ring.front() != nullptr)
+    {
+        block* blk = m_ring.front();
+        if (blk == nullptr)
+        {
+            usleep(20000);
+            continue;
+        }
+
+        output& out = outputs[blk->stream];
+        if (out.file != nullptr && m_max_file_bytes > 0 && out.bytes >= m_max_file_bytes)
+        {
+            out.close();
+        }
+
+        const time_t now = time(NULL);
+        if (out.file == nullptr)
+        {
+            char stamp[32];
+            struct tm local_time;
+            localtime_r(&now, &local_time);
+            strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local_time);
+
+            const std::string path = m_dir + "/" + m_client_name + "_" +
+                m_stream_names[blk->stream] + "_" + stamp + (flac ? ".flac" : ".wav");
+
+            SF_INFO info;
+            memset(&info, 0, sizeof(info));
+            info.samplerate = m_sample_rate;
+            info.channels = 1;
+            info.format = m_format;
+            out.file = sf_open(path.c_str(), SFM_WRITE, &info);
+            out.last_sync = now;
+        }
+
+        if (out.file != nullptr)
+        {
+            sf_writef_float(out.file, blk->data, blk->frames);
+            out.bytes += blk->frames * bytes_per_frame;
+            m_frames_written.fetch_add(blk->frames, std::memory_order_relaxed);
+
+            if (m_sync_interval > 0 && (now - out.last_sync) >= m_sync_interval)
+            {
+                sf_write_sync(out.file);
+                out.last_sync = now;
+            }
+        }
+
+        m_ring.pop_front();
+    }
+}
+
+void handle_tap_command(stream_tap&          tap,
+                        control_socket&      control,
+                        const char*          arg,
+                        const struct config* cfg,
+                        unsigned             sample_rate)
+{
+    if (arg == nullptr || strcasecmp(arg, "status") == 0)
+    {
+        // Fall through to the status reply
+    }
+    else if (strcasecmp(arg, "on") == 0)
+    {
+        if (!tap.enabled() && !tap.start(cfg, sample_rate))
+        {
+            control.reply("ERROR no tap directory configured");
+            return;
+        }
+    }
+    else if (strcasecmp(arg, "off") == 0)
+    {
+        tap.stop();
+    }
+    else
+    {
+        control.reply("ERROR invalid tap command %s", arg);
+        return;
+    }
+
+    control.reply("OK %s frames=%llu overflows=%llu",
+                  tap.enabled() ? "on" : "off",
+                  (unsigned long long)tap.frames_written(),
+                  (unsigned long long)tap.overflows());
+}
@@ -0,0 +1,106 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STREAM_TAP_H
+#define STREAM_TAP_H
+
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <string>
+#include <vector>
+
+#include "spsc_queue.h"
+
+struct config;
+class control_socket;
+
+// Records audio streams from the JACK thread for diagnostics. The JACK
+// thread copies each period into a preallocated ring and never blocks. If
+// the ring is full the period is dropped and counted. A background thread
+// writes the ring out to one WAV or FLAC file per stream, syncing it to
+// disk periodically and starting a new file once it reaches the size limit
+class stream_tap
+{
+public:
+    static const size_t BLOCK_FRAMES = 2048;
+    static const size_t NUM_BLOCKS = 128;
+
+    explicit stream_tap(const char* client_name);
+    ~stream_tap();
+
+    // Streams must all be added before the first start
+    int add_stream(const char* stream_name);
+
+    bool start(const struct config* cfg, unsigned sample_rate);
+    void stop();
+
+    bool enabled() const
+    {
+        return m_enabled.load(std::memory_order_relaxed);
+    }
+
+    uint64_t overflows() const
+    {
+        return m_overflows.load(std::memory_order_relaxed);
+    }
+
+    uint64_t frames_written() const
+    {
+        return m_frames_written.load(std::memory_order_relaxed);
+    }
+
+    // Called from the JACK thread
+    void write(int stream, const float* frames, size_t count);
+
+private:
+    struct block
+    {
+        int    stream;
+        size_t frames;
+        float  data[BLOCK_FRAMES];
+    };
+
+    struct output;
+
+    void writer_thread();
+
+private:
+    const std::string m_client_name;
+    std::vector<std::string> m_stream_names;
+
+    std::string m_dir;
+    int         m_format = 0;
+    uint64_t    m_max_file_bytes = 0;
+    int         m_sync_interval = 0;
+    unsigned    m_sample_rate = 0;
+
+    std::atomic<bool>     m_enabled;
+    std::atomic<bool>     m_running;
+    std::atomic<uint64_t> m_overflows;
+    std::atomic<uint64_t> m_frames_written;
+
+    // About 1MB, so keep instances out of the stack
+    spsc_queue<block, NUM_BLOCKS> m_ring;
+    std::thread m_writer;
+};
+
+// Handles "tap on|off|status" from a control socket
+void handle_tap_command(stream_tap&          tap,
+                        control_socket&      control,
+                        const char*          arg,
+                        const struct config* cfg,
+                        unsigned             sample_rate);
+
+#endif
@@ -0,0 +1,41 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TEST_SPEECH_H
+#define TEST_SPEECH_H
+
+#include <cmath>
+#include <vector>
+
+// Something with a speech-like spectrum and envelope for the codec to chew
+// on, so the timings aren't of the easy case of silence
+inline std::vector<float> make_test_speech(size_t count, unsigned sample_rate)
+{
+    std::vector<float> speech(count);
+    unsigned noise = 12345;
+    for (size_t i = 0; i < count; ++i)
+    {
+        const float t = (float)i / sample_rate;
+        const float envelope = 0.5f + (0.5f * sinf(2.0f * (float)M_PI * 3.0f * t));
+        noise = (noise * 1103515245) + 12345;
+        const float hiss = (((noise >> 16) & 0x7fff) / 32768.0f) - 0.5f;
+        speech[i] = envelope * ((0.3f * sinf(2.0f * (float)M_PI * 150.0f * t)) +
+                                (0.2f * sinf(2.0f * (float)M_PI * 700.0f * t)) +
+                                (0.1f * sinf(2.0f * (float)M_PI * 2200.0f * t)) +
+                                (0.05f * hiss));
+    }
+    return speech;
+}
+
+#endif
@@ -0,0 +1,9 @@
+#!/usr/bin/env sh
+
+# Speaks a message received on the FreeDV text channel in the headset.
+# jack_crypto_rx runs this with the message as the only argument
+
+. /etc/profile.d/shell_functions.sh
+
+logger -t text_notify -p daemon.notice "Text message: $1"
+headset_tts "$1"
@@ -0,0 +1,266 @@
+/*
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU Lesser General Public License version 2.1, as
+  published by the Free Software Foundation.  This program is
+  distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or
+  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef VOICE_MANAGER_H
+#define VOICE_MANAGER_H
+
+#include <cstdint>
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include "simd.h"
+#include "spsc_queue.h"
+#include "audio_clip.h"
+
+struct voice_params
+{
+    // When more voices are playing than there are cursors the lowest
+    // priority one is dropped, and lower priority voices are ducked while a
+    // higher priority voice plays
+    int    priority = 0;
+    // Requests that the main (speech) signal be ducked while this plays
+    bool   duck_main = false;
+    // Silence to play before the clip starts
+    size_t delay_frames = 0;
+    float  gain = 1.0f;
+};
+
+// Plays any number of overlapping clips through lightweight cursors.
+// play/collect are called from a normal thread, active/mix from the JACK
+// thread. The JACK side never allocates, copies sample data into a queue or
+// releases a clip; finished clips are handed back to be released by collect
+class voice_manager
+{
+public:
+    static const size_t MAX_VOICES = 8;
+
+    voice_manager(float duck_gain = 0.25f)
+        : m_duck_gain(duck_gain),
+          m_next_id(1)
+    {
+    }
+
+    bool play(const audio_clip_ptr& clip, const voice_params& params = voice_params())
+    {
+        collect();
+
+        // Bounding the outstanding clips also guarantees the finished queue
+        // can never fill up
+        if (!clip || clip->size() == 0 || m_retained.size() >= QUEUE_SIZE)
+        {
+            return false;
+        }
+
+        const command cmd = { clip.get(), params, m_next_id++ };
+        if (!m_commands.push(cmd))
+        {
+            return false;
+        }
+
+        m_retained.push_back(std::make_pair(cmd.id, clip));
+        return true;
+    }
+
+    void stop_all()
+    {
+        const command cmd = { nullptr, voice_params(), 0 };
+        m_commands.push(cmd);
+    }
+
+    // Releases clips whose playback has finished
+    void collect()
+    {
+        uint32_t id = 0;
+        while (m_finished.pop(id))
+        {
+            m_retained.erase(std::remove_if(m_retained.begin(),
+                                            m_retained.end(),
+                                            [id](const std::pair<uint32_t, audio_clip_ptr>& v)
+                                            { return v.first == id; }),
+                             m_retained.end());
+        }
+    }
+
+    // True while any voice is playing (or waiting out its delay)
+    bool active()
+    {
+        drain_commands();
+        return m_num_active > 0;
+    }
+
+    // True while a playing voice has asked for the main signal to be ducked
+    bool ducking_main() const
+    {
+        return m_ducking_main;
+    }
+
+    // Adds all the playing voices into out. Returns the number of frames at
+    // the start of out that were covered by a voice (including delays)
+    size_t mix(float* out, size_t nframes)
+    {
+        drain_commands();
+
+        int max_priority = INT32_MIN;
+        bool ducking_main = false;
+        for (size_t i = 0; i < MAX_VOICES; ++i)
+        {
+            if (m_cursors[i].clip != nullptr)
+            {
+                max_priority = std::max(max_priority, m_cursors[i].params.priority);
+                ducking_main = ducking_main || m_cursors[i].params.duck_main;
+            }
+        }
+        m_ducking_main = ducking_main;
+
+        size_t covered = 0;
+
+        // Work in small blocks so a block of the output stays in cache while
+        // every voice is added into it
+        static const size_t BLOCK_FRAMES = 64;
+        for (size_t block = 0; block < nframes && m_num_active > 0; block += BLOCK_FRAMES)
+        {
+            const size_t block_end = std::min(nframes, block + BLOCK_FRAMES);
+            for (size_t i = 0; i < MAX_VOICES; ++i)
+            {
+                cursor& cur = m_cursors[i];
+                if (cur.clip == nullptr)
+                {
+                    continue;
+                }
+
+                size_t frame = block;
+                if (cur.delay > 0)
+                {
+                    const size_t skip = std::min(cur.delay, block_end - frame);
+                    cur.delay -= skip;
+                    frame += skip;
+                }
+
+                const size_t remaining = cur.clip->size() - cur.pos;
+                const size_t count = std::min(remaining, block_end - frame);
+                const float gain = cur.params.priority < max_priority ?
+                    cur.params.gain * m_duck_gain : cur.params.gain;
+                simd_mix(out + frame, cur.clip->data() + cur.pos, count, gain);
+
+                cur.pos += count;
+                frame += count;
+                covered = std::max(covered, frame);
+
+                if (cur.pos == cur.clip->size())
+                {
+                    finish(cur);
+                }
+            }
+        }
+
+        return covered;
+    }
+
+private:
+    struct command
+    {
+        const audio_clip* clip;
+        voice_params      params;
+        uint32_t          id;
+    };
+
+    struct cursor
+    {
+        const audio_clip* clip = nullptr;
+        voice_params      params;
+        size_t            pos = 0;
+        size_t            delay = 0;
+        uint32_t          id = 0;
+    };
+
+    void finish(cursor& cur)
+    {
+        // The finished queue is larger than the number of cursors plus
+        // pending commands so this can't fail
+        m_finished.push(cur.id);
+        cur.clip = nullptr;
+        --m_num_active;
+    }
+
+    void drain_commands()
+    {
+        command cmd;
+        while (m_commands.pop(cmd))
+        {
+            if (cmd.clip == nullptr)
+            {
+                for (size_t i = 0; i < MAX_VOICES; ++i)
+                {
+                    if (m_cursors[i].clip != nullptr) finish(m_cursors[i]);
+                }
+                continue;
+            }
+
+            // Use a free cursor, or else steal the lowest priority one if it
+            // is not more important than the new voice
+            cursor* slot = nullptr;
+            for (size_t i = 0; i < MAX_VOICES; ++i)
+            {
+                cursor& cur = m_cursors[i];
+                if (cur.clip == nullptr)
+                {
+                    slot = &cur;
+                    break;
+                }
+                else if (cur.params.priority <= cmd.params.priority &&
+                         (slot == nullptr || cur.params.priority < slot->params.priority))
+                {
+                    slot = &cur;
+                }
+            }
+
+            if (slot == nullptr)
+            {
+                m_finished.push(cmd.id);
+                continue;
+            }
+            else if (slot->clip != nullptr)
+            {
+                finish(*slot);
+            }
+
+            slot->clip = cmd.clip;
+            slot->params = cmd.params;
+            slot->pos = 0;
+            slot->delay = cmd.params.delay_frames;
+            slot->id = cmd.id;
+            ++m_num_active;
+        }
+    }
+
+private:
+    static const size_t QUEUE_SIZE = 16;
+
+    const float m_duck_gain;
+
+    // Owned by the JACK thread
+    cursor m_cursors[MAX_VOICES];
+    size_t m_num_active = 0;
+    bool   m_ducking_main = false;
+
+    spsc_queue<command, QUEUE_SIZE>      m_commands;
+    spsc_queue<uint32_t, QUEUE_SIZE * 2> m_finished;
+
+    // Owned by the thread calling play
+    uint32_t m_next_id;
+    std::vector<std::pair<uint32_t, audio_clip_ptr>> m_retained;
+};
+
+#endif